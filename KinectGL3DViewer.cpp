@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <GL/glew.h>
 #include <GL/glut.h>
 #define GLM_FORCE_RADIANS
@@ -10,8 +12,14 @@
 #include <math.h>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 
 #include "kinect/Tracker.h"
+#include "kinect/HeadTrackingThread.h"
+#include "kinect/HeadPredictor.h"
+#include "kinect/SyntheticFrameSource.h"
+#include "kinect/SessionPlayer.h"
+#include "kinect/Benchmark.h"
 
 /**
  * KinectGL3DViewer.cpp
@@ -28,12 +36,41 @@
  * - 's': Toggle shading
  * - 'b': Move camera left
  * - 'n': Move camera right
+ * - 'r': Start/stop recording the sensor streams to a session file
+ * - '1', '2', '3': Switch the sensor to the low latency, default or high
+ *   accuracy resolution profile
  * - ESC: Exit application
+ *
+ * Command line:
+ * - --synthetic [hz]: Track a rendered head moving on a scripted path instead
+ *   of using the Kinect sensor (30, 60 or 120 Hz, default 30)
+ * - --play <session> [--fast]: Replay a recorded session instead of using the
+ *   sensor, in real time or as fast as tracking can consume it
+ * - --profile <name>: Start with the low-latency, default or high-accuracy
+ *   resolution profile
+ * - --roi: Acquire only the color pixels around the tracked head, and print
+ *   the bandwidth that saved on exit
+ * - --denoise: Denoise and hole fill depth frames as they are acquired
+ * - --undistort: Remove lens distortion from color and depth frames as they
+ *   are acquired
+ * - --no-prediction: Draw the head where it was last tracked instead of
+ *   where it will be when the frame is on screen
+ * - --benchmark <name> [session]: Run an offline benchmark on a recorded
+ *   session (or synthetic frames) and exit without opening a window
  */
 
 // ===== Global Variables =====
 // Kinect tracking
 Tracker* tracker = nullptr;
+HeadTrackingThread* headTracking = nullptr;       // runs the tracker beside the render loop
+HeadPose headPose = {};                           // newest pose the render loop has seen
+unsigned int headPoseCount = 0;                   // poses published when it last looked
+HeadPredictor headPredictor;                      // extrapolates poses to when frames are shown
+bool headPrediction = true;                       // off with --no-prediction
+long long lastDisplayTime = 0;                    // FrameClockMicroseconds() of the last display()
+double displayInterval = 16667;                   // smoothed time between display() calls, microseconds
+SyntheticFrameSource* syntheticSource = nullptr;  // replaces the sensor with --synthetic
+SessionPlayer* sessionPlayer = nullptr;           // replaces the sensor with --play
 
 // Camera and view control
 int mouseoldx, mouseoldy;     // Stores previous mouse position for camera control
@@ -64,6 +101,16 @@ GLint amountx = 0;                // Horizontal camera offset
 GLint amounty = 0;                // Vertical camera offset
 GLdouble amountHead = 0;          // Head tracking horizontal offset
 GLdouble amountCenter = 0;        // Head tracking center offset
+GLdouble headGain = 2.0;          // Scene units the eye moves per meter the tracked head moves
+
+// Session recording
+bool recording = false;           // Sensor streams are being written to disk
+bool roiAcquisition = false;      // Color frames are cut to the head region (--roi)
+bool depthFiltering = false;      // Depth frames are denoised and hole filled (--denoise)
+bool undistortion = false;        // Lens distortion is removed from both streams (--undistort)
+SensorProfileId profile = SENSOR_PROFILE_DEFAULT;
+
+const unsigned int HeadPollMilliseconds = 4;  // well under a sensor frame at 120 Hz
 
 /**
  * Transforms a vector by the current modelview matrix.
@@ -89,8 +136,48 @@ void deleteBuffers() {
 	glDeleteBuffers(3, teapotbuffers);
 }
 
+// Follows the tracked head with the eye, keeping the scene center in view.
+// The pose is whatever the tracking thread published last; a read that races
+// its write fails and the previous pose is kept, so rendering never waits.
+// With prediction the eye goes where the head will be when this frame is
+// scanned out, about one display interval from now.
+void applyHeadPose() {
+  HeadPose pose;
+  if (headTracking && headTracking->GetPose(&pose) && pose.publishTime != headPose.publishTime) {
+    headPose = pose;
+    headPredictor.AddPose(pose);
+  }
+  long long now = FrameClockMicroseconds();
+  if (lastDisplayTime) {
+    displayInterval += 0.1 * (std::min(now - lastDisplayTime, 100000LL) - displayInterval);
+  }
+  lastDisplayTime = now;
+
+  HeadPose shown = headPose;
+  if (headPose.confidence <= 0 ||
+      (headPrediction && !headPredictor.Predict(now + (long long)displayInterval, &shown))) {
+    return;  // keep the last head position, or the one set with 'w' and 'e'
+  }
+  amountHead = headGain * shown.position.x;
+  modelview = glm::lookAt(glm::vec3(-amountHead, -eyeloc, eyeloc), glm::vec3(0, 0, 0), glm::vec3(0, 1, 1));
+}
+
+// Redraws when the tracking thread published a pose since the last look,
+// polled from the GLUT thread since the tracker must not call into GLUT.
+// A predicted head moves between poses too, so it is redrawn every time.
+void pollHeadPose(int) {
+  unsigned int count = headTracking->GetPoseCount();
+  if (count != headPoseCount || (headPrediction && headPose.confidence > 0)) {
+    headPoseCount = count;
+    glutPostRedisplay();
+  }
+  glutTimerFunc(HeadPollMilliseconds, pollHeadPose, 0);
+}
+
 void display(void)
 {
+  applyHeadPose();
+
   // Clear all pixels in the buffer
 
   glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT) ; 
@@ -316,6 +403,33 @@ void moveCamera()
 void keyboard(unsigned char key, int x, int y) {
     switch (key) {
         case 27:  // ESC key - Exit application
+            if (roiAcquisition) {
+                FrameRoiStats roi = tracker->GetSource()->GetRoiStats();
+                printf("ROI acquisition: %u region frames, %u whole frames, %.1f MB copied, %.1f MB saved\n",
+                    roi.regionFrames, roi.fullFrames, roi.bytesCopied / 1e6, roi.bytesSaved / 1e6);
+            }
+            if (depthFiltering) {
+                DepthFilterStats filter = tracker->GetSource()->GetDepthFilterStats();
+                printf("Depth filter: %u frames filtered in %lld us on average, %u passed unfiltered after %u budget overruns\n",
+                    filter.filteredFrames, filter.averageTime, filter.bypassedFrames, filter.bypasses);
+            }
+            headTracking->Stop();  // before exit() destroys what it is using
+            {
+                TrackerFallbackStats fallback = tracker->GetFallbackStats();
+                printf("Head poses: %u from the face tracker, %u skeleton, %u depth, %u none; %u switches\n",
+                    fallback.frames[HEAD_POSE_FACE], fallback.frames[HEAD_POSE_SKELETON], fallback.frames[HEAD_POSE_DEPTH],
+                    fallback.frames[HEAD_POSE_NONE], fallback.switches);
+                printf("Face tracking: %lld us on average, %u tracks over budget, %u frame sets sat out\n",
+                    fallback.meanFaceTime, fallback.overruns, fallback.faceSkipped);
+                TrackerReacquireStats reacquire = tracker->GetReacquireStats();
+                printf("Face re-acquisition: %u found again after %lld ms on average; searches by duration (<2, 4, 8 ... 128, more ms):\n",
+                    reacquire.reacquired, reacquire.meanRecovery / 1000);
+                printf("  %5u in a region:", reacquire.roiSearches);
+                for (unsigned int i = 0; i < REACQUIRE_HISTOGRAM_BUCKETS; ++i) printf(" %u", reacquire.roiTime[i]);
+                printf("\n  %5u whole frame:", reacquire.fullSearches);
+                for (unsigned int i = 0; i < REACQUIRE_HISTOGRAM_BUCKETS; ++i) printf(" %u", reacquire.fullTime[i]);
+                printf("\n");
+            }
             exit(0);
             break;
         case 'p': // Toggle animation of the teapot
@@ -363,6 +477,26 @@ void keyboard(unsigned char key, int x, int y) {
             moveEye();
             glutPostRedisplay();
             break;
+        case 'r': // Toggle recording of color, depth and skeleton frames
+            if (recording) {
+                tracker->GetSource()->StopRecording();
+                recording = false;
+                printf("Recording stopped\n");
+            }
+            else {
+                char path[64];
+                sprintf(path, "session-%ld.kses", (long)time(NULL));
+                recording = tracker->GetSource()->StartRecording(path);
+                printf(recording ? "Recording to %s\n" : "Cannot record to %s\n", path);
+            }
+            break;
+        case '1': // Resolution profiles, the face tracker follows in the background
+        case '2':
+        case '3':
+            profile = (SensorProfileId)(SENSOR_PROFILE_LOW_LATENCY + key - '1');
+            printf(tracker->GetSource()->SetProfile(profile) ? "Switched to the %s profile\n" : "The source cannot switch to the %s profile\n",
+                GetSensorProfile(profile).name);
+            break;
         default:
             break;
     }
@@ -440,6 +574,11 @@ void init() {
  * Sets up GLUT window, initializes Kinect tracking and OpenGL state.
  */
 int main(int argc, char** argv) {
+    // Benchmarks run headless
+    if (argc >= 3 && strcmp(argv[1], "--benchmark") == 0) {
+        return RunBenchmark(argv[2], argc >= 4 ? argv[3] : NULL);
+    }
+
     glutInit(&argc, argv);
     
     // Configure OpenGL context with double buffering and depth testing
@@ -454,28 +593,93 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // Parse the remaining command line (glutInit removed its own options)
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--synthetic") == 0) {
+            SyntheticConfig config = SyntheticFrameSource::DefaultConfig();
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+                config.rateHz = atoi(argv[++i]);
+            }
+            syntheticSource = new SyntheticFrameSource();
+            syntheticSource->SetConfig(config);
+        }
+        else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+            sessionPlayer = new SessionPlayer();
+            if (!sessionPlayer->Open(argv[++i])) {
+                std::cerr << "Cannot open session " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--fast") == 0 && sessionPlayer) {
+            sessionPlayer->SetMode(SESSION_PLAYBACK_FREE_RUNNING);
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            if (!FindSensorProfile(argv[++i], &profile)) {
+                std::cerr << "Unknown profile " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--roi") == 0) {
+            roiAcquisition = true;
+        }
+        else if (strcmp(argv[i], "--denoise") == 0) {
+            depthFiltering = true;
+        }
+        else if (strcmp(argv[i], "--undistort") == 0) {
+            undistortion = true;
+        }
+        else if (strcmp(argv[i], "--no-prediction") == 0) {
+            headPrediction = false;
+        }
+    }
+
     // Initialize Kinect head tracking
+    IFrameSource* source = sessionPlayer ? (IFrameSource*)sessionPlayer : syntheticSource;
     tracker = new Tracker();
-    if (!tracker->Init()) {
+    if (!tracker->Init(source)) {
         std::cerr << "Failed to initialize Kinect tracker" << std::endl;
         return 1;
     }
+    if (roiAcquisition) {
+        tracker->GetSource()->SetRoiAcquisition(FRAME_ROI_VIDEO);
+    }
+    if (depthFiltering) {
+        DepthFilterParams params = DefaultDepthFiltering();
+        tracker->GetSource()->SetDepthFilter(&params);
+    }
+    if (undistortion) {
+        LensCalibration videoLens = NominalColorLens();
+        LensCalibration depthLens = NominalDepthLens();
+        tracker->GetSource()->SetUndistortion(&videoLens, &depthLens);
+    }
+    if (profile != SENSOR_PROFILE_DEFAULT && !tracker->GetSource()->SetProfile(profile)) {
+        std::cerr << "The source cannot switch to the " << GetSensorProfile(profile).name << " profile" << std::endl;
+    }
 
     init();  // Initialize OpenGL state
 
+    // Track on a thread of its own, at the rate frames arrive
+    headTracking = new HeadTrackingThread();
+    headTracking->Start(tracker);
+
     // Register GLUT callback functions
     glutDisplayFunc(display);      // Frame rendering
     glutReshapeFunc(reshape);      // Window resize handling
     glutKeyboardFunc(keyboard);    // Keyboard input
     glutMouseFunc(mouse);          // Mouse button events
     glutMotionFunc(mousedrag);     // Mouse movement
+    glutTimerFunc(HeadPollMilliseconds, pollHeadPose, 0);  // New head poses
 
     glutMainLoop();  // Start the render loop
 
     // Cleanup resources
     deleteBuffers();
+    headTracking->Stop();
+    delete headTracking;
     tracker->Destroy();
     delete tracker;
+    delete syntheticSource;
+    delete sessionPlayer;
 
     return 0;
 }
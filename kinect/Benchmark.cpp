@@ -0,0 +1,1514 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="Benchmark.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "Benchmark.h"
+#include "DepthCodec.h"
+#include "DepthFilter.h"
+#include "DepthHeadLocator.h"
+#include "DepthPlanes.h"
+#include "DepthRegistration.h"
+#include "GrayPyramid.h"
+#include "HeadPredictor.h"
+#include "LensUndistortion.h"
+#include "PointCloud.h"
+#include "SessionPlayer.h"
+#include "SkeletonSmoother.h"
+#include "SyntheticFrameSource.h"
+#include "UserSegmentation.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+static bool LoadBenchmarkFrames(const char* sessionPath, SessionChunkType stream, std::vector<FrameRef>& frames)
+{
+    frames.clear();
+    if (sessionPath)
+    {
+        SessionPlayer player;
+        SessionImageHeader image;
+        if (!player.Open(sessionPath) || !player.GetImageFormat(stream, &image))
+        {
+            printf("Cannot read %s frames from %s\n", stream == SESSION_CHUNK_VIDEO ? "color" : "depth", sessionPath);
+            return false;
+        }
+
+        // The frames outlive the pool, they free themselves once released
+        FramePool pool;
+        pool.Init(image.width, image.height, FrameFormat(image.format), 0);
+        for (unsigned int n = 0; n < player.GetFrameCount(stream); ++n)
+        {
+            FrameRef frame = pool.Acquire();
+            if (frame && player.ReadFrame(stream, n, frame))
+            {
+                frames.push_back(frame);
+            }
+        }
+        return !frames.empty();
+    }
+
+    SyntheticConfig config = SyntheticFrameSource::DefaultConfig();
+    config.rateHz = 120;
+    SyntheticFrameSource source;
+    source.SetConfig(config);
+    source.Init();
+    for (long long end = FrameClockMicroseconds() + 1000000; FrameClockMicroseconds() < end; )
+    {
+        if (stream == SESSION_CHUNK_VIDEO ? source.AcquireVideoBuffer() : source.AcquireDepthBuffer())
+        {
+            frames.push_back(stream == SESSION_CHUNK_VIDEO ? source.GetVideoFrame() : source.GetDepthFrame());
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    source.Release();
+    return !frames.empty();
+}
+
+bool LoadBenchmarkDepthFrames(const char* sessionPath, std::vector<FrameRef>& frames)
+{
+    return LoadBenchmarkFrames(sessionPath, SESSION_CHUNK_DEPTH, frames);
+}
+
+bool LoadBenchmarkVideoFrames(const char* sessionPath, std::vector<FrameRef>& frames)
+{
+    return LoadBenchmarkFrames(sessionPath, SESSION_CHUNK_VIDEO, frames);
+}
+
+// Compression ratio and throughput of DepthCodec, and a check that every
+// frame decodes back to the same bits.
+static int BenchmarkDepthCodec(const char* sessionPath)
+{
+    std::vector<FrameRef> frames;
+    if (!LoadBenchmarkDepthFrames(sessionPath, frames))
+    {
+        return 1;
+    }
+
+    const int passes = 10;
+    size_t rawBytes = 0;
+    std::vector<std::vector<unsigned char> > coded(frames.size());
+    long long start = FrameClockMicroseconds();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            coded[i].clear();
+            EncodeDepthFrame(frames[i].Get(), coded[i]);
+        }
+    }
+    long long encodeTime = FrameClockMicroseconds() - start;
+
+    FramePool pool;
+    pool.Init(frames[0]->GetWidth(), frames[0]->GetHeight(), FRAME_FORMAT_D13P3, 1);
+    FrameRef decoded = pool.Acquire();
+    size_t codedBytes = 0;
+    unsigned int mismatches = 0;
+    long long decodeTime = 0;
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        Frame* pFrame = frames[i].Get();
+        rawBytes += size_t(pFrame->GetWidth()) * pFrame->GetHeight() * 2;
+        codedBytes += coded[i].size();
+
+        start = FrameClockMicroseconds();
+        bool ok = true;
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            ok = DecodeDepthFrame(&coded[i][0], coded[i].size(), decoded.Get()) && ok;
+        }
+        decodeTime += FrameClockMicroseconds() - start;
+
+        for (unsigned int y = 0; ok && y < pFrame->GetHeight(); ++y)
+        {
+            ok = memcmp(pFrame->GetBuffer() + y * pFrame->GetStride(),
+                decoded->GetBuffer() + y * decoded->GetStride(), pFrame->GetWidth() * 2) == 0;
+        }
+        if (!ok)
+        {
+            mismatches++;
+        }
+    }
+
+    double megabytes = double(rawBytes) * passes / 1e6;
+    printf("depth codec: %u frames %ux%u, %.2f:1 (%.0f bytes per frame)\n", (unsigned int)frames.size(),
+        frames[0]->GetWidth(), frames[0]->GetHeight(), double(rawBytes) / codedBytes, double(codedBytes) / frames.size());
+    printf("  encode %.0f MB/s, decode %.0f MB/s, %u frames did not round trip\n",
+        megabytes / (encodeTime * 1e-6 + 1e-9), megabytes / (decodeTime * 1e-6 + 1e-9), mismatches);
+    return mismatches ? 1 : 0;
+}
+
+// Cost of remapping depth frames into the color image of the profile with the
+// same depth resolution, using the nominal calibration, and a check against
+// splatting every pixel through DepthRegistration::MapPixel.
+static int BenchmarkRegistration(const char* sessionPath)
+{
+    std::vector<FrameRef> frames;
+    if (!LoadBenchmarkDepthFrames(sessionPath, frames))
+    {
+        return 1;
+    }
+
+    unsigned int depthWidth = frames[0]->GetFullWidth();
+    unsigned int depthHeight = frames[0]->GetFullHeight();
+    unsigned int colorWidth = 640, colorHeight = 480;
+    for (int p = 0; p < SENSOR_PROFILE_COUNT; ++p)
+    {
+        const SensorProfile& profile = GetSensorProfile(SensorProfileId(p));
+        if (profile.depthWidth == depthWidth)
+        {
+            colorWidth = profile.videoWidth;
+            colorHeight = profile.videoHeight;
+        }
+    }
+
+    DepthRegistration registration;
+    long long start = FrameClockMicroseconds();
+    registration.Build(depthWidth, depthHeight, colorWidth, colorHeight,
+        NominalRegistrationCalibration(depthWidth, depthHeight, colorWidth, colorHeight));
+    long long buildTime = FrameClockMicroseconds() - start;
+
+    FramePool pool;
+    pool.Init(colorWidth, colorHeight, FRAME_FORMAT_D13P3, 1);
+    FrameRef registered = pool.Acquire();
+    const int passes = 10;
+    start = FrameClockMicroseconds();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            registration.Remap(frames[i].Get(), registered.Get());
+        }
+    }
+    long long remapTime = FrameClockMicroseconds() - start;
+
+    int splat = int((colorWidth + depthWidth - 1) / depthWidth);
+    std::vector<unsigned short> expected(size_t(colorWidth) * colorHeight);
+    size_t covered = 0;
+    unsigned int mismatches = 0;
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        Frame* pDepth = frames[i].Get();
+        registration.Remap(pDepth, registered.Get());
+
+        std::fill(expected.begin(), expected.end(), (unsigned short)0);
+        for (unsigned int y = 0; y < pDepth->GetHeight(); ++y)
+        {
+            const unsigned short* pRow = (const unsigned short*)(pDepth->GetBuffer() + y * pDepth->GetStride());
+            for (unsigned int x = 0; x < pDepth->GetWidth(); ++x)
+            {
+                int cx, cy;
+                if (!registration.MapPixel(x + pDepth->GetOffsetX(), y + pDepth->GetOffsetY(), pRow[x], &cx, &cy) ||
+                    cx - splat / 2 + splat > int(colorWidth) || cy - splat / 2 + splat > int(colorHeight) ||
+                    cx < splat / 2 || cy < splat / 2)
+                {
+                    continue;
+                }
+                for (int sy = 0; sy < splat; ++sy)
+                {
+                    for (int sx = 0; sx < splat; ++sx)
+                    {
+                        unsigned short& value = expected[(cy - splat / 2 + sy) * colorWidth + cx - splat / 2 + sx];
+                        value = !value || pRow[x] < value ? pRow[x] : value;
+                    }
+                }
+            }
+        }
+
+        bool ok = true;
+        for (unsigned int y = 0; y < colorHeight; ++y)
+        {
+            const unsigned short* pRow = (const unsigned short*)(registered->GetBuffer() + y * registered->GetStride());
+            ok = memcmp(pRow, &expected[y * colorWidth], colorWidth * 2) == 0 && ok;
+            for (unsigned int x = 0; x < colorWidth; ++x)
+            {
+                covered += pRow[x] != 0;
+            }
+        }
+        if (!ok)
+        {
+            mismatches++;
+        }
+    }
+
+    printf("depth registration: %u frames %ux%u into %ux%u, tables built in %.1f ms\n", (unsigned int)frames.size(),
+        depthWidth, depthHeight, colorWidth, colorHeight, buildTime / 1000.0);
+    printf("  %.1f us per frame, %.1f%% of color pixels covered, %u frames differ from the per pixel mapping\n",
+        double(remapTime) / (double(passes) * frames.size()), 100.0 * covered / (double(frames.size()) * colorWidth * colorHeight),
+        mismatches);
+    return mismatches ? 1 : 0;
+}
+
+// Throughput of UnpackDepthFrame at the 320x240 and 640x480 depth resolutions
+// (or on the frames of a session), next to a plain copy of the packed frames
+// as the memory bandwidth reference. There are more frames than fit in the
+// cache, so both run from memory.
+static int BenchmarkUnpack(const char* sessionPath)
+{
+    static const unsigned int Sizes[][2] = { { 320, 240 }, { 640, 480 } };
+    unsigned int mismatches = 0;
+    for (size_t s = 0; s < (sessionPath ? 1 : sizeof(Sizes) / sizeof(Sizes[0])); ++s)
+    {
+        std::vector<FrameRef> frames;
+        FramePool packedPool;
+        if (sessionPath)
+        {
+            if (!LoadBenchmarkDepthFrames(sessionPath, frames))
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            unsigned int seed = 1;
+            packedPool.Init(Sizes[s][0], Sizes[s][1], FRAME_FORMAT_D13P3, 0);
+            for (int n = 0; n < 64; ++n)
+            {
+                frames.push_back(packedPool.Acquire());
+                Frame* pFrame = frames.back().Get();
+                for (unsigned int y = 0; y < pFrame->GetHeight(); ++y)
+                {
+                    unsigned short* pRow = (unsigned short*)(pFrame->GetBuffer() + y * pFrame->GetStride());
+                    for (unsigned int x = 0; x < pFrame->GetWidth(); ++x)
+                    {
+                        seed = seed * 1664525u + 1013904223u;
+                        pRow[x] = (unsigned short)((((seed >> 8) % 4000 + 400) << 3) | (seed >> 29));
+                    }
+                }
+            }
+        }
+
+        Frame* pFirst = frames[0].Get();
+        FramePool depthPool, playerPool, copyPool;
+        depthPool.Init(pFirst->GetFullWidth(), pFirst->GetFullHeight(), FRAME_FORMAT_D16, 0);
+        playerPool.Init(pFirst->GetFullWidth(), pFirst->GetFullHeight(), FRAME_FORMAT_P8, 0);
+        copyPool.Init(pFirst->GetFullWidth(), pFirst->GetFullHeight(), FRAME_FORMAT_D13P3, 0);
+        std::vector<FrameRef> depth, players, copies;
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            depth.push_back(depthPool.Acquire());
+            players.push_back(playerPool.Acquire());
+            copies.push_back(copyPool.Acquire());
+        }
+
+        const int passes = 20;
+        size_t pixels = 0;
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            pixels += size_t(frames[i]->GetWidth()) * frames[i]->GetHeight();
+        }
+        long long start = FrameClockMicroseconds();
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                UnpackDepthFrame(frames[i].Get(), depth[i].Get(), players[i].Get());
+            }
+        }
+        long long unpackTime = FrameClockMicroseconds() - start;
+        start = FrameClockMicroseconds();
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                memcpy(copies[i]->GetBuffer(), frames[i]->GetBuffer(), frames[i]->GetBufferSize());
+            }
+        }
+        long long copyTime = FrameClockMicroseconds() - start;
+
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            Frame* pFrame = frames[i].Get();
+            bool ok = UnpackDepthFrame(pFrame, depth[i].Get(), players[i].Get());
+            for (unsigned int y = 0; ok && y < pFrame->GetHeight(); ++y)
+            {
+                const unsigned short* pRow = (const unsigned short*)(pFrame->GetBuffer() + y * pFrame->GetStride());
+                const unsigned short* pDepth = (const unsigned short*)(depth[i]->GetBuffer() + y * depth[i]->GetStride());
+                const unsigned char* pPlayers = players[i]->GetBuffer() + y * players[i]->GetStride();
+                for (unsigned int x = 0; ok && x < pFrame->GetWidth(); ++x)
+                {
+                    ok = pDepth[x] == pRow[x] >> 3 && pPlayers[x] == (pRow[x] & 7);
+                }
+            }
+            if (!ok)
+            {
+                mismatches++;
+            }
+        }
+
+        // Bytes moved: 2 read and 3 written per pixel, against 2 and 2 for the copy
+        double perFrame = double(unpackTime) / (double(passes) * frames.size());
+        printf("depth unpack: %u frames %ux%u, %.1f us per frame\n", (unsigned int)frames.size(),
+            pFirst->GetWidth(), pFirst->GetHeight(), perFrame);
+        printf("  %.2f GB/s moved, plain copy of the packed frames %.2f GB/s\n",
+            5.0 * pixels * passes / (unpackTime * 1e3 + 1e-9), 4.0 * pixels * passes / (copyTime * 1e3 + 1e-9));
+    }
+    if (mismatches)
+    {
+        printf("%u frames did not unpack to the packed values\n", mismatches);
+    }
+    return mismatches ? 1 : 0;
+}
+
+// Event to frame ready latency of each stream of the synthetic source at 120 Hz.
+static int BenchmarkDispatch(const char* sessionPath)
+{
+    (void)sessionPath;
+    SyntheticConfig config = SyntheticFrameSource::DefaultConfig();
+    config.rateHz = 120;
+    SyntheticFrameSource source;
+    source.SetConfig(config);
+    source.Init();
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    source.Release();
+
+    StreamDispatcher& dispatcher = source.GetDispatcher();
+    for (unsigned int i = 0; i < dispatcher.GetStreamCount(); ++i)
+    {
+        StreamLatencyStats stats = dispatcher.GetLatency(i);
+        printf("%-9s %u events, latency mean %lld us, max %lld us\n",
+            dispatcher.GetStreamName(i), stats.events, stats.mean, stats.max);
+    }
+    return 0;
+}
+
+// Mean frame to frame acceleration of the tracked joints, the jitter a viewer sees.
+static double JointJitter(const std::vector<SkeletonSoA>& frames)
+{
+    double sum = 0;
+    unsigned int count = 0;
+    for (size_t f = 2; f < frames.size(); ++f)
+    {
+        for (unsigned int n = 0; n < SKELETON_SOA_COUNT; ++n)
+        {
+            if (frames[f].state[n] == JOINT_NOT_TRACKED || frames[f - 1].state[n] == JOINT_NOT_TRACKED ||
+                frames[f - 2].state[n] == JOINT_NOT_TRACKED)
+            {
+                continue;
+            }
+            double ax = frames[f].x[n] - 2 * frames[f - 1].x[n] + frames[f - 2].x[n];
+            double ay = frames[f].y[n] - 2 * frames[f - 1].y[n] + frames[f - 2].y[n];
+            double az = frames[f].z[n] - 2 * frames[f - 1].z[n] + frames[f - 2].z[n];
+            sum += sqrt(ax * ax + ay * ay + az * az);
+            count++;
+        }
+    }
+    return count ? sum / count : 0;
+}
+
+// Replaces every frame with one of twice the width and height, each pixel
+// repeated 2x2, for measuring at 640x480 with the 320x240 synthetic frames.
+static void DoubleDepthFrames(std::vector<FrameRef>& frames)
+{
+    // The frames outlive the pool, they free themselves once released
+    FramePool pool;
+    pool.Init(frames[0]->GetWidth() * 2, frames[0]->GetHeight() * 2, FRAME_FORMAT_D13P3, 0);
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        FrameRef large = pool.Acquire();
+        for (unsigned int y = 0; y < large->GetHeight(); ++y)
+        {
+            const unsigned short* pIn = (const unsigned short*)(frames[i]->GetBuffer() + (y / 2) * frames[i]->GetStride());
+            unsigned short* pOut = (unsigned short*)(large->GetBuffer() + y * large->GetStride());
+            for (unsigned int x = 0; x < large->GetWidth(); ++x)
+            {
+                pOut[x] = pIn[x / 2];
+            }
+        }
+        large->SetTimestamp(frames[i]->GetTimestamp(), frames[i]->GetFrameNumber());
+        frames[i] = large;
+    }
+}
+
+// Cost of back-projecting 640x480 depth frames (the synthetic frames scaled
+// up, or those of a session) on one core and on a thread pool, against the
+// 8.3 ms a frame has at 120 Hz, and a check against the plain formula.
+static int BenchmarkPointCloud(const char* sessionPath)
+{
+    std::vector<FrameRef> frames;
+    if (!LoadBenchmarkDepthFrames(sessionPath, frames))
+    {
+        return 1;
+    }
+    if (!sessionPath)
+    {
+        DoubleDepthFrames(frames);
+    }
+
+    ThreadPool threads;
+    unsigned int cores = std::thread::hardware_concurrency();
+    PointCloudBuilder builder;
+    PointCloud cloud;
+    const int passes = 10;
+    for (int run = 0; run < 2; ++run)
+    {
+        threads.Start(run ? (cores > 1 ? cores - 1 : 0) : 0);
+        builder.SetThreadPool(run ? &threads : NULL);
+        builder.Build(frames[0].Get(), cloud);     // builds the ray table
+        long long start = FrameClockMicroseconds();
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                builder.Build(frames[i].Get(), cloud);
+            }
+        }
+        double perFrame = double(FrameClockMicroseconds() - start) / (double(passes) * frames.size());
+        printf("point cloud: %u frames %ux%u on %u thread(s), %.1f us per frame (%.1f%% of a 120 Hz frame)\n",
+            (unsigned int)frames.size(), frames[0]->GetWidth(), frames[0]->GetHeight(), threads.GetThreadCount(),
+            perFrame, perFrame / 83.33);
+        threads.Stop();
+    }
+
+    Frame* pDepth = frames.back().Get();
+    double focal = NOMINAL_DEPTH_FOCAL_LENGTH * pDepth->GetFullWidth() / 320.0;
+    double worst = 0;
+    for (unsigned int y = 0; y < pDepth->GetHeight(); ++y)
+    {
+        const unsigned short* pRow = (const unsigned short*)(pDepth->GetBuffer() + y * pDepth->GetStride());
+        const float* pX = (const float*)(cloud.x->GetBuffer() + y * cloud.x->GetStride());
+        const float* pY = (const float*)(cloud.y->GetBuffer() + y * cloud.y->GetStride());
+        const float* pZ = (const float*)(cloud.z->GetBuffer() + y * cloud.z->GetStride());
+        for (unsigned int x = 0; x < pDepth->GetWidth(); ++x)
+        {
+            double z = (pRow[x] >> 3) * 0.001;
+            double u = x + pDepth->GetOffsetX() - pDepth->GetFullWidth() * 0.5;
+            double v = y + pDepth->GetOffsetY() - pDepth->GetFullHeight() * 0.5;
+            worst = std::max(worst, std::max(fabs(pX[x] - u * z / focal), std::max(fabs(pY[x] + v * z / focal), fabs(pZ[x] - z))));
+        }
+    }
+    printf("  largest difference to the formula %.3f mm\n", worst * 1000);
+    return worst < 0.0005 ? 0 : 1;
+}
+
+// Share of pixels without depth, and the mean error of those with depth
+// against the clean frame in mm, or against the frame itself without one.
+static void DepthErrors(Frame* pFrame, Frame* pClean, double* pHoles, double* pError)
+{
+    long long holes = 0, valid = 0;
+    double error = 0;
+    for (unsigned int y = 0; y < pFrame->GetHeight(); ++y)
+    {
+        const unsigned short* pRow = (const unsigned short*)(pFrame->GetBuffer() + y * pFrame->GetStride());
+        const unsigned short* pCleanRow = (const unsigned short*)(pClean->GetBuffer() + y * pClean->GetStride());
+        for (unsigned int x = 0; x < pFrame->GetWidth(); ++x)
+        {
+            if (!(pRow[x] >> 3))
+            {
+                holes++;
+            }
+            else if (pCleanRow[x] >> 3)
+            {
+                error += abs(int(pRow[x] >> 3) - int(pCleanRow[x] >> 3));
+                valid++;
+            }
+        }
+    }
+    *pHoles = double(holes) / (double(pFrame->GetWidth()) * pFrame->GetHeight());
+    *pError = valid ? error / valid : 0;
+}
+
+// Cost of DepthFilter per frame at 320x240 and 640x480, on one core and on a
+// thread pool, and what it does to holes and noise. Synthetic frames get
+// noise, holes and flying pixels along depth edges added, and are compared
+// to the clean frames; sessions have their own.
+static int BenchmarkDenoise(const char* sessionPath)
+{
+    std::vector<FrameRef> clean;
+    if (!LoadBenchmarkDepthFrames(sessionPath, clean))
+    {
+        return 1;
+    }
+
+    int result = 0;
+    for (int size = 0; size < (sessionPath ? 1 : 2); ++size)
+    {
+        if (size)
+        {
+            DoubleDepthFrames(clean);
+        }
+        std::vector<FrameRef> frames = clean;
+        FramePool noisyPool;
+        if (!sessionPath)
+        {
+            noisyPool.Init(clean[0]->GetWidth(), clean[0]->GetHeight(), FRAME_FORMAT_D13P3, 0);
+            unsigned int seed = 1;
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                frames[i] = noisyPool.Acquire();
+                frames[i]->SetTimestamp(clean[i]->GetTimestamp(), clean[i]->GetFrameNumber());
+                for (unsigned int y = 0; y < clean[i]->GetHeight(); ++y)
+                {
+                    const unsigned short* pIn = (const unsigned short*)(clean[i]->GetBuffer() + y * clean[i]->GetStride());
+                    unsigned short* pOut = (unsigned short*)(frames[i]->GetBuffer() + y * frames[i]->GetStride());
+                    for (unsigned int x = 0; x < clean[i]->GetWidth(); ++x)
+                    {
+                        seed = seed * 1664525u + 1013904223u;
+                        unsigned int r = seed >> 8;
+                        int mm = pIn[x] >> 3;
+                        int next = x + 1 < clean[i]->GetWidth() ? pIn[x + 1] >> 3 : mm;
+                        if (r % 100 < 3)
+                        {   // dropout
+                            mm = 0;
+                        }
+                        else if (abs(next - mm) > 100 && r % 2)
+                        {   // flying pixel between the two surfaces
+                            mm = (mm + next) / 2;
+                        }
+                        else if (mm)
+                        {   // noise grows with distance
+                            int amplitude = 2 + mm / 400;
+                            mm += int((r >> 8) % (2 * amplitude + 1)) - amplitude;
+                        }
+                        pOut[x] = (unsigned short)((mm << 3) | (pIn[x] & 7));
+                    }
+                }
+            }
+        }
+
+        DepthFilterParams params = DefaultDepthFiltering();
+        params.budget = 0;
+        ThreadPool threads;
+        unsigned int cores = std::thread::hardware_concurrency();
+        DepthFilter filter;
+        FrameRef filtered;
+        const int passes = 5;
+        double rawHoles = 0, rawError = 0, holes = 0, error = 0;
+        for (int run = 0; run < 2; ++run)
+        {
+            threads.Start(run ? (cores > 1 ? cores - 1 : 0) : 0);
+            filter.SetParameters(params);
+            filter.SetThreadPool(run ? &threads : NULL);
+            filter.Apply(frames[0].Get(), filtered);    // allocates
+            long long time = 0;
+            for (int pass = 0; pass < passes; ++pass)
+            {
+                filter.Reset();
+                for (size_t i = 0; i < frames.size(); ++i)
+                {
+                    long long start = FrameClockMicroseconds();
+                    filter.Apply(frames[i].Get(), filtered);
+                    time += FrameClockMicroseconds() - start;
+
+                    if (pass == 0 && run == 0)
+                    {
+                        double h, e;
+                        DepthErrors(frames[i].Get(), clean[i].Get(), &h, &e);
+                        rawHoles += h;
+                        rawError += e;
+                        DepthErrors(filtered.Get(), clean[i].Get(), &h, &e);
+                        holes += h;
+                        error += e;
+                    }
+                }
+            }
+            double perFrame = double(time) / (double(passes) * frames.size());
+            printf("depth filter: %u frames %ux%u on %u thread(s), %.1f us per frame (%.1f%% of a 30 Hz frame)\n",
+                (unsigned int)frames.size(), frames[0]->GetWidth(), frames[0]->GetHeight(), threads.GetThreadCount(),
+                perFrame, perFrame / 333.33);
+            threads.Stop();
+        }
+
+        double n = double(frames.size());
+        printf("  holes %.2f%% raw, %.2f%% filtered\n", rawHoles / n * 100, holes / n * 100);
+        if (!sessionPath)
+        {
+            printf("  mean error %.2f mm raw, %.2f mm filtered\n", rawError / n, error / n);
+            if (holes >= rawHoles || error >= rawError)
+            {
+                result = 1;
+            }
+        }
+    }
+    return result;
+}
+
+// Per pixel 3x3 erosion or dilation, for checking UserSegmenter.
+static std::vector<unsigned char> ReferenceMorphology(const std::vector<unsigned char>& in, int width, int height, bool dilate)
+{
+    std::vector<unsigned char> out(in.size());
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            bool any = false, all = true;
+            for (int dy = -1; dy <= 1; ++dy)
+            {
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    int nx = x + dx, ny = y + dy;
+                    bool set = nx >= 0 && nx < width && ny >= 0 && ny < height && in[ny * width + nx];
+                    any = any || set;
+                    all = all && set;
+                }
+            }
+            out[y * width + x] = dilate ? any : all;
+        }
+    }
+    return out;
+}
+
+// The plain GrayPyramid, one level at a time from the one above, as the
+// reference and the baseline.
+static void ReferencePyramid(Frame* pVideo, std::vector<std::vector<unsigned char> >& levels, unsigned int count)
+{
+    unsigned int width = pVideo->GetWidth();
+    unsigned int height = pVideo->GetHeight();
+    levels.resize(count);
+    levels[0].resize(width * height);
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        const unsigned char* p = pVideo->GetBuffer() + y * pVideo->GetStride();
+        for (unsigned int x = 0; x < width; ++x, p += 4)
+        {
+            levels[0][y * width + x] = (unsigned char)((29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8);
+        }
+    }
+    for (unsigned int level = 1; level < count; ++level)
+    {
+        const std::vector<unsigned char>& above = levels[level - 1];
+        unsigned int aboveWidth = width;
+        width /= 2;
+        height /= 2;
+        levels[level].resize(width * height);
+        for (unsigned int y = 0; y < height; ++y)
+        {
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                const unsigned char* p = &above[2 * y * aboveWidth + 2 * x];
+                levels[level][y * width + x] = (unsigned char)((p[0] + p[1] + p[aboveWidth] + p[aboveWidth + 1] + 2) >> 2);
+            }
+        }
+    }
+}
+
+// Cost of GrayPyramidBuilder per color frame against the plain level by level
+// build, and a check of every level against it, for the full frames and for
+// an odd sized region of one.
+static int BenchmarkPyramid(const char* sessionPath)
+{
+    std::vector<FrameRef> frames;
+    if (!LoadBenchmarkVideoFrames(sessionPath, frames))
+    {
+        return 1;
+    }
+
+    GrayPyramidBuilder builder;
+    GrayPyramid pyramid;
+    std::vector<std::vector<unsigned char> > reference;
+    const unsigned int levels = 4;
+    const int passes = 10;
+    builder.SetLevels(levels);
+    long long start = FrameClockMicroseconds();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            builder.Build(frames[i].Get(), pyramid);
+        }
+    }
+    double perFrame = double(FrameClockMicroseconds() - start) / (double(passes) * frames.size());
+    start = FrameClockMicroseconds();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            ReferencePyramid(frames[i].Get(), reference, levels);
+        }
+    }
+    double plainPerFrame = double(FrameClockMicroseconds() - start) / (double(passes) * frames.size());
+    printf("gray pyramid: %u frames %ux%u, %u levels, %.1f us per frame, %.1f us level by level\n",
+        (unsigned int)frames.size(), frames[0]->GetWidth(), frames[0]->GetHeight(), levels, perFrame, plainPerFrame);
+
+    // The odd region leaves partial vectors at the end of every row
+    FramePool regionPool;
+    regionPool.Init(frames[0]->GetFullWidth(), frames[0]->GetFullHeight(), FRAME_FORMAT_B8G8R8X8, 1);
+    FrameRef region = regionPool.Acquire();
+    Frame* pFull = frames.back().Get();
+    unsigned int regionWidth = std::min(203u, pFull->GetWidth() - 37);
+    unsigned int regionHeight = std::min(151u, pFull->GetHeight() - 21);
+    region->SetRegion(pFull->GetOffsetX() + 37, pFull->GetOffsetY() + 21, regionWidth, regionHeight);
+    for (unsigned int y = 0; y < regionHeight; ++y)
+    {
+        memcpy(region->GetBuffer() + y * region->GetStride(), pFull->GetBuffer() + (y + 21) * pFull->GetStride() + 37 * 4, regionWidth * 4);
+    }
+
+    int result = 0;
+    Frame* pChecks[2] = { pFull, region.Get() };
+    for (int check = 0; check < 2; ++check)
+    {
+        if (!builder.Build(pChecks[check], pyramid))
+        {
+            printf("  %s: pyramid not built\n", check ? "region" : "frame");
+            result = 1;
+            continue;
+        }
+        ReferencePyramid(pChecks[check], reference, pyramid.levels);
+        unsigned int differences = 0;
+        for (unsigned int level = 0; level < pyramid.levels; ++level)
+        {
+            Frame* pLevel = pyramid.level[level].Get();
+            for (unsigned int y = 0; y < pLevel->GetHeight(); ++y)
+            {
+                const unsigned char* pRow = pLevel->GetBuffer() + y * pLevel->GetStride();
+                for (unsigned int x = 0; x < pLevel->GetWidth(); ++x)
+                {
+                    differences += pRow[x] != reference[level][y * pLevel->GetWidth() + x];
+                }
+            }
+        }
+        printf("  %s %ux%u at (%u, %u), %u levels down to %ux%u: %u pixels differ from the plain build\n",
+            check ? "region" : "frame", pChecks[check]->GetWidth(), pChecks[check]->GetHeight(),
+            pChecks[check]->GetOffsetX(), pChecks[check]->GetOffsetY(), pyramid.levels,
+            pyramid.level[pyramid.levels - 1]->GetWidth(), pyramid.level[pyramid.levels - 1]->GetHeight(), differences);
+        if (differences)
+        {
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// Cost of LensUndistorter per frame on whole color frames, on a 160x160
+// head region of them and on whole depth frames, and a check of the color
+// output against bilinear sampling straight from the lens model.
+static int BenchmarkUndistort(const char* sessionPath)
+{
+    std::vector<FrameRef> video, depth;
+    if (!LoadBenchmarkVideoFrames(sessionPath, video) || !LoadBenchmarkDepthFrames(sessionPath, depth))
+    {
+        return 1;
+    }
+
+    LensUndistorter undistorter;
+    FramePool pool;
+    pool.Init(video[0]->GetFullWidth(), video[0]->GetFullHeight(), FRAME_FORMAT_B8G8R8X8, 1);
+    FrameRef whole = pool.Acquire();
+    FrameRef region = pool.Acquire();
+    unsigned int regionSize = std::min(160u, std::min(video[0]->GetFullWidth(), video[0]->GetFullHeight()));
+    region->SetRegion((video[0]->GetFullWidth() - regionSize) / 2, (video[0]->GetFullHeight() - regionSize) / 2, regionSize, regionSize);
+    undistorter.SetCalibration(NominalColorLens());
+    undistorter.Remap(video[0].Get(), whole.Get());    // builds the table
+
+    const int passes = 10;
+    Frame* pTargets[2] = { whole.Get(), region.Get() };
+    for (int target = 0; target < 2; ++target)
+    {
+        long long start = FrameClockMicroseconds();
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            for (size_t i = 0; i < video.size(); ++i)
+            {
+                undistorter.Remap(video[i].Get(), pTargets[target]);
+            }
+        }
+        double perFrame = double(FrameClockMicroseconds() - start) / (double(passes) * video.size());
+        printf("undistort color: %u frames, %ux%u of %ux%u, %.1f us per frame\n", (unsigned int)video.size(),
+            pTargets[target]->GetWidth(), pTargets[target]->GetHeight(), video[0]->GetFullWidth(), video[0]->GetFullHeight(), perFrame);
+    }
+
+    LensUndistorter depthUndistorter;
+    depthUndistorter.SetCalibration(NominalDepthLens());
+    FrameRef undistortedDepth;
+    depthUndistorter.Apply(depth[0].Get(), undistortedDepth);
+    long long start = FrameClockMicroseconds();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (size_t i = 0; i < depth.size(); ++i)
+        {
+            depthUndistorter.Apply(depth[i].Get(), undistortedDepth);
+        }
+    }
+    double perFrame = double(FrameClockMicroseconds() - start) / (double(passes) * depth.size());
+    printf("undistort depth: %u frames %ux%u, %.1f us per frame\n", (unsigned int)depth.size(),
+        depth[0]->GetWidth(), depth[0]->GetHeight(), perFrame);
+
+    // The region must match the whole frame; both against the lens model
+    Frame* pIn = video.back().Get();
+    undistorter.Remap(pIn, whole.Get());
+    undistorter.Remap(pIn, region.Get());
+    LensCalibration lens = NominalColorLens();
+    double scale = double(pIn->GetFullWidth()) / lens.width;
+    double fx = lens.focalX * scale, fy = lens.focalY * scale, cx = lens.centerX * scale, cy = lens.centerY * scale;
+    unsigned int regionDifferences = 0;
+    double errorSum = 0, worst = 0;
+    unsigned int compared = 0;
+    for (unsigned int y = 0; y < whole->GetHeight(); ++y)
+    {
+        const unsigned char* pRow = whole->GetBuffer() + y * whole->GetStride();
+        for (unsigned int x = 0; x < whole->GetWidth(); ++x)
+        {
+            if (y >= region->GetOffsetY() && y < region->GetOffsetY() + region->GetHeight() &&
+                x >= region->GetOffsetX() && x < region->GetOffsetX() + region->GetWidth())
+            {
+                const unsigned char* pRegion = region->GetBuffer() + (y - region->GetOffsetY()) * region->GetStride() + (x - region->GetOffsetX()) * 4;
+                regionDifferences += memcmp(pRegion, pRow + x * 4, 4) != 0;
+            }
+
+            double xn = (x - cx) / fx, yn = (y - cy) / fy;
+            double r2 = xn * xn + yn * yn;
+            double radial = 1 + r2 * (lens.k1 + r2 * (lens.k2 + r2 * lens.k3));
+            double su = fx * (xn * radial + 2 * lens.p1 * xn * yn + lens.p2 * (r2 + 2 * xn * xn)) + cx;
+            double sv = fy * (yn * radial + lens.p1 * (r2 + 2 * yn * yn) + 2 * lens.p2 * xn * yn) + cy;
+            if (su < 0 || sv < 0 || su >= pIn->GetWidth() - 1 || sv >= pIn->GetHeight() - 1)
+            {
+                continue;
+            }
+            int x0 = int(su), y0 = int(sv);
+            double a = su - x0, b = sv - y0;
+            const unsigned char* p = pIn->GetBuffer() + y0 * pIn->GetStride() + x0 * 4;
+            for (int channel = 0; channel < 3; ++channel)
+            {
+                double expected = (1 - a) * (1 - b) * p[channel] + a * (1 - b) * p[channel + 4] +
+                    (1 - a) * b * p[pIn->GetStride() + channel] + a * b * p[pIn->GetStride() + channel + 4];
+                double error = fabs(pRow[x * 4 + channel] - expected);
+                errorSum += error;
+                worst = std::max(worst, error);
+                compared++;
+            }
+        }
+    }
+    printf("  %.3f levels mean, %.2f largest difference to the lens model; region %u pixels differ from the whole frame\n",
+        errorSum / std::max(compared, 1u), worst, regionDifferences);
+    return regionDifferences ? 1 : 0;
+}
+
+// Cost of UserSegmenter per frame at 320x240 and 640x480, from D13P3 frames
+// and from their player planes, and a check of the last frame's masks and
+// statistics against a per pixel open and close. Synthetic frames get specks
+// and pinholes in the player index channel for the cleanup to remove.
+static int BenchmarkSegmentation(const char* sessionPath)
+{
+    std::vector<FrameRef> frames;
+    if (!LoadBenchmarkDepthFrames(sessionPath, frames))
+    {
+        return 1;
+    }
+
+    int result = 0;
+    for (int size = 0; size < (sessionPath ? 1 : 2); ++size)
+    {
+        if (size)
+        {
+            DoubleDepthFrames(frames);
+        }
+        if (!sessionPath)
+        {
+            unsigned int seed = 1;
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                for (unsigned int y = 0; y < frames[i]->GetHeight(); ++y)
+                {
+                    unsigned short* pRow = (unsigned short*)(frames[i]->GetBuffer() + y * frames[i]->GetStride());
+                    for (unsigned int x = 0; x < frames[i]->GetWidth(); ++x)
+                    {
+                        seed = seed * 1664525u + 1013904223u;
+                        if ((seed >> 8) % 200 == 0)
+                        {
+                            pRow[x] ^= 1;
+                        }
+                    }
+                }
+            }
+        }
+
+        FramePool playerPool;
+        playerPool.Init(frames[0]->GetWidth(), frames[0]->GetHeight(), FRAME_FORMAT_P8, 0);
+        FramePool depthPool;
+        depthPool.Init(frames[0]->GetWidth(), frames[0]->GetHeight(), FRAME_FORMAT_D16, 0);
+        std::vector<FrameRef> players(frames.size());
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            players[i] = playerPool.Acquire();
+            FrameRef depth = depthPool.Acquire();
+            UnpackDepthFrame(frames[i].Get(), depth.Get(), players[i].Get());
+        }
+
+        UserSegmenter segmenter;
+        UserMasks masks;
+        const int passes = 20;
+        const char* inputs[2] = { "D13P3", "player plane" };
+        for (int input = 0; input < 2; ++input)
+        {
+            std::vector<FrameRef>& source = input ? players : frames;
+            long long start = FrameClockMicroseconds();
+            for (int pass = 0; pass < passes; ++pass)
+            {
+                for (size_t i = 0; i < source.size(); ++i)
+                {
+                    segmenter.Segment(source[i].Get(), masks);
+                }
+            }
+            double perFrame = double(FrameClockMicroseconds() - start) / (double(passes) * source.size());
+            printf("segmentation: %u frames %ux%u from the %s, %.1f us per frame\n",
+                (unsigned int)source.size(), masks.width, masks.height, inputs[input], perFrame);
+        }
+
+        Frame* pPlayers = players.back().Get();
+        int width = pPlayers->GetWidth(), height = pPlayers->GetHeight();
+        unsigned int mismatches = 0, background = 0;
+        for (unsigned int p = 1; p <= USER_MASK_PLAYERS; ++p)
+        {
+            std::vector<unsigned char> mask(width * height);
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    mask[y * width + x] = pPlayers->GetBuffer()[y * pPlayers->GetStride() + x] == p;
+                }
+            }
+            mask = ReferenceMorphology(ReferenceMorphology(mask, width, height, false), width, height, true);
+            mask = ReferenceMorphology(ReferenceMorphology(mask, width, height, true), width, height, false);
+
+            unsigned int pixels = 0, left = width, right = 0, top = height, bottom = 0;
+            double sumX = 0, sumY = 0;
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    if (mask[y * width + x] != masks.Test(p, x, y))
+                    {
+                        mismatches++;
+                    }
+                    if (mask[y * width + x])
+                    {
+                        pixels++;
+                        sumX += x;
+                        sumY += y;
+                        left = std::min(left, (unsigned int)x);
+                        right = std::max(right, (unsigned int)x + 1);
+                        top = std::min(top, (unsigned int)y);
+                        bottom = std::max(bottom, (unsigned int)y + 1);
+                    }
+                }
+            }
+            const UserMaskStats& stats = masks.stats[p - 1];
+            if (stats.pixels != pixels || (pixels && (stats.left != left || stats.right != right || stats.top != top ||
+                stats.bottom != bottom || fabs(stats.centroidX - sumX / pixels) > 0.01 || fabs(stats.centroidY - sumY / pixels) > 0.01)))
+            {
+                mismatches++;
+            }
+            if (pixels)
+            {
+                printf("  player %u: %u pixels in %ux%u at %u,%u, centroid %.1f,%.1f\n", p, pixels,
+                    stats.right - stats.left, stats.bottom - stats.top, stats.left, stats.top, stats.centroidX, stats.centroidY);
+            }
+            background += pixels;
+        }
+        printf("  %.1f%% of the pixels are background, %u differences to the per pixel cleanup\n",
+            100.0 - 100.0 * background / (width * height), mismatches);
+        if (mismatches)
+        {
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// Cost of SkeletonSmoother per frame, and how much jitter it takes out. The
+// synthetic worst case has all six skeletons tracked with every joint on a
+// smooth path plus up to 1 cm of noise.
+static int BenchmarkSmoothing(const char* sessionPath)
+{
+    std::vector<SkeletonSoA> raw;
+    SkeletonFrame frame;
+    if (sessionPath)
+    {
+        SessionPlayer player;
+        if (!player.Open(sessionPath))
+        {
+            printf("Cannot read skeleton frames from %s\n", sessionPath);
+            return 1;
+        }
+        for (unsigned int n = 0; n < player.GetFrameCount(SESSION_CHUNK_SKELETON) && player.ReadSkeletonFrame(n, frame); ++n)
+        {
+            raw.push_back(SkeletonSoA());
+            SkeletonFrameToSoA(frame, raw.back());
+        }
+    }
+    else
+    {
+        unsigned int seed = 1;
+        for (unsigned int n = 0; n < 300; ++n)
+        {
+            frame.timestamp = n * 33333LL;
+            frame.frameNumber = n;
+            for (int i = 0; i < SKELETON_COUNT; ++i)
+            {
+                frame.tracked[i] = true;
+                for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+                {
+                    float noise[3];
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        seed = seed * 1664525u + 1013904223u;
+                        noise[k] = ((seed >> 8) / float(1 << 24) - 0.5f) * 0.02f;
+                    }
+                    frame.joints[i][j].x = 0.5f * i - 1.25f + 0.3f * sinf(n * 0.05f) + noise[0];
+                    frame.joints[i][j].y = 0.05f * j - 0.5f + noise[1];
+                    frame.joints[i][j].z = 2.0f + 0.2f * cosf(n * 0.03f) + noise[2];
+                    frame.jointState[i][j] = j % 7 ? JOINT_TRACKED : JOINT_INFERRED;
+                }
+            }
+            raw.push_back(SkeletonSoA());
+            SkeletonFrameToSoA(frame, raw.back());
+        }
+    }
+    if (raw.size() < 3)
+    {
+        printf("Not enough skeleton frames\n");
+        return 1;
+    }
+
+    const int passes = 100;
+    std::vector<SkeletonSoA> smoothed;
+    SkeletonSmoother smoother;
+    long long time = 0;
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        smoothed = raw;
+        smoother.Reset();
+        long long start = FrameClockMicroseconds();
+        for (size_t f = 0; f < smoothed.size(); ++f)
+        {
+            smoother.Apply(smoothed[f]);
+        }
+        time += FrameClockMicroseconds() - start;
+    }
+    double perFrame = double(time) / (double(passes) * raw.size());
+
+    printf("skeleton smoothing: %u frames, %.2f us per frame for all %u joints\n",
+        (unsigned int)raw.size(), perFrame, SKELETON_SOA_COUNT);
+    printf("  jitter %.2f mm raw, %.2f mm smoothed\n", JointJitter(raw) * 1000, JointJitter(smoothed) * 1000);
+    return 0;
+}
+
+struct HeadSample
+{
+    long long   time;       // microseconds
+    Point3      position;
+};
+
+// Scripted head of the synthetic prediction benchmark: it moves to a new
+// resting place every 1.2 s, taking 0.5 s with a minimum jerk profile like
+// people do, at up to about 2 m/s, while slowly swaying back and forth.
+static Point3 PredictionHeadPath(double seconds)
+{
+    const double Pi = 3.14159265358979;
+    const double Period = 1.2;
+    const double Move = 0.5;
+    int n = int(seconds / Period);
+    double t = std::min((seconds - n * Period) / Move, 1.0);
+    double s = t * t * t * (10 - 15 * t + 6 * t * t);
+    double rest[2][2];
+    for (int i = 0; i < 2; ++i)
+    {
+        for (int axis = 0; axis < 2; ++axis)
+        {
+            unsigned int hash = (unsigned int)(n + i) * 2654435761u + axis * 40503u;
+            hash = (hash ^ (hash >> 13)) * 1274126177u;
+            rest[i][axis] = (hash ^ (hash >> 16)) / 4294967296.0 - 0.5;
+        }
+    }
+    Point3 head;
+    head.x = float(0.5 * (rest[0][0] + (rest[1][0] - rest[0][0]) * s));
+    head.y = float(0.1 + 0.15 * (rest[0][1] + (rest[1][1] - rest[0][1]) * s));
+    head.z = float(1.5 + 0.15 * sin(2 * Pi * seconds / 6.0));
+    return head;
+}
+
+// Position at time, linear between the samples around it.
+static Point3 InterpolateHead(const std::vector<HeadSample>& samples, long long time)
+{
+    size_t i = 1;
+    while (i + 1 < samples.size() && samples[i].time < time)
+    {
+        ++i;
+    }
+    const HeadSample& a = samples[i - 1];
+    const HeadSample& b = samples[i];
+    float t = float(time - a.time) / float(b.time - a.time);
+    Point3 p = { a.position.x + t * (b.position.x - a.position.x), a.position.y + t * (b.position.y - a.position.y),
+        a.position.z + t * (b.position.z - a.position.z) };
+    return p;
+}
+
+static float HeadDistance(const Point3& a, const Point3& b)
+{
+    return sqrtf((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z));
+}
+
+// Root mean square and 95th percentile of errors, in millimeters.
+static void PrintErrors(const char* label, std::vector<float>& errors)
+{
+    double sum = 0;
+    for (size_t i = 0; i < errors.size(); ++i)
+    {
+        sum += double(errors[i]) * errors[i];
+    }
+    std::sort(errors.begin(), errors.end());
+    printf("%s %6.1f mm rms, %6.1f mm p95", label, sqrt(sum / errors.size()) * 1000, errors[errors.size() * 95 / 100] * 1000);
+}
+
+// How far HeadPredictor's extrapolation is from where the head really was,
+// against just using the newest pose, for the latencies between a sensor
+// frame and the display showing it. Sessions use the closest skeleton's head
+// joint as the tracked pose and the pose interpolated from later frames as
+// the truth; the synthetic run has 3 mm of tracking noise on an exact path.
+static int BenchmarkPrediction(const char* sessionPath)
+{
+    std::vector<HeadSample> measured;
+    std::vector<HeadSample> truth;
+    if (sessionPath)
+    {
+        SessionPlayer player;
+        SkeletonFrame frame;
+        Point3 hint[2] = {};
+        if (!player.Open(sessionPath))
+        {
+            printf("Cannot read skeleton frames from %s\n", sessionPath);
+            return 1;
+        }
+        for (unsigned int n = 0; n < player.GetFrameCount(SESSION_CHUNK_SKELETON) && player.ReadSkeletonFrame(n, frame); ++n)
+        {
+            if (SelectClosestSkeleton(frame, hint))
+            {
+                HeadSample sample = { frame.timestamp, hint[1] };
+                measured.push_back(sample);
+            }
+        }
+        truth = measured;
+    }
+    else
+    {
+        unsigned int seed = 1;
+        for (unsigned int n = 0; n < 900; ++n)
+        {
+            HeadSample sample = { n * 33333LL, PredictionHeadPath(n / 30.0) };
+            truth.push_back(sample);
+            float* axes[3] = { &sample.position.x, &sample.position.y, &sample.position.z };
+            for (int k = 0; k < 3; ++k)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                *axes[k] += ((seed >> 8) / float(1 << 24) - 0.5f) * 0.006f;
+            }
+            measured.push_back(sample);
+        }
+        // Truth between the frames too
+        truth.clear();
+        for (long long t = 0; t <= measured.back().time; t += 1000)
+        {
+            HeadSample sample = { t, PredictionHeadPath(t * 1e-6) };
+            truth.push_back(sample);
+        }
+    }
+    if (measured.size() < 30)
+    {
+        printf("Not enough skeleton frames\n");
+        return 1;
+    }
+
+    printf("head prediction: %u poses over %.1f s\n", (unsigned int)measured.size(),
+        (measured.back().time - measured.front().time) * 1e-6);
+    const long long horizons[] = { 16667, 33333, 50000, 66667, 100000 };
+    for (size_t h = 0; h < sizeof(horizons) / sizeof(horizons[0]); ++h)
+    {
+        HeadPredictor predictor;
+        std::vector<float> predictedErrors;
+        std::vector<float> heldErrors;
+        long long time = 0;
+        for (size_t i = 0; i < measured.size(); ++i)
+        {
+            HeadPose pose = {};
+            pose.position = measured[i].position;
+            pose.confidence = 1;
+            pose.frameTimestamp = measured[i].time;
+            pose.publishTime = measured[i].time;
+
+            long long start = FrameClockMicroseconds();
+            HeadPose predicted;
+            predictor.AddPose(pose);
+            predictor.PredictAt(measured[i].time + horizons[h], &predicted);
+            time += FrameClockMicroseconds() - start;
+
+            // Skip the filter settling in, and targets past the end
+            if (i >= 10 && measured[i].time + horizons[h] <= truth.back().time)
+            {
+                Point3 actual = InterpolateHead(truth, measured[i].time + horizons[h]);
+                predictedErrors.push_back(HeadDistance(predicted.position, actual));
+                heldErrors.push_back(HeadDistance(pose.position, actual));
+            }
+        }
+        printf("  %5.1f ms ahead:", horizons[h] / 1000.0);
+        PrintErrors(" predicted", predictedErrors);
+        PrintErrors(", newest pose", heldErrors);
+        printf(", %.2f us per pose\n", double(time) / measured.size());
+    }
+    return 0;
+}
+
+struct HeadLocateSample
+{
+    FrameRef    depth;
+    Point3      seed;       // skeleton head joint
+    Point3      truth;
+};
+
+// Runs DepthHeadLocator on every sample, seeded with the skeleton head, and
+// prints its time per frame and, if there is one, its error from the truth.
+static void MeasureHeadLocate(const char* label, const std::vector<HeadLocateSample>& samples, bool hasTruth)
+{
+    const int passes = 20;
+    DepthHeadLocator locator;
+    long long total = 0;
+    long long slowest = 0;
+    unsigned int found = 0;
+    double sumError = 0;
+    float maxError = 0;
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            HeadPose pose;
+            long long start = FrameClockMicroseconds();
+            bool located = locator.Locate(samples[i].depth.Get(), samples[i].seed, &pose);
+            long long time = FrameClockMicroseconds() - start;
+            total += time;
+            slowest = std::max(slowest, time);
+            if (located && pass == 0)
+            {
+                found++;
+                float error = HeadDistance(pose.position, samples[i].truth);
+                sumError += error;
+                maxError = std::max(maxError, error);
+            }
+        }
+    }
+
+    printf("%s: %u frames, %.1f us per frame, %lld us slowest, %u heads found\n", label, (unsigned int)samples.size(),
+        double(total) / (double(passes) * samples.size()), slowest, found);
+    if (found)
+    {
+        printf("  %s %.1f mm mean, %.1f mm max\n", hasTruth ? "error" : "distance from the skeleton head",
+            sumError / found * 1000, maxError * 1000);
+    }
+}
+
+// Cost and accuracy of DepthHeadLocator. The synthetic head, a sphere above a
+// torso, is seeded with its skeleton head joint off by up to 5 cm, like a
+// tracked joint can be, at 320x240 and 640x480. Sessions have no truth; the
+// distance from the skeleton head joint is reported instead.
+static int BenchmarkHeadLocate(const char* sessionPath)
+{
+    std::vector<HeadLocateSample> samples;
+    if (sessionPath)
+    {
+        std::vector<FrameRef> frames;
+        SessionPlayer player;
+        if (!LoadBenchmarkDepthFrames(sessionPath, frames) || !player.Open(sessionPath))
+        {
+            return 1;
+        }
+        // The skeleton frame nearest each depth frame
+        SkeletonFrame skeleton;
+        unsigned int next = 0;
+        Point3 hint[2] = {};
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            bool tracked = false;
+            while (next < player.GetFrameCount(SESSION_CHUNK_SKELETON) && player.ReadSkeletonFrame(next, skeleton))
+            {
+                next++;
+                tracked = SelectClosestSkeleton(skeleton, hint);
+                if (skeleton.timestamp >= frames[i]->GetTimestamp())
+                {
+                    break;
+                }
+            }
+            if (tracked)
+            {
+                HeadLocateSample sample = { frames[i], hint[1], hint[1] };
+                samples.push_back(sample);
+            }
+        }
+        if (samples.empty())
+        {
+            printf("No tracked skeletons in %s\n", sessionPath);
+            return 1;
+        }
+        MeasureHeadLocate("depth head", samples, false);
+        return 0;
+    }
+
+    const unsigned int widths[] = { 320, 640 };
+    for (int w = 0; w < 2; ++w)
+    {
+        SyntheticConfig config = SyntheticFrameSource::DefaultConfig();
+        config.rateHz = 120;
+        config.trajectory = SYNTHETIC_TRAJECTORY_APPROACH;
+        config.cycleSeconds = 1.0f;
+        config.depthWidth = widths[w];
+        config.depthHeight = widths[w] * 3 / 4;
+        SyntheticFrameSource source;
+        source.SetConfig(config);
+        source.Init();
+        samples.clear();
+        unsigned int seed = 1;
+        FrameSet set;
+        for (long long end = FrameClockMicroseconds() + 1000000; FrameClockMicroseconds() < end; )
+        {
+            if (!source.AcquireFrameSet(set) || !set.hasSkeleton)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            Point3 head = set.skeleton.joints[0][SKELETON_JOINT_HEAD];
+            float* axes[3] = { &head.x, &head.y, &head.z };
+            for (int k = 0; k < 3; ++k)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                *axes[k] += ((seed >> 8) / float(1 << 24) - 0.5f) * 0.1f;
+            }
+            HeadLocateSample sample = { set.depth, head, source.GetGroundTruth(set.depth->GetTimestamp()) };
+            samples.push_back(sample);
+        }
+        source.Release();
+
+        char label[32];
+        sprintf(label, "depth head %ux%u", config.depthWidth, config.depthHeight);
+        MeasureHeadLocate(label, samples, true);
+    }
+    return 0;
+}
+
+// FrameSets taken from player during milliseconds, as fast as they come.
+static unsigned int CountPlaybackSets(SessionPlayer& player, unsigned int milliseconds)
+{
+    unsigned int sets = 0;
+    FrameSet set;
+    for (long long end = FrameClockMicroseconds() + milliseconds * 1000LL; FrameClockMicroseconds() < end; )
+    {
+        if (player.AcquireFrameSet(set))
+        {
+            sets++;
+        }
+        else
+        {
+            player.WaitFrameSet(10);
+        }
+    }
+    return sets;
+}
+
+// Free-running replay of a session, looped, and a seek back in real time.
+// Both must keep producing FrameSets after the timeline went backwards. Without
+// a session, half a second of the synthetic source at 60 Hz is recorded first.
+static int BenchmarkPlayback(const char* sessionPath)
+{
+    const char* path = sessionPath;
+    if (!path)
+    {
+        path = "benchmark-playback.kses";
+        SyntheticConfig config = SyntheticFrameSource::DefaultConfig();
+        config.rateHz = 60;
+        SyntheticFrameSource source;
+        source.SetConfig(config);
+        source.Init();
+        if (!source.StartRecording(path))
+        {
+            printf("Cannot write %s\n", path);
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        source.StopRecording();
+        source.Release();
+    }
+
+    SessionPlayer player;
+    if (!player.Open(path))
+    {
+        printf("Cannot open %s\n", path);
+        return 1;
+    }
+    unsigned int frames = player.GetFrameCount(SESSION_CHUNK_VIDEO);
+
+    player.SetMode(SESSION_PLAYBACK_FREE_RUNNING);
+    player.SetLoop(true);
+    player.Init();
+    long long start = FrameClockMicroseconds();
+    unsigned int sets = CountPlaybackSets(player, 2000);
+    SessionPlayerStats stats = player.GetStats();
+    player.Release();
+    double seconds = (FrameClockMicroseconds() - start) * 1e-6;
+    unsigned int passes = frames ? stats.framesPlayed / frames : 0;
+    printf("free running: %u color frames, %.1f passes, %u sets, %.0f sets/s\n",
+        stats.framesPlayed, frames ? double(stats.framesPlayed) / frames : 0.0, sets, sets / seconds);
+
+    player.SetMode(SESSION_PLAYBACK_REALTIME);
+    player.SetLoop(false);
+    player.Seek(player.GetStartTime());
+    player.Init();
+    unsigned int before = CountPlaybackSets(player, 300);
+    player.Seek(player.GetStartTime());
+    unsigned int after = CountPlaybackSets(player, 300);
+    player.Release();
+    printf("real time: %u sets before seeking back to the start, %u after\n", before, after);
+
+    if (!sessionPath)
+    {
+        remove(path);
+    }
+    // Every pass after the first must have made sets too
+    if (passes < 2 || sets <= frames || !after)
+    {
+        printf("FrameSets stopped after the timeline went back\n");
+        return 1;
+    }
+    return 0;
+}
+
+struct BenchmarkEntry
+{
+    const char* name;
+    int (*pRun)(const char* sessionPath);
+};
+
+static const BenchmarkEntry Benchmarks[] =
+{
+    { "codec",        BenchmarkDepthCodec },
+    { "denoise",      BenchmarkDenoise },
+    { "dispatch",     BenchmarkDispatch },
+    { "headlocate",   BenchmarkHeadLocate },
+    { "playback",     BenchmarkPlayback },
+    { "pointcloud",   BenchmarkPointCloud },
+    { "prediction",   BenchmarkPrediction },
+    { "pyramid",      BenchmarkPyramid },
+    { "registration", BenchmarkRegistration },
+    { "segmentation", BenchmarkSegmentation },
+    { "smoothing",    BenchmarkSmoothing },
+    { "undistort",    BenchmarkUndistort },
+    { "unpack",       BenchmarkUnpack },
+};
+
+int RunBenchmark(const char* name, const char* sessionPath)
+{
+    for (size_t i = 0; i < sizeof(Benchmarks) / sizeof(Benchmarks[0]); ++i)
+    {
+        if (strcmp(name, Benchmarks[i].name) == 0)
+        {
+            return Benchmarks[i].pRun(sessionPath);
+        }
+    }
+
+    printf("Unknown benchmark %s, available:", name);
+    for (size_t i = 0; i < sizeof(Benchmarks) / sizeof(Benchmarks[0]); ++i)
+    {
+        printf(" %s", Benchmarks[i].name);
+    }
+    printf("\n");
+    return 1;
+}
@@ -0,0 +1,21 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="Benchmark.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+#include <vector>
+
+// Offline measurements run from the command line with --benchmark <name> [session].
+// They work on the frames of a recorded session, or on frames of the synthetic
+// source when no session is given, and print their results to stdout.
+// Returns the process exit code; unknown names list the available benchmarks.
+int RunBenchmark(const char* name, const char* sessionPath);
+
+// Depth frames of the session, or one second of synthetic frames at 120 Hz.
+bool LoadBenchmarkDepthFrames(const char* sessionPath, std::vector<FrameRef>& frames);
+// Color frames, likewise.
+bool LoadBenchmarkVideoFrames(const char* sessionPath, std::vector<FrameRef>& frames);
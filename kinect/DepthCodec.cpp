@@ -0,0 +1,281 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthCodec.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "DepthCodec.h"
+#include "Simd.h"
+#include <cstring>
+
+static const unsigned int DepthCodecMagic = 0x33314344;    // "DC13"
+static const unsigned int BlockSize = 16;
+
+#pragma pack(push, 4)
+struct DepthCodecHeader
+{
+    unsigned int    magic;
+    unsigned short  width;
+    unsigned short  height;
+    unsigned int    depthBytes;     // size of the depth stream that follows
+    unsigned int    playerBytes;    // size of the player stream after it
+};
+#pragma pack(pop)
+
+static inline unsigned short ZigZag(int residual)
+{
+    return (unsigned short)(((unsigned int)residual << 1) ^ (unsigned int)(residual >> 31));
+}
+
+static inline int UnZigZag(unsigned short value)
+{
+    return int(value >> 1) ^ -int(value & 1);
+}
+
+static void AppendVarint(std::vector<unsigned char>& out, unsigned int value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char)value);
+}
+
+// Encodes one row of zigzagged residuals as bit plane blocks.
+static void EncodeBlocks(const unsigned short* pResiduals, unsigned int count, std::vector<unsigned char>& out)
+{
+    for (unsigned int start = 0; start < count; start += BlockSize)
+    {
+        unsigned int n = count - start < BlockSize ? count - start : BlockSize;
+        unsigned short largest = 0;
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            largest |= pResiduals[start + i];
+        }
+        unsigned char bits = 0;
+        while (largest >> bits)
+        {
+            bits++;
+        }
+
+        out.push_back(bits);
+        for (unsigned int b = 0; b < bits; ++b)
+        {
+            unsigned short plane = 0;
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                plane |= (unsigned short)(((pResiduals[start + i] >> b) & 1) << i);
+            }
+            out.push_back((unsigned char)plane);
+            out.push_back((unsigned char)(plane >> 8));
+        }
+    }
+}
+
+void EncodeDepthFrame(Frame* pFrame, std::vector<unsigned char>& out)
+{
+    unsigned int width = pFrame->GetWidth();
+    unsigned int height = pFrame->GetHeight();
+    size_t headerAt = out.size();
+    out.resize(headerAt + sizeof(DepthCodecHeader));
+
+    // Depth plane
+    std::vector<unsigned short> residuals(width);
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        const unsigned short* pRow = (const unsigned short*)(pFrame->GetBuffer() + y * pFrame->GetStride());
+        const unsigned short* pAbove = (const unsigned short*)((const unsigned char*)pRow - pFrame->GetStride());
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            int prediction = y ? (pAbove[x] >> 3) : (x ? (pRow[x - 1] >> 3) : 0);
+            residuals[x] = ZigZag(int(pRow[x] >> 3) - prediction);
+        }
+        EncodeBlocks(&residuals[0], width, out);
+    }
+    size_t depthEnd = out.size();
+
+    // Player plane: (index, run length - 1) pairs in raster order
+    unsigned int runValue = 0;
+    unsigned int runLength = 0;
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        const unsigned short* pRow = (const unsigned short*)(pFrame->GetBuffer() + y * pFrame->GetStride());
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            unsigned int player = pRow[x] & 7;
+            if (player != runValue && runLength)
+            {
+                out.push_back((unsigned char)runValue);
+                AppendVarint(out, runLength - 1);
+                runLength = 0;
+            }
+            runValue = player;
+            runLength++;
+        }
+    }
+    if (runLength)
+    {
+        out.push_back((unsigned char)runValue);
+        AppendVarint(out, runLength - 1);
+    }
+
+    DepthCodecHeader header;
+    header.magic = DepthCodecMagic;
+    header.width = (unsigned short)width;
+    header.height = (unsigned short)height;
+    header.depthBytes = (unsigned int)(depthEnd - headerAt - sizeof(DepthCodecHeader));
+    header.playerBytes = (unsigned int)(out.size() - depthEnd);
+    memcpy(&out[headerAt], &header, sizeof(header));
+}
+
+// Expands one block of bit planes into up to 16 zigzagged residuals.
+static inline void DecodeBlock(const unsigned char* pPlanes, unsigned int bits, unsigned short* pOut)
+{
+#if defined(KINECT_AVX2)
+    const __m256i laneBits = _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128,
+        256, 512, 1024, 2048, 4096, 8192, 16384, (short)0x8000);
+    __m256i value = _mm256_setzero_si256();
+    for (unsigned int b = 0; b < bits; ++b)
+    {
+        __m256i plane = _mm256_set1_epi16((short)(pPlanes[2 * b] | (pPlanes[2 * b + 1] << 8)));
+        __m256i set = _mm256_cmpeq_epi16(_mm256_and_si256(plane, laneBits), laneBits);
+        value = _mm256_or_si256(value, _mm256_and_si256(set, _mm256_set1_epi16((short)(1 << b))));
+    }
+    _mm256_storeu_si256((__m256i*)pOut, value);
+#elif defined(KINECT_SSE2)
+    const __m128i laneBitsLo = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m128i laneBitsHi = _mm_setr_epi16(256, 512, 1024, 2048, 4096, 8192, 16384, (short)0x8000);
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    for (unsigned int b = 0; b < bits; ++b)
+    {
+        __m128i plane = _mm_set1_epi16((short)(pPlanes[2 * b] | (pPlanes[2 * b + 1] << 8)));
+        __m128i bit = _mm_set1_epi16((short)(1 << b));
+        lo = _mm_or_si128(lo, _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(plane, laneBitsLo), laneBitsLo), bit));
+        hi = _mm_or_si128(hi, _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(plane, laneBitsHi), laneBitsHi), bit));
+    }
+    _mm_storeu_si128((__m128i*)pOut, lo);
+    _mm_storeu_si128((__m128i*)(pOut + 8), hi);
+#else
+    for (unsigned int i = 0; i < BlockSize; ++i)
+    {
+        pOut[i] = 0;
+    }
+    for (unsigned int b = 0; b < bits; ++b)
+    {
+        unsigned int plane = pPlanes[2 * b] | (pPlanes[2 * b + 1] << 8);
+        for (unsigned int i = 0; i < BlockSize; ++i)
+        {
+            pOut[i] |= (unsigned short)(((plane >> i) & 1) << b);
+        }
+    }
+#endif
+}
+
+// pRow[x] = (above[x] >> 3 + UnZigZag(residual[x])) << 3, player bits cleared.
+static void ReconstructRow(const unsigned short* pResiduals, const unsigned short* pAbove, unsigned short* pRow, unsigned int width)
+{
+    unsigned int x = 0;
+#if defined(KINECT_SSE2)
+    const __m128i one = _mm_set1_epi16(1);
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i z = _mm_loadu_si128((const __m128i*)(pResiduals + x));
+        __m128i residual = _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z, one)));
+        __m128i above = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(pAbove + x)), 3);
+        _mm_storeu_si128((__m128i*)(pRow + x), _mm_slli_epi16(_mm_add_epi16(above, residual), 3));
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        pRow[x] = (unsigned short)(((pAbove[x] >> 3) + UnZigZag(pResiduals[x])) << 3);
+    }
+}
+
+bool DecodeDepthFrame(const unsigned char* pData, size_t size, Frame* pFrame)
+{
+    DepthCodecHeader header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, pData, sizeof(header));
+    if (header.magic != DepthCodecMagic || header.width != pFrame->GetWidth() || header.height != pFrame->GetHeight() ||
+        pFrame->GetFormat() != FRAME_FORMAT_D13P3 || sizeof(header) + (size_t)header.depthBytes + header.playerBytes > size)
+    {
+        return false;
+    }
+
+    unsigned int width = header.width;
+    unsigned int height = header.height;
+    const unsigned char* pIn = pData + sizeof(header);
+    const unsigned char* pDepthEnd = pIn + header.depthBytes;
+
+    // Room for whole blocks, the last one of a row may be partial
+    std::vector<unsigned short> residuals((width + BlockSize - 1) / BlockSize * BlockSize);
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        for (unsigned int start = 0; start < width; start += BlockSize)
+        {
+            if (pIn >= pDepthEnd || pIn + 1 + 2 * pIn[0] > pDepthEnd || pIn[0] > 16)
+            {
+                return false;
+            }
+            DecodeBlock(pIn + 1, pIn[0], &residuals[start]);
+            pIn += 1 + 2 * pIn[0];
+        }
+
+        unsigned short* pRow = (unsigned short*)(pFrame->GetBuffer() + y * pFrame->GetStride());
+        if (y)
+        {
+            ReconstructRow(&residuals[0], (const unsigned short*)((const unsigned char*)pRow - pFrame->GetStride()), pRow, width);
+        }
+        else
+        {   // First row is predicted from the left, that is a running sum
+            int depth = 0;
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                depth += UnZigZag(residuals[x]);
+                pRow[x] = (unsigned short)(depth << 3);
+            }
+        }
+    }
+
+    // Player index runs; zero runs only need skipping
+    const unsigned char* pPlayerEnd = pDepthEnd + header.playerBytes;
+    size_t pixel = 0;
+    size_t pixelCount = size_t(width) * height;
+    pIn = pDepthEnd;
+    while (pIn < pPlayerEnd)
+    {
+        unsigned short player = *pIn++;
+        size_t run = 0;
+        for (unsigned int shift = 0; pIn < pPlayerEnd; shift += 7)
+        {
+            run |= size_t(*pIn & 0x7F) << shift;
+            if (!(*pIn++ & 0x80))
+            {
+                break;
+            }
+        }
+        run++;
+        if (pixel + run > pixelCount || player > 7)
+        {
+            return false;
+        }
+        if (player)
+        {
+            for (size_t end = pixel + run; pixel < end; ++pixel)
+            {
+                unsigned short* pRow = (unsigned short*)(pFrame->GetBuffer() + (pixel / width) * pFrame->GetStride());
+                pRow[pixel % width] |= player;
+            }
+        }
+        else
+        {
+            pixel += run;
+        }
+    }
+    return pixel == pixelCount;
+}
@@ -0,0 +1,27 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthCodec.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+#include <cstddef>
+#include <vector>
+
+// Lossless codec for FRAME_FORMAT_D13P3 depth frames, used for session recordings.
+//
+// The 13 bit depth and the 3 bit player index are coded separately. Depth is
+// predicted from the pixel above (from the left on the first row), the
+// residuals are zigzag mapped and stored in blocks of 16 as bit planes,
+// as many planes as the largest residual of the block needs. That makes
+// decoding a handful of SIMD compares and adds per block with no serial
+// dependency between pixels. The player index is mostly zero and is run
+// length coded.
+
+// Appends the coded frame to out.
+void EncodeDepthFrame(Frame* pFrame, std::vector<unsigned char>& out);
+
+// Decodes into pFrame, which must have the size and format of the encoded frame.
+bool DecodeDepthFrame(const unsigned char* pData, size_t size, Frame* pFrame);
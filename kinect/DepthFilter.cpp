@@ -0,0 +1,461 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthFilter.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "DepthFilter.h"
+#include "FrameSource.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const unsigned int BypassFrames = 150;       // about 5 s at 30 fps before trying again
+static const unsigned int WarmupFrames = 8;         // timed frames before the budget applies
+
+DepthFilterParams DefaultDepthFiltering()
+{
+    DepthFilterParams params = { 30, 3, 3, 2, 2, 4000 };
+    return params;
+}
+
+// The stages are written once against these: a plain int, SSE2 and AVX2
+// version of the 16 bit operations they need. Depth in millimetres fits a
+// signed 16 bit lane. Masks are all ones or all zeros.
+struct DepthScalarOps
+{
+    typedef int V;
+    enum { Width = 1 };
+    static V Load(const unsigned short* p)  { return *p; }
+    static void Store(unsigned short* p, V v) { *p = (unsigned short)v; }
+    static V Set(int i)                     { return i; }
+    static V Add(V a, V b)                  { return a + b; }
+    static V Sub(V a, V b)                  { return a - b; }
+    static V Min(V a, V b)                  { return a < b ? a : b; }
+    static V Max(V a, V b)                  { return a > b ? a : b; }
+    static V And(V a, V b)                  { return a & b; }
+    static V AndNot(V mask, V a)            { return ~mask & a; }
+    static V Or(V a, V b)                   { return a | b; }
+    static V Equal(V a, V b)                { return a == b ? -1 : 0; }
+    static V Less(V a, V b)                 { return a < b ? -1 : 0; }
+    static V ShiftRight(V a, int n)         { return a >> n; }
+    static V ShiftLeft(V a, int n)          { return (a << n) & 0xFFFF; }
+    static V RoundDiv(V a, V b)             { return (int)lrintf(float(a) / float(b)); }
+};
+
+#if defined(KINECT_SSE2)
+struct DepthSse2Ops
+{
+    typedef __m128i V;
+    enum { Width = 8 };
+    static V Load(const unsigned short* p)  { return _mm_loadu_si128((const __m128i*)p); }
+    static void Store(unsigned short* p, V v) { _mm_storeu_si128((__m128i*)p, v); }
+    static V Set(int i)                     { return _mm_set1_epi16((short)i); }
+    static V Add(V a, V b)                  { return _mm_add_epi16(a, b); }
+    static V Sub(V a, V b)                  { return _mm_sub_epi16(a, b); }
+    static V Min(V a, V b)                  { return _mm_min_epi16(a, b); }
+    static V Max(V a, V b)                  { return _mm_max_epi16(a, b); }
+    static V And(V a, V b)                  { return _mm_and_si128(a, b); }
+    static V AndNot(V mask, V a)            { return _mm_andnot_si128(mask, a); }
+    static V Or(V a, V b)                   { return _mm_or_si128(a, b); }
+    static V Equal(V a, V b)                { return _mm_cmpeq_epi16(a, b); }
+    static V Less(V a, V b)                 { return _mm_cmplt_epi16(a, b); }
+    static V ShiftRight(V a, int n)         { return _mm_srl_epi16(a, _mm_cvtsi32_si128(n)); }
+    static V ShiftLeft(V a, int n)          { return _mm_sll_epi16(a, _mm_cvtsi32_si128(n)); }
+    static V RoundDiv(V a, V b)
+    {
+        // Sign extend to 32 bits, divide as floats, round to nearest like lrintf
+        __m128 aLo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16));
+        __m128 aHi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16));
+        __m128 bLo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16));
+        __m128 bHi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16));
+        return _mm_packs_epi32(_mm_cvtps_epi32(_mm_div_ps(aLo, bLo)), _mm_cvtps_epi32(_mm_div_ps(aHi, bHi)));
+    }
+};
+#endif
+
+#if defined(KINECT_AVX2)
+struct DepthAvx2Ops
+{
+    typedef __m256i V;
+    enum { Width = 16 };
+    static V Load(const unsigned short* p)  { return _mm256_loadu_si256((const __m256i*)p); }
+    static void Store(unsigned short* p, V v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static V Set(int i)                     { return _mm256_set1_epi16((short)i); }
+    static V Add(V a, V b)                  { return _mm256_add_epi16(a, b); }
+    static V Sub(V a, V b)                  { return _mm256_sub_epi16(a, b); }
+    static V Min(V a, V b)                  { return _mm256_min_epi16(a, b); }
+    static V Max(V a, V b)                  { return _mm256_max_epi16(a, b); }
+    static V And(V a, V b)                  { return _mm256_and_si256(a, b); }
+    static V AndNot(V mask, V a)            { return _mm256_andnot_si256(mask, a); }
+    static V Or(V a, V b)                   { return _mm256_or_si256(a, b); }
+    static V Equal(V a, V b)                { return _mm256_cmpeq_epi16(a, b); }
+    static V Less(V a, V b)                 { return _mm256_cmpgt_epi16(b, a); }
+    static V ShiftRight(V a, int n)         { return _mm256_srl_epi16(a, _mm_cvtsi32_si128(n)); }
+    static V ShiftLeft(V a, int n)          { return _mm256_sll_epi16(a, _mm_cvtsi32_si128(n)); }
+    static V RoundDiv(V a, V b)
+    {
+        __m256 aLo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(a)));
+        __m256 aHi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(a, 1)));
+        __m256 bLo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(b)));
+        __m256 bHi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(b, 1)));
+        // packs works within 128 bit lanes, put the quadwords back in order
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(_mm256_div_ps(aLo, bLo)), _mm256_cvtps_epi32(_mm256_div_ps(aHi, bHi)));
+        return _mm256_permute4x64_epi64(packed, 0xD8);
+    }
+};
+#endif
+
+// Vector loops run past the width to the next multiple of 16 pixels: frame
+// rows are padded to whole cache lines and planes by their margin. Clearing
+// from the width on keeps the right border zero for the next stage.
+static void ClearTail(unsigned short* pRow, unsigned int width)
+{
+    unsigned int end = ((width + 15) & ~15u) + 16;
+    memset(pRow + width, 0, (end - width) * sizeof(unsigned short));
+}
+
+template <typename Ops>
+static void UnpackRow(const unsigned short* pPacked, unsigned short* pOut, unsigned int width)
+{
+    for (unsigned int x = 0; x < width; x += Ops::Width)
+    {
+        Ops::Store(pOut + x, Ops::ShiftRight(Ops::Load(pPacked + x), 3));
+    }
+    ClearTail(pOut, width);
+}
+
+template <typename Ops>
+static void SpatialRow(const unsigned short* pAbove, const unsigned short* pRow, const unsigned short* pBelow,
+    unsigned short* pOut, unsigned int width, const DepthFilterParams& params)
+{
+    typedef typename Ops::V V;
+    const V zero = Ops::Set(0);
+    const V one = Ops::Set(1);
+    const V edge = Ops::Set(params.edgeThreshold + 1);
+    const V minNeighbours = Ops::Set(params.minNeighbours);
+
+    for (unsigned int x = 0; x < width; x += Ops::Width)
+    {
+        V c = Ops::Load(pRow + x);
+        V threshold = Ops::Add(edge, Ops::ShiftRight(c, 5));
+        const unsigned short* neighbours[8] =
+        {
+            pAbove + x - 1, pAbove + x, pAbove + x + 1, pRow + x - 1,
+            pRow + x + 1, pBelow + x - 1, pBelow + x, pBelow + x + 1,
+        };
+        V sum = zero;
+        V count = zero;
+        for (int i = 0; i < 8; ++i)
+        {
+            V n = Ops::Load(neighbours[i]);
+            V d = Ops::Sub(n, c);
+            V same = Ops::AndNot(Ops::Equal(n, zero), Ops::Less(Ops::Max(d, Ops::Sub(zero, d)), threshold));
+            sum = Ops::Add(sum, Ops::And(same, d));
+            count = Ops::Sub(count, same);
+        }
+        V drop = Ops::Or(Ops::Equal(c, zero), Ops::Less(count, minNeighbours));
+        Ops::Store(pOut + x, Ops::AndNot(drop, Ops::Add(c, Ops::RoundDiv(sum, Ops::Add(count, one)))));
+    }
+    ClearTail(pOut, width);
+}
+
+template <typename Ops>
+static typename Ops::V Median3(typename Ops::V a, typename Ops::V b, typename Ops::V c)
+{
+    return Ops::Max(Ops::Min(a, b), Ops::Min(Ops::Max(a, b), c));
+}
+
+// frames[0] is the current frame, the others (2 or 4) are earlier ones.
+template <typename Ops>
+static void TemporalRow(const unsigned short* const* frames, unsigned int count, unsigned short* pOut,
+    unsigned int width, const DepthFilterParams& params)
+{
+    typedef typename Ops::V V;
+    const V zero = Ops::Set(0);
+    const V edge = Ops::Set(params.edgeThreshold);
+
+    for (unsigned int x = 0; x < width; x += Ops::Width)
+    {
+        V c = Ops::Load(frames[0] + x);
+        V threshold = Ops::Add(edge, Ops::ShiftRight(c, 5));
+        V v[5];
+        v[0] = c;
+        for (unsigned int i = 1; i < count; ++i)
+        {
+            // An earlier frame without depth here, or across an edge from now, votes for now
+            V h = Ops::Load(frames[i] + x);
+            V d = Ops::Sub(h, c);
+            V stale = Ops::Or(Ops::Equal(h, zero), Ops::Less(threshold, Ops::Max(d, Ops::Sub(zero, d))));
+            v[i] = Ops::Or(Ops::And(stale, c), Ops::AndNot(stale, h));
+        }
+
+        V median;
+        if (count == 5)
+        {
+            V low = Ops::Max(Ops::Min(v[1], v[2]), Ops::Min(v[3], v[4]));
+            V high = Ops::Min(Ops::Max(v[1], v[2]), Ops::Max(v[3], v[4]));
+            median = Median3<Ops>(v[0], low, high);
+        }
+        else
+        {
+            median = Median3<Ops>(v[0], v[1], v[2]);
+        }
+        Ops::Store(pOut + x, Ops::AndNot(Ops::Equal(c, zero), median));
+    }
+    ClearTail(pOut, width);
+}
+
+// Writes millimetres to pOut, or, with pPacked, D13P3 with its player indices
+// to pPackedOut.
+template <typename Ops>
+static void FillRow(const unsigned short* pAbove, const unsigned short* pRow, const unsigned short* pBelow,
+    unsigned short* pOut, const unsigned short* pPacked, unsigned short* pPackedOut, unsigned int width, bool fill)
+{
+    typedef typename Ops::V V;
+    const V zero = Ops::Set(0);
+    const V playerMask = Ops::Set(7);
+
+    for (unsigned int x = 0; x < width; x += Ops::Width)
+    {
+        V c = Ops::Load(pRow + x);
+        if (fill)
+        {
+            V farthest = Ops::Max(Ops::Max(Ops::Load(pAbove + x - 1), Ops::Load(pAbove + x)), Ops::Load(pAbove + x + 1));
+            farthest = Ops::Max(farthest, Ops::Max(Ops::Load(pRow + x - 1), Ops::Load(pRow + x + 1)));
+            farthest = Ops::Max(farthest, Ops::Max(Ops::Max(Ops::Load(pBelow + x - 1), Ops::Load(pBelow + x)), Ops::Load(pBelow + x + 1)));
+            V hole = Ops::Equal(c, zero);
+            c = Ops::Or(Ops::And(hole, farthest), Ops::AndNot(hole, c));
+        }
+        if (pPacked)
+        {
+            Ops::Store(pPackedOut + x, Ops::Or(Ops::ShiftLeft(c, 3), Ops::And(Ops::Load(pPacked + x), playerMask)));
+        }
+        else
+        {
+            Ops::Store(pOut + x, c);
+        }
+    }
+    if (!pPacked)
+    {
+        ClearTail(pOut, width);
+    }
+}
+
+#if defined(KINECT_AVX2)
+typedef DepthAvx2Ops DepthOps;
+#elif defined(KINECT_SSE2)
+typedef DepthSse2Ops DepthOps;
+#else
+typedef DepthScalarOps DepthOps;
+#endif
+
+DepthFilter::DepthFilter()
+{
+    m_Params = DefaultDepthFiltering();
+    m_pThreads = NULL;
+    m_FullWidth = 0;
+    m_FullHeight = 0;
+    m_Stride = 0;
+    Reset();
+}
+
+void DepthFilter::SetParameters(const DepthFilterParams& params)
+{
+    m_Params = params;
+    // Odd, so the median is one of the frames. std::min binds references, and
+    // MaxTemporalFrames has no definition to bind to.
+    unsigned int maxFrames = MaxTemporalFrames;
+    m_Params.temporalFrames = std::min(maxFrames, std::max(1u, params.temporalFrames) | 1);
+    m_Params.minNeighbours = std::min(8u, params.minNeighbours);
+    m_FullWidth = 0;    // the ring changes size, allocate again
+    Reset();
+}
+
+void DepthFilter::Reset()
+{
+    m_HistoryNext = 0;
+    m_HistoryCount = 0;
+    memset(m_Geometry, 0, sizeof(m_Geometry));
+    memset(&m_Stats, 0, sizeof(m_Stats));
+    m_TimedFrames = 0;
+    m_BypassLeft = 0;
+}
+
+void DepthFilter::Allocate(unsigned int fullWidth, unsigned int fullHeight)
+{
+    m_FullWidth = fullWidth;
+    m_FullHeight = fullHeight;
+    m_Stride = ((fullWidth + 15) & ~15u) + 2 * Margin;
+    size_t size = size_t(m_Stride) * (fullHeight + 2);
+    m_Input.assign(size, 0);
+    m_Work[0].assign(size, 0);
+    m_Work[1].assign(size, 0);
+    for (unsigned int i = 0; i < MaxTemporalFrames; ++i)
+    {
+        if (i < m_Params.temporalFrames)
+        {
+            m_History[i].assign(size, 0);
+        }
+        else
+        {
+            Plane().swap(m_History[i]);
+        }
+    }
+    m_HistoryNext = 0;
+    m_HistoryCount = 0;
+    m_Pool.Init(fullWidth, fullHeight, FRAME_FORMAT_D13P3, 4);
+}
+
+template <typename Stage>
+void DepthFilter::RunBands(unsigned int height, const Stage& stage)
+{
+    unsigned int bands = (height + BandRows - 1) / BandRows;
+    if (m_pThreads && bands > 1)
+    {
+        m_pThreads->Run(bands, [&](unsigned int band)
+        {
+            stage(band * BandRows, std::min(height, (band + 1) * BandRows));
+        });
+    }
+    else
+    {
+        stage(0, height);
+    }
+}
+
+void DepthFilter::UnpackRows(Frame* pDepth, unsigned int begin, unsigned int end)
+{
+    for (unsigned int y = begin; y < end; ++y)
+    {
+        UnpackRow<DepthOps>((const unsigned short*)(pDepth->GetBuffer() + y * pDepth->GetStride()),
+            Row(m_Input, y), pDepth->GetWidth());
+    }
+}
+
+// Spatial and temporal filter together: the median of a row only needs the
+// same row of the spatially filtered frames.
+void DepthFilter::SmoothRows(unsigned int width, unsigned int begin, unsigned int end)
+{
+    unsigned int count = m_Params.temporalFrames;
+    Plane& current = m_History[m_HistoryNext];
+    for (unsigned int y = begin; y < end; ++y)
+    {
+        SpatialRow<DepthOps>(Row(m_Input, y - 1), Row(m_Input, y), Row(m_Input, y + 1), Row(current, y), width, m_Params);
+        if (count > 1)
+        {
+            // Frames the ring does not have yet are stood in for by the current one
+            const unsigned short* frames[MaxTemporalFrames];
+            for (unsigned int i = 0; i < count; ++i)
+            {
+                frames[i] = i <= m_HistoryCount ? Row(m_History[(m_HistoryNext + count - i) % count], y) : Row(current, y);
+            }
+            TemporalRow<DepthOps>(frames, count, Row(m_Work[0], y), width, m_Params);
+        }
+    }
+}
+
+void DepthFilter::FillRows(Plane& source, Plane* pTarget, Frame* pDepth, Frame* pOut, bool fill, unsigned int begin, unsigned int end)
+{
+    for (unsigned int y = begin; y < end; ++y)
+    {
+        if (pOut)
+        {
+            FillRow<DepthOps>(Row(source, y - 1), Row(source, y), Row(source, y + 1), NULL,
+                (const unsigned short*)(pDepth->GetBuffer() + y * pDepth->GetStride()),
+                (unsigned short*)(pOut->GetBuffer() + y * pOut->GetStride()), pDepth->GetWidth(), fill);
+        }
+        else
+        {
+            FillRow<DepthOps>(Row(source, y - 1), Row(source, y), Row(source, y + 1), Row(*pTarget, y),
+                NULL, NULL, pDepth->GetWidth(), fill);
+        }
+    }
+}
+
+bool DepthFilter::Apply(Frame* pDepth, FrameRef& filtered)
+{
+    if (pDepth->GetFormat() != FRAME_FORMAT_D13P3)
+    {
+        return false;
+    }
+    if (m_BypassLeft)
+    {
+        if (--m_BypassLeft == 0)
+        {   // Try again with a fresh average
+            m_TimedFrames = 0;
+            m_HistoryCount = 0;
+        }
+        m_Stats.bypassedFrames++;
+        return false;
+    }
+
+    long long start = FrameClockMicroseconds();
+    bool allocated = pDepth->GetFullWidth() != m_FullWidth || pDepth->GetFullHeight() != m_FullHeight;
+    if (allocated)
+    {   // New resolution profile
+        Allocate(pDepth->GetFullWidth(), pDepth->GetFullHeight());
+    }
+
+    filtered = m_Pool.Acquire();
+    if (!filtered || (pDepth->IsRegion() &&
+        !filtered->SetRegion(pDepth->GetOffsetX(), pDepth->GetOffsetY(), pDepth->GetWidth(), pDepth->GetHeight())))
+    {
+        filtered.Reset();
+        return false;
+    }
+    filtered->SetTimestamp(pDepth->GetTimestamp(), pDepth->GetFrameNumber());
+
+    unsigned int width = pDepth->GetWidth();
+    unsigned int height = pDepth->GetHeight();
+    unsigned int geometry[4] = { pDepth->GetOffsetX(), pDepth->GetOffsetY(), width, height };
+    if (memcmp(geometry, m_Geometry, sizeof(m_Geometry)) != 0)
+    {   // The ring holds other pixels
+        memcpy(m_Geometry, geometry, sizeof(m_Geometry));
+        m_HistoryCount = 0;
+    }
+
+    // The row below the frame is the bottom border of the planes read as 3x3
+    // windows; a larger frame before may have left depth there.
+    Plane& current = m_History[m_HistoryNext];
+    Plane* windowed[] = { &m_Input, &current, &m_Work[0], &m_Work[1] };
+    for (int i = 0; i < 4; ++i)
+    {
+        memset(Row(*windowed[i], height) - Margin, 0, m_Stride * sizeof(unsigned short));
+    }
+
+    RunBands(height, [&](unsigned int begin, unsigned int end) { UnpackRows(pDepth, begin, end); });
+    RunBands(height, [&](unsigned int begin, unsigned int end) { SmoothRows(width, begin, end); });
+
+    Plane* pSource = m_Params.temporalFrames > 1 ? &m_Work[0] : &current;
+    for (unsigned int pass = 0; pass + 1 < m_Params.holeFillPasses; ++pass)
+    {
+        Plane* pTarget = pSource == &m_Work[1] ? &m_Work[0] : &m_Work[1];
+        RunBands(height, [&](unsigned int begin, unsigned int end) { FillRows(*pSource, pTarget, pDepth, NULL, true, begin, end); });
+        pSource = pTarget;
+    }
+    // The last pass packs the result with the player indices
+    bool fill = m_Params.holeFillPasses > 0;
+    RunBands(height, [&](unsigned int begin, unsigned int end) { FillRows(*pSource, NULL, pDepth, filtered.Get(), fill, begin, end); });
+
+    if (m_Params.temporalFrames > 1)
+    {
+        m_HistoryNext = (m_HistoryNext + 1) % m_Params.temporalFrames;
+        m_HistoryCount = std::min(m_HistoryCount + 1, m_Params.temporalFrames - 1);
+    }
+    m_Stats.filteredFrames++;
+
+    // Frames that allocated say nothing about the steady state
+    if (!allocated)
+    {
+        long long time = FrameClockMicroseconds() - start;
+        m_Stats.averageTime = m_TimedFrames++ ? m_Stats.averageTime + (time - m_Stats.averageTime) / 8 : time;
+        if (m_Params.budget && m_TimedFrames >= WarmupFrames && m_Stats.averageTime > m_Params.budget)
+        {
+            m_BypassLeft = BypassFrames;
+            m_Stats.bypasses++;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthFilter.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+#include "ThreadPool.h"
+#include <vector>
+
+struct DepthFilterParams
+{
+    unsigned int    edgeThreshold;  // mm, plus 1/32 of the depth; neighbours further away are across an edge
+    unsigned int    minNeighbours;  // pixels with fewer neighbours on their side of an edge are flying pixels
+    unsigned int    temporalFrames; // frames in the temporal median: 1 (off), 3 or 5
+    unsigned int    holeFillPasses; // each pass fills holes one pixel further in
+    unsigned int    threads;        // including the acquiring thread
+    long long       budget;         // microseconds a frame may take on average, 0 for no limit
+};
+
+// Filtering for a 320x240 or 640x480 head at 30 fps.
+DepthFilterParams DefaultDepthFiltering();
+
+struct DepthFilterStats
+{
+    unsigned int    filteredFrames;
+    unsigned int    bypassedFrames; // passed on unfiltered after the budget was exceeded
+    unsigned int    bypasses;       // times the budget was exceeded
+    long long       averageTime;    // microseconds per filtered frame, recent average
+};
+
+// Cleans up depth frames before anyone looks for the head in them:
+//
+// - spatial: every pixel becomes the mean of itself and those of its 8
+//   neighbours on the same side of a depth edge, so edges stay sharp. Pixels
+//   with fewer than minNeighbours such neighbours are flying pixels between
+//   the head and the background and are dropped.
+// - temporal: the median of the pixel over the last temporalFrames frames,
+//   leaving out frames where it had no depth or was across an edge from now.
+// - holes: pixels without depth take the farthest of their neighbours, the
+//   background a shadow hides, one ring of pixels per pass.
+//
+// Frames go through in bands of rows on the thread pool, if there is one,
+// with 16 bit SSE2 or AVX2 inner loops. A frame whose geometry differs from
+// the last (a new ROI or resolution) restarts the temporal median. When the
+// average time per frame exceeds the budget, frames pass unfiltered for a
+// while before the filter tries again.
+class DepthFilter
+{
+public:
+    DepthFilter();
+
+    void SetParameters(const DepthFilterParams& params);
+    const DepthFilterParams& GetParameters() { return(m_Params); };
+    void SetThreadPool(ThreadPool* pThreads) { m_pThreads = pThreads; };
+    void Reset();
+
+    // Filters a FRAME_FORMAT_D13P3 frame, whole or region, into a frame from
+    // the filter's pool with the same geometry and timestamp. Player indices
+    // pass through. False if pDepth should be used as it is: it is another
+    // format, or the filter is over its budget.
+    bool Apply(Frame* pDepth, FrameRef& filtered);
+
+    DepthFilterStats GetStats() { return(m_Stats); };
+
+private:
+    static const unsigned int BandRows = 16;
+    static const unsigned int MaxTemporalFrames = 5;
+
+    // Planes of millimetres with a zero border of one row above and below and
+    // Margin pixels left and right, so 3x3 windows need no edge cases; zero
+    // is no depth and never counts as a neighbour.
+    static const unsigned int Margin = 16;
+    typedef std::vector<unsigned short> Plane;
+    unsigned short* Row(Plane& plane, unsigned int y) { return(&plane[(y + 1) * m_Stride + Margin]); };
+
+    void Allocate(unsigned int fullWidth, unsigned int fullHeight);
+    template <typename Stage>
+    void RunBands(unsigned int height, const Stage& stage);
+    void UnpackRows(Frame* pDepth, unsigned int begin, unsigned int end);
+    void SmoothRows(unsigned int width, unsigned int begin, unsigned int end);
+    void FillRows(Plane& source, Plane* pTarget, Frame* pDepth, Frame* pOut, bool fill, unsigned int begin, unsigned int end);
+
+    DepthFilterParams   m_Params;
+    ThreadPool*         m_pThreads;
+    FramePool           m_Pool;
+    unsigned int        m_FullWidth;
+    unsigned int        m_FullHeight;
+    unsigned int        m_Stride;       // pixels
+    Plane               m_Input;
+    Plane               m_History[MaxTemporalFrames];   // spatially filtered frames, a ring
+    Plane               m_Work[2];
+    unsigned int        m_HistoryNext;  // ring slot the current frame goes to
+    unsigned int        m_HistoryCount; // earlier frames in the ring
+    unsigned int        m_Geometry[4];  // offset and size of the frames in the ring
+
+    DepthFilterStats    m_Stats;
+    unsigned int        m_TimedFrames;  // since the average was restarted
+    unsigned int        m_BypassLeft;   // frames still to pass unfiltered
+};
@@ -0,0 +1,307 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthHeadLocator.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "DepthHeadLocator.h"
+#include "FrameSource.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+
+static const float HeadRadius = 0.1f;           // meters
+static const float HeadHeight = 0.2f;           // rows below the top of the head that are head
+static const float WindowHalfWidth = 0.25f;     // window around the seed, meters
+static const float WindowAbove = 0.3f;
+static const float WindowBelow = 0.25f;
+static const float BandNear = 0.15f;            // depth band, in front of and behind the seed's surface
+static const float BandFar = 0.25f;
+static const int SeedSearch = 3;                // pixels around the seed's projection
+static const float SeedTolerance = 0.25f;       // meters between the seed and its surface
+static const float MinCoverage = 0.3f;          // of the pixels a head disc covers at that depth
+static const float Pi = 3.14159265f;
+
+// Mask bytes of the pixels of a row: 0xFF for depths in [lo, hi] millimetres,
+// else 0. Depths fit in 13 bits, so signed 16 bit compares do; invalid depths
+// (0) are below any band.
+static void BandRow(const unsigned short* pDepth, unsigned char* pMask, unsigned int width, unsigned int shift, int lo, int hi)
+{
+    unsigned int x = 0;
+#if defined(KINECT_AVX2)
+    const __m256i below = _mm256_set1_epi16((short)lo);
+    const __m256i above = _mm256_set1_epi16((short)(hi + 1));
+    for (; x + 16 <= width; x += 16)
+    {
+        __m256i d = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i*)(pDepth + x)), _mm_cvtsi32_si128(shift));
+        __m256i in = _mm256_andnot_si256(_mm256_cmpgt_epi16(below, d), _mm256_cmpgt_epi16(above, d));
+        _mm_storeu_si128((__m128i*)(pMask + x), _mm_packs_epi16(_mm256_castsi256_si128(in), _mm256_extracti128_si256(in, 1)));
+    }
+#elif defined(KINECT_SSE2)
+    const __m128i below = _mm_set1_epi16((short)lo);
+    const __m128i above = _mm_set1_epi16((short)(hi + 1));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i a = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(pDepth + x)), count);
+        __m128i b = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(pDepth + x + 8)), count);
+        a = _mm_andnot_si128(_mm_cmplt_epi16(a, below), _mm_cmplt_epi16(a, above));
+        b = _mm_andnot_si128(_mm_cmplt_epi16(b, below), _mm_cmplt_epi16(b, above));
+        _mm_storeu_si128((__m128i*)(pMask + x), _mm_packs_epi16(a, b));
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        int d = pDepth[x] >> shift;
+        pMask[x] = (d >= lo && d <= hi) ? 0xFF : 0;
+    }
+}
+
+// Adds up the depths of the blob pixels of a row (mask 1), the depths times
+// their x in the row, and their number. Each 32 bit lane adds at most a few
+// dozen products of a 13 bit depth and a 10 bit position, so it cannot
+// overflow before the row ends.
+static void BlobRowSums(const unsigned short* pDepth, const unsigned char* pMask, unsigned int width, unsigned int shift,
+    long long* pSumZ, long long* pSumXZ, unsigned int* pCount)
+{
+    unsigned int x = 0;
+    long long sumZ = 0;
+    long long sumXZ = 0;
+    int count = 0;
+#if defined(KINECT_AVX2)
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i step = _mm256_set1_epi16(16);
+    const __m128i blob = _mm_set1_epi8(1);
+    __m256i position = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m256i z = _mm256_setzero_si256();
+    __m256i xz = _mm256_setzero_si256();
+    __m256i n = _mm256_setzero_si256();
+    for (; x + 16 <= width; x += 16)
+    {
+        __m256i in = _mm256_cvtepi8_epi16(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(pMask + x)), blob));
+        __m256i d = _mm256_and_si256(_mm256_srl_epi16(_mm256_loadu_si256((const __m256i*)(pDepth + x)), _mm_cvtsi32_si128(shift)), in);
+        z = _mm256_add_epi32(z, _mm256_madd_epi16(d, ones));
+        xz = _mm256_add_epi32(xz, _mm256_madd_epi16(d, position));
+        n = _mm256_sub_epi16(n, in);
+        position = _mm256_add_epi16(position, step);
+    }
+    alignas(32) int lanes[3][8];
+    _mm256_store_si256((__m256i*)lanes[0], z);
+    _mm256_store_si256((__m256i*)lanes[1], xz);
+    _mm256_store_si256((__m256i*)lanes[2], _mm256_madd_epi16(n, ones));
+    for (int i = 0; i < 8; ++i)
+    {
+        sumZ += lanes[0][i];
+        sumXZ += lanes[1][i];
+        count += lanes[2][i];
+    }
+#elif defined(KINECT_SSE2)
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i step = _mm_set1_epi16(8);
+    const __m128i blob = _mm_set1_epi8(1);
+    const __m128i count16 = _mm_cvtsi32_si128(shift);
+    __m128i position = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    __m128i z = _mm_setzero_si128();
+    __m128i xz = _mm_setzero_si128();
+    __m128i n = _mm_setzero_si128();
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i in = _mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i*)(pMask + x)), blob);
+        in = _mm_unpacklo_epi8(in, in);
+        __m128i d = _mm_and_si128(_mm_srl_epi16(_mm_loadu_si128((const __m128i*)(pDepth + x)), count16), in);
+        z = _mm_add_epi32(z, _mm_madd_epi16(d, ones));
+        xz = _mm_add_epi32(xz, _mm_madd_epi16(d, position));
+        n = _mm_sub_epi16(n, in);
+        position = _mm_add_epi16(position, step);
+    }
+    alignas(16) int lanes[3][4];
+    _mm_store_si128((__m128i*)lanes[0], z);
+    _mm_store_si128((__m128i*)lanes[1], xz);
+    _mm_store_si128((__m128i*)lanes[2], _mm_madd_epi16(n, ones));
+    for (int i = 0; i < 4; ++i)
+    {
+        sumZ += lanes[0][i];
+        sumXZ += lanes[1][i];
+        count += lanes[2][i];
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        if (pMask[x] == 1)
+        {
+            int d = pDepth[x] >> shift;
+            sumZ += d;
+            sumXZ += (long long)d * x;
+            count++;
+        }
+    }
+    *pSumZ += sumZ;
+    *pSumXZ += sumXZ;
+    *pCount += count;
+}
+
+DepthHeadLocator::DepthHeadLocator()
+{
+    m_Width = 0;
+    m_Height = 0;
+    m_LastPixels = 0;
+}
+
+// Marks the band pixels 4-connected to the seed as blob, a run at a time.
+void DepthHeadLocator::FloodFill(unsigned int seedX, unsigned int seedY, unsigned int* pTop)
+{
+    unsigned int top = seedY;
+    m_Stack.clear();
+    m_Stack.push_back(seedY * m_Width + seedX);
+    while (!m_Stack.empty())
+    {
+        unsigned int y = m_Stack.back() / m_Width;
+        unsigned int x = m_Stack.back() % m_Width;
+        m_Stack.pop_back();
+        unsigned char* pRow = &m_Mask[y * m_Width];
+        if (pRow[x] != 0xFF)
+        {
+            continue;
+        }
+
+        unsigned int left = x;
+        unsigned int right = x + 1;
+        while (left > 0 && pRow[left - 1] == 0xFF)
+        {
+            left--;
+        }
+        while (right < m_Width && pRow[right] == 0xFF)
+        {
+            right++;
+        }
+        std::fill(pRow + left, pRow + right, (unsigned char)1);
+        top = std::min(top, y);
+
+        // One seed per run of band pixels touching this run, above and below
+        for (int dy = -1; dy <= 1; dy += 2)
+        {
+            unsigned int ny = y + dy;
+            if (ny >= m_Height)
+            {
+                continue;
+            }
+            const unsigned char* pNext = &m_Mask[ny * m_Width];
+            for (unsigned int nx = left; nx < right; ++nx)
+            {
+                if (pNext[nx] == 0xFF && (nx == left || pNext[nx - 1] != 0xFF))
+                {
+                    m_Stack.push_back(ny * m_Width + nx);
+                }
+            }
+        }
+    }
+    *pTop = top;
+}
+
+bool DepthHeadLocator::Locate(Frame* pDepth, const Point3& seed, HeadPose* pPose)
+{
+    unsigned int shift;
+    switch (pDepth->GetFormat())
+    {
+    case FRAME_FORMAT_D13P3:    shift = 3; break;
+    case FRAME_FORMAT_D16:      shift = 0; break;
+    default:                    return false;
+    }
+    if (seed.z <= 0)
+    {
+        return false;
+    }
+
+    // Projection of the full image; the frame may be a region of it
+    float focal = NOMINAL_DEPTH_FOCAL_LENGTH * pDepth->GetFullWidth() / 320.0f;
+    float cx = pDepth->GetFullWidth() * 0.5f;
+    float cy = pDepth->GetFullHeight() * 0.5f;
+    int left = pDepth->GetOffsetX();
+    int top = pDepth->GetOffsetY();
+    int right = left + pDepth->GetWidth();
+    int bottom = top + pDepth->GetHeight();
+    auto depthRow = [pDepth, top](int y) { return (const unsigned short*)(pDepth->GetBuffer() + (y - top) * pDepth->GetStride()); };
+
+    // The surface pixel nearest the seed's depth
+    int u = int(floorf(cx + focal * seed.x / seed.z));
+    int v = int(floorf(cy - focal * seed.y / seed.z));
+    int seedZ = int(seed.z * 1000.0f);
+    int bestError = int(SeedTolerance * 1000.0f) + 1;
+    int seedX = 0;
+    int seedY = 0;
+    for (int y = std::max(v - SeedSearch, top); y <= std::min(v + SeedSearch, bottom - 1); ++y)
+    {
+        for (int x = std::max(u - SeedSearch, left); x <= std::min(u + SeedSearch, right - 1); ++x)
+        {
+            int d = depthRow(y)[x - left] >> shift;
+            if (d > 0 && abs(d - seedZ) < bestError)
+            {
+                bestError = abs(d - seedZ);
+                seedX = x;
+                seedY = y;
+            }
+        }
+    }
+    if (bestError > int(SeedTolerance * 1000.0f))
+    {
+        return false;
+    }
+    int surface = depthRow(seedY)[seedX - left] >> shift;
+    float pixelsPerMeter = focal * 1000.0f / surface;
+
+    // Band mask of the window
+    int x0 = std::max(left, seedX - int(pixelsPerMeter * WindowHalfWidth));
+    int x1 = std::min(right, seedX + int(pixelsPerMeter * WindowHalfWidth) + 1);
+    int y0 = std::max(top, seedY - int(pixelsPerMeter * WindowAbove));
+    int y1 = std::min(bottom, seedY + int(pixelsPerMeter * WindowBelow) + 1);
+    m_Width = x1 - x0;
+    m_Height = y1 - y0;
+    m_Mask.resize(size_t(m_Width) * m_Height);
+    int lo = std::max(1, surface - int(BandNear * 1000.0f));
+    int hi = surface + int(BandFar * 1000.0f);
+    for (int y = y0; y < y1; ++y)
+    {
+        BandRow(depthRow(y) + x0 - left, &m_Mask[(y - y0) * m_Width], m_Width, shift, lo, hi);
+    }
+
+    unsigned int blobTop;
+    FloodFill(seedX - x0, seedY - y0, &blobTop);
+
+    // Camera space centroid of the head rows
+    unsigned int headRows = std::min(m_Height - blobTop, (unsigned int)(pixelsPerMeter * HeadHeight) + 1);
+    long long sumZ = 0;
+    long long sumXZ = 0;
+    long long sumYZ = 0;
+    unsigned int count = 0;
+    for (unsigned int y = blobTop; y < blobTop + headRows; ++y)
+    {
+        long long rowZ = 0;
+        BlobRowSums(depthRow(y + y0) + x0 - left, &m_Mask[y * m_Width], m_Width, shift, &rowZ, &sumXZ, &count);
+        sumZ += rowZ;
+        sumYZ += rowZ * y;
+    }
+    m_LastPixels = count;
+    float headPixels = Pi * (pixelsPerMeter * HeadRadius) * (pixelsPerMeter * HeadRadius);
+    if (count == 0 || count < MinCoverage * headPixels)
+    {
+        return false;
+    }
+
+    // Pixel centers are at +0.5; sums are in millimetres
+    double scale = 0.001 / count;
+    double x = (sumXZ + (x0 + 0.5 - cx) * sumZ) * scale / focal;
+    double y = -(sumYZ + (y0 + 0.5 - cy) * sumZ) * scale / focal;
+    double z = sumZ * scale;
+    // A sphere seen from the front shows depths 2/3 of its radius nearer than
+    // its center on average, over the pixels it covers
+    double push = 1.0 + (2.0 / 3.0) * HeadRadius / sqrt(x * x + y * y + z * z);
+
+    pPose->position.x = float(x * push);
+    pPose->position.y = float(y * push);
+    pPose->position.z = float(z * push);
+    pPose->rotation[0] = pPose->rotation[1] = pPose->rotation[2] = 0;
+    pPose->confidence = std::min(1.0f, count / headPixels);
+    pPose->frameNumber = pDepth->GetFrameNumber();
+    pPose->frameTimestamp = pDepth->GetTimestamp();
+    return true;
+}
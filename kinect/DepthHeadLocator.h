@@ -0,0 +1,48 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthHeadLocator.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+#include "HeadPose.h"
+#include <vector>
+
+// Finds the center of a head in a depth frame, near a seed position such as
+// the skeleton's head joint or the previous result. It needs no face tracker
+// and runs at the depth rate, well under a millisecond per frame.
+//
+// The seed's projection is snapped to the nearest surface within a few pixels.
+// Around it, a window of about 0.5 x 0.55 m is thresholded to a depth band
+// around that surface, 16 pixels at a time with SSE2 or AVX2. A scanline
+// flood fill from the seed, bounded by the window, keeps the blob connected to
+// it. The blob's top row is the top of the head. The rows within a head's
+// height below it are averaged into a camera space centroid, which is pushed
+// back along its ray by the depth the visible half of a head sphere has on
+// average. The integer sums for the centroid are also computed 16 pixels at a
+// time.
+class DepthHeadLocator
+{
+public:
+    DepthHeadLocator();
+
+    // pDepth is FRAME_FORMAT_D13P3 or FRAME_FORMAT_D16, full frame or region;
+    // seed is in camera space. Fills position, confidence (the share of a
+    // head's pixels the blob has, up to 1), frameNumber and frameTimestamp;
+    // rotation is zero. False if there is no head-sized blob at the seed.
+    bool Locate(Frame* pDepth, const Point3& seed, HeadPose* pPose);
+
+    // Pixels in the head rows of the last blob found.
+    unsigned int GetLastPixels() { return(m_LastPixels); };
+
+private:
+    void FloodFill(unsigned int seedX, unsigned int seedY, unsigned int* pTop);
+
+    unsigned int                m_Width;    // of the window
+    unsigned int                m_Height;
+    std::vector<unsigned char>  m_Mask;     // 0 outside the band, 0xFF inside, 1 in the blob
+    std::vector<unsigned int>   m_Stack;    // flood fill seeds, y * m_Width + x
+    unsigned int                m_LastPixels;
+};
@@ -0,0 +1,83 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthPlanes.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "DepthPlanes.h"
+#include "Simd.h"
+
+// Frame rows start cache line aligned and their stride is a whole number of
+// cache lines, so the vector loops may run past the width to the next 32 (16)
+// pixels without leaving the row's buffer, and every store is aligned.
+static void UnpackRow(const unsigned short* pPacked, unsigned short* pDepth, unsigned char* pPlayers, unsigned int width)
+{
+    unsigned int x = 0;
+#if defined(KINECT_AVX2)
+    const __m256i playerMask = _mm256_set1_epi16(7);
+    for (; x < width; x += 32)
+    {
+        __m256i a = _mm256_load_si256((const __m256i*)(pPacked + x));
+        __m256i b = _mm256_load_si256((const __m256i*)(pPacked + x + 16));
+        _mm256_stream_si256((__m256i*)(pDepth + x), _mm256_srli_epi16(a, 3));
+        _mm256_stream_si256((__m256i*)(pDepth + x + 16), _mm256_srli_epi16(b, 3));
+        // packus works within 128 bit lanes, put the quadwords back in order
+        __m256i players = _mm256_packus_epi16(_mm256_and_si256(a, playerMask), _mm256_and_si256(b, playerMask));
+        _mm256_stream_si256((__m256i*)(pPlayers + x), _mm256_permute4x64_epi64(players, 0xD8));
+    }
+#elif defined(KINECT_SSE2)
+    const __m128i playerMask = _mm_set1_epi16(7);
+    for (; x < width; x += 16)
+    {
+        __m128i a = _mm_load_si128((const __m128i*)(pPacked + x));
+        __m128i b = _mm_load_si128((const __m128i*)(pPacked + x + 8));
+        _mm_stream_si128((__m128i*)(pDepth + x), _mm_srli_epi16(a, 3));
+        _mm_stream_si128((__m128i*)(pDepth + x + 8), _mm_srli_epi16(b, 3));
+        _mm_stream_si128((__m128i*)(pPlayers + x), _mm_packus_epi16(_mm_and_si128(a, playerMask), _mm_and_si128(b, playerMask)));
+    }
+#else
+    for (; x < width; ++x)
+    {
+        pDepth[x] = (unsigned short)(pPacked[x] >> 3);
+        pPlayers[x] = (unsigned char)(pPacked[x] & 7);
+    }
+#endif
+}
+
+// Gives pFrame the geometry of pPacked.
+static bool MatchGeometry(Frame* pPacked, Frame* pFrame)
+{
+    if (pFrame->GetFullWidth() != pPacked->GetFullWidth() || pFrame->GetFullHeight() != pPacked->GetFullHeight())
+    {
+        return false;
+    }
+    if (pPacked->IsRegion())
+    {
+        return pFrame->SetRegion(pPacked->GetOffsetX(), pPacked->GetOffsetY(), pPacked->GetWidth(), pPacked->GetHeight());
+    }
+    return !pFrame->IsRegion();
+}
+
+bool UnpackDepthFrame(Frame* pPacked, Frame* pDepth, Frame* pPlayers)
+{
+    if (pPacked->GetFormat() != FRAME_FORMAT_D13P3 || pDepth->GetFormat() != FRAME_FORMAT_D16 ||
+        pPlayers->GetFormat() != FRAME_FORMAT_P8 || !MatchGeometry(pPacked, pDepth) || !MatchGeometry(pPacked, pPlayers))
+    {
+        return false;
+    }
+
+    for (unsigned int y = 0; y < pPacked->GetHeight(); ++y)
+    {
+        UnpackRow((const unsigned short*)(pPacked->GetBuffer() + y * pPacked->GetStride()),
+            (unsigned short*)(pDepth->GetBuffer() + y * pDepth->GetStride()),
+            pPlayers->GetBuffer() + y * pPlayers->GetStride(), pPacked->GetWidth());
+    }
+#if defined(KINECT_SSE2)
+    // Streaming stores are weakly ordered; finish them before the planes are published
+    _mm_sfence();
+#endif
+
+    pDepth->SetTimestamp(pPacked->GetTimestamp(), pPacked->GetFrameNumber());
+    pPlayers->SetTimestamp(pPacked->GetTimestamp(), pPacked->GetFrameNumber());
+    return true;
+}
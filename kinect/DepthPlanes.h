@@ -0,0 +1,20 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthPlanes.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+
+// Splits a FRAME_FORMAT_D13P3 frame into pDepth, a FRAME_FORMAT_D16 frame of
+// millimetres, and pPlayers, a FRAME_FORMAT_P8 frame of player indices, so
+// consumers need not shift and mask every pixel themselves.
+//
+// One streaming pass: each row is read once and both planes are written with
+// non-temporal stores, which go around the cache of the acquiring thread; the
+// planes are read later, by other threads. The outputs take the size, region
+// and timestamp of pPacked and must come from pools of its full size.
+// False if the formats or sizes do not fit.
+bool UnpackDepthFrame(Frame* pPacked, Frame* pDepth, Frame* pPlayers);
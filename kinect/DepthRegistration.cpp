@@ -0,0 +1,202 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthRegistration.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "DepthRegistration.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const float KinectBaseline = 0.025f;     // meters, depth to color camera
+
+RegistrationCalibration NominalRegistrationCalibration(unsigned int depthWidth, unsigned int depthHeight,
+    unsigned int colorWidth, unsigned int colorHeight)
+{
+    RegistrationCalibration calibration;
+    calibration.depthFocal = NOMINAL_DEPTH_FOCAL_LENGTH * depthWidth / 320.0f;
+    calibration.depthCenterX = depthWidth * 0.5f;
+    calibration.depthCenterY = depthHeight * 0.5f;
+    calibration.colorFocal = NOMINAL_COLOR_FOCAL_LENGTH * colorWidth / 640.0f;
+    calibration.colorCenterX = colorWidth * 0.5f;
+    calibration.colorCenterY = colorHeight * 0.5f;
+    calibration.depthToColor = IdentityTransform();
+    calibration.depthToColor.translation[0] = KinectBaseline;
+    return calibration;
+}
+
+DepthRegistration::DepthRegistration()
+{
+    m_DepthWidth = 0;
+    m_DepthHeight = 0;
+    m_ColorWidth = 0;
+    m_ColorHeight = 0;
+    m_Splat = 1;
+    memset(m_BandX, 0, sizeof(m_BandX));
+    memset(m_BandY, 0, sizeof(m_BandY));
+}
+
+bool DepthRegistration::Build(unsigned int depthWidth, unsigned int depthHeight, unsigned int colorWidth, unsigned int colorHeight,
+    const RegistrationCalibration& calibration)
+{
+    // Project every depth ray at infinity, where the translation drops out
+    const float (*r)[3] = calibration.depthToColor.rotation;
+    std::vector<float> baseX(size_t(depthWidth) * depthHeight);
+    std::vector<float> baseY(baseX.size());
+    for (unsigned int y = 0; y < depthHeight; ++y)
+    {
+        for (unsigned int x = 0; x < depthWidth; ++x)
+        {
+            // Camera space has y up, images have it down
+            float rayX = (x + 0.5f - calibration.depthCenterX) / calibration.depthFocal;
+            float rayY = -(y + 0.5f - calibration.depthCenterY) / calibration.depthFocal;
+            float cx = r[0][0] * rayX + r[0][1] * rayY + r[0][2];
+            float cy = r[1][0] * rayX + r[1][1] * rayY + r[1][2];
+            float cz = r[2][0] * rayX + r[2][1] * rayY + r[2][2];
+            baseX[y * depthWidth + x] = calibration.colorCenterX + calibration.colorFocal * cx / cz - 0.5f;
+            baseY[y * depthWidth + x] = calibration.colorCenterY - calibration.colorFocal * cy / cz - 0.5f;
+        }
+    }
+
+    // The translation seen from the optical axis, in color pixels at 1 mm
+    const float* t = calibration.depthToColor.translation;
+    float parallaxX = calibration.colorFocal * t[0] * 1000.0f;
+    float parallaxY = -calibration.colorFocal * t[1] * 1000.0f;
+    return Build(depthWidth, depthHeight, colorWidth, colorHeight, &baseX[0], &baseY[0], parallaxX, parallaxY);
+}
+
+bool DepthRegistration::Build(unsigned int depthWidth, unsigned int depthHeight, unsigned int colorWidth, unsigned int colorHeight,
+    const float* pBaseX, const float* pBaseY, float parallaxX, float parallaxY)
+{
+    if (!depthWidth || !depthHeight || !colorWidth || !colorHeight)
+    {
+        return false;
+    }
+    m_DepthWidth = depthWidth;
+    m_DepthHeight = depthHeight;
+    m_ColorWidth = colorWidth;
+    m_ColorHeight = colorHeight;
+    m_Splat = std::max(1, int((colorWidth + depthWidth - 1) / depthWidth));
+
+    size_t pixels = size_t(depthWidth) * depthHeight;
+    m_BaseX.resize(pixels);
+    m_BaseY.resize(pixels);
+    for (size_t i = 0; i < pixels; ++i)
+    {
+        // The splat covers the color pixels around the depth pixel's center
+        m_BaseX[i] = int(floorf(pBaseX[i] + 0.5f)) - m_Splat / 2;
+        m_BaseY[i] = int(floorf(pBaseY[i] + 0.5f)) - m_Splat / 2;
+    }
+    for (unsigned int band = 0; band < BandCount; ++band)
+    {
+        float z = float((band << BandShift) + (1 << BandShift) / 2);
+        m_BandX[band] = int(floorf(parallaxX / z + 0.5f));
+        m_BandY[band] = int(floorf(parallaxY / z + 0.5f));
+    }
+    m_Targets.resize(depthWidth);
+    return true;
+}
+
+bool DepthRegistration::IsBuiltFor(unsigned int depthWidth, unsigned int depthHeight, unsigned int colorWidth, unsigned int colorHeight)
+{
+    return m_DepthWidth == depthWidth && m_DepthHeight == depthHeight && m_ColorWidth == colorWidth && m_ColorHeight == colorHeight;
+}
+
+bool DepthRegistration::MapPixel(unsigned int x, unsigned int y, unsigned short depth, int* pColorX, int* pColorY)
+{
+    unsigned int band = std::min((unsigned int)(depth >> 3) >> BandShift, BandCount - 1);
+    if (x >= m_DepthWidth || y >= m_DepthHeight || !(depth >> 3))
+    {
+        return false;
+    }
+    *pColorX = m_BaseX[y * m_DepthWidth + x] + m_BandX[band] + m_Splat / 2;
+    *pColorY = m_BaseY[y * m_DepthWidth + x] + m_BandY[band] + m_Splat / 2;
+    return *pColorX >= 0 && *pColorX < int(m_ColorWidth) && *pColorY >= 0 && *pColorY < int(m_ColorHeight);
+}
+
+// Color pixel index of the top left of each pixel's splat, -1 for pixels
+// without depth or whose splat does not fit. lut is the table index of pDepth[0].
+void DepthRegistration::MapRow(const unsigned short* pDepth, unsigned int count, unsigned int lut, int colorStride, int* pTargets)
+{
+    int maxX = int(m_ColorWidth) - m_Splat;
+    int maxY = int(m_ColorHeight) - m_Splat;
+    unsigned int x = 0;
+#if defined(KINECT_AVX2)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lastBand = _mm256_set1_epi32(BandCount - 1);
+    const __m256i limitX = _mm256_set1_epi32(maxX + 1);
+    const __m256i limitY = _mm256_set1_epi32(maxY + 1);
+    const __m256i stride = _mm256_set1_epi32(colorStride);
+    const __m256i none = _mm256_set1_epi32(-1);
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i depth = _mm256_srli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(pDepth + x))), 3);
+        __m256i band = _mm256_min_epi32(_mm256_srli_epi32(depth, BandShift), lastBand);
+        __m256i cx = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)&m_BaseX[lut + x]), _mm256_i32gather_epi32(m_BandX, band, 4));
+        __m256i cy = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)&m_BaseY[lut + x]), _mm256_i32gather_epi32(m_BandY, band, 4));
+
+        // 0 <= c <= max, as c > -1 and limit > c
+        __m256i valid = _mm256_andnot_si256(_mm256_cmpeq_epi32(depth, zero),
+            _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(cx, none), _mm256_cmpgt_epi32(limitX, cx)),
+                _mm256_and_si256(_mm256_cmpgt_epi32(cy, none), _mm256_cmpgt_epi32(limitY, cy))));
+        __m256i target = _mm256_add_epi32(_mm256_mullo_epi32(cy, stride), cx);
+        _mm256_storeu_si256((__m256i*)(pTargets + x), _mm256_blendv_epi8(none, target, valid));
+    }
+#endif
+    for (; x < count; ++x)
+    {
+        unsigned int depth = pDepth[x] >> 3;
+        unsigned int band = std::min(depth >> BandShift, BandCount - 1);
+        int cx = m_BaseX[lut + x] + m_BandX[band];
+        int cy = m_BaseY[lut + x] + m_BandY[band];
+        pTargets[x] = depth && cx >= 0 && cx <= maxX && cy >= 0 && cy <= maxY ? cy * colorStride + cx : -1;
+    }
+}
+
+bool DepthRegistration::Remap(Frame* pDepth, Frame* pRegistered)
+{
+    if (pDepth->GetFormat() != FRAME_FORMAT_D13P3 || pRegistered->GetFormat() != FRAME_FORMAT_D13P3 ||
+        !IsBuiltFor(pDepth->GetFullWidth(), pDepth->GetFullHeight(), pRegistered->GetWidth(), pRegistered->GetHeight()) ||
+        pRegistered->IsRegion())
+    {
+        return false;
+    }
+
+    unsigned short* pOut = (unsigned short*)pRegistered->GetBuffer();
+    int outStride = int(pRegistered->GetStride() / sizeof(unsigned short));
+    for (unsigned int y = 0; y < m_ColorHeight; ++y)
+    {
+        memset(pOut + y * outStride, 0, m_ColorWidth * sizeof(unsigned short));
+    }
+
+    for (unsigned int y = 0; y < pDepth->GetHeight(); ++y)
+    {
+        const unsigned short* pRow = (const unsigned short*)(pDepth->GetBuffer() + y * pDepth->GetStride());
+        unsigned int lut = (y + pDepth->GetOffsetY()) * m_DepthWidth + pDepth->GetOffsetX();
+        MapRow(pRow, pDepth->GetWidth(), lut, outStride, &m_Targets[0]);
+
+        for (unsigned int x = 0; x < pDepth->GetWidth(); ++x)
+        {
+            int target = m_Targets[x];
+            if (target < 0)
+            {
+                continue;
+            }
+            unsigned short value = pRow[x];
+            for (int sy = 0; sy < m_Splat; ++sy)
+            {
+                unsigned short* pSplat = pOut + target + sy * outStride;
+                for (int sx = 0; sx < m_Splat; ++sx)
+                {
+                    if (!pSplat[sx] || value < pSplat[sx])
+                    {
+                        pSplat[sx] = value;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
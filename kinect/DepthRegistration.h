@@ -0,0 +1,80 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="DepthRegistration.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FrameSource.h"
+#include <vector>
+
+// Pinhole models of the two cameras and the pose of the color camera relative
+// to the depth camera.
+struct RegistrationCalibration
+{
+    float           depthFocal;         // pixels, at the depth resolution
+    float           depthCenterX;
+    float           depthCenterY;
+    float           colorFocal;         // pixels, at the color resolution
+    float           colorCenterX;
+    float           colorCenterY;
+    RigidTransform  depthToColor;       // meters
+};
+
+// Nominal Kinect for Windows intrinsics for the given resolutions, with the
+// color camera 25 mm beside the depth camera.
+RegistrationCalibration NominalRegistrationCalibration(unsigned int depthWidth, unsigned int depthHeight,
+    unsigned int colorWidth, unsigned int colorHeight);
+
+// Maps D13P3 depth frames into the pixel grid of the color camera.
+//
+// Where a depth pixel lands in the color image is its position for a point
+// at infinity, plus a parallax shift along the camera baseline that only
+// depends on the depth. The first is a per pixel table, the second a table of
+// 16 mm depth bands, both built once per pair of resolutions. Remapping a
+// frame is then two table lookups and a bounds check per pixel, done eight at
+// a time with AVX2 gathers, followed by a z-buffered splat of each depth pixel
+// over the color pixels it covers. The splat stays scalar; AVX2 has no scatter.
+class DepthRegistration
+{
+public:
+    DepthRegistration();
+
+    // From a calibration.
+    bool Build(unsigned int depthWidth, unsigned int depthHeight, unsigned int colorWidth, unsigned int colorHeight,
+        const RegistrationCalibration& calibration);
+    // From a measured mapping: pBaseX/Y is the color position of every depth
+    // pixel for a point at infinity, and the parallax shift at depth z (mm)
+    // is parallaxX/Y / z color pixels.
+    bool Build(unsigned int depthWidth, unsigned int depthHeight, unsigned int colorWidth, unsigned int colorHeight,
+        const float* pBaseX, const float* pBaseY, float parallaxX, float parallaxY);
+
+    bool IsBuiltFor(unsigned int depthWidth, unsigned int depthHeight, unsigned int colorWidth, unsigned int colorHeight);
+
+    // Color pixel a depth pixel (full frame coordinates) with the given D13P3
+    // value lands on; false if it has no depth or falls outside the color image.
+    bool MapPixel(unsigned int x, unsigned int y, unsigned short depth, int* pColorX, int* pColorY);
+
+    // Fills pRegistered, a D13P3 frame of the color resolution, with the depth
+    // seen by every color pixel, 0 where no depth pixel lands. The depth frame
+    // may be a region. Where several depth pixels land, the nearest wins.
+    bool Remap(Frame* pDepth, Frame* pRegistered);
+
+private:
+    static const unsigned int BandShift = 4;            // 16 mm bands
+    static const unsigned int BandCount = 8192 >> BandShift;
+
+    unsigned int        m_DepthWidth;
+    unsigned int        m_DepthHeight;
+    unsigned int        m_ColorWidth;
+    unsigned int        m_ColorHeight;
+    int                 m_Splat;        // color pixels covered by a depth pixel, per axis
+    std::vector<int>    m_BaseX;        // per depth pixel, color pixels
+    std::vector<int>    m_BaseY;
+    int                 m_BandX[BandCount];
+    int                 m_BandY[BandCount];
+    std::vector<int>    m_Targets;      // scratch: color pixel index of each depth pixel of a row, -1 if none
+
+    void MapRow(const unsigned short* pDepth, unsigned int count, unsigned int lut, int colorStride, int* pTargets);
+};
@@ -0,0 +1,291 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="FramePool.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "FramePool.h"
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static const unsigned int FrameAlignment = 64;  // cache line, also enough for AVX loads
+
+// Held across the last release of a frame and while a pool detaches its frames,
+// so a frame never sees its pool go away between dropping to zero references
+// and being recycled, and a pool never frees a frame that is being returned.
+static std::mutex FrameDetachLock;
+
+static unsigned char* AlignedAlloc(size_t size)
+{
+#ifdef _WIN32
+    return (unsigned char*)_aligned_malloc(size, FrameAlignment);
+#else
+    void* p = NULL;
+    return posix_memalign(&p, FrameAlignment, size) == 0 ? (unsigned char*)p : NULL;
+#endif
+}
+
+static void AlignedFree(unsigned char* p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+unsigned int FrameFormatBytesPerPixel(FrameFormat format)
+{
+    switch (format)
+    {
+    case FRAME_FORMAT_B8G8R8X8: return 4;
+    case FRAME_FORMAT_D13P3:    return 2;
+    case FRAME_FORMAT_D16:      return 2;
+    case FRAME_FORMAT_P8:       return 1;
+    case FRAME_FORMAT_F32:      return 4;
+    case FRAME_FORMAT_L8:       return 1;
+    default:                    return 0;
+    }
+}
+
+Frame::Frame()
+{
+    m_pPool = NULL;
+    m_RefCount = 0;
+    m_pBuffer = NULL;
+    m_Width = 0;
+    m_Height = 0;
+    m_Stride = 0;
+    m_Format = FRAME_FORMAT_INVALID;
+    m_FullWidth = 0;
+    m_FullHeight = 0;
+    m_FullStride = 0;
+    m_Capacity = 0;
+    m_OffsetX = 0;
+    m_OffsetY = 0;
+    m_IsRegion = false;
+    m_Timestamp = 0;
+    m_FrameNumber = 0;
+}
+
+Frame::~Frame()
+{
+    AlignedFree(m_pBuffer);
+}
+
+bool Frame::SetRegion(unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+    if (!width || !height || x + width > m_FullWidth || y + height > m_FullHeight)
+    {
+        return false;
+    }
+    // Rows stay cache line aligned; a region is never larger than the full image
+    m_Width = width;
+    m_Height = height;
+    m_Stride = (width * FrameFormatBytesPerPixel(m_Format) + FrameAlignment - 1) & ~(FrameAlignment - 1);
+    m_OffsetX = x;
+    m_OffsetY = y;
+    m_IsRegion = true;
+    return true;
+}
+
+void Frame::Release()
+{
+    int count = m_RefCount.load(std::memory_order_relaxed);
+    while (count > 1)
+    {   // Not the last reference, nothing can happen to the pool
+        if (m_RefCount.compare_exchange_weak(count, count - 1, std::memory_order_acq_rel))
+        {
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> detachLock(FrameDetachLock);
+    if (m_RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        if (m_pPool)
+        {
+            m_pPool->Recycle(this);
+        }
+        else
+        {   // The pool went away while this frame was still out
+            delete this;
+        }
+    }
+}
+
+FramePool::FramePool()
+{
+    m_Width = 0;
+    m_Height = 0;
+    m_Stride = 0;
+    m_Format = FRAME_FORMAT_INVALID;
+    m_AllocatedCount = 0;
+}
+
+FramePool::~FramePool()
+{
+    Release();
+}
+
+void FramePool::Init(unsigned int width, unsigned int height, FrameFormat format, unsigned int count)
+{
+    Release(); // Deal with double initializations.
+
+    std::lock_guard<std::mutex> lock(m_Lock);
+    m_Width = width;
+    m_Height = height;
+    m_Format = format;
+    // Round rows up to whole cache lines so every row starts aligned
+    m_Stride = (width * FrameFormatBytesPerPixel(format) + FrameAlignment - 1) & ~(FrameAlignment - 1);
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        Frame* pFrame = Allocate();
+        if (pFrame)
+        {
+            m_Free.push_back(pFrame);
+        }
+    }
+}
+
+void FramePool::Release()
+{
+    std::lock_guard<std::mutex> detachLock(FrameDetachLock);
+    std::lock_guard<std::mutex> lock(m_Lock);
+    for (size_t i = 0; i < m_All.size(); ++i)
+    {
+        if (m_All[i]->m_RefCount.load(std::memory_order_relaxed) != 0)
+        {   // Still referenced somewhere, it deletes itself on its last release
+            m_All[i]->m_pPool = NULL;
+        }
+    }
+    // Only frames on the free list belong to the pool alone
+    for (size_t i = 0; i < m_Free.size(); ++i)
+    {
+        delete m_Free[i];
+    }
+    m_All.clear();
+    m_Free.clear();
+    m_AllocatedCount = 0;
+}
+
+void FramePool::Resize(unsigned int width, unsigned int height)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    m_Width = width;
+    m_Height = height;
+    m_Stride = (width * FrameFormatBytesPerPixel(m_Format) + FrameAlignment - 1) & ~(FrameAlignment - 1);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m_Free.size(); ++i)
+    {
+        if (Fit(m_Free[i]))
+        {
+            m_Free[kept++] = m_Free[i];
+        }
+    }
+    m_Free.resize(kept);
+}
+
+// Must be called with m_Lock held.
+Frame* FramePool::Allocate()
+{
+    unsigned char* pBuffer = AlignedAlloc(size_t(m_Stride) * m_Height);
+    if (!pBuffer)
+    {
+        return NULL;
+    }
+
+    Frame* pFrame = new Frame();
+    pFrame->m_pPool = this;
+    pFrame->m_pBuffer = pBuffer;
+    pFrame->m_Width = m_Width;
+    pFrame->m_Height = m_Height;
+    pFrame->m_Stride = m_Stride;
+    pFrame->m_Format = m_Format;
+    pFrame->m_FullWidth = m_Width;
+    pFrame->m_FullHeight = m_Height;
+    pFrame->m_FullStride = m_Stride;
+    pFrame->m_Capacity = size_t(m_Stride) * m_Height;
+    m_All.push_back(pFrame);
+    m_AllocatedCount++;
+    return pFrame;
+}
+
+FrameRef FramePool::Acquire()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    Frame* pFrame = NULL;
+    if (!m_Free.empty())
+    {   // Most recently recycled first, its buffer is the most likely to still be cached
+        pFrame = m_Free.back();
+        m_Free.pop_back();
+    }
+    else if (m_Stride)
+    {
+        pFrame = Allocate();
+    }
+    if (!pFrame)
+    {
+        return FrameRef();
+    }
+
+    pFrame->m_RefCount = 1;
+    pFrame->m_Width = pFrame->m_FullWidth;
+    pFrame->m_Height = pFrame->m_FullHeight;
+    pFrame->m_Stride = pFrame->m_FullStride;
+    pFrame->m_OffsetX = 0;
+    pFrame->m_OffsetY = 0;
+    pFrame->m_IsRegion = false;
+    pFrame->m_Timestamp = 0;
+    pFrame->m_FrameNumber = 0;
+    return FrameRef(pFrame);
+}
+
+unsigned int FramePool::GetFreeCount()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    return (unsigned int)m_Free.size();
+}
+
+// Gives a free frame the current size, or deletes it if its buffer is too
+// small. Must be called with m_Lock held.
+bool FramePool::Fit(Frame* pFrame)
+{
+    if (pFrame->m_FullWidth == m_Width && pFrame->m_FullHeight == m_Height)
+    {
+        return true;
+    }
+    if (pFrame->m_Capacity >= size_t(m_Stride) * m_Height)
+    {
+        pFrame->m_FullWidth = m_Width;
+        pFrame->m_FullHeight = m_Height;
+        pFrame->m_FullStride = m_Stride;
+        return true;
+    }
+
+    for (size_t i = 0; i < m_All.size(); ++i)
+    {
+        if (m_All[i] == pFrame)
+        {
+            m_All[i] = m_All.back();
+            m_All.pop_back();
+            break;
+        }
+    }
+    m_AllocatedCount--;
+    delete pFrame;
+    return false;
+}
+
+void FramePool::Recycle(Frame* pFrame)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    if (Fit(pFrame))
+    {
+        m_Free.push_back(pFrame);
+    }
+}
@@ -0,0 +1,141 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="FramePool.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+enum FrameFormat
+{
+    FRAME_FORMAT_INVALID = 0,
+    FRAME_FORMAT_B8G8R8X8,      // color, 4 bytes per pixel
+    FRAME_FORMAT_D13P3,         // depth in mm << 3 | player index
+    FRAME_FORMAT_D16,           // depth in mm
+    FRAME_FORMAT_P8,            // player index, 0 for none
+    FRAME_FORMAT_F32,           // one float per pixel
+    FRAME_FORMAT_L8,            // luma, 8 bits
+};
+
+unsigned int FrameFormatBytesPerPixel(FrameFormat format);
+
+class FramePool;
+
+// Image buffer handed out by a FramePool. Frames are reference counted through
+// FrameRef and go back to their pool when the last reference is dropped.
+//
+// A frame can also hold just a region of interest of the full image: width,
+// height and stride then describe the tightly packed region, which starts at
+// GetOffsetX/Y() of the GetFullWidth() x GetFullHeight() image.
+class Frame
+{
+public:
+    unsigned char*  GetBuffer()       { return(m_pBuffer); };
+    unsigned int    GetWidth()        { return(m_Width); };
+    unsigned int    GetHeight()       { return(m_Height); };
+    unsigned int    GetStride()       { return(m_Stride); };
+    unsigned int    GetBufferSize()   { return(m_Stride * m_Height); };
+    FrameFormat     GetFormat()       { return(m_Format); };
+
+    bool            IsRegion()        { return(m_IsRegion); };
+    unsigned int    GetOffsetX()      { return(m_OffsetX); };
+    unsigned int    GetOffsetY()      { return(m_OffsetY); };
+    unsigned int    GetFullWidth()    { return(m_FullWidth); };
+    unsigned int    GetFullHeight()   { return(m_FullHeight); };
+    // Turns the frame into a region of the full image, false if it does not fit.
+    // The frame is a full one again when it comes back out of its pool.
+    bool            SetRegion(unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
+    long long       GetTimestamp()    { return(m_Timestamp); };     // microseconds
+    unsigned int    GetFrameNumber()  { return(m_FrameNumber); };
+    void            SetTimestamp(long long timestamp, unsigned int frameNumber) { m_Timestamp = timestamp; m_FrameNumber = frameNumber; };
+
+    void AddRef()   { m_RefCount.fetch_add(1, std::memory_order_relaxed); };
+    void Release();
+
+private:
+    friend class FramePool;
+
+    Frame();
+    ~Frame();
+
+    FramePool*          m_pPool;
+    std::atomic<int>    m_RefCount;
+    unsigned char*      m_pBuffer;
+    unsigned int        m_Width;
+    unsigned int        m_Height;
+    unsigned int        m_Stride;
+    FrameFormat         m_Format;
+    unsigned int        m_FullWidth;
+    unsigned int        m_FullHeight;
+    unsigned int        m_FullStride;
+    size_t              m_Capacity;     // bytes allocated at m_pBuffer
+    unsigned int        m_OffsetX;
+    unsigned int        m_OffsetY;
+    bool                m_IsRegion;
+    long long           m_Timestamp;
+    unsigned int        m_FrameNumber;
+};
+
+// Owning handle to a pooled frame.
+class FrameRef
+{
+public:
+    FrameRef() : m_pFrame(NULL) {}
+    explicit FrameRef(Frame* pFrame) : m_pFrame(pFrame) {}  // adopts an existing reference
+    FrameRef(const FrameRef& other) : m_pFrame(other.m_pFrame) { if (m_pFrame) m_pFrame->AddRef(); }
+    FrameRef(FrameRef&& other) : m_pFrame(other.m_pFrame) { other.m_pFrame = NULL; }
+    ~FrameRef() { Reset(); }
+
+    FrameRef& operator=(FrameRef other) { Frame* p = m_pFrame; m_pFrame = other.m_pFrame; other.m_pFrame = p; return(*this); }
+
+    void    Reset()             { if (m_pFrame) { m_pFrame->Release(); m_pFrame = NULL; } }
+    Frame*  Get() const         { return(m_pFrame); };
+    Frame*  operator->() const  { return(m_pFrame); };
+    explicit operator bool() const { return(m_pFrame != NULL); };
+
+private:
+    Frame*  m_pFrame;
+};
+
+// Recycling allocator of equally sized, cache-line aligned frame buffers.
+class FramePool
+{
+public:
+    FramePool();
+    ~FramePool();
+
+    // Preallocates count frames; frames beyond that are allocated on demand.
+    void Init(unsigned int width, unsigned int height, FrameFormat format, unsigned int count);
+    void Release();
+    // Changes the size of the frames handed out from now on. Buffers that are
+    // large enough are kept for the new size, including those of frames still
+    // out, which are resized or freed when they come back.
+    void Resize(unsigned int width, unsigned int height);
+
+    FrameRef Acquire();
+
+    unsigned int GetAllocatedCount() { return(m_AllocatedCount); };
+    unsigned int GetFreeCount();
+
+private:
+    friend class Frame;
+
+    Frame* Allocate();
+    bool Fit(Frame* pFrame);
+    void Recycle(Frame* pFrame);
+
+    std::mutex              m_Lock;
+    std::vector<Frame*>     m_Free;
+    std::vector<Frame*>     m_All;
+    unsigned int            m_Width;
+    unsigned int            m_Height;
+    unsigned int            m_Stride;
+    FrameFormat             m_Format;
+    unsigned int            m_AllocatedCount;
+};
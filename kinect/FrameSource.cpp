@@ -0,0 +1,427 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="FrameSource.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "FrameSource.h"
+#include "DepthPlanes.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+RigidTransform IdentityTransform()
+{
+    RigidTransform transform = { { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } }, { 0, 0, 0 } };
+    return transform;
+}
+
+Point3 TransformPoint(const RigidTransform& transform, const Point3& p)
+{
+    const float (*r)[3] = transform.rotation;
+    Point3 q;
+    q.x = r[0][0] * p.x + r[0][1] * p.y + r[0][2] * p.z + transform.translation[0];
+    q.y = r[1][0] * p.x + r[1][1] * p.y + r[1][2] * p.z + transform.translation[1];
+    q.z = r[2][0] * p.x + r[2][1] * p.y + r[2][2] * p.z + transform.translation[2];
+    return q;
+}
+
+// The NUI runtime streams color at 640x480 or 1280x960 and depth at 80x60,
+// 320x240 or 640x480; the face tracker takes any of these.
+static const SensorProfile SensorProfiles[SENSOR_PROFILE_COUNT] =
+{
+    { "low-latency",    640,  480,  80, 60 },
+    { "default",        640,  480, 320, 240 },
+    { "high-accuracy", 1280,  960, 640, 480 },
+};
+
+const SensorProfile& GetSensorProfile(SensorProfileId profile)
+{
+    return SensorProfiles[profile < SENSOR_PROFILE_COUNT ? profile : SENSOR_PROFILE_DEFAULT];
+}
+
+bool FindSensorProfile(const char* name, SensorProfileId* pProfile)
+{
+    for (int i = 0; i < SENSOR_PROFILE_COUNT; ++i)
+    {
+        if (strcmp(name, SensorProfiles[i].name) == 0)
+        {
+            *pProfile = (SensorProfileId)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SelectClosestSkeleton(const SkeletonFrame& frame, Point3 hint[2])
+{
+    int selectedSkeleton = -1;
+    float smallestDistance = 0;
+
+    if (hint[1].x == 0 && hint[1].y == 0 && hint[1].z == 0)
+    {
+        // Get the skeleton closest to the camera
+        for (int i = 0 ; i < SKELETON_COUNT ; i++ )
+        {
+            const Point3& head = frame.joints[i][SKELETON_JOINT_HEAD];
+            if (frame.tracked[i] && (smallestDistance == 0 || head.z < smallestDistance))
+            {
+                smallestDistance = head.z;
+                selectedSkeleton = i;
+            }
+        }
+    }
+    else
+    {   // Get the skeleton closest to the previous position
+        for (int i = 0 ; i < SKELETON_COUNT ; i++ )
+        {
+            if (frame.tracked[i])
+            {
+                const Point3& head = frame.joints[i][SKELETON_JOINT_HEAD];
+                float d = fabs(head.x - hint[1].x) +
+                    fabs(head.y - hint[1].y) +
+                    fabs(head.z - hint[1].z);
+                if (smallestDistance == 0 || d < smallestDistance)
+                {
+                    smallestDistance = d;
+                    selectedSkeleton = i;
+                }
+            }
+        }
+    }
+    if (selectedSkeleton == -1)
+    {
+        return false;
+    }
+
+    hint[0] = frame.joints[selectedSkeleton][SKELETON_JOINT_SHOULDER_CENTER];
+    hint[1] = frame.joints[selectedSkeleton][SKELETON_JOINT_HEAD];
+
+    return true;
+}
+
+long long FrameClockMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FrameSourceBase::FrameSourceBase()
+{
+    m_Profile = SENSOR_PROFILE_DEFAULT;
+    m_Extrinsics = IdentityTransform();
+    m_SmoothSkeletons = true;
+    m_DepthPlanes = true;
+    m_PyramidLevels = 0;
+    m_UndistortVideo = false;
+    m_UndistortDepth = false;
+    m_FilterDepth = false;
+    m_ZoomFactor = 1.0f;
+    m_ViewOffsetX = 0;
+    m_ViewOffsetY = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        memset(&m_SkeletonExchange.Slot(i), 0, sizeof(SkeletonFrame));
+    }
+    m_RoiStreams = FRAME_ROI_NONE;
+    m_FaceTracked = false;
+    memset(m_RoiHint, 0, sizeof(m_RoiHint));
+    m_RoiHintTime = 0;
+    memset(&m_RoiStats, 0, sizeof(m_RoiStats));
+}
+
+void FrameSourceBase::InitExchange(unsigned int videoWidth, unsigned int videoHeight, unsigned int depthWidth, unsigned int depthHeight)
+{
+    // One buffer being written, one ready and one being read per stream, plus
+    // a spare for each consumer that holds on to a frame.
+    m_VideoPool.Init(videoWidth, videoHeight, FRAME_FORMAT_B8G8R8X8, 4);
+    m_DepthPool.Init(depthWidth, depthHeight, FRAME_FORMAT_D13P3, 4);
+    m_DepthMmPool.Init(depthWidth, depthHeight, FRAME_FORMAT_D16, 4);
+    m_PlayerPool.Init(depthWidth, depthHeight, FRAME_FORMAT_P8, 4);
+    m_VideoExchange.Reset();
+    m_DepthExchange.Reset();
+    m_SkeletonExchange.Reset();
+    m_SkeletonHistory.Reset();
+    m_Smoother.Reset();
+    {
+        std::lock_guard<std::mutex> lock(m_DepthFilterLock);
+        m_DepthFilter.Reset();
+    }
+    m_Sync.Reset();
+    memset(m_RoiHint, 0, sizeof(m_RoiHint));
+    m_RoiHintTime = 0;
+    memset(&m_RoiStats, 0, sizeof(m_RoiStats));
+}
+
+void FrameSourceBase::ResizeExchange(unsigned int videoWidth, unsigned int videoHeight, unsigned int depthWidth, unsigned int depthHeight)
+{
+    // The exchanges and the synchronizer keep their frames: the reader may be
+    // using them right now, and old frames age out of the synchronizer anyway.
+    m_VideoPool.Resize(videoWidth, videoHeight);
+    m_DepthPool.Resize(depthWidth, depthHeight);
+    m_DepthMmPool.Resize(depthWidth, depthHeight);
+    m_PlayerPool.Resize(depthWidth, depthHeight);
+    std::lock_guard<std::mutex> lock(m_RoiLock);
+    m_RoiHintTime = 0;
+}
+
+void FrameSourceBase::RestartTimeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_SmoothingLock);
+        m_Smoother.Reset();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_DepthFilterLock);
+        m_DepthFilter.Reset();
+    }
+    m_Sync.Restart();
+}
+
+void FrameSourceBase::ReleaseExchange()
+{
+    m_Recorder.Stop();
+    for (int i = 0; i < 3; ++i)
+    {
+        m_VideoExchange.Slot(i).Reset();
+        m_DepthExchange.Slot(i).Reset();
+    }
+    m_Sync.Reset();
+    m_VideoPool.Release();
+    m_DepthPool.Release();
+    m_DepthMmPool.Release();
+    m_PlayerPool.Release();
+}
+
+FrameRef& FrameSourceBase::BeginVideoFrame()
+{
+    FrameRef& slot = m_VideoExchange.WriteSlot();
+    // Drop the old frame first so the pool can hand the same, still cached, buffer back.
+    slot.Reset();
+    slot = m_VideoPool.Acquire();
+    return slot;
+}
+
+FrameRef& FrameSourceBase::BeginDepthFrame()
+{
+    FrameRef& slot = m_DepthExchange.WriteSlot();
+    slot.Reset();
+    slot = m_DepthPool.Acquire();
+    return slot;
+}
+
+void FrameSourceBase::PublishVideoFrame()
+{
+    FrameRef& slot = m_VideoExchange.WriteSlot();
+    m_Recorder.RecordVideo(slot);
+
+    // Recordings keep the raw frame, like depth below
+    {
+        std::lock_guard<std::mutex> lock(m_VideoUndistortLock);
+        FrameRef undistorted;
+        if (m_UndistortVideo && slot && m_VideoUndistorter.Apply(slot.Get(), undistorted))
+        {
+            slot = undistorted;
+        }
+    }
+
+    // Built while the frame is still in the cache from being filled
+    GrayPyramid pyramid;
+    unsigned int levels = m_PyramidLevels.load();
+    if (levels && slot)
+    {
+        if (levels != m_PyramidBuilder.GetLevels())
+        {
+            m_PyramidBuilder.SetLevels(levels);
+        }
+        m_PyramidBuilder.Build(slot.Get(), pyramid);
+    }
+    m_Sync.PushVideo(slot, pyramid);
+    m_VideoExchange.Publish();
+}
+
+void FrameSourceBase::PublishDepthFrame()
+{
+    FrameRef& slot = m_DepthExchange.WriteSlot();
+    m_Recorder.RecordDepth(slot);
+
+    // Recordings keep the raw frame; everyone else gets the filtered one
+    {
+        std::lock_guard<std::mutex> lock(m_DepthFilterLock);
+        FrameRef filtered;
+        if (m_FilterDepth && slot && m_DepthFilter.Apply(slot.Get(), filtered))
+        {
+            slot = filtered;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_DepthUndistortLock);
+        FrameRef undistorted;
+        if (m_UndistortDepth && slot && m_DepthUndistorter.Apply(slot.Get(), undistorted))
+        {
+            slot = undistorted;
+        }
+    }
+
+    // Split on the producer thread, so every reader of the set finds the planes ready
+    FrameRef depthMm, players;
+    if (m_DepthPlanes.load() && slot)
+    {
+        depthMm = m_DepthMmPool.Acquire();
+        players = m_PlayerPool.Acquire();
+        if (!depthMm || !players || !UnpackDepthFrame(slot.Get(), depthMm.Get(), players.Get()))
+        {
+            depthMm.Reset();
+            players.Reset();
+        }
+    }
+    m_Sync.PushDepth(slot, depthMm, players);
+    m_DepthExchange.Publish();
+}
+
+void FrameSourceBase::SetSkeletonSmoothing(const SkeletonSmoothingParams* pParams)
+{
+    std::lock_guard<std::mutex> lock(m_SmoothingLock);
+    m_SmoothSkeletons = pParams != NULL;
+    if (pParams)
+    {
+        m_Smoother.SetParameters(*pParams);
+    }
+    m_Smoother.Reset();
+}
+
+void FrameSourceBase::SetDepthFilter(const DepthFilterParams* pParams)
+{
+    std::lock_guard<std::mutex> lock(m_DepthFilterLock);
+    m_FilterDepth = pParams != NULL;
+    if (pParams)
+    {
+        m_DepthFilter.SetParameters(*pParams);
+        // The acquiring thread takes bands too
+        m_DepthFilterThreads.Start(pParams->threads > 1 ? pParams->threads - 1 : 0);
+        m_DepthFilter.SetThreadPool(&m_DepthFilterThreads);
+    }
+    else
+    {
+        m_DepthFilterThreads.Stop();
+    }
+}
+
+void FrameSourceBase::SetUndistortion(const LensCalibration* pVideo, const LensCalibration* pDepth)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_VideoUndistortLock);
+        m_UndistortVideo = pVideo != NULL;
+        if (pVideo)
+        {
+            m_VideoUndistorter.SetCalibration(*pVideo);
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_DepthUndistortLock);
+    m_UndistortDepth = pDepth != NULL;
+    if (pDepth)
+    {
+        m_DepthUndistorter.SetCalibration(*pDepth);
+    }
+}
+
+DepthFilterStats FrameSourceBase::GetDepthFilterStats()
+{
+    std::lock_guard<std::mutex> lock(m_DepthFilterLock);
+    return m_DepthFilter.GetStats();
+}
+
+void FrameSourceBase::PublishSkeletonFrame()
+{
+    // Recordings keep the raw joints; everyone else gets them smoothed
+    SkeletonFrame& frame = m_SkeletonExchange.WriteSlot();
+    m_Recorder.RecordSkeleton(frame);
+    SkeletonFrameToSoA(frame, m_SkeletonSoA);
+    {
+        std::lock_guard<std::mutex> lock(m_SmoothingLock);
+        if (m_SmoothSkeletons)
+        {
+            m_Smoother.Apply(m_SkeletonSoA);
+            SkeletonSoAToFrame(m_SkeletonSoA, frame);
+        }
+    }
+
+    if (m_RoiStreams.load())
+    {
+        std::lock_guard<std::mutex> lock(m_RoiLock);
+        if (SelectClosestSkeleton(frame, m_RoiHint))
+        {
+            m_RoiHintTime = FrameClockMicroseconds();
+        }
+    }
+    m_SkeletonHistory.Push(m_SkeletonSoA);
+    m_Sync.PushSkeleton(frame);
+    m_SkeletonExchange.Publish();
+}
+
+// Head plus the distance it can move between two frames, and the offset
+// between the depth and color cameras.
+static const float RoiHalfExtent = 0.3f;            // meters
+static const long long RoiHintMaxAge = 200000;      // microseconds, about 6 skeleton frames
+static const int RoiAlignment = 16;                 // pixels, whole cache lines of color
+static const float RoiMinDepth = 0.1f;              // meters, nearer heads project to nonsense
+
+void FrameSourceBase::ApplyAcquisitionRegion(FrameRef& slot, FrameRoiStream stream)
+{
+    if (!slot || !(m_RoiStreams.load() & stream))
+    {
+        return;
+    }
+
+    int fullWidth = slot->GetFullWidth();
+    int fullHeight = slot->GetFullHeight();
+    long long fullBytes = (long long)fullWidth * fullHeight * FrameFormatBytesPerPixel(slot->GetFormat());
+
+    std::lock_guard<std::mutex> lock(m_RoiLock);
+    const Point3& head = m_RoiHint[1];
+    bool useRegion = m_FaceTracked.load() && m_RoiHintTime && head.z >= RoiMinDepth &&
+        FrameClockMicroseconds() - m_RoiHintTime <= RoiHintMaxAge;
+    if (useRegion)
+    {
+        // Project the head with the nominal intrinsics of the stream
+        float focal = stream == FRAME_ROI_VIDEO ?
+            NOMINAL_COLOR_FOCAL_LENGTH * fullWidth / 640.0f : NOMINAL_DEPTH_FOCAL_LENGTH * fullWidth / 320.0f;
+        float u = fullWidth * 0.5f + focal * head.x / head.z;
+        float v = fullHeight * 0.5f - focal * head.y / head.z;
+        float half = focal * RoiHalfExtent / head.z;
+
+        // Clamped to the frame before converting, so far off heads cannot overflow int
+        float left = std::max(0.0f, u - half);
+        float right = std::min(float(fullWidth), u + half);
+        float top = std::max(0.0f, v - half);
+        float bottom = std::min(float(fullHeight), v + half);
+        useRegion = left < right && top < bottom;
+        if (useRegion)
+        {
+            int x0 = int(left) / RoiAlignment * RoiAlignment;
+            int x1 = std::min(fullWidth, (int(right) + RoiAlignment) / RoiAlignment * RoiAlignment);
+            int y0 = int(top);
+            int y1 = std::min(fullHeight, int(bottom) + 1);
+            useRegion = slot->SetRegion(x0, y0, x1 - x0, y1 - y0);
+        }
+    }
+
+    long long copied = (long long)slot->GetWidth() * slot->GetHeight() * FrameFormatBytesPerPixel(slot->GetFormat());
+    if (useRegion)
+    {
+        m_RoiStats.regionFrames++;
+    }
+    else
+    {   // Not tracked or no recent head: whole frames until we find the face again
+        m_RoiStats.fullFrames++;
+    }
+    m_RoiStats.bytesCopied += copied;
+    m_RoiStats.bytesSaved += fullBytes - copied;
+}
+
+FrameRoiStats FrameSourceBase::GetRoiStats()
+{
+    std::lock_guard<std::mutex> lock(m_RoiLock);
+    return m_RoiStats;
+}
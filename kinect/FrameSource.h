@@ -0,0 +1,273 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="FrameSource.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "DepthFilter.h"
+#include "FramePool.h"
+#include "FrameSynchronizer.h"
+#include "GrayPyramid.h"
+#include "LensUndistortion.h"
+#include "SessionRecorder.h"
+#include "SkeletonFrame.h"
+#include "SkeletonHistory.h"
+#include "SkeletonSmoother.h"
+#include "TripleBuffer.h"
+#include <atomic>
+#include <mutex>
+
+// NUI_CAMERA_DEPTH/COLOR_NOMINAL_FOCAL_LENGTH_IN_PIXELS, for 320x240 depth and
+// 640x480 color. Scale linearly with the image width for other resolutions.
+const float NOMINAL_DEPTH_FOCAL_LENGTH = 285.63f;
+const float NOMINAL_COLOR_FOCAL_LENGTH = 531.15f;
+
+// Rotation and translation from a sensor's camera space to the space shared by
+// all sensors of a rig, e.g. the display's. Meters.
+struct RigidTransform
+{
+    float   rotation[3][3];     // row major, p' = R p + t
+    float   translation[3];
+};
+
+RigidTransform IdentityTransform();
+Point3 TransformPoint(const RigidTransform& transform, const Point3& p);
+
+// Resolution profiles a source can be switched between while it runs.
+enum SensorProfileId
+{
+    SENSOR_PROFILE_LOW_LATENCY = 0,     // 80x60 depth, least to copy and to search
+    SENSOR_PROFILE_DEFAULT,             // 640x480 color, 320x240 depth
+    SENSOR_PROFILE_HIGH_ACCURACY,       // 1280x960 color at 12 fps, 640x480 depth
+    SENSOR_PROFILE_COUNT,
+};
+
+struct SensorProfile
+{
+    const char*     name;
+    unsigned int    videoWidth;
+    unsigned int    videoHeight;
+    unsigned int    depthWidth;
+    unsigned int    depthHeight;
+};
+
+const SensorProfile& GetSensorProfile(SensorProfileId profile);
+// Looks a profile up by name ("low-latency", "default", "high-accuracy").
+bool FindSensorProfile(const char* name, SensorProfileId* pProfile);
+
+// Picks the skeleton to use as face tracking hint: the one closest to the
+// previous head position in hint[1], or the one closest to the camera if there
+// is none. Fills hint[0] with its neck and hint[1] with its head.
+bool SelectClosestSkeleton(const SkeletonFrame& frame, Point3 hint[2]);
+
+// Monotonic clock used for frame timestamps when the source has none.
+long long FrameClockMicroseconds();
+
+// Streams SetRoiAcquisition() applies to.
+enum FrameRoiStream
+{
+    FRAME_ROI_NONE  = 0,
+    FRAME_ROI_VIDEO = 1,
+    FRAME_ROI_DEPTH = 2,
+};
+
+struct FrameRoiStats
+{
+    unsigned int    regionFrames;   // acquired as a region around the head
+    unsigned int    fullFrames;     // acquired whole while ROI acquisition was on
+    long long       bytesCopied;
+    long long       bytesSaved;     // compared to acquiring every frame whole
+};
+
+// Anything that produces color, depth and skeleton frames. Readers follow the
+// KinectSensor pattern: Acquire*() switches to the newest complete frame
+// (false if there is none since the last call), Get*() returns it.
+class IFrameSource
+{
+public:
+    virtual ~IFrameSource() {}
+
+    virtual void        Init() = 0;
+    virtual void        Release() = 0;
+
+    virtual bool        AcquireVideoBuffer() = 0;
+    virtual bool        AcquireDepthBuffer() = 0;
+    virtual bool        AcquireSkeletonFrame() = 0;
+    virtual FrameRef    GetVideoFrame() = 0;
+    virtual FrameRef    GetDepthFrame() = 0;
+    virtual const SkeletonFrame& GetSkeletonFrame() = 0;
+    // Every skeleton frame of the last second, readable from any thread.
+    virtual SkeletonHistory& GetSkeletonHistory() = 0;
+    // Skeleton joints are smoothed before anyone but the recorder sees them,
+    // with DefaultSkeletonSmoothing() unless set otherwise; NULL turns it off.
+    virtual void        SetSkeletonSmoothing(const SkeletonSmoothingParams* pParams) = 0;
+    // Newest color frame with the depth and skeleton frames captured with it,
+    // false if there is no new complete set. Independent of Acquire*() above.
+    virtual bool        AcquireFrameSet(FrameSet& set) = 0;
+    // Sleeps until the source delivers another color or depth frame, at most
+    // milliseconds, so a tracking thread need not poll AcquireFrameSet().
+    virtual bool        WaitFrameSet(unsigned int milliseconds) = 0;
+    // Depth frames are split into a millimetre and a player index plane as they
+    // are acquired, see FrameSet::depthMm and players. On unless turned off.
+    virtual void        SetDepthPlanes(bool enable) = 0;
+    // Depth frames are denoised and their holes filled as they are acquired,
+    // see DepthFilter; NULL, the default, turns it off. Recordings keep the raw
+    // frames.
+    virtual void        SetDepthFilter(const DepthFilterParams* pParams) = 0;
+    virtual DepthFilterStats GetDepthFilterStats() = 0;
+    // Color frames get a GrayPyramid of this many levels as they are acquired,
+    // see FrameSet::pyramid; 0, the default, turns it off.
+    virtual void        SetGrayPyramid(unsigned int levels) = 0;
+    // Color and depth frames are undistorted as they are acquired, see
+    // LensUndistorter; NULL, the default, leaves a stream as it is. Regions
+    // from ROI acquisition are undistorted only inside the region. Recordings
+    // keep the raw frames.
+    virtual void        SetUndistortion(const LensCalibration* pVideo, const LensCalibration* pDepth) = 0;
+
+    virtual float       GetZoomFactor() = 0;
+    virtual void        GetViewOffset(int* pX, int* pY) = 0;
+
+    // Record mode: every frame the source produces also goes to a session file.
+    virtual bool        StartRecording(const char* path) = 0;
+    virtual void        StopRecording() = 0;
+
+    // ROI acquisition: while the face is tracked, the given streams (FrameRoiStream
+    // flags) only acquire a padded region around the skeleton head, see
+    // Frame::IsRegion(). Whole frames again as soon as tracking is lost.
+    virtual void        SetRoiAcquisition(unsigned int streams) = 0;
+    virtual void        SetFaceTracked(bool tracked) = 0;
+    virtual FrameRoiStats GetRoiStats() = 0;
+
+    // Resolution of the color and depth streams. Before Init() this only picks
+    // the profile to start with; on a running source the streams are reopened at
+    // the new resolution and frames of the new size follow. False if the source
+    // cannot produce that resolution.
+    virtual bool        SetProfile(SensorProfileId profile) = 0;
+    virtual SensorProfileId GetProfile() = 0;
+
+    // Pose of the sensor in a multi-sensor rig, identity unless set. Set it
+    // before the source is shared with other threads.
+    virtual void        SetExtrinsics(const RigidTransform& extrinsics) = 0;
+    virtual const RigidTransform& GetExtrinsics() = 0;
+};
+
+// Frame exchange shared by all sources: pooled color/depth frames and skeleton
+// frames, each passed from the producing thread to the reader through a triple
+// buffer, and matched into FrameSets by a FrameSynchronizer.
+class FrameSourceBase : public IFrameSource
+{
+public:
+    FrameSourceBase();
+
+    bool        AcquireVideoBuffer()    { return(m_VideoExchange.Acquire()); };
+    bool        AcquireDepthBuffer()    { return(m_DepthExchange.Acquire()); };
+    bool        AcquireSkeletonFrame()  { return(m_SkeletonExchange.Acquire()); };
+    FrameRef    GetVideoFrame()         { return(m_VideoExchange.ReadSlot()); };
+    FrameRef    GetDepthFrame()         { return(m_DepthExchange.ReadSlot()); };
+    const SkeletonFrame& GetSkeletonFrame() { return(m_SkeletonExchange.ReadSlot()); };
+    SkeletonHistory& GetSkeletonHistory() { return(m_SkeletonHistory); };
+    void        SetSkeletonSmoothing(const SkeletonSmoothingParams* pParams);
+    bool        AcquireFrameSet(FrameSet& set) { return(m_Sync.Acquire(set)); };
+    bool        WaitFrameSet(unsigned int milliseconds) { return(m_Sync.Wait(milliseconds)); };
+    void        SetDepthPlanes(bool enable) { m_DepthPlanes = enable; };
+    void        SetDepthFilter(const DepthFilterParams* pParams);
+    DepthFilterStats GetDepthFilterStats();
+    void        SetGrayPyramid(unsigned int levels) { m_PyramidLevels = levels; };
+    void        SetUndistortion(const LensCalibration* pVideo, const LensCalibration* pDepth);
+
+    float       GetZoomFactor()         { return(m_ZoomFactor); };
+    void        GetViewOffset(int* pX, int* pY) { *pX = m_ViewOffsetX; *pY = m_ViewOffsetY; };
+
+    unsigned int GetVideoFramesOverwritten() { return(m_VideoExchange.OverwrittenCount()); };
+    unsigned int GetDepthFramesOverwritten() { return(m_DepthExchange.OverwrittenCount()); };
+    // Neither the triple buffer reader nor the FrameSet reader took the newest color frame yet
+    bool        IsVideoFramePending()   { return(m_VideoExchange.HasUnread() && m_Sync.HasPendingVideo()); };
+    // Sleeps until IsVideoFramePending() is false, at most milliseconds. Only
+    // the FrameSet reader wakes it up early; false on time out.
+    bool        WaitVideoFrameTaken(unsigned int milliseconds) { m_Sync.WaitVideoTaken(milliseconds); return(!IsVideoFramePending()); };
+
+    void        SetSyncTolerance(long long microseconds) { m_Sync.SetTolerance(microseconds); };
+    FrameSyncStats GetSyncStats()       { return(m_Sync.GetStats()); };
+
+    bool        StartRecording(const char* path) { return(m_Recorder.Start(path)); };
+    void        StopRecording()         { m_Recorder.Stop(); };
+    SessionRecorderStats GetRecordingStats() { return(m_Recorder.GetStats()); };
+
+    void        SetRoiAcquisition(unsigned int streams) { m_RoiStreams = streams; };
+    void        SetFaceTracked(bool tracked) { m_FaceTracked = tracked; };
+    FrameRoiStats GetRoiStats();
+
+    SensorProfileId GetProfile()        { return(m_Profile); };
+
+    void        SetExtrinsics(const RigidTransform& extrinsics) { m_Extrinsics = extrinsics; };
+    const RigidTransform& GetExtrinsics() { return(m_Extrinsics); };
+
+protected:
+    void        InitExchange(unsigned int videoWidth, unsigned int videoHeight, unsigned int depthWidth, unsigned int depthHeight);
+    void        ReleaseExchange();
+    // Changes the frame size of a running exchange, with the producers stopped.
+    // Frames of the old size still held by readers stay valid; their buffers are
+    // reused for the new size as they come back, if they are large enough.
+    void        ResizeExchange(unsigned int videoWidth, unsigned int videoHeight, unsigned int depthWidth, unsigned int depthHeight);
+    // Producer thread, when its clock went backwards (a replay looped or
+    // seeked back): frames are matched and filtered as if the source had just
+    // started, the next color frame makes a set however old it is.
+    void        RestartTimeline();
+
+    // Producer side: Begin*() returns an empty pooled frame in the write slot,
+    // Publish*() hands it to the reader.
+    FrameRef&   BeginVideoFrame();
+    FrameRef&   BeginDepthFrame();
+    SkeletonFrame& BeginSkeletonFrame() { return(m_SkeletonExchange.WriteSlot()); };
+    void        PublishVideoFrame();
+    void        PublishDepthFrame();
+    void        PublishSkeletonFrame();
+    // Sources that can acquire part of a frame call this on the frame from
+    // Begin*Frame(). It makes it a region around the head if ROI acquisition
+    // applies; the source then fills only the region.
+    void        ApplyAcquisitionRegion(FrameRef& slot, FrameRoiStream stream);
+
+    SensorProfileId m_Profile;
+    RigidTransform m_Extrinsics;
+    float       m_ZoomFactor;   // video frame zoom factor (it is 1.0f if there is no zoom)
+    int         m_ViewOffsetX;  // Offset of the view from the top left corner.
+    int         m_ViewOffsetY;
+
+private:
+    FramePool   m_VideoPool;
+    FramePool   m_DepthPool;
+    FramePool   m_DepthMmPool;
+    FramePool   m_PlayerPool;
+    std::atomic<bool>           m_DepthPlanes;
+    std::mutex                  m_DepthFilterLock;
+    DepthFilter                 m_DepthFilter;
+    ThreadPool                  m_DepthFilterThreads;
+    bool                        m_FilterDepth;
+    std::atomic<unsigned int>   m_PyramidLevels;
+    std::mutex                  m_VideoUndistortLock;   // one per stream, so neither waits for the other
+    std::mutex                  m_DepthUndistortLock;
+    LensUndistorter             m_VideoUndistorter;
+    LensUndistorter             m_DepthUndistorter;
+    bool                        m_UndistortVideo;
+    bool                        m_UndistortDepth;
+    GrayPyramidBuilder          m_PyramidBuilder;   // color stream's
+    TripleBuffer<FrameRef>      m_VideoExchange;
+    TripleBuffer<FrameRef>      m_DepthExchange;
+    TripleBuffer<SkeletonFrame> m_SkeletonExchange;
+    SkeletonHistory             m_SkeletonHistory;
+    SkeletonSoA                 m_SkeletonSoA;      // skeleton stream's conversion buffer
+    std::mutex                  m_SmoothingLock;
+    SkeletonSmoother            m_Smoother;
+    bool                        m_SmoothSkeletons;
+    FrameSynchronizer           m_Sync;
+    SessionRecorder             m_Recorder;
+
+    std::atomic<unsigned int>   m_RoiStreams;
+    std::atomic<bool>           m_FaceTracked;
+    std::mutex                  m_RoiLock;
+    Point3                      m_RoiHint[2];       // neck and head of the skeleton followed
+    long long                   m_RoiHintTime;      // when the hint was last updated, 0 if never
+    FrameRoiStats               m_RoiStats;
+};
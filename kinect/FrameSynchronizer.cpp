@@ -0,0 +1,228 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="FrameSynchronizer.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "FrameSynchronizer.h"
+#include "FrameSource.h"
+#include <chrono>
+#include <cstring>
+
+static inline long long Distance(long long a, long long b)
+{
+    return a > b ? a - b : b - a;
+}
+
+FrameSynchronizer::FrameSynchronizer()
+{
+    m_Tolerance = FRAME_SYNC_DEFAULT_TOLERANCE;
+    Reset();
+}
+
+void FrameSynchronizer::Reset()
+{
+    Restart();
+    std::lock_guard<std::mutex> lock(m_Lock);
+    memset(&m_Stats, 0, sizeof(m_Stats));
+    m_SkewSum = 0;
+    m_WaitSum = 0;
+}
+
+void FrameSynchronizer::Restart()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    for (unsigned int i = 0; i < RingSize; ++i)
+    {
+        m_Video[i].frame.Reset();
+        m_Video[i].pyramid = GrayPyramid();
+        m_Video[i].used = false;
+        m_Depth[i].frame.Reset();
+        m_Depth[i].depthMm.Reset();
+        m_Depth[i].players.Reset();
+    }
+    m_VideoCount = 0;
+    m_DepthCount = 0;
+    m_SkeletonCount = 0;
+    m_LastTimestamp = 0;
+    m_HasLast = false;
+    m_Taken.notify_all();   // nothing is pending any more
+}
+
+void FrameSynchronizer::PushVideo(const FrameRef& frame, const GrayPyramid& pyramid)
+{
+    if (!frame)
+    {
+        return;
+    }
+    long long now = FrameClockMicroseconds();
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        VideoEntry& entry = m_Video[m_VideoCount % RingSize];
+        if (entry.frame && !entry.used)
+        {
+            m_Stats.videoDropped++;
+        }
+        entry.frame = frame;
+        entry.pyramid = pyramid;
+        entry.arrival = now;
+        entry.used = false;
+        m_VideoCount++;
+    }
+    m_Pushed.notify_all();
+}
+
+void FrameSynchronizer::PushDepth(const FrameRef& frame, const FrameRef& depthMm, const FrameRef& players)
+{
+    if (!frame)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        DepthEntry& entry = m_Depth[m_DepthCount % RingSize];
+        entry.frame = frame;
+        entry.depthMm = depthMm;
+        entry.players = players;
+        m_DepthCount++;
+    }
+    m_Pushed.notify_all();
+}
+
+void FrameSynchronizer::PushSkeleton(const SkeletonFrame& frame)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    m_Skeleton[m_SkeletonCount % RingSize] = frame;
+    m_SkeletonCount++;
+}
+
+// Must be called with m_Lock held. Closest depth frame to timestamp, NULL if there is none.
+FrameSynchronizer::DepthEntry* FrameSynchronizer::FindDepth(long long timestamp)
+{
+    unsigned int depthFrames = m_DepthCount < RingSize ? m_DepthCount : RingSize;
+    DepthEntry* pBest = NULL;
+    for (unsigned int j = 1; j <= depthFrames; ++j)
+    {
+        DepthEntry& depth = m_Depth[(m_DepthCount - j) % RingSize];
+        if (!pBest || Distance(depth.frame->GetTimestamp(), timestamp) < Distance(pBest->frame->GetTimestamp(), timestamp))
+        {
+            pBest = &depth;
+        }
+    }
+    return pBest;
+}
+
+bool FrameSynchronizer::HasPendingVideo()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    return IsVideoPending();
+}
+
+// Must be called with m_Lock held.
+bool FrameSynchronizer::IsVideoPending()
+{
+    if (!m_VideoCount)
+    {
+        return false;
+    }
+    long long timestamp = m_Video[(m_VideoCount - 1) % RingSize].frame->GetTimestamp();
+    if (m_HasLast && timestamp <= m_LastTimestamp)
+    {
+        return false;
+    }
+
+    // Not pending if depth already moved past it without a match: it never will be
+    DepthEntry* pDepth = FindDepth(timestamp);
+    FrameRef& newest = m_Depth[(m_DepthCount - 1) % RingSize].frame;
+    return !pDepth || Distance(pDepth->frame->GetTimestamp(), timestamp) <= m_Tolerance ||
+        newest->GetTimestamp() < timestamp + m_Tolerance;
+}
+
+bool FrameSynchronizer::Wait(unsigned int milliseconds)
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    unsigned int pushed = m_VideoCount + m_DepthCount;
+    return m_Pushed.wait_for(lock, std::chrono::milliseconds(milliseconds),
+        [&] { return m_VideoCount + m_DepthCount != pushed; });
+}
+
+bool FrameSynchronizer::WaitVideoTaken(unsigned int milliseconds)
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    return m_Taken.wait_for(lock, std::chrono::milliseconds(milliseconds), [this] { return !IsVideoPending(); });
+}
+
+bool FrameSynchronizer::Acquire(FrameSet& set)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    unsigned int videoFrames = m_VideoCount < RingSize ? m_VideoCount : RingSize;
+    unsigned int skeletonFrames = m_SkeletonCount < RingSize ? m_SkeletonCount : RingSize;
+
+    // Newest color frame first; stop at the one of the last set
+    for (unsigned int i = 1; i <= videoFrames; ++i)
+    {
+        VideoEntry& video = m_Video[(m_VideoCount - i) % RingSize];
+        long long timestamp = video.frame->GetTimestamp();
+        if (m_HasLast && timestamp <= m_LastTimestamp)
+        {
+            break;
+        }
+
+        DepthEntry* pDepth = FindDepth(timestamp);
+        if (!pDepth || Distance(pDepth->frame->GetTimestamp(), timestamp) > m_Tolerance)
+        {
+            continue;
+        }
+
+        set.video = video.frame;
+        set.pyramid = video.pyramid;
+        set.depth = pDepth->frame;
+        set.depthMm = pDepth->depthMm;
+        set.players = pDepth->players;
+        set.depthSkew = set.depth->GetTimestamp() - timestamp;
+
+        // Skeletons are computed from depth frames, match them to the depth frame
+        const SkeletonFrame* pSkeleton = NULL;
+        for (unsigned int j = 1; j <= skeletonFrames; ++j)
+        {
+            const SkeletonFrame& skeleton = m_Skeleton[(m_SkeletonCount - j) % RingSize];
+            if (!pSkeleton || Distance(skeleton.timestamp, set.depth->GetTimestamp()) < Distance(pSkeleton->timestamp, set.depth->GetTimestamp()))
+            {
+                pSkeleton = &skeleton;
+            }
+        }
+        set.hasSkeleton = pSkeleton && Distance(pSkeleton->timestamp, set.depth->GetTimestamp()) <= m_Tolerance;
+        if (set.hasSkeleton)
+        {
+            set.skeleton = *pSkeleton;
+            set.skeletonSkew = pSkeleton->timestamp - set.depth->GetTimestamp();
+        }
+        else
+        {
+            memset(&set.skeleton, 0, sizeof(set.skeleton));
+            set.skeletonSkew = 0;
+        }
+
+        video.used = true;
+        m_LastTimestamp = timestamp;
+        m_HasLast = true;
+
+        long long skew = Distance(set.depthSkew, 0);
+        m_Stats.sets++;
+        m_Stats.lastSkew = skew;
+        m_Stats.maxSkew = skew > m_Stats.maxSkew ? skew : m_Stats.maxSkew;
+        m_SkewSum += skew;
+        m_WaitSum += FrameClockMicroseconds() - video.arrival;
+        m_Stats.meanSkew = m_SkewSum / m_Stats.sets;
+        m_Stats.meanWait = m_WaitSum / m_Stats.sets;
+        m_Taken.notify_all();
+        return true;
+    }
+    return false;
+}
+
+FrameSyncStats FrameSynchronizer::GetStats()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    return m_Stats;
+}
@@ -0,0 +1,112 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="FrameSynchronizer.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+#include "GrayPyramid.h"
+#include "SkeletonFrame.h"
+#include <condition_variable>
+#include <mutex>
+
+// Half a frame period at 30 Hz.
+const long long FRAME_SYNC_DEFAULT_TOLERANCE = 16667;
+
+// Color, depth and skeleton frames captured at (nearly) the same instant.
+struct FrameSet
+{
+    FrameRef        video;
+    FrameRef        depth;
+    FrameRef        depthMm;        // depth split into FRAME_FORMAT_D16 and FRAME_FORMAT_P8
+    FrameRef        players;        // planes, empty if the source does not split it
+    GrayPyramid     pyramid;        // luma of video, no levels unless the source builds it
+    SkeletonFrame   skeleton;       // zeroed if hasSkeleton is false
+    bool            hasSkeleton;
+    long long       depthSkew;      // depth minus color timestamp, microseconds
+    long long       skeletonSkew;   // skeleton minus depth timestamp
+};
+
+struct FrameSyncStats
+{
+    unsigned int    sets;           // handed out by Acquire()
+    unsigned int    videoDropped;   // color frames that never became part of a set
+    long long       lastSkew;       // |depth - color| of the last set, microseconds
+    long long       maxSkew;
+    long long       meanSkew;
+    long long       meanWait;       // from color frame arrival to its set being handed out
+};
+
+// Pairs the frames of independently delivered streams by timestamp. Producers
+// push every frame; the last few of each stream are kept, and Acquire() returns
+// the newest color frame that has a depth frame within the tolerance, with the
+// skeleton frame closest to that depth frame.
+class FrameSynchronizer
+{
+public:
+    FrameSynchronizer();
+
+    void SetTolerance(long long microseconds) { m_Tolerance = microseconds; };
+    long long GetTolerance() { return(m_Tolerance); };
+    void Reset();   // drops all frames and statistics
+    // Drops all frames and forgets the last set, keeping the statistics. For
+    // sources whose clock went backwards, e.g. a replay that looped or seeked;
+    // Acquire() otherwise takes nothing older than the last set.
+    void Restart();
+
+    // pyramid is that of the frame, if there is one
+    void PushVideo(const FrameRef& frame, const GrayPyramid& pyramid = GrayPyramid());
+    // depthMm and players are the planes of the frame, if there are any
+    void PushDepth(const FrameRef& frame, const FrameRef& depthMm = FrameRef(), const FrameRef& players = FrameRef());
+    void PushSkeleton(const SkeletonFrame& frame);
+
+    // False if no set newer than the last one is complete yet.
+    bool Acquire(FrameSet& set);
+    bool HasPendingVideo();     // a color frame newer than the last set arrived
+    // Blocks until another color or depth frame is pushed, at most milliseconds.
+    // False on time out.
+    bool Wait(unsigned int milliseconds);
+    // Blocks until HasPendingVideo() is false, at most milliseconds. False on
+    // time out.
+    bool WaitVideoTaken(unsigned int milliseconds);
+    FrameSyncStats GetStats();
+
+private:
+    static const unsigned int RingSize = 4;
+
+    struct VideoEntry
+    {
+        FrameRef    frame;
+        GrayPyramid pyramid;
+        long long   arrival;
+        bool        used;
+    };
+
+    struct DepthEntry
+    {
+        FrameRef    frame;
+        FrameRef    depthMm;
+        FrameRef    players;
+    };
+
+    DepthEntry* FindDepth(long long timestamp);
+    bool IsVideoPending();
+
+    std::mutex      m_Lock;
+    std::condition_variable m_Pushed;
+    std::condition_variable m_Taken;    // a set was handed out
+    long long       m_Tolerance;
+    VideoEntry      m_Video[RingSize];
+    DepthEntry      m_Depth[RingSize];
+    SkeletonFrame   m_Skeleton[RingSize];
+    unsigned int    m_VideoCount;       // frames pushed, the newest is at (count - 1) % RingSize
+    unsigned int    m_DepthCount;
+    unsigned int    m_SkeletonCount;
+    long long       m_LastTimestamp;    // of the color frame of the last set
+    bool            m_HasLast;
+    FrameSyncStats  m_Stats;
+    long long       m_SkewSum;
+    long long       m_WaitSum;
+};
@@ -0,0 +1,191 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="GrayPyramid.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "GrayPyramid.h"
+#include "Simd.h"
+#include <algorithm>
+
+// Frame rows start cache line aligned and their stride is a whole number of
+// cache lines, so the vector loops may run past the width to the next 16
+// (32) pixels without leaving the row's buffer, and every access is aligned.
+static void LumaRow(const unsigned char* pBgrx, unsigned char* pLuma, unsigned int width)
+{
+    unsigned int x = 0;
+#if defined(KINECT_AVX2)
+    // Each 32 bit pixel is two 16 bit lanes, B and R and, shifted down, G and X
+    const __m256i lowBytes = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i weightsBR = _mm256_set1_epi32((77 << 16) | 29);
+    const __m256i weightsG = _mm256_set1_epi32(150);
+    const __m256i round = _mm256_set1_epi32(128);
+    for (; x < width; x += 16)
+    {
+        __m256i y[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            __m256i v = _mm256_load_si256((const __m256i*)(pBgrx + (x + i * 8) * 4));
+            __m256i br = _mm256_and_si256(v, lowBytes);
+            __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), lowBytes);
+            y[i] = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(br, weightsBR),
+                _mm256_madd_epi16(g, weightsG)), round), 8);
+        }
+        // packs works within 128 bit lanes, put the quadwords back in order
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(y[0], y[1]), 0xD8);
+        _mm_store_si128((__m128i*)(pLuma + x),
+            _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1)));
+    }
+#elif defined(KINECT_SSE2)
+    const __m128i lowBytes = _mm_set1_epi32(0x00FF00FF);
+    const __m128i weightsBR = _mm_set1_epi32((77 << 16) | 29);
+    const __m128i weightsG = _mm_set1_epi32(150);
+    const __m128i round = _mm_set1_epi32(128);
+    for (; x < width; x += 16)
+    {
+        __m128i y[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            __m128i v = _mm_load_si128((const __m128i*)(pBgrx + (x + i * 4) * 4));
+            __m128i br = _mm_and_si128(v, lowBytes);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), lowBytes);
+            y[i] = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(br, weightsBR),
+                _mm_madd_epi16(g, weightsG)), round), 8);
+        }
+        _mm_store_si128((__m128i*)(pLuma + x),
+            _mm_packus_epi16(_mm_packs_epi32(y[0], y[1]), _mm_packs_epi32(y[2], y[3])));
+    }
+#else
+    for (; x < width; ++x)
+    {
+        const unsigned char* p = pBgrx + x * 4;
+        pLuma[x] = (unsigned char)((29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8);
+    }
+#endif
+}
+
+// Rounded mean of each 2x2 block of two rows.
+static void DownsampleRow(const unsigned char* pAbove, const unsigned char* pBelow, unsigned char* pOut, unsigned int width)
+{
+    unsigned int x = 0;
+#if defined(KINECT_AVX2)
+    const __m256i lowByte = _mm256_set1_epi16(0x00FF);
+    const __m256i two = _mm256_set1_epi16(2);
+    for (; x < width; x += 32)
+    {
+        __m256i sums[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            __m256i a = _mm256_load_si256((const __m256i*)(pAbove + 2 * x + i * 32));
+            __m256i b = _mm256_load_si256((const __m256i*)(pBelow + 2 * x + i * 32));
+            __m256i pairs = _mm256_add_epi16(_mm256_add_epi16(_mm256_and_si256(a, lowByte), _mm256_srli_epi16(a, 8)),
+                _mm256_add_epi16(_mm256_and_si256(b, lowByte), _mm256_srli_epi16(b, 8)));
+            sums[i] = _mm256_srli_epi16(_mm256_add_epi16(pairs, two), 2);
+        }
+        _mm256_store_si256((__m256i*)(pOut + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(sums[0], sums[1]), 0xD8));
+    }
+#elif defined(KINECT_SSE2)
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x < width; x += 16)
+    {
+        __m128i sums[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            __m128i a = _mm_load_si128((const __m128i*)(pAbove + 2 * x + i * 16));
+            __m128i b = _mm_load_si128((const __m128i*)(pBelow + 2 * x + i * 16));
+            __m128i pairs = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, lowByte), _mm_srli_epi16(a, 8)),
+                _mm_add_epi16(_mm_and_si128(b, lowByte), _mm_srli_epi16(b, 8)));
+            sums[i] = _mm_srli_epi16(_mm_add_epi16(pairs, two), 2);
+        }
+        _mm_store_si128((__m128i*)(pOut + x), _mm_packus_epi16(sums[0], sums[1]));
+    }
+#else
+    for (; x < width; ++x)
+    {
+        pOut[x] = (unsigned char)((pAbove[2 * x] + pAbove[2 * x + 1] + pBelow[2 * x] + pBelow[2 * x + 1] + 2) >> 2);
+    }
+#endif
+}
+
+GrayPyramidBuilder::GrayPyramidBuilder()
+{
+    m_Levels = 4;
+    m_FullWidth = 0;
+    m_FullHeight = 0;
+}
+
+void GrayPyramidBuilder::SetLevels(unsigned int levels)
+{
+    m_Levels = std::min(std::max(levels, 1u), GRAY_PYRAMID_MAX_LEVELS);
+    m_FullWidth = 0;    // pools for the new levels
+}
+
+// Row of the level below, now that row of level is done, and so on down.
+void GrayPyramidBuilder::DownsampleFrom(GrayPyramid& pyramid, unsigned int level, unsigned int row)
+{
+    for (; level + 1 < pyramid.levels && (row & 1); ++level, row /= 2)
+    {
+        Frame* pAbove = pyramid.level[level].Get();
+        Frame* pBelow = pyramid.level[level + 1].Get();
+        if (row / 2 >= pBelow->GetHeight())
+        {   // The odd last row of a level has no partner
+            break;
+        }
+        DownsampleRow(pAbove->GetBuffer() + (row - 1) * pAbove->GetStride(), pAbove->GetBuffer() + row * pAbove->GetStride(),
+            pBelow->GetBuffer() + (row / 2) * pBelow->GetStride(), pBelow->GetWidth());
+    }
+}
+
+bool GrayPyramidBuilder::Build(Frame* pVideo, GrayPyramid& pyramid)
+{
+    pyramid.levels = 0;
+    if (pVideo->GetFormat() != FRAME_FORMAT_B8G8R8X8)
+    {
+        return false;
+    }
+    if (pVideo->GetFullWidth() != m_FullWidth || pVideo->GetFullHeight() != m_FullHeight)
+    {   // New resolution profile
+        m_FullWidth = pVideo->GetFullWidth();
+        m_FullHeight = pVideo->GetFullHeight();
+        for (unsigned int i = 0; i < GRAY_PYRAMID_MAX_LEVELS; ++i)
+        {
+            if (i < m_Levels)
+            {
+                m_Pools[i].Init(std::max(m_FullWidth >> i, 1u), std::max(m_FullHeight >> i, 1u), FRAME_FORMAT_L8, 4);
+            }
+            else
+            {
+                m_Pools[i].Release();
+            }
+        }
+    }
+
+    // A small region runs out of pixels before the last level
+    unsigned int levels = 0;
+    while (levels < m_Levels && (pVideo->GetWidth() >> levels) && (pVideo->GetHeight() >> levels))
+    {
+        FrameRef& frame = pyramid.level[levels];
+        frame = m_Pools[levels].Acquire();
+        if (!frame || (pVideo->IsRegion() && !frame->SetRegion(pVideo->GetOffsetX() >> levels, pVideo->GetOffsetY() >> levels,
+            pVideo->GetWidth() >> levels, pVideo->GetHeight() >> levels)))
+        {
+            return false;
+        }
+        frame->SetTimestamp(pVideo->GetTimestamp(), pVideo->GetFrameNumber());
+        levels++;
+    }
+    for (unsigned int i = levels; i < GRAY_PYRAMID_MAX_LEVELS; ++i)
+    {
+        pyramid.level[i].Reset();
+    }
+    pyramid.levels = levels;
+
+    Frame* pLuma = pyramid.level[0].Get();
+    for (unsigned int y = 0; y < pVideo->GetHeight(); ++y)
+    {
+        LumaRow(pVideo->GetBuffer() + y * pVideo->GetStride(), pLuma->GetBuffer() + y * pLuma->GetStride(), pVideo->GetWidth());
+        DownsampleFrom(pyramid, 0, y);
+    }
+    return true;
+}
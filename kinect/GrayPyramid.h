@@ -0,0 +1,49 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="GrayPyramid.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+
+const unsigned int GRAY_PYRAMID_MAX_LEVELS = 5;
+
+// Luma of a color frame (level 0) and its successive 2x2 box downsamplings,
+// each a FRAME_FORMAT_L8 frame with the timestamp of the color frame. A level
+// is half the width and height of the one above, rounded down. Levels of a
+// region color frame are regions too, at the offset halved per level.
+struct GrayPyramid
+{
+    GrayPyramid() : levels(0) {}
+
+    unsigned int    levels;     // 0 if there is no pyramid
+    FrameRef        level[GRAY_PYRAMID_MAX_LEVELS];
+};
+
+// Builds GrayPyramids from FRAME_FORMAT_B8G8R8X8 frames in one pass over the
+// color frame: as soon as two rows of a level are done they are averaged into
+// a row of the next, so every row is still in the cache when it is read
+// again and the color frame is read once. Luma is (77 R + 150 G + 29 B) / 256,
+// 16 pixels at a time with SSE2 or AVX2; the levels come from pools of the
+// builder's own.
+class GrayPyramidBuilder
+{
+public:
+    GrayPyramidBuilder();
+
+    // Up to GRAY_PYRAMID_MAX_LEVELS, 4 by default (640x480 down to 80x60).
+    void SetLevels(unsigned int levels);
+    unsigned int GetLevels() { return(m_Levels); };
+
+    bool Build(Frame* pVideo, GrayPyramid& pyramid);
+
+private:
+    void DownsampleFrom(GrayPyramid& pyramid, unsigned int level, unsigned int row);
+
+    unsigned int    m_Levels;
+    unsigned int    m_FullWidth;
+    unsigned int    m_FullHeight;
+    FramePool       m_Pools[GRAY_PYRAMID_MAX_LEVELS];
+};
@@ -0,0 +1,32 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="HeadPose.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "SkeletonFrame.h"
+
+// Estimator a HeadPose came from, from the most to the least accurate.
+enum HeadPoseSource
+{
+    HEAD_POSE_NONE = 0,
+    HEAD_POSE_FACE,             // face tracker
+    HEAD_POSE_SKELETON,         // skeleton head joint
+    HEAD_POSE_DEPTH,            // head blob in the depth frame
+    HEAD_POSE_SOURCE_COUNT,
+};
+
+// Where the head was on one tracked frame, in the camera space of its sensor.
+// Small and trivially copyable, so it can go through a Seqlock.
+struct HeadPose
+{
+    Point3          position;       // head center, meters
+    float           rotation[3];    // pitch, yaw and roll, degrees
+    float           confidence;     // 0 = no head on the frame, position and rotation are meaningless
+    HeadPoseSource  source;
+    unsigned int    frameNumber;
+    long long       frameTimestamp; // microseconds, of the color frame the pose was measured on
+    long long       publishTime;    // FrameClockMicroseconds() when the pose was published
+};
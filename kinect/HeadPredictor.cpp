@@ -0,0 +1,190 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="HeadPredictor.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "HeadPredictor.h"
+#include <algorithm>
+#include <cmath>
+
+// Fraction of the way the clock offset rises towards a larger sample
+static const double ClockOffsetRise = 0.01;
+
+HeadPredictionParams DefaultHeadPrediction()
+{
+    HeadPredictionParams params;
+    params.jerkNoise = 5.0f;
+    params.measurementNoise = 0.004f;
+    params.speedCutoff = 0.3f;
+    params.captureLatency = 20000;
+    params.maxHorizon = 120000;
+    params.resetGap = 250000;
+    params.resetDistance = 0.3f;
+    return params;
+}
+
+HeadPredictor::HeadPredictor()
+{
+    m_Params = DefaultHeadPrediction();
+    Reset();
+}
+
+void HeadPredictor::Reset()
+{
+    m_Started = false;
+    m_Last = HeadPose();
+    m_ClockOffset = 0;
+}
+
+void HeadPredictor::Start(const HeadPose& pose)
+{
+    // Unknown velocity and acceleration, within what a head does
+    const double initial[3] = { m_Params.measurementNoise * m_Params.measurementNoise, 0.5 * 0.5, 5.0 * 5.0 };
+    const float position[3] = { pose.position.x, pose.position.y, pose.position.z };
+    for (int i = 0; i < 3; ++i)
+    {
+        Axis& axis = m_Axes[i];
+        axis.x[0] = position[i];
+        axis.x[1] = 0;
+        axis.x[2] = 0;
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                axis.P[r][c] = r == c ? initial[r] : 0;
+            }
+        }
+    }
+    m_Started = true;
+}
+
+// x = F x, P = F P F' + Q, with F the constant acceleration transition over
+// dt and Q its white jerk noise.
+void HeadPredictor::Propagate(Axis& axis, double dt)
+{
+    const double F[3][3] = { { 1, dt, dt * dt / 2 }, { 0, 1, dt }, { 0, 0, 1 } };
+    double x[3];
+    double FP[3][3];
+    for (int r = 0; r < 3; ++r)
+    {
+        x[r] = 0;
+        for (int k = 0; k < 3; ++k)
+        {
+            x[r] += F[r][k] * axis.x[k];
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            FP[r][c] = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                FP[r][c] += F[r][k] * axis.P[k][c];
+            }
+        }
+    }
+
+    double q = double(m_Params.jerkNoise) * m_Params.jerkNoise;
+    double dt2 = dt * dt;
+    double dt3 = dt2 * dt;
+    const double Q[3][3] =
+    {
+        { dt3 * dt2 / 20, dt2 * dt2 / 8, dt3 / 6 },
+        { dt2 * dt2 / 8,  dt3 / 3,       dt2 / 2 },
+        { dt3 / 6,        dt2 / 2,       dt },
+    };
+    for (int r = 0; r < 3; ++r)
+    {
+        axis.x[r] = x[r];
+        for (int c = 0; c < 3; ++c)
+        {
+            double p = q * Q[r][c];
+            for (int k = 0; k < 3; ++k)
+            {
+                p += FP[r][k] * F[c][k];
+            }
+            axis.P[r][c] = p;
+        }
+    }
+}
+
+// Update with a position measurement z of variance r.
+void HeadPredictor::Correct(Axis& axis, double z, double r)
+{
+    double s = axis.P[0][0] + r;
+    double K[3] = { axis.P[0][0] / s, axis.P[1][0] / s, axis.P[2][0] / s };
+    double innovation = z - axis.x[0];
+    double row[3] = { axis.P[0][0], axis.P[0][1], axis.P[0][2] };
+    for (int i = 0; i < 3; ++i)
+    {
+        axis.x[i] += K[i] * innovation;
+        for (int c = 0; c < 3; ++c)
+        {
+            axis.P[i][c] -= K[i] * row[c];
+        }
+    }
+}
+
+void HeadPredictor::AddPose(const HeadPose& pose)
+{
+    if (pose.confidence <= 0)
+    {
+        return;
+    }
+
+    long long offset = pose.publishTime - pose.frameTimestamp;
+    long long dt = pose.frameTimestamp - m_Last.frameTimestamp;
+    if (m_Started && dt <= 0)
+    {
+        return;     // an older or repeated frame
+    }
+    const float position[3] = { pose.position.x, pose.position.y, pose.position.z };
+    bool restart = !m_Started || dt > m_Params.resetGap;
+    for (int i = 0; i < 3 && !restart; ++i)
+    {
+        restart = fabs(position[i] - m_Axes[i].x[0]) > m_Params.resetDistance;
+    }
+
+    if (restart)
+    {
+        Start(pose);
+        m_ClockOffset = offset;
+    }
+    else
+    {
+        double speed = sqrt(m_Axes[0].x[1] * m_Axes[0].x[1] + m_Axes[1].x[1] * m_Axes[1].x[1] + m_Axes[2].x[1] * m_Axes[2].x[1]);
+        double sigma = m_Params.measurementNoise / (1 + speed / m_Params.speedCutoff);
+        for (int i = 0; i < 3; ++i)
+        {
+            Propagate(m_Axes[i], dt * 1e-6);
+            Correct(m_Axes[i], position[i], sigma * sigma);
+        }
+        m_ClockOffset = offset < m_ClockOffset ? offset :
+            m_ClockOffset + (long long)((offset - m_ClockOffset) * ClockOffsetRise);
+    }
+    m_Last = pose;
+}
+
+bool HeadPredictor::Predict(long long displayTime, HeadPose* pPose) const
+{
+    return PredictAt(displayTime - m_ClockOffset + m_Params.captureLatency, pPose);
+}
+
+bool HeadPredictor::PredictAt(long long frameTime, HeadPose* pPose) const
+{
+    if (!m_Started)
+    {
+        return false;
+    }
+    double h = std::min(std::max(frameTime - m_Last.frameTimestamp, 0LL), m_Params.maxHorizon) * 1e-6;
+    float position[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        const double* x = m_Axes[i].x;
+        position[i] = float(x[0] + x[1] * h + x[2] * h * h / 2);
+    }
+    *pPose = m_Last;
+    pPose->position.x = position[0];
+    pPose->position.y = position[1];
+    pPose->position.z = position[2];
+    return true;
+}
@@ -0,0 +1,79 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="HeadPredictor.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "HeadPose.h"
+
+struct HeadPredictionParams
+{
+    float       jerkNoise;          // m/s^3, how abruptly the head may change its acceleration
+    float       measurementNoise;   // meters, tracking noise of a still head
+    float       speedCutoff;        // m/s, at this speed measurements are trusted twice as much
+    long long   captureLatency;     // microseconds from exposure to the frame timestamp
+    long long   maxHorizon;         // microseconds, no extrapolation further past the newest pose
+    long long   resetGap;           // microseconds without a pose that restart the filter
+    float       resetDistance;      // meters, a jump this large restarts it (another head)
+};
+
+// Parameters for a Kinect face track at 30 Hz viewed on a 60 Hz display.
+HeadPredictionParams DefaultHeadPrediction();
+
+// Extrapolates the tracked head to the time a rendered frame will be on screen,
+// so the parallax does not trail the head by the sensor's frame period and the
+// tracking latency.
+//
+// Each axis of the position has a constant acceleration Kalman filter, driven
+// by white jerk noise, updated at the timestamps of the frames the poses were
+// measured on. Like the One Euro filter, it smooths a still head hard and a
+// moving one little: the measurement noise shrinks as the filtered speed
+// grows, so jitter is damped without adding lag to fast moves. Rotation is
+// passed through from the newest pose.
+//
+// Frame timestamps come from the sensor's clock; the offset to
+// FrameClockMicroseconds() is the smallest difference seen between a pose's
+// publish time and its frame timestamp, rising slowly so clock drift does not
+// leave it behind. What happens before the timestamp is taken, exposure and
+// transfer, cannot be seen that way and is the captureLatency parameter.
+//
+// Not thread safe; the render loop owns it.
+class HeadPredictor
+{
+public:
+    HeadPredictor();
+
+    void SetParameters(const HeadPredictionParams& params) { m_Params = params; };
+    const HeadPredictionParams& GetParameters() { return(m_Params); };
+    void Reset();
+
+    // Adds a tracked pose, in frame timestamp order. Poses without confidence
+    // are ignored; after resetGap without any the filter starts over.
+    void AddPose(const HeadPose& pose);
+
+    // Pose at displayTime, a FrameClockMicroseconds() time such as the expected
+    // scan-out of the frame being rendered. False before the first pose.
+    bool Predict(long long displayTime, HeadPose* pPose) const;
+    // The same at a time of the sensor's clock.
+    bool PredictAt(long long frameTime, HeadPose* pPose) const;
+
+private:
+    // State and covariance of one axis: position, velocity, acceleration
+    struct Axis
+    {
+        double  x[3];
+        double  P[3][3];
+    };
+
+    void Start(const HeadPose& pose);
+    void Propagate(Axis& axis, double dt);
+    void Correct(Axis& axis, double z, double r);
+
+    HeadPredictionParams    m_Params;
+    Axis                    m_Axes[3];
+    HeadPose                m_Last;         // newest pose added
+    bool                    m_Started;
+    long long               m_ClockOffset;  // FrameClockMicroseconds() - frame timestamp
+};
@@ -0,0 +1,69 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="HeadTrackingThread.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "HeadTrackingThread.h"
+#include "SensorFusion.h"
+
+// Upper bound on the thread's sleep, so Stop() never waits long
+static const unsigned int FrameWaitMilliseconds = 50;
+
+HeadTrackingThread::HeadTrackingThread()
+{
+    m_pTracker = NULL;
+    m_Stop = false;
+}
+
+HeadTrackingThread::~HeadTrackingThread()
+{
+    Stop();
+}
+
+bool HeadTrackingThread::Start(Tracker* pTracker)
+{
+    Stop(); // Deal with double starts.
+
+    if (!pTracker || !pTracker->GetSource())
+    {
+        return false;
+    }
+    m_pTracker = pTracker;
+    m_Stop = false;
+    m_Thread = std::thread(&HeadTrackingThread::Run, this);
+    return true;
+}
+
+void HeadTrackingThread::Stop()
+{
+    m_Stop = true;
+    if (m_Thread.joinable())
+    {
+        m_Thread.join();
+    }
+    m_pTracker = NULL;
+}
+
+void HeadTrackingThread::Run()
+{
+    IFrameSource* pSource = m_pTracker->GetSource();
+    while (!m_Stop)
+    {
+        if (!m_pTracker->Update())
+        {
+            pSource->WaitFrameSet(FrameWaitMilliseconds);
+            continue;
+        }
+
+        // A lost head publishes zero confidence, so readers stop following
+        // it at once instead of holding on to the last position.
+        HeadPose pose = {};
+        if (m_pTracker->GetHeadPose(&pose))
+        {
+            pose.confidence *= FieldOfViewConfidence(pose.position);
+        }
+        pose.publishTime = FrameClockMicroseconds();
+        m_Pose.Write(pose);
+    }
+}
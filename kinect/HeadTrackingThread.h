@@ -0,0 +1,45 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="HeadTrackingThread.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "HeadPose.h"
+#include "Seqlock.h"
+#include "Tracker.h"
+#include <atomic>
+#include <thread>
+
+// Runs a Tracker on a thread of its own, as fast as its source delivers frame
+// sets, and publishes the result of every set as a HeadPose through a seqlock.
+// Render callbacks take the newest pose without ever waiting for the tracker,
+// and the tracker never waits for them: a write is a copy of a few words, and
+// a read that overlaps one fails rather than retrying, leaving the reader with
+// the pose it already had.
+class HeadTrackingThread
+{
+public:
+    HeadTrackingThread();
+    ~HeadTrackingThread();
+
+    // Until Stop(), only the thread may call pTracker's Update() and Get*()
+    // methods; its source stays usable from any thread.
+    bool Start(Tracker* pTracker);
+    void Stop();
+
+    // Newest pose; false if none was published yet or one is being written
+    // right now. Any thread.
+    bool GetPose(HeadPose* pPose) const { return(m_Pose.GetVersion() != 0 && m_Pose.TryRead(*pPose)); };
+    // Poses published so far, to tell whether there is a new one.
+    unsigned int GetPoseCount() const   { return(m_Pose.GetVersion()); };
+
+private:
+    void Run();
+
+    Tracker*            m_pTracker;
+    std::thread         m_Thread;
+    std::atomic<bool>   m_Stop;
+    Seqlock<HeadPose>   m_Pose;
+};
@@ -7,23 +7,17 @@
 #include "KinectSensor.h"
 #include <cmath>
 
-KinectSensor::KinectSensor()
+KinectSensor::KinectSensor(int sensorIndex)
 {
-    m_hNextDepthFrameEvent = NULL;
-    m_hNextVideoFrameEvent = NULL;
-    m_hNextSkeletonEvent = NULL;
+    m_SensorIndex = sensorIndex;
+    m_SkeletonTracking = true;
+    m_pNuiSensor = NULL;
     m_pDepthStreamHandle = NULL;
     m_pVideoStreamHandle = NULL;
-    m_hThNuiProcess=NULL;
-    m_hEvNuiProcessStop=NULL;
+    m_DepthStream = m_VideoStream = m_SkeletonStream = -1;
     m_bNuiInitialized = false;
     m_FramesTotal = 0;
     m_SkeletonTotal = 0;
-    m_VideoBuffer = NULL;
-    m_DepthBuffer = NULL;
-    m_ZoomFactor = 1.0f;
-    m_ViewOffset.x = 0;
-    m_ViewOffset.y = 0;
 }
 
 KinectSensor::~KinectSensor()
@@ -31,155 +25,192 @@ KinectSensor::~KinectSensor()
     Release();
 }
 
+int KinectSensor::GetSensorCount()
+{
+    int count = 0;
+    if (FAILED(NuiGetSensorCount(&count)))
+    {
+        return 0;
+    }
+    return count;
+}
+
 void KinectSensor::Init()
 {
     Release(); // Deal with double initializations.
 
-    m_VideoBuffer = FTCreateImage();
-    m_VideoBuffer->Allocate(640, 480, FTIMAGEFORMAT_UINT8_B8G8R8X8);
-
-    m_DepthBuffer = FTCreateImage();
-    m_DepthBuffer->Allocate(320, 240, FTIMAGEFORMAT_UINT16_D13P3);
+    const SensorProfile& profile = GetSensorProfile(m_Profile);
+    InitExchange(profile.videoWidth, profile.videoHeight, profile.depthWidth, profile.depthHeight);
     
     m_FramesTotal = 0;
     m_SkeletonTotal = 0;
 
-    for (int i = 0; i < NUI_SKELETON_COUNT; ++i)
-    {
-        m_HeadPoint[i] = m_NeckPoint[i] = FT_VECTOR3D(0, 0, 0);
-        m_SkeletonTracked[i] = false;
-    }
+    m_DepthStream = m_Dispatcher.AddStream("depth", [this] { GotDepthAlert(); m_FramesTotal++; });
+    m_VideoStream = m_Dispatcher.AddStream("color", [this] { GotVideoAlert(); });
+    m_SkeletonStream = m_Dispatcher.AddStream("skeleton", [this] { GotSkeletonAlert(); m_SkeletonTotal++; });
 
-    m_hNextDepthFrameEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-    m_hNextVideoFrameEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-    m_hNextSkeletonEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    OpenStreams();
     
-    NuiInitialize(NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX | NUI_INITIALIZE_FLAG_USES_SKELETON | NUI_INITIALIZE_FLAG_USES_COLOR);
-    m_bNuiInitialized = true;
+	// Start the stream workers
+    m_Dispatcher.Start();
+}
 
-    NuiSkeletonTrackingEnable( m_hNextSkeletonEvent, NUI_SKELETON_TRACKING_FLAG_ENABLE_IN_NEAR_RANGE | NUI_SKELETON_TRACKING_FLAG_ENABLE_SEATED_SUPPORT);
+// The runtime opens each stream type once per NuiInitialize(), so a new
+// resolution means shutting it down and starting over.
+bool KinectSensor::SetProfile(SensorProfileId profile)
+{
+    if (profile >= SENSOR_PROFILE_COUNT)
+    {
+        return false;
+    }
+    m_Profile = profile;
+    if (!m_bNuiInitialized)
+    {   // Init() opens the streams at this profile
+        return true;
+    }
 
-    NuiImageStreamOpen(
-		NUI_IMAGE_TYPE_COLOR,
-		NUI_IMAGE_RESOLUTION_640x480,
-        0,
-        2,
-        m_hNextVideoFrameEvent,
-        &m_pVideoStreamHandle );
-    
-	NuiImageStreamOpen(
-		NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX,
-		NUI_IMAGE_RESOLUTION_320x240,
-        NUI_IMAGE_STREAM_FLAG_ENABLE_NEAR_MODE,
-        2,
-        m_hNextDepthFrameEvent,
-        &m_pDepthStreamHandle );
-    
-	// Start the Nui processing thread
-    m_hEvNuiProcessStop=CreateEvent(NULL,TRUE,FALSE,NULL);
-    m_hThNuiProcess=CreateThread(NULL,0,ProcessThread,this,0,NULL);
+    m_Dispatcher.Stop();
+    m_pNuiSensor->NuiShutdown();
+    m_bNuiInitialized = false;
+
+    const SensorProfile& resolution = GetSensorProfile(profile);
+    ResizeExchange(resolution.videoWidth, resolution.videoHeight, resolution.depthWidth, resolution.depthHeight);
+    bool opened = OpenStreams();
+    m_Dispatcher.Start();
+    return opened;
 }
 
-void KinectSensor::Release()
+static NUI_IMAGE_RESOLUTION ImageResolution(unsigned int width)
 {
-    // Stop the Nui processing thread
-    if(m_hEvNuiProcessStop!=NULL)
+    switch (width)
     {
-        // Signal the thread
-        SetEvent(m_hEvNuiProcessStop);
-
-        // Wait for thread to stop
-        if(m_hThNuiProcess!=NULL)
-        {
-            WaitForSingleObject(m_hThNuiProcess,INFINITE);
-            CloseHandle(m_hThNuiProcess);
-            m_hThNuiProcess = NULL;
-        }
-        CloseHandle(m_hEvNuiProcessStop);
-        m_hEvNuiProcessStop = NULL;
+    case 80:    return NUI_IMAGE_RESOLUTION_80x60;
+    case 320:   return NUI_IMAGE_RESOLUTION_320x240;
+    case 1280:  return NUI_IMAGE_RESOLUTION_1280x960;
+    default:    return NUI_IMAGE_RESOLUTION_640x480;
     }
+}
 
-    if (m_bNuiInitialized)
+// The runtime maps a depth pixel at a given depth to a color pixel. Sampling
+// every pixel near and far separates the position at infinity from the
+// parallax, which falls off as 1 / depth; the parallax is averaged over the
+// frame to get past the whole pixel results.
+bool KinectSensor::BuildRegistration(DepthRegistration& registration)
+{
+    if (!m_bNuiInitialized)
     {
-        NuiShutdown();
+        return false;
     }
-    m_bNuiInitialized = false;
 
-    if (m_hNextSkeletonEvent && m_hNextSkeletonEvent != INVALID_HANDLE_VALUE)
+    const SensorProfile& profile = GetSensorProfile(m_Profile);
+    NUI_IMAGE_RESOLUTION colorResolution = ImageResolution(profile.videoWidth);
+    NUI_IMAGE_RESOLUTION depthResolution = ImageResolution(profile.depthWidth);
+    const float nearDepth = 800.0f;
+    const float farDepth = 4000.0f;
+    const float inverseSpan = 1.0f / (1.0f / nearDepth - 1.0f / farDepth);
+
+    size_t pixels = size_t(profile.depthWidth) * profile.depthHeight;
+    std::vector<float> farX(pixels), farY(pixels);
+    double parallaxX = 0, parallaxY = 0;
+    for (unsigned int y = 0; y < profile.depthHeight; ++y)
     {
-        CloseHandle(m_hNextSkeletonEvent);
-        m_hNextSkeletonEvent = NULL;
+        for (unsigned int x = 0; x < profile.depthWidth; ++x)
+        {
+            LONG nearColorX, nearColorY, farColorX, farColorY;
+            if (FAILED(m_pNuiSensor->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(colorResolution, depthResolution,
+                    NULL, x, y, USHORT(nearDepth) << 3, &nearColorX, &nearColorY)) ||
+                FAILED(m_pNuiSensor->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(colorResolution, depthResolution,
+                    NULL, x, y, USHORT(farDepth) << 3, &farColorX, &farColorY)))
+            {
+                return false;
+            }
+            farX[y * profile.depthWidth + x] = float(farColorX);
+            farY[y * profile.depthWidth + x] = float(farColorY);
+            parallaxX += (nearColorX - farColorX) * inverseSpan;
+            parallaxY += (nearColorY - farColorY) * inverseSpan;
+        }
     }
-    if (m_hNextDepthFrameEvent && m_hNextDepthFrameEvent != INVALID_HANDLE_VALUE)
+    parallaxX /= pixels;
+    parallaxY /= pixels;
+
+    for (size_t i = 0; i < pixels; ++i)
     {
-        CloseHandle(m_hNextDepthFrameEvent);
-        m_hNextDepthFrameEvent = NULL;
+        farX[i] -= float(parallaxX / farDepth);
+        farY[i] -= float(parallaxY / farDepth);
     }
-    if (m_hNextVideoFrameEvent && m_hNextVideoFrameEvent != INVALID_HANDLE_VALUE)
+    return registration.Build(profile.depthWidth, profile.depthHeight, profile.videoWidth, profile.videoHeight,
+        &farX[0], &farY[0], float(parallaxX), float(parallaxY));
+}
+
+bool KinectSensor::OpenStreams()
+{
+    const SensorProfile& profile = GetSensorProfile(m_Profile);
+
+    if (!m_pNuiSensor && FAILED(NuiCreateSensorByIndex(m_SensorIndex, &m_pNuiSensor)))
     {
-        CloseHandle(m_hNextVideoFrameEvent);
-        m_hNextVideoFrameEvent = NULL;
+        m_pNuiSensor = NULL;
+        return false;
     }
-    if (m_VideoBuffer)
+
+    DWORD flags = NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX | NUI_INITIALIZE_FLAG_USES_COLOR;
+    if (m_SkeletonTracking)
     {
-        m_VideoBuffer->Release();
-        m_VideoBuffer = NULL;
+        flags |= NUI_INITIALIZE_FLAG_USES_SKELETON;
     }
-    if (m_DepthBuffer)
+    m_pNuiSensor->NuiInitialize(flags);
+    m_bNuiInitialized = true;
+
+    if (m_SkeletonTracking)
     {
-        m_DepthBuffer->Release();
-        m_DepthBuffer = NULL;
+        m_pNuiSensor->NuiSkeletonTrackingEnable( m_Dispatcher.GetEventHandle(m_SkeletonStream), NUI_SKELETON_TRACKING_FLAG_ENABLE_IN_NEAR_RANGE | NUI_SKELETON_TRACKING_FLAG_ENABLE_SEATED_SUPPORT);
     }
+
+    HRESULT hrVideo = m_pNuiSensor->NuiImageStreamOpen(
+		NUI_IMAGE_TYPE_COLOR,
+		ImageResolution(profile.videoWidth),
+        0,
+        2,
+        m_Dispatcher.GetEventHandle(m_VideoStream),
+        &m_pVideoStreamHandle );
+    
+	HRESULT hrDepth = m_pNuiSensor->NuiImageStreamOpen(
+		NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX,
+		ImageResolution(profile.depthWidth),
+        NUI_IMAGE_STREAM_FLAG_ENABLE_NEAR_MODE,
+        2,
+        m_Dispatcher.GetEventHandle(m_DepthStream),
+        &m_pDepthStreamHandle );
+
+    return SUCCEEDED(hrVideo) && SUCCEEDED(hrDepth);
 }
 
-DWORD WINAPI KinectSensor::ProcessThread(LPVOID pParam)
+void KinectSensor::Release()
 {
-    KinectSensor*  pthis=(KinectSensor *) pParam;
-    HANDLE          hEvents[4];
-
-    // Configure events to be listened on
-    hEvents[0]=pthis->m_hEvNuiProcessStop;
-    hEvents[1]=pthis->m_hNextDepthFrameEvent;
-    hEvents[2]=pthis->m_hNextVideoFrameEvent;
-    hEvents[3]=pthis->m_hNextSkeletonEvent;
+    // Stop the stream workers
+    m_Dispatcher.Stop();
 
-    // Main thread loop
-    while (true)
+    if (m_bNuiInitialized)
     {
-        // Wait for an event to be signaled
-        WaitForMultipleObjects(sizeof(hEvents)/sizeof(hEvents[0]),hEvents,FALSE,100);
-
-        // If the stop event is set, stop looping and exit
-        if (WAIT_OBJECT_0 == WaitForSingleObject(pthis->m_hEvNuiProcessStop, 0))
-        {
-            break;
-        }
-
-        // Process signal events
-        if (WAIT_OBJECT_0 == WaitForSingleObject(pthis->m_hNextDepthFrameEvent, 0))
-        {
-            pthis->GotDepthAlert();
-            pthis->m_FramesTotal++;
-        }
-        if (WAIT_OBJECT_0 == WaitForSingleObject(pthis->m_hNextVideoFrameEvent, 0))
-        {
-            pthis->GotVideoAlert();
-        }
-        if (WAIT_OBJECT_0 == WaitForSingleObject(pthis->m_hNextSkeletonEvent, 0))
-        {
-            pthis->GotSkeletonAlert();
-            pthis->m_SkeletonTotal++;
-        }
+        m_pNuiSensor->NuiShutdown();
+    }
+    m_bNuiInitialized = false;
+    if (m_pNuiSensor)
+    {
+        m_pNuiSensor->Release();
+        m_pNuiSensor = NULL;
     }
 
-    return 0;
+    // Closes the events the runtime was signalling
+    m_Dispatcher.Clear();
+    ReleaseExchange();
 }
 
 void KinectSensor::GotVideoAlert( )
 {
-    const NUI_IMAGE_FRAME* pImageFrame = NULL;
+    NUI_IMAGE_FRAME imageFrame;
+    const NUI_IMAGE_FRAME* pImageFrame = &imageFrame;
 
-    bool hr = NuiImageStreamGetNextFrame(m_pVideoStreamHandle, 0, &pImageFrame);
+    HRESULT hr = m_pNuiSensor->NuiImageStreamGetNextFrame(m_pVideoStreamHandle, 0, &imageFrame);
     if (FAILED(hr))
     {
         return;
@@ -190,22 +221,28 @@ void KinectSensor::GotVideoAlert( )
     pTexture->LockRect(0, &LockedRect, NULL, 0);
     if (LockedRect.Pitch)
     {   // Copy video frame to face tracking
-        memcpy(m_VideoBuffer->GetBuffer(), PBYTE(LockedRect.pBits), min(m_VideoBuffer->GetBufferSize(), UINT(pTexture->BufferLen())));
+        FrameRef& slot = BeginVideoFrame();
+        ApplyAcquisitionRegion(slot, FRAME_ROI_VIDEO);
+        if (CopyLockedRect(slot, LockedRect, pImageFrame))
+        {
+            PublishVideoFrame();
+        }
     }
     else
     {
         OutputDebugString(L"Buffer length of received texture is bogus\r\n");
     }
 
-    hr = NuiImageStreamReleaseFrame(m_pVideoStreamHandle, pImageFrame);
+    hr = m_pNuiSensor->NuiImageStreamReleaseFrame(m_pVideoStreamHandle, &imageFrame);
 }
 
 
 void KinectSensor::GotDepthAlert( )
 {
-    const NUI_IMAGE_FRAME* pImageFrame = NULL;
+    NUI_IMAGE_FRAME imageFrame;
+    const NUI_IMAGE_FRAME* pImageFrame = &imageFrame;
 
-    bool hr = NuiImageStreamGetNextFrame(m_pDepthStreamHandle, 0, &pImageFrame);
+    HRESULT hr = m_pNuiSensor->NuiImageStreamGetNextFrame(m_pDepthStreamHandle, 0, &imageFrame);
 
     if (FAILED(hr))
     {
@@ -217,90 +254,82 @@ void KinectSensor::GotDepthAlert( )
     pTexture->LockRect(0, &LockedRect, NULL, 0);
     if (LockedRect.Pitch)
     {   // Copy depth frame to face tracking
-        memcpy(m_DepthBuffer->GetBuffer(), PBYTE(LockedRect.pBits), min(m_DepthBuffer->GetBufferSize(), UINT(pTexture->BufferLen())));
+        FrameRef& slot = BeginDepthFrame();
+        ApplyAcquisitionRegion(slot, FRAME_ROI_DEPTH);
+        if (CopyLockedRect(slot, LockedRect, pImageFrame))
+        {
+            PublishDepthFrame();
+        }
     }
     else
     {
         OutputDebugString( L"Buffer length of received depth texture is bogus\r\n" );
     }
 
-    hr = NuiImageStreamReleaseFrame(m_pDepthStreamHandle, pImageFrame);
+    hr = m_pNuiSensor->NuiImageStreamReleaseFrame(m_pDepthStreamHandle, &imageFrame);
 }
 
-void KinectSensor::GotSkeletonAlert()
+// The only copy on the acquisition path: from the locked NUI texture into a
+// pooled frame that is then handed to every consumer by reference. A region
+// frame only takes its part of the texture.
+bool KinectSensor::CopyLockedRect(FrameRef& slot, const NUI_LOCKED_RECT& lockedRect, const NUI_IMAGE_FRAME* pImageFrame)
 {
-    NUI_SKELETON_FRAME SkeletonFrame = {0};
-
-    bool hr = NuiSkeletonGetNextFrame(0, &SkeletonFrame);
-    if(FAILED(hr))
+    if (!slot)
     {
-        return;
+        return false;
     }
 
-    for( int i = 0 ; i < NUI_SKELETON_COUNT ; i++ )
+    UINT bytesPerPixel = FrameFormatBytesPerPixel(slot->GetFormat());
+    UINT left = slot->GetOffsetX() * bytesPerPixel;
+    UINT top = slot->GetOffsetY();
+    UINT textureRows = lockedRect.size / lockedRect.Pitch;
+    if (left >= UINT(lockedRect.Pitch) || top >= textureRows)
     {
-        if( SkeletonFrame.SkeletonData[i].eTrackingState == NUI_SKELETON_TRACKED &&
-            NUI_SKELETON_POSITION_TRACKED == SkeletonFrame.SkeletonData[i].eSkeletonPositionTrackingState[NUI_SKELETON_POSITION_HEAD] &&
-            NUI_SKELETON_POSITION_TRACKED == SkeletonFrame.SkeletonData[i].eSkeletonPositionTrackingState[NUI_SKELETON_POSITION_SHOULDER_CENTER])
-        {
-            m_SkeletonTracked[i] = true;
-            m_HeadPoint[i].x = SkeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HEAD].x;
-            m_HeadPoint[i].y = SkeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HEAD].y;
-            m_HeadPoint[i].z = SkeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HEAD].z;
-            m_NeckPoint[i].x = SkeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_SHOULDER_CENTER].x;
-            m_NeckPoint[i].y = SkeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_SHOULDER_CENTER].y;
-            m_NeckPoint[i].z = SkeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_SHOULDER_CENTER].z;
-        }
-        else
-        {
-            m_HeadPoint[i] = m_NeckPoint[i] = FT_VECTOR3D(0, 0, 0);
-            m_SkeletonTracked[i] = false;
-        }
+        return false;
     }
+    UINT rowBytes = min(slot->GetWidth() * bytesPerPixel, UINT(lockedRect.Pitch) - left);
+    UINT rows = min(slot->GetHeight(), textureRows - top);
+    const BYTE* pSource = lockedRect.pBits + top * lockedRect.Pitch + left;
+    for (UINT y = 0; y < rows; ++y)
+    {
+        memcpy(slot->GetBuffer() + y * slot->GetStride(), pSource + y * lockedRect.Pitch, rowBytes);
+    }
+    slot->SetTimestamp(pImageFrame->liTimeStamp.QuadPart * 1000, pImageFrame->dwFrameNumber);
+    return true;
 }
 
-bool KinectSensor::GetClosestHint(FT_VECTOR3D* pHint3D)
+void KinectSensor::GotSkeletonAlert()
 {
-    int selectedSkeleton = -1;
-    float smallestDistance = 0;
+    NUI_SKELETON_FRAME NuiSkeletonFrame = {0};
 
-    if (pHint3D[1].x == 0 && pHint3D[1].y == 0 && pHint3D[1].z == 0)
+    HRESULT hr = m_pNuiSensor->NuiSkeletonGetNextFrame(0, &NuiSkeletonFrame);
+    if(FAILED(hr))
     {
-        // Get the skeleton closest to the camera
-        for (int i = 0 ; i < NUI_SKELETON_COUNT ; i++ )
-        {
-            if (m_SkeletonTracked[i] && (smallestDistance == 0 || m_HeadPoint[i].z < smallestDistance))
-            {
-                smallestDistance = m_HeadPoint[i].z;
-                selectedSkeleton = i;
-            }
-        }
+        return;
     }
-    else
-    {   // Get the skeleton closest to the previous position
-        for (int i = 0 ; i < NUI_SKELETON_COUNT ; i++ )
+
+    SkeletonFrame& frame = BeginSkeletonFrame();
+    frame.timestamp = NuiSkeletonFrame.liTimeStamp.QuadPart * 1000;
+    frame.frameNumber = NuiSkeletonFrame.dwFrameNumber;
+
+    for( int i = 0 ; i < NUI_SKELETON_COUNT ; i++ )
+    {
+        const NUI_SKELETON_DATA& skeleton = NuiSkeletonFrame.SkeletonData[i];
+
+        // Usable as a face tracking hint only if both head and neck are really tracked
+        frame.tracked[i] = skeleton.eTrackingState == NUI_SKELETON_TRACKED &&
+            NUI_SKELETON_POSITION_TRACKED == skeleton.eSkeletonPositionTrackingState[NUI_SKELETON_POSITION_HEAD] &&
+            NUI_SKELETON_POSITION_TRACKED == skeleton.eSkeletonPositionTrackingState[NUI_SKELETON_POSITION_SHOULDER_CENTER];
+
+        for (int j = 0; j < NUI_SKELETON_POSITION_COUNT; ++j)
         {
-            if (m_SkeletonTracked[i])
-            {
-                float d = fabs(m_HeadPoint[i].x - pHint3D[1].x) +
-                    fabs(m_HeadPoint[i].y - pHint3D[1].y) +
-                    fabs(m_HeadPoint[i].z - pHint3D[1].z);
-                if (smallestDistance == 0 || d < smallestDistance)
-                {
-                    smallestDistance = d;
-                    selectedSkeleton = i;
-                }
-            }
+            bool valid = skeleton.eTrackingState == NUI_SKELETON_TRACKED;
+            frame.joints[i][j].x = valid ? skeleton.SkeletonPositions[j].x : 0;
+            frame.joints[i][j].y = valid ? skeleton.SkeletonPositions[j].y : 0;
+            frame.joints[i][j].z = valid ? skeleton.SkeletonPositions[j].z : 0;
+            frame.jointState[i][j] = valid ? (unsigned char)skeleton.eSkeletonPositionTrackingState[j] : (unsigned char)JOINT_NOT_TRACKED;
         }
     }
-    if (selectedSkeleton == -1)
-    {
-        return false;
-    }
 
-    pHint3D[0] = m_NeckPoint[selectedSkeleton];
-    pHint3D[1] = m_HeadPoint[selectedSkeleton];
-
-    return true;
+    PublishSkeletonFrame();
 }
-
@@ -8,49 +8,57 @@
 
 #include <FaceTrackLib.h>
 #include <NuiApi.h>
+#include "DepthRegistration.h"
+#include "FrameSource.h"
+#include "StreamDispatcher.h"
 
-class KinectSensor
+// Kinect for Windows backend of IFrameSource. Each of the color, depth and
+// skeleton streams has a worker thread that copies its frames into the shared
+// frame exchange as soon as the NUI runtime signals them.
+//
+// Every instance drives the sensor with the given index, so several sensors
+// can run side by side, each with its own stream workers. The runtime tracks
+// skeletons on one sensor per process only; turn it off on the others.
+class KinectSensor : public FrameSourceBase
 {
 public:
-    KinectSensor();
+    explicit KinectSensor(int sensorIndex = 0);
     ~KinectSensor();
 
+    static int GetSensorCount();    // connected sensors
+    int GetSensorIndex() { return(m_SensorIndex); };
+    void SetSkeletonTracking(bool enable) { m_SkeletonTracking = enable; };    // takes effect on Init()
+
     void Init();
     void Release();
+    bool SetProfile(SensorProfileId profile);
 
-    IFTImage*   GetVideoBuffer(){ return(m_VideoBuffer); };
-    IFTImage*   GetDepthBuffer(){ return(m_DepthBuffer); };
-    float       GetZoomFactor() { return(m_ZoomFactor); };
-    POINT*      GetViewOffSet() { return(&m_ViewOffset); };
-    bool        GetClosestHint(FT_VECTOR3D* pHint3D);
+    // Depth to color tables for the current profile from the sensor's factory
+    // calibration. Queries the runtime for every depth pixel, so call it once
+    // after Init() and after each profile change, not per frame.
+    bool BuildRegistration(DepthRegistration& registration);
 
-    bool        IsTracked(UINT skeletonId) { return(m_SkeletonTracked[skeletonId]);};
-    FT_VECTOR3D NeckPoint(UINT skeletonId) { return(m_NeckPoint[skeletonId]);};
-    FT_VECTOR3D HeadPoint(UINT skeletonId) { return(m_HeadPoint[skeletonId]);};
+    // Event to frame ready latency of the "depth", "color" and "skeleton" streams
+    StreamDispatcher& GetDispatcher() { return(m_Dispatcher); };
 
 private:
-    IFTImage*   m_VideoBuffer;
-    IFTImage*   m_DepthBuffer;
-    FT_VECTOR3D m_NeckPoint[NUI_SKELETON_COUNT];
-    FT_VECTOR3D m_HeadPoint[NUI_SKELETON_COUNT];
-    bool        m_SkeletonTracked[NUI_SKELETON_COUNT];
-    FLOAT       m_ZoomFactor;   // video frame zoom factor (it is 1.0f if there is no zoom)
-    POINT       m_ViewOffset;   // Offset of the view from the top left corner.
-
-    HANDLE      m_hNextDepthFrameEvent;
-    HANDLE      m_hNextVideoFrameEvent;
-    HANDLE      m_hNextSkeletonEvent;
+    int         m_SensorIndex;
+    bool        m_SkeletonTracking;
+    INuiSensor* m_pNuiSensor;
+    StreamDispatcher m_Dispatcher;
+    int         m_DepthStream;
+    int         m_VideoStream;
+    int         m_SkeletonStream;
     HANDLE      m_pDepthStreamHandle;
     HANDLE      m_pVideoStreamHandle;
-    HANDLE      m_hThNuiProcess;
-    HANDLE      m_hEvNuiProcessStop;
 
     bool        m_bNuiInitialized; 
     int         m_FramesTotal;
     int         m_SkeletonTotal;
     
-    static DWORD WINAPI ProcessThread(PVOID pParam);
+    bool OpenStreams();
     void GotVideoAlert();
     void GotDepthAlert();
     void GotSkeletonAlert();
+    bool CopyLockedRect(FrameRef& slot, const NUI_LOCKED_RECT& lockedRect, const NUI_IMAGE_FRAME* pImageFrame);
 };
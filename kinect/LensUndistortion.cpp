@@ -0,0 +1,436 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="LensUndistortion.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "LensUndistortion.h"
+#include "FrameSource.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+
+// Tap x of pixels whose source is outside the image
+static const short Outside = -32768;
+
+LensCalibration NominalColorLens()
+{
+    LensCalibration lens;
+    lens.width = 640;
+    lens.height = 480;
+    lens.focalX = NOMINAL_COLOR_FOCAL_LENGTH;
+    lens.focalY = NOMINAL_COLOR_FOCAL_LENGTH;
+    lens.centerX = 320.0f;
+    lens.centerY = 240.0f;
+    lens.k1 = 0.20f;
+    lens.k2 = -0.45f;
+    lens.k3 = 0.35f;
+    lens.p1 = 0.0f;
+    lens.p2 = 0.0f;
+    return lens;
+}
+
+LensCalibration NominalDepthLens()
+{
+    LensCalibration lens;
+    lens.width = 320;
+    lens.height = 240;
+    lens.focalX = NOMINAL_DEPTH_FOCAL_LENGTH;
+    lens.focalY = NOMINAL_DEPTH_FOCAL_LENGTH;
+    lens.centerX = 160.0f;
+    lens.centerY = 120.0f;
+    lens.k1 = -0.10f;
+    lens.k2 = 0.35f;
+    lens.k3 = 0.0f;
+    lens.p1 = 0.0f;
+    lens.p2 = 0.0f;
+    return lens;
+}
+
+LensUndistorter::LensUndistorter()
+{
+    m_Calibration = NominalColorLens();
+    m_FullWidth = 0;
+    m_FullHeight = 0;
+    m_Format = FRAME_FORMAT_INVALID;
+}
+
+void LensUndistorter::SetCalibration(const LensCalibration& calibration)
+{
+    m_Calibration = calibration;
+    m_FullWidth = 0;    // rebuilt with the next frame
+}
+
+bool LensUndistorter::Build(unsigned int fullWidth, unsigned int fullHeight, FrameFormat format)
+{
+    if (fullWidth > 32767 || fullHeight > 32767 || !m_Calibration.width || !m_Calibration.height)
+    {
+        return false;
+    }
+    m_FullWidth = fullWidth;
+    m_FullHeight = fullHeight;
+    m_Format = format;
+    size_t size = size_t(fullWidth) * fullHeight;
+    m_TapX.resize(size);
+    m_TapY.resize(size);
+    m_TapA.assign(size, 0);
+    m_TapB.assign(size, 0);
+
+    double scaleX = double(fullWidth) / m_Calibration.width;
+    double scaleY = double(fullHeight) / m_Calibration.height;
+    double fx = m_Calibration.focalX * scaleX;
+    double fy = m_Calibration.focalY * scaleY;
+    double cx = m_Calibration.centerX * scaleX;
+    double cy = m_Calibration.centerY * scaleY;
+    const LensCalibration& c = m_Calibration;
+    bool nearest = format != FRAME_FORMAT_B8G8R8X8;
+
+    size_t i = 0;
+    for (unsigned int v = 0; v < fullHeight; ++v)
+    {
+        for (unsigned int u = 0; u < fullWidth; ++u, ++i)
+        {
+            // Where the lens put the point this pixel would see through a pinhole
+            double xn = (u - cx) / fx;
+            double yn = (v - cy) / fy;
+            double r2 = xn * xn + yn * yn;
+            double radial = 1 + r2 * (c.k1 + r2 * (c.k2 + r2 * c.k3));
+            double xd = xn * radial + 2 * c.p1 * xn * yn + c.p2 * (r2 + 2 * xn * xn);
+            double yd = yn * radial + c.p1 * (r2 + 2 * yn * yn) + 2 * c.p2 * xn * yn;
+            double su = fx * xd + cx;
+            double sv = fy * yd + cy;
+
+            if (nearest)
+            {
+                double x = floor(su + 0.5);
+                double y = floor(sv + 0.5);
+                bool inside = x >= 0 && y >= 0 && x < fullWidth && y < fullHeight;
+                m_TapX[i] = inside ? short(x) : Outside;
+                m_TapY[i] = inside ? short(y) : 0;
+                continue;
+            }
+
+            // Within a pixel of the image the edge pixels are stretched
+            if (su <= -1 || sv <= -1 || su >= fullWidth || sv >= fullHeight)
+            {
+                m_TapX[i] = Outside;
+                m_TapY[i] = 0;
+                continue;
+            }
+            double x = floor(su);
+            double y = floor(sv);
+            int a = int((su - x) * 16 + 0.5);
+            int b = int((sv - y) * 16 + 0.5);
+            if (a == 16)
+            {
+                x += 1;
+                a = 0;
+            }
+            if (b == 16)
+            {
+                y += 1;
+                b = 0;
+            }
+            m_TapX[i] = short(x);
+            m_TapY[i] = short(y);
+            m_TapA[i] = (unsigned char)a;
+            m_TapB[i] = (unsigned char)b;
+        }
+    }
+    m_Pool.Init(fullWidth, fullHeight, format, 4);
+    return true;
+}
+
+// Bilinear weights in 1/256 of the four pixels, top left to bottom right.
+static inline void TapWeights(unsigned int a, unsigned int b, unsigned int weights[4])
+{
+    weights[0] = (16 - a) * (16 - b);
+    weights[1] = a * (16 - b);
+    weights[2] = (16 - a) * b;
+    weights[3] = a * b;
+}
+
+// Each source pixel clamped into the input, for taps at its edges. pIn
+// coordinates.
+static unsigned int ClampedBilinearPixel(Frame* pIn, int x, int y, unsigned int a, unsigned int b)
+{
+    int width = pIn->GetWidth();
+    int height = pIn->GetHeight();
+    int x0 = std::min(std::max(x, 0), width - 1);
+    int x1 = std::min(std::max(x + 1, 0), width - 1);
+    int y0 = std::min(std::max(y, 0), height - 1);
+    int y1 = std::min(std::max(y + 1, 0), height - 1);
+    const unsigned char* pTop = pIn->GetBuffer() + y0 * pIn->GetStride();
+    const unsigned char* pBottom = pIn->GetBuffer() + y1 * pIn->GetStride();
+    unsigned int weights[4];
+    TapWeights(a, b, weights);
+    unsigned int pixel = 0;
+    for (int channel = 0; channel < 4; ++channel)
+    {
+        unsigned int sum = pTop[x0 * 4 + channel] * weights[0] + pTop[x1 * 4 + channel] * weights[1] +
+            pBottom[x0 * 4 + channel] * weights[2] + pBottom[x1 * 4 + channel] * weights[3];
+        pixel |= ((sum + 128) >> 8) << (channel * 8);
+    }
+    return pixel;
+}
+
+// ClampedBilinearPixel of count taps, black outside the image.
+static void ClampedPixels(Frame* pIn, const short* pTapX, const short* pTapY, const unsigned char* pTapA, const unsigned char* pTapB,
+    unsigned int count, unsigned int* pOut)
+{
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        pOut[i] = pTapX[i] == Outside ? 0 :
+            ClampedBilinearPixel(pIn, pTapX[i] - int(pIn->GetOffsetX()), pTapY[i] - int(pIn->GetOffsetY()), pTapA[i], pTapB[i]);
+    }
+}
+
+#if defined(KINECT_AVX2)
+// Blends the pixel pairs of four taps, left and right in each 64 bit lane,
+// with the weights of the taps in the same layout. B and R, then G and X, are
+// two 16 bit lanes each; products and sums fit them, 255 * 256 at most. The
+// tap's pixel ends up in the low half of the lane.
+static inline __m256i BlendPairs(__m256i top, __m256i bottom, __m256i topWeights, __m256i bottomWeights)
+{
+    const __m256i lowByte = _mm256_set1_epi16(0x00FF);
+    __m256i low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_and_si256(top, lowByte), topWeights),
+        _mm256_mullo_epi16(_mm256_and_si256(bottom, lowByte), bottomWeights));
+    __m256i high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_srli_epi16(top, 8), topWeights),
+        _mm256_mullo_epi16(_mm256_srli_epi16(bottom, 8), bottomWeights));
+    low = _mm256_add_epi16(_mm256_add_epi16(low, _mm256_srli_epi64(low, 32)), _mm256_set1_epi16(128));
+    high = _mm256_add_epi16(_mm256_add_epi16(high, _mm256_srli_epi64(high, 32)), _mm256_set1_epi16(128));
+    return _mm256_or_si256(_mm256_srli_epi16(low, 8), _mm256_andnot_si256(lowByte, high));
+}
+#elif defined(KINECT_SSE2)
+// Four taps, as the AVX2 version.
+static inline __m128i BlendPixels(__m128i topLeft, __m128i topRight, __m128i bottomLeft, __m128i bottomRight, __m128i a, __m128i b)
+{
+    const __m128i sixteen = _mm_set1_epi32(16);
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+    const __m128i round = _mm_set1_epi16(128);
+    __m128i left = _mm_sub_epi32(sixteen, a);
+    __m128i up = _mm_sub_epi32(sixteen, b);
+    __m128i w[4] = { _mm_mullo_epi16(left, up), _mm_mullo_epi16(a, up), _mm_mullo_epi16(left, b), _mm_mullo_epi16(a, b) };
+    __m128i pixels[4] = { topLeft, topRight, bottomLeft, bottomRight };
+    __m128i low = round, high = round;
+    for (int i = 0; i < 4; ++i)
+    {
+        __m128i weight = _mm_or_si128(w[i], _mm_slli_epi32(w[i], 16));
+        low = _mm_add_epi16(low, _mm_mullo_epi16(_mm_and_si128(pixels[i], lowByte), weight));
+        high = _mm_add_epi16(high, _mm_mullo_epi16(_mm_srli_epi16(pixels[i], 8), weight));
+    }
+    return _mm_or_si128(_mm_srli_epi16(low, 8), _mm_andnot_si128(lowByte, high));
+}
+#endif
+
+void LensUndistorter::RemapColor(Frame* pIn, Frame* pOut)
+{
+    int inX = pIn->GetOffsetX();
+    int inY = pIn->GetOffsetY();
+    // Taps whose 2x2 pixels are all inside the input need no clamping
+    unsigned int innerWidth = pIn->GetWidth() - 1;
+    unsigned int innerHeight = pIn->GetHeight() - 1;
+    unsigned int stride = pIn->GetStride();
+    const unsigned char* pBuffer = pIn->GetBuffer();
+#if defined(KINECT_AVX2)
+    const __m256i sign = _mm256_set1_epi32(int(0x80000000));
+    const __m256i origin = _mm256_set_epi32(inY, inX, inY, inX, inY, inX, inY, inX);
+    const __m256i inner = _mm256_xor_si256(_mm256_set_epi32(innerHeight, innerWidth, innerHeight, innerWidth,
+        innerHeight, innerWidth, innerHeight, innerWidth), sign);
+    const __m256i strides = _mm256_set_epi32(stride, 4, stride, 4, stride, 4, stride, 4);
+    const __m256i sixteen = _mm256_set1_epi32(16);
+#endif
+
+    for (unsigned int y = 0; y < pOut->GetHeight(); ++y)
+    {
+        size_t tap = size_t(y + pOut->GetOffsetY()) * m_FullWidth + pOut->GetOffsetX();
+        const short* pTapX = &m_TapX[tap];
+        const short* pTapY = &m_TapY[tap];
+        const unsigned char* pTapA = &m_TapA[tap];
+        const unsigned char* pTapB = &m_TapB[tap];
+        unsigned int* pRow = (unsigned int*)(pOut->GetBuffer() + y * pOut->GetStride());
+        unsigned int x = 0;
+#if defined(KINECT_AVX2)
+        for (; x + 8 <= pOut->GetWidth(); x += 8)
+        {
+            // x and y of the taps interleaved, four pairs per 128 bit lane
+            __m128i tx = _mm_loadu_si128((const __m128i*)(pTapX + x));
+            __m128i ty = _mm_loadu_si128((const __m128i*)(pTapY + x));
+            __m256i xy = _mm256_sub_epi32(_mm256_cvtepi16_epi32(_mm_unpacklo_epi16(tx, ty)), origin);
+            __m256i xy2 = _mm256_sub_epi32(_mm256_cvtepi16_epi32(_mm_unpackhi_epi16(tx, ty)), origin);
+            // Unsigned compares: negative coordinates are large
+            __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi32(inner, _mm256_xor_si256(xy, sign)),
+                _mm256_cmpgt_epi32(inner, _mm256_xor_si256(xy2, sign)));
+            if (_mm256_movemask_epi8(inside) != -1)
+            {
+                ClampedPixels(pIn, pTapX + x, pTapY + x, pTapA + x, pTapB + x, 8, pRow + x);
+                continue;
+            }
+            // Byte offsets y * stride + x * 4, the pairs summed
+            // Byte offsets y * stride + x * 4, the pairs summed: taps 0, 1, 4 and 5
+            // in the low lane, 2, 3, 6 and 7 in the high one
+            __m256i offsets = _mm256_hadd_epi32(_mm256_mullo_epi32(xy, strides), _mm256_mullo_epi32(xy2, strides));
+            __m128i offsetsLow = _mm256_castsi256_si128(offsets);
+            __m128i offsetsHigh = _mm256_extracti128_si256(offsets, 1);
+
+            // Weights in 1/256, in both 16 bit halves of each tap's 32 bit lane
+            __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(pTapA + x)));
+            __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(pTapB + x)));
+            __m256i left = _mm256_sub_epi32(sixteen, a);
+            __m256i up = _mm256_sub_epi32(sixteen, b);
+            __m256i w[4] = { _mm256_mullo_epi16(left, up), _mm256_mullo_epi16(a, up), _mm256_mullo_epi16(left, b), _mm256_mullo_epi16(a, b) };
+            for (int i = 0; i < 4; ++i)
+            {
+                w[i] = _mm256_or_si256(w[i], _mm256_slli_epi32(w[i], 16));
+            }
+
+            // Both pixels of a row in one 64 bit gather element
+            __m256i first = BlendPairs(_mm256_i32gather_epi64((const long long*)pBuffer, offsetsLow, 1),
+                _mm256_i32gather_epi64((const long long*)(pBuffer + stride), offsetsLow, 1),
+                _mm256_unpacklo_epi32(w[0], w[1]), _mm256_unpacklo_epi32(w[2], w[3]));
+            __m256i second = BlendPairs(_mm256_i32gather_epi64((const long long*)pBuffer, offsetsHigh, 1),
+                _mm256_i32gather_epi64((const long long*)(pBuffer + stride), offsetsHigh, 1),
+                _mm256_unpackhi_epi32(w[0], w[1]), _mm256_unpackhi_epi32(w[2], w[3]));
+            __m256 pixels = _mm256_shuffle_ps(_mm256_castsi256_ps(first), _mm256_castsi256_ps(second), _MM_SHUFFLE(2, 0, 2, 0));
+            _mm256_storeu_si256((__m256i*)(pRow + x), _mm256_castps_si256(pixels));
+        }
+#elif defined(KINECT_SSE2)
+        const size_t corners[4] = { 0, 4, stride, stride + 4 };
+        for (; x + 4 <= pOut->GetWidth(); x += 4)
+        {
+            const unsigned char* p[4];
+            bool inside = true;
+            for (unsigned int i = 0; i < 4; ++i)
+            {
+                unsigned int sx = pTapX[x + i] - inX;
+                unsigned int sy = pTapY[x + i] - inY;
+                inside = inside && sx < innerWidth && sy < innerHeight;
+                p[i] = pBuffer + sy * stride + sx * 4;
+            }
+            if (!inside)
+            {
+                ClampedPixels(pIn, pTapX + x, pTapY + x, pTapA + x, pTapB + x, 4, pRow + x);
+                continue;
+            }
+            __m128i pixels[4];
+            for (unsigned int i = 0; i < 4; ++i)
+            {
+                pixels[i] = _mm_setr_epi32(*(const int*)(p[0] + corners[i]), *(const int*)(p[1] + corners[i]),
+                    *(const int*)(p[2] + corners[i]), *(const int*)(p[3] + corners[i]));
+            }
+            __m128i a = _mm_setr_epi32(pTapA[x], pTapA[x + 1], pTapA[x + 2], pTapA[x + 3]);
+            __m128i b = _mm_setr_epi32(pTapB[x], pTapB[x + 1], pTapB[x + 2], pTapB[x + 3]);
+            _mm_storeu_si128((__m128i*)(pRow + x), BlendPixels(pixels[0], pixels[1], pixels[2], pixels[3], a, b));
+        }
+#endif
+        ClampedPixels(pIn, pTapX + x, pTapY + x, pTapA + x, pTapB + x, pOut->GetWidth() - x, pRow + x);
+    }
+}
+
+void LensUndistorter::RemapDepth(Frame* pIn, Frame* pOut)
+{
+    int inX = pIn->GetOffsetX();
+    int inY = pIn->GetOffsetY();
+    int width = pIn->GetWidth();
+    int height = pIn->GetHeight();
+    unsigned int stride = pIn->GetStride();
+    const unsigned char* pBuffer = pIn->GetBuffer();
+#if defined(KINECT_AVX2)
+    // A tap in the last column would gather two bytes past the input
+    const __m256i sign = _mm256_set1_epi32(int(0x80000000));
+    const __m256i origin = _mm256_set_epi32(inY, inX, inY, inX, inY, inX, inY, inX);
+    const __m256i inner = _mm256_xor_si256(_mm256_set_epi32(height, width - 1, height, width - 1,
+        height, width - 1, height, width - 1), sign);
+    const __m256i strides = _mm256_set_epi32(stride, 2, stride, 2, stride, 2, stride, 2);
+#endif
+
+    for (unsigned int y = 0; y < pOut->GetHeight(); ++y)
+    {
+        size_t tap = size_t(y + pOut->GetOffsetY()) * m_FullWidth + pOut->GetOffsetX();
+        const short* pTapX = &m_TapX[tap];
+        const short* pTapY = &m_TapY[tap];
+        unsigned short* pRow = (unsigned short*)(pOut->GetBuffer() + y * pOut->GetStride());
+        unsigned int x = 0;
+#if defined(KINECT_AVX2)
+        for (; x + 8 <= pOut->GetWidth(); x += 8)
+        {
+            __m128i tx = _mm_loadu_si128((const __m128i*)(pTapX + x));
+            __m128i ty = _mm_loadu_si128((const __m128i*)(pTapY + x));
+            __m256i xy = _mm256_sub_epi32(_mm256_cvtepi16_epi32(_mm_unpacklo_epi16(tx, ty)), origin);
+            __m256i xy2 = _mm256_sub_epi32(_mm256_cvtepi16_epi32(_mm_unpackhi_epi16(tx, ty)), origin);
+            __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi32(inner, _mm256_xor_si256(xy, sign)),
+                _mm256_cmpgt_epi32(inner, _mm256_xor_si256(xy2, sign)));
+            if (_mm256_movemask_epi8(inside) != -1)
+            {
+                break;
+            }
+            __m256i offsets = _mm256_hadd_epi32(_mm256_mullo_epi32(xy, strides), _mm256_mullo_epi32(xy2, strides));
+            offsets = _mm256_permute4x64_epi64(offsets, 0xD8);
+            __m256i depth = _mm256_and_si256(_mm256_i32gather_epi32((const int*)pBuffer, offsets, 1), _mm256_set1_epi32(0xFFFF));
+            depth = _mm256_permute4x64_epi64(_mm256_packus_epi32(depth, depth), 0x08);
+            _mm_storeu_si128((__m128i*)(pRow + x), _mm256_castsi256_si128(depth));
+        }
+#endif
+        for (; x < pOut->GetWidth(); ++x)
+        {
+            if (pTapX[x] == Outside)
+            {
+                pRow[x] = 0;
+                continue;
+            }
+            int sx = std::min(std::max(pTapX[x] - inX, 0), width - 1);
+            int sy = std::min(std::max(pTapY[x] - inY, 0), height - 1);
+            pRow[x] = ((const unsigned short*)(pBuffer + sy * stride))[sx];
+        }
+    }
+}
+
+bool LensUndistorter::Remap(Frame* pIn, Frame* pOut)
+{
+    FrameFormat format = pIn->GetFormat();
+    if ((format != FRAME_FORMAT_B8G8R8X8 && format != FRAME_FORMAT_D13P3 && format != FRAME_FORMAT_D16) ||
+        pOut->GetFormat() != format || pOut->GetFullWidth() != pIn->GetFullWidth() || pOut->GetFullHeight() != pIn->GetFullHeight())
+    {
+        return false;
+    }
+    if ((pIn->GetFullWidth() != m_FullWidth || pIn->GetFullHeight() != m_FullHeight || format != m_Format) &&
+        !Build(pIn->GetFullWidth(), pIn->GetFullHeight(), format))
+    {
+        return false;
+    }
+
+    if (format == FRAME_FORMAT_B8G8R8X8)
+    {
+        RemapColor(pIn, pOut);
+    }
+    else
+    {
+        RemapDepth(pIn, pOut);
+    }
+    pOut->SetTimestamp(pIn->GetTimestamp(), pIn->GetFrameNumber());
+    return true;
+}
+
+bool LensUndistorter::Apply(Frame* pIn, FrameRef& undistorted)
+{
+    FrameFormat format = pIn->GetFormat();
+    if (format != FRAME_FORMAT_B8G8R8X8 && format != FRAME_FORMAT_D13P3 && format != FRAME_FORMAT_D16)
+    {
+        return false;
+    }
+    if ((pIn->GetFullWidth() != m_FullWidth || pIn->GetFullHeight() != m_FullHeight || format != m_Format) &&
+        !Build(pIn->GetFullWidth(), pIn->GetFullHeight(), format))
+    {
+        return false;
+    }
+
+    undistorted = m_Pool.Acquire();
+    if (!undistorted || (pIn->IsRegion() &&
+        !undistorted->SetRegion(pIn->GetOffsetX(), pIn->GetOffsetY(), pIn->GetWidth(), pIn->GetHeight())) ||
+        !Remap(pIn, undistorted.Get()))
+    {
+        undistorted.Reset();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="LensUndistortion.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+#include <vector>
+
+// Pinhole intrinsics and Brown-Conrady distortion of a camera. Focal lengths
+// and center are in pixels at width x height; frames of other resolutions of
+// the same camera use them scaled.
+struct LensCalibration
+{
+    unsigned int    width;
+    unsigned int    height;
+    float           focalX;
+    float           focalY;
+    float           centerX;
+    float           centerY;
+    float           k1;         // radial
+    float           k2;
+    float           k3;
+    float           p1;         // tangential
+    float           p2;
+};
+
+// Nominal intrinsics with distortion typical of Kinect for Windows cameras,
+// for 640x480 color and 320x240 depth. A calibration of the unit at hand
+// does better.
+LensCalibration NominalColorLens();
+LensCalibration NominalDepthLens();
+
+// Removes lens distortion from frames, keeping their intrinsics. The source
+// position of every pixel is computed once per resolution into a table of
+// fixed point taps: the top left source pixel and the position within it in
+// 1/16 pixels. Color frames are then the weighted sum of four BGRX pixels per
+// pixel, computed in 16 bit lanes with the channels split into two pairs;
+// AVX2 gathers the pixels of eight taps at a time. Depth is not interpolated,
+// which would invent depths across edges and mix player indices; its taps
+// are the nearest source pixel.
+//
+// Only the pixels of the output frame are computed, so undistorting a region
+// around the head costs a fraction of the whole frame. Taps that fall outside
+// a region input take its edge pixels; those outside the image are black.
+class LensUndistorter
+{
+public:
+    LensUndistorter();
+
+    void SetCalibration(const LensCalibration& calibration);
+    const LensCalibration& GetCalibration() { return(m_Calibration); };
+
+    // Undistorts a FRAME_FORMAT_B8G8R8X8, D13P3 or D16 frame, whole or region,
+    // into a frame from the undistorter's pool with the same geometry and
+    // timestamp. False for other formats.
+    bool Apply(Frame* pIn, FrameRef& undistorted);
+    // Undistorts into the caller's pOut, of pIn's format and full size, whose
+    // geometry chooses the pixels computed.
+    bool Remap(Frame* pIn, Frame* pOut);
+
+private:
+    bool Build(unsigned int fullWidth, unsigned int fullHeight, FrameFormat format);
+    void RemapColor(Frame* pIn, Frame* pOut);
+    void RemapDepth(Frame* pIn, Frame* pOut);
+
+    LensCalibration             m_Calibration;
+    unsigned int                m_FullWidth;
+    unsigned int                m_FullHeight;
+    FrameFormat                 m_Format;
+    // Taps per pixel of the full image, as planes for vector loads
+    std::vector<short>          m_TapX;     // top left source pixel, full image coordinates, -32768 outside it
+    std::vector<short>          m_TapY;
+    std::vector<unsigned char>  m_TapA;     // sixteenths of a pixel right of it, 0 for depth
+    std::vector<unsigned char>  m_TapB;     // and down
+    FramePool                   m_Pool;
+};
@@ -0,0 +1,129 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="MultiSensorTracker.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "MultiSensorTracker.h"
+
+// Upper bound on a tracking thread's sleep, so Destroy() never waits long
+static const unsigned int FrameWaitMilliseconds = 50;
+
+MultiSensorTracker::MultiSensorTracker()
+{
+    m_Stop = false;
+}
+
+MultiSensorTracker::~MultiSensorTracker()
+{
+    Destroy();
+}
+
+bool MultiSensorTracker::Init(unsigned int sensorCount, const std::vector<RigidTransform>& extrinsics)
+{
+    Destroy(); // Deal with double initializations.
+
+    unsigned int connected = (unsigned int)KinectSensor::GetSensorCount();
+    if (!sensorCount || sensorCount > connected)
+    {
+        sensorCount = connected;
+    }
+
+    std::vector<IFrameSource*> sources;
+    for (unsigned int i = 0; i < sensorCount && i < FUSION_MAX_SENSORS; ++i)
+    {
+        KinectSensor* pSensor = new KinectSensor(i);
+        // The runtime tracks skeletons on a single sensor per process
+        pSensor->SetSkeletonTracking(i == 0);
+        pSensor->SetExtrinsics(i < extrinsics.size() ? extrinsics[i] : IdentityTransform());
+        m_OwnedSensors.push_back(pSensor);
+        sources.push_back(pSensor);
+    }
+    return Start(sources);
+}
+
+bool MultiSensorTracker::Init(const std::vector<IFrameSource*>& sources)
+{
+    Destroy(); // Deal with double initializations.
+
+    return Start(sources);
+}
+
+bool MultiSensorTracker::Start(const std::vector<IFrameSource*>& sources)
+{
+    if (sources.empty() || sources.size() > FUSION_MAX_SENSORS)
+    {
+        return false;
+    }
+
+    m_Fusion.Init((unsigned int)sources.size());
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        Tracker* pTracker = new Tracker();
+        m_Trackers.push_back(pTracker);
+        if (!pTracker->Init(sources[i]))
+        {
+            Destroy();
+            return false;
+        }
+    }
+
+    m_Stop = false;
+    for (size_t i = 0; i < m_Trackers.size(); ++i)
+    {
+        m_Threads.push_back(std::thread(&MultiSensorTracker::TrackingThread, this, (unsigned int)i));
+    }
+    return true;
+}
+
+void MultiSensorTracker::Destroy()
+{
+    m_Stop = true;
+    for (size_t i = 0; i < m_Threads.size(); ++i)
+    {
+        m_Threads[i].join();
+    }
+    m_Threads.clear();
+
+    // Trackers release their sources; the sensors we made are ours to delete
+    for (size_t i = 0; i < m_Trackers.size(); ++i)
+    {
+        m_Trackers[i]->Destroy();
+        delete m_Trackers[i];
+    }
+    m_Trackers.clear();
+    for (size_t i = 0; i < m_OwnedSensors.size(); ++i)
+    {
+        delete m_OwnedSensors[i];
+    }
+    m_OwnedSensors.clear();
+}
+
+void MultiSensorTracker::TrackingThread(unsigned int sensor)
+{
+    Tracker* pTracker = m_Trackers[sensor];
+    IFrameSource* pSource = pTracker->GetSource();
+    const RigidTransform& extrinsics = pSource->GetExtrinsics();
+
+    while (!m_Stop)
+    {
+        if (!pTracker->Update())
+        {
+            pSource->WaitFrameSet(FrameWaitMilliseconds);
+            continue;
+        }
+
+        // A lost head publishes zero confidence, so the fusion stops using
+        // this sensor at once instead of when its last estimate gets stale.
+        // A sensor on a fallback estimator counts for less.
+        HeadEstimate estimate = {};
+        HeadPose pose;
+        if (pTracker->GetHeadPose(&pose))
+        {
+            estimate.position = TransformPoint(extrinsics, pose.position);
+            estimate.confidence = pose.confidence * FieldOfViewConfidence(pose.position);
+            estimate.timestamp = pose.frameTimestamp;
+        }
+        m_Fusion.Publish(sensor, estimate);
+    }
+}
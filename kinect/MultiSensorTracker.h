@@ -0,0 +1,49 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="MultiSensorTracker.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "KinectSensor.h"
+#include "SensorFusion.h"
+#include "Tracker.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Tracks the head with several sensors at once and fuses the results into one
+// estimate in rig space. Every sensor has its own stream workers, face tracker
+// and tracking thread, so another sensor adds a core's worth of work but no
+// latency to the others; the fusion only reads the newest estimate of each.
+class MultiSensorTracker
+{
+public:
+    MultiSensorTracker();
+    ~MultiSensorTracker();
+
+    // Drives sensorCount Kinect sensors (0 for all connected ones), sensor i
+    // placed at extrinsics[i], or at the origin if there is no such entry.
+    bool Init(unsigned int sensorCount, const std::vector<RigidTransform>& extrinsics);
+    // Tracks sources the caller owns, placed at their GetExtrinsics().
+    bool Init(const std::vector<IFrameSource*>& sources);
+    void Destroy();
+
+    // Fused head position in rig space; call from one thread.
+    bool GetHead(HeadEstimate* pHead) { return(m_Fusion.Fuse(pHead)); };
+    FusionStats GetFusionStats()      { return(m_Fusion.GetStats()); };
+
+    unsigned int GetSensorCount()     { return((unsigned int)m_Trackers.size()); };
+    Tracker* GetTracker(unsigned int sensor) { return(m_Trackers[sensor]); };
+
+private:
+    std::vector<KinectSensor*>  m_OwnedSensors;
+    std::vector<Tracker*>       m_Trackers;
+    std::vector<std::thread>    m_Threads;
+    std::atomic<bool>           m_Stop;
+    HeadFusion                  m_Fusion;
+
+    bool Start(const std::vector<IFrameSource*>& sources);
+    void TrackingThread(unsigned int sensor);
+};
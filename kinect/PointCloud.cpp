@@ -0,0 +1,132 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="PointCloud.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "PointCloud.h"
+#include "FrameSource.h"
+#include "Simd.h"
+#include <algorithm>
+
+static const unsigned int RayPadding = 8;       // floats the vector loop may read past a row
+
+PointCloudBuilder::PointCloudBuilder()
+{
+    m_Width = 0;
+    m_Height = 0;
+    m_pThreads = NULL;
+}
+
+void PointCloudBuilder::BuildRays(unsigned int width, unsigned int height)
+{
+    m_Width = width;
+    m_Height = height;
+    m_RayX.assign(size_t(width) * height + RayPadding, 0.0f);
+    m_RayY.assign(size_t(width) * height + RayPadding, 0.0f);
+
+    // NuiTransformDepthImageToSkeleton() without the divide
+    float perMillimetre = 0.001f / (NOMINAL_DEPTH_FOCAL_LENGTH * width / 320.0f);
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            m_RayX[y * width + x] = (x - width * 0.5f) * perMillimetre;
+            m_RayY[y * width + x] = -(y - height * 0.5f) * perMillimetre;
+        }
+    }
+    m_Pool.Init(width, height, FRAME_FORMAT_F32, 3);
+}
+
+// Frame rows are padded to whole cache lines, so the vector loops may run on
+// to the next multiple of 8 pixels: plane stores stay aligned and inside
+// the row, and the ray tables are padded for the last row of the image.
+void PointCloudBuilder::BuildRows(Frame* pDepth, PointCloud& cloud, unsigned int begin, unsigned int end)
+{
+    unsigned int shift = pDepth->GetFormat() == FRAME_FORMAT_D13P3 ? 3 : 0;
+    unsigned int width = pDepth->GetWidth();
+    for (unsigned int y = begin; y < end; ++y)
+    {
+        const unsigned short* pDepthRow = (const unsigned short*)(pDepth->GetBuffer() + y * pDepth->GetStride());
+        const float* pRayX = &m_RayX[(y + pDepth->GetOffsetY()) * m_Width + pDepth->GetOffsetX()];
+        const float* pRayY = &m_RayY[(y + pDepth->GetOffsetY()) * m_Width + pDepth->GetOffsetX()];
+        float* pX = (float*)(cloud.x->GetBuffer() + y * cloud.x->GetStride());
+        float* pY = (float*)(cloud.y->GetBuffer() + y * cloud.y->GetStride());
+        float* pZ = (float*)(cloud.z->GetBuffer() + y * cloud.z->GetStride());
+
+        unsigned int x = 0;
+#if defined(KINECT_AVX2)
+        const __m256 meters = _mm256_set1_ps(0.001f);
+        for (; x < width; x += 8)
+        {
+            __m128i raw = _mm_srli_epi16(_mm_load_si128((const __m128i*)(pDepthRow + x)), shift);
+            __m256 z = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(raw));
+            _mm256_store_ps(pX + x, _mm256_mul_ps(z, _mm256_loadu_ps(pRayX + x)));
+            _mm256_store_ps(pY + x, _mm256_mul_ps(z, _mm256_loadu_ps(pRayY + x)));
+            _mm256_store_ps(pZ + x, _mm256_mul_ps(z, meters));
+        }
+#elif defined(KINECT_SSE2)
+        const __m128 meters = _mm_set1_ps(0.001f);
+        const __m128i zero = _mm_setzero_si128();
+        for (; x < width; x += 8)
+        {
+            __m128i raw = _mm_srli_epi16(_mm_load_si128((const __m128i*)(pDepthRow + x)), shift);
+            __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero));
+            __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, zero));
+            _mm_store_ps(pX + x, _mm_mul_ps(lo, _mm_loadu_ps(pRayX + x)));
+            _mm_store_ps(pX + x + 4, _mm_mul_ps(hi, _mm_loadu_ps(pRayX + x + 4)));
+            _mm_store_ps(pY + x, _mm_mul_ps(lo, _mm_loadu_ps(pRayY + x)));
+            _mm_store_ps(pY + x + 4, _mm_mul_ps(hi, _mm_loadu_ps(pRayY + x + 4)));
+            _mm_store_ps(pZ + x, _mm_mul_ps(lo, meters));
+            _mm_store_ps(pZ + x + 4, _mm_mul_ps(hi, meters));
+        }
+#else
+        for (; x < width; ++x)
+        {
+            float z = float(pDepthRow[x] >> shift);
+            pX[x] = z * pRayX[x];
+            pY[x] = z * pRayY[x];
+            pZ[x] = z * 0.001f;
+        }
+#endif
+    }
+}
+
+bool PointCloudBuilder::Build(Frame* pDepth, PointCloud& cloud)
+{
+    if (pDepth->GetFormat() != FRAME_FORMAT_D16 && pDepth->GetFormat() != FRAME_FORMAT_D13P3)
+    {
+        return false;
+    }
+    if (pDepth->GetFullWidth() != m_Width || pDepth->GetFullHeight() != m_Height)
+    {   // New resolution profile
+        BuildRays(pDepth->GetFullWidth(), pDepth->GetFullHeight());
+    }
+
+    FrameRef* planes[3] = { &cloud.x, &cloud.y, &cloud.z };
+    for (int i = 0; i < 3; ++i)
+    {
+        *planes[i] = m_Pool.Acquire();
+        if (!*planes[i] || (pDepth->IsRegion() &&
+            !(*planes[i])->SetRegion(pDepth->GetOffsetX(), pDepth->GetOffsetY(), pDepth->GetWidth(), pDepth->GetHeight())))
+        {
+            return false;
+        }
+        (*planes[i])->SetTimestamp(pDepth->GetTimestamp(), pDepth->GetFrameNumber());
+    }
+
+    unsigned int height = pDepth->GetHeight();
+    unsigned int bands = (height + BandRows - 1) / BandRows;
+    if (m_pThreads && bands > 1)
+    {
+        m_pThreads->Run(bands, [&](unsigned int band)
+        {
+            BuildRows(pDepth, cloud, band * BandRows, std::min(height, (band + 1) * BandRows));
+        });
+    }
+    else
+    {
+        BuildRows(pDepth, cloud, 0, height);
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="PointCloud.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+#include "ThreadPool.h"
+#include <vector>
+
+// Depth frame back-projected to camera space, one FRAME_FORMAT_F32 plane per
+// coordinate, in meters with the skeleton space conventions (x right, y up,
+// z away from the sensor). The planes have the size and region of the depth
+// frame; pixels without depth have z = 0.
+struct PointCloud
+{
+    FrameRef    x;
+    FrameRef    y;
+    FrameRef    z;
+};
+
+// Builds point clouds from depth frames. The ray of every pixel, scaled to
+// meters per millimetre of depth, is kept in a table built from the nominal
+// depth focal length the first time a resolution is seen, so a point costs a
+// conversion and two multiplies. Rows are split into bands run on the thread
+// pool, if one is given, and the planes come from a pool of their own.
+class PointCloudBuilder
+{
+public:
+    PointCloudBuilder();
+
+    void SetThreadPool(ThreadPool* pThreads) { m_pThreads = pThreads; };
+
+    // pDepth is FRAME_FORMAT_D16 or FRAME_FORMAT_D13P3, full frame or region.
+    bool Build(Frame* pDepth, PointCloud& cloud);
+
+private:
+    static const unsigned int BandRows = 32;
+
+    void BuildRays(unsigned int width, unsigned int height);
+    void BuildRows(Frame* pDepth, PointCloud& cloud, unsigned int begin, unsigned int end);
+
+    unsigned int        m_Width;
+    unsigned int        m_Height;
+    std::vector<float>  m_RayX;     // per pixel, plus padding for the vector loop
+    std::vector<float>  m_RayY;
+    FramePool           m_Pool;
+    ThreadPool*         m_pThreads;
+};
@@ -0,0 +1,169 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SensorFusion.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "SensorFusion.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Kinect for Windows field of view, and the band inside its edges where the
+// confidence fades out.
+static const float HalfFovX = 28.5f * 3.14159265f / 180.0f;
+static const float HalfFovY = 21.5f * 3.14159265f / 180.0f;
+static const float EdgeBand = 6.0f * 3.14159265f / 180.0f;
+static const float NearDistance = 2.0f;     // meters, full confidence up to here
+static const float FarDistance = 4.0f;      // half confidence here
+
+// Estimates further than this from the most confident one are outliers.
+static const float FusionGate = 0.25f;      // meters
+static const long long FusionDefaultMaxAge = 100000;    // microseconds, three frames at 30 Hz
+
+float FieldOfViewConfidence(const Point3& p)
+{
+    if (p.z <= 0)
+    {
+        return 0;
+    }
+    float marginX = HalfFovX - fabsf(atan2f(p.x, p.z));
+    float marginY = HalfFovY - fabsf(atan2f(p.y, p.z));
+    float edge = std::max(0.0f, std::min(1.0f, std::min(marginX, marginY) / EdgeBand));
+    float range = p.z <= NearDistance ? 1.0f :
+        std::max(0.0f, 1.0f - 0.5f * (p.z - NearDistance) / (FarDistance - NearDistance));
+    return edge * range;
+}
+
+bool LoadSensorExtrinsics(const char* path, std::vector<RigidTransform>& extrinsics)
+{
+    FILE* pFile = fopen(path, "r");
+    if (!pFile)
+    {
+        return false;
+    }
+
+    extrinsics.clear();
+    char line[512];
+    bool valid = true;
+    while (valid && fgets(line, sizeof(line), pFile))
+    {
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+        {
+            continue;
+        }
+        RigidTransform transform;
+        float* r = &transform.rotation[0][0];
+        float* t = transform.translation;
+        valid = sscanf(p, "%f %f %f %f %f %f %f %f %f %f %f %f",
+            &r[0], &r[1], &r[2], &r[3], &r[4], &r[5], &r[6], &r[7], &r[8], &t[0], &t[1], &t[2]) == 12;
+        extrinsics.push_back(transform);
+    }
+    fclose(pFile);
+    return valid && !extrinsics.empty();
+}
+
+HeadFusion::HeadFusion()
+{
+    m_SensorCount = 0;
+    m_MaxAge = FusionDefaultMaxAge;
+    memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+void HeadFusion::Init(unsigned int sensorCount)
+{
+    m_SensorCount = std::min(sensorCount, FUSION_MAX_SENSORS);
+    for (unsigned int i = 0; i < FUSION_MAX_SENSORS; ++i)
+    {
+        m_Estimates[i].Reset();
+        for (int j = 0; j < 3; ++j)
+        {
+            memset(&m_Estimates[i].Slot(j), 0, sizeof(Entry));
+        }
+    }
+    memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+void HeadFusion::Publish(unsigned int sensor, const HeadEstimate& estimate)
+{
+    if (sensor >= m_SensorCount)
+    {
+        return;
+    }
+    Entry& entry = m_Estimates[sensor].WriteSlot();
+    entry.estimate = estimate;
+    entry.published = FrameClockMicroseconds();
+    m_Estimates[sensor].Publish();
+}
+
+bool HeadFusion::Fuse(HeadEstimate* pHead)
+{
+    // The read slot keeps the last estimate of a sensor that published nothing new
+    long long now = FrameClockMicroseconds();
+    long long newest = 0;
+    const HeadEstimate* pCurrent[FUSION_MAX_SENSORS];
+    int best = -1;
+    for (unsigned int i = 0; i < m_SensorCount; ++i)
+    {
+        m_Estimates[i].Acquire();
+        const Entry& entry = m_Estimates[i].ReadSlot();
+        bool current = entry.estimate.confidence > 0 && now - entry.published <= m_MaxAge;
+        pCurrent[i] = current ? &entry.estimate : NULL;
+        if (current)
+        {
+            newest = std::max(newest, entry.published);
+            if (best < 0 || entry.estimate.confidence > pCurrent[best]->confidence)
+            {
+                best = (int)i;
+            }
+        }
+    }
+    if (best < 0)
+    {
+        return false;
+    }
+
+    const Point3& anchor = pCurrent[best]->position;
+    Point3 sum = { 0, 0, 0 };
+    float weight = 0;
+    float confidence = 0;
+    unsigned int used = 0;
+    for (unsigned int i = 0; i < m_SensorCount; ++i)
+    {
+        const HeadEstimate* pEstimate = pCurrent[i];
+        if (!pEstimate)
+        {
+            continue;
+        }
+        float dx = pEstimate->position.x - anchor.x;
+        float dy = pEstimate->position.y - anchor.y;
+        float dz = pEstimate->position.z - anchor.z;
+        if (dx * dx + dy * dy + dz * dz > FusionGate * FusionGate)
+        {
+            m_Stats.rejected++;
+            continue;
+        }
+        sum.x += pEstimate->confidence * pEstimate->position.x;
+        sum.y += pEstimate->confidence * pEstimate->position.y;
+        sum.z += pEstimate->confidence * pEstimate->position.z;
+        weight += pEstimate->confidence;
+        // Independent sensors agreeing make the result more certain than either
+        confidence = 1 - (1 - confidence) * (1 - pEstimate->confidence);
+        used++;
+    }
+
+    pHead->position.x = sum.x / weight;
+    pHead->position.y = sum.y / weight;
+    pHead->position.z = sum.z / weight;
+    pHead->confidence = confidence;
+    pHead->timestamp = newest;
+    m_Stats.fused++;
+    m_Stats.lastSensors = used;
+    return true;
+}
@@ -0,0 +1,78 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SensorFusion.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FrameSource.h"
+#include "TripleBuffer.h"
+#include <vector>
+
+const unsigned int FUSION_MAX_SENSORS = 8;
+
+// Head position one sensor measured, already in rig space (see
+// IFrameSource::GetExtrinsics).
+struct HeadEstimate
+{
+    Point3          position;       // meters
+    float           confidence;     // 0 = no estimate, 1 = fully trusted
+    long long       timestamp;      // microseconds, of the sensor frame it was measured on;
+                                    // fused estimates carry the FrameClockMicroseconds() time
+                                    // their newest input was published at
+};
+
+struct FusionStats
+{
+    unsigned int    fused;          // estimates handed out by Fuse()
+    unsigned int    lastSensors;    // sensors that contributed to the last one
+    unsigned int    rejected;       // sensor estimates dropped as outliers
+};
+
+// How much to trust a head seen at p (camera space) by a Kinect: fully well
+// inside the field of view, falling to zero at its edges where the face
+// tracker loses the face, and less with distance as depth gets noisy.
+float FieldOfViewConfidence(const Point3& p);
+
+// Reads the rig file: one line per sensor, in sensor index order, with the
+// nine row major rotation values and the three translation values (meters).
+// Lines starting with # are comments.
+bool LoadSensorExtrinsics(const char* path, std::vector<RigidTransform>& extrinsics);
+
+// Merges the head estimates of several sensors into one.
+//
+// Each sensor's tracking thread publishes into its own triple buffer, so the
+// sensors never wait for each other or for the reader. Fuse() takes the newest
+// estimate of every sensor, drops stale ones (by the time they were published,
+// sensors do not share a clock) and those far from the most
+// confident one (a second face, a bad track), and averages the rest weighted
+// by confidence. The work per call is a few operations per sensor.
+class HeadFusion
+{
+public:
+    HeadFusion();
+
+    void Init(unsigned int sensorCount);
+    void SetMaxAge(long long microseconds) { m_MaxAge = microseconds; };
+
+    // Called by the thread of the given sensor only.
+    void Publish(unsigned int sensor, const HeadEstimate& estimate);
+    // Called by one reader thread. False if no sensor has a recent estimate.
+    bool Fuse(HeadEstimate* pHead);
+
+    unsigned int GetSensorCount() { return(m_SensorCount); };
+    FusionStats GetStats() { return(m_Stats); };    // reader thread only
+
+private:
+    struct Entry
+    {
+        HeadEstimate    estimate;
+        long long       published;  // FrameClockMicroseconds()
+    };
+
+    unsigned int                m_SensorCount;
+    long long                   m_MaxAge;
+    TripleBuffer<Entry>         m_Estimates[FUSION_MAX_SENSORS];
+    FusionStats                 m_Stats;
+};
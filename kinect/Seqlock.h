@@ -0,0 +1,96 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="Seqlock.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+// Single writer, any number of readers, nobody ever blocks. The writer bumps a
+// sequence number to odd, writes and bumps it to even; a reader copies the
+// value and keeps the copy only if the sequence was the same even number
+// before and after. Readers retry while a write is in progress, which lasts
+// as long as one copy of T.
+//
+// The value is kept as relaxed atomic words so concurrent reads and writes
+// are well defined; for the trivially copyable types used here that compiles
+// to plain moves.
+template <typename T>
+class Seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock needs a trivially copyable type");
+
+public:
+    Seqlock()
+    {
+        m_Sequence = 0;
+        for (unsigned int i = 0; i < WordCount; ++i)
+        {
+            m_Words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Writer side, one thread only.
+    void Write(const T& value)
+    {
+        unsigned int sequence = m_Sequence.load(std::memory_order_relaxed);
+        m_Sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        const unsigned char* pBytes = reinterpret_cast<const unsigned char*>(&value);
+        for (unsigned int i = 0; i < WordCount; ++i)
+        {
+            unsigned long long word = 0;
+            memcpy(&word, pBytes + i * sizeof(word), ChunkSize(i));
+            m_Words[i].store(word, std::memory_order_relaxed);
+        }
+
+        m_Sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // False if a write was in progress; value may then be torn and must not be used.
+    bool TryRead(T& value) const
+    {
+        unsigned int before = m_Sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            return false;
+        }
+
+        unsigned char* pBytes = reinterpret_cast<unsigned char*>(&value);
+        for (unsigned int i = 0; i < WordCount; ++i)
+        {
+            unsigned long long word = m_Words[i].load(std::memory_order_relaxed);
+            memcpy(pBytes + i * sizeof(word), &word, ChunkSize(i));
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return m_Sequence.load(std::memory_order_relaxed) == before;
+    }
+
+    void Read(T& value) const
+    {
+        while (!TryRead(value))
+        {
+        }
+    }
+
+    // Number of completed writes.
+    unsigned int GetVersion() const { return(m_Sequence.load(std::memory_order_acquire) >> 1); };
+
+private:
+    enum { WordCount = (sizeof(T) + sizeof(unsigned long long) - 1) / sizeof(unsigned long long) };
+
+    static size_t ChunkSize(unsigned int word)
+    {
+        size_t left = sizeof(T) - word * sizeof(unsigned long long);
+        return left < sizeof(unsigned long long) ? left : sizeof(unsigned long long);
+    }
+
+    std::atomic<unsigned int>       m_Sequence;
+    std::atomic<unsigned long long> m_Words[WordCount];
+};
@@ -0,0 +1,72 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SessionFormat.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+// On-disk layout of recorded sessions: a file header followed by one chunk per
+// color, depth or skeleton frame, in the order the sensor delivered them, and
+// an index of all chunks with a fixed size footer at the very end of the file.
+// All fields are little endian.
+
+const unsigned int SESSION_MAGIC = 0x5345534B;   // "KSES"
+const unsigned int SESSION_VERSION = 1;
+const unsigned int SESSION_INDEX_MAGIC = 0x5844494B;   // "KIDX"
+
+enum SessionChunkType
+{
+    SESSION_CHUNK_VIDEO = 1,    // SessionImageHeader + packed rows
+    SESSION_CHUNK_DEPTH,        // SessionImageHeader + packed rows
+    SESSION_CHUNK_SKELETON,     // SkeletonFrame
+    SESSION_CHUNK_DEPTH_CODED,  // SessionImageHeader + DepthCodec stream
+};
+
+#pragma pack(push, 4)
+
+struct SessionFileHeader
+{
+    unsigned int    magic;
+    unsigned int    version;
+    unsigned int    headerSize;     // sizeof(SessionFileHeader), chunks start right after it
+    unsigned int    reserved;
+};
+
+struct SessionChunkHeader
+{
+    unsigned int    type;           // SessionChunkType
+    unsigned int    payloadSize;    // bytes following this header
+    long long       timestamp;      // microseconds
+    unsigned int    frameNumber;
+    unsigned int    region;         // x | y << 16 of a region of interest image (see Frame::IsRegion), else 0
+};
+
+struct SessionImageHeader
+{
+    unsigned int    width;
+    unsigned int    height;
+    unsigned int    format;         // FrameFormat
+    unsigned int    rowBytes;       // rows are stored without padding
+                                    // width and height are the region's for a region frame
+};
+
+// One per chunk, in file order.
+struct SessionIndexEntry
+{
+    long long       timestamp;
+    long long       offset;         // of the SessionChunkHeader from the start of the file
+    unsigned int    type;
+    unsigned int    frameNumber;
+};
+
+// Last bytes of the file. Missing if the recording was cut short, in which case
+// readers rebuild the index by walking the chunks.
+struct SessionFooter
+{
+    unsigned int    magic;          // SESSION_INDEX_MAGIC
+    unsigned int    entryCount;
+    long long       indexOffset;    // of the first SessionIndexEntry
+};
+
+#pragma pack(pop)
@@ -0,0 +1,553 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SessionPlayer.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "SessionPlayer.h"
+#include "DepthCodec.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SessionPlayer::SessionPlayer()
+{
+    m_pData = NULL;
+    m_Size = 0;
+#ifdef _WIN32
+    m_hFile = NULL;
+    m_hMapping = NULL;
+#endif
+    m_StartTime = 0;
+    m_EndTime = 0;
+    m_Mode = SESSION_PLAYBACK_REALTIME;
+    m_Loop = false;
+    m_Stop = false;
+    m_Finished = false;
+    m_Position = 0;
+    m_FramesPlayed = 0;
+    m_SessionTime = 0;
+    m_PlayStart = 0;
+}
+
+SessionPlayer::~SessionPlayer()
+{
+    Close();
+}
+
+bool SessionPlayer::Open(const char* path)
+{
+    Close(); // Deal with double opens.
+
+    if (!MapFile(path))
+    {
+        return false;
+    }
+    if (!LoadIndex())
+    {
+        Close();
+        return false;
+    }
+    BuildStreamIndexes();
+    m_Position = 0;
+    return true;
+}
+
+void SessionPlayer::Close()
+{
+    Release();
+    UnmapFile();
+    m_Index.clear();
+    m_VideoIndex = StreamIndex();
+    m_DepthIndex = StreamIndex();
+    m_SkeletonIndex = StreamIndex();
+}
+
+bool SessionPlayer::MapFile(const char* path)
+{
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE hMapping = NULL;
+    if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0)
+    {
+        hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    if (!hMapping)
+    {
+        CloseHandle(hFile);
+        return false;
+    }
+    m_pData = (const unsigned char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_pData)
+    {
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return false;
+    }
+    m_hFile = hFile;
+    m_hMapping = hMapping;
+    m_Size = size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);  // the mapping keeps the file alive
+    if (p == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(p, info.st_size, MADV_SEQUENTIAL);
+    m_pData = (const unsigned char*)p;
+    m_Size = info.st_size;
+#endif
+    return true;
+}
+
+void SessionPlayer::UnmapFile()
+{
+    if (!m_pData)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(m_pData);
+    CloseHandle(m_hMapping);
+    CloseHandle(m_hFile);
+    m_hMapping = NULL;
+    m_hFile = NULL;
+#else
+    munmap((void*)m_pData, m_Size);
+#endif
+    m_pData = NULL;
+    m_Size = 0;
+}
+
+bool SessionPlayer::LoadIndex()
+{
+    const SessionFileHeader* pHeader = (const SessionFileHeader*)m_pData;
+    if (m_Size < (long long)sizeof(SessionFileHeader) || pHeader->magic != SESSION_MAGIC || pHeader->version != SESSION_VERSION)
+    {
+        return false;
+    }
+
+    // Use the footer index when the recording was closed properly and every
+    // entry points at a whole chunk of its type before the index
+    if (m_Size >= (long long)(sizeof(SessionFileHeader) + sizeof(SessionFooter)))
+    {
+        const SessionFooter* pFooter = (const SessionFooter*)(m_pData + m_Size - sizeof(SessionFooter));
+        if (pFooter->magic == SESSION_INDEX_MAGIC && pFooter->indexOffset >= (long long)sizeof(SessionFileHeader) &&
+            pFooter->indexOffset + (long long)pFooter->entryCount * (long long)sizeof(SessionIndexEntry) == m_Size - (long long)sizeof(SessionFooter))
+        {
+            const SessionIndexEntry* pEntries = (const SessionIndexEntry*)(m_pData + pFooter->indexOffset);
+            m_Index.assign(pEntries, pEntries + pFooter->entryCount);
+            for (size_t i = 0; i < m_Index.size(); ++i)
+            {
+                if (!IsValidChunk(m_Index[i].offset, pFooter->indexOffset) ||
+                    ((const SessionChunkHeader*)(m_pData + m_Index[i].offset))->type != m_Index[i].type)
+                {
+                    m_Index.clear();
+                    break;
+                }
+            }
+            if (!m_Index.empty())
+            {
+                return true;
+            }
+        }
+    }
+
+    // Otherwise walk the chunks up to the first incomplete one
+    long long offset = pHeader->headerSize;
+    while (IsValidChunk(offset, m_Size))
+    {
+        const SessionChunkHeader* pChunk = (const SessionChunkHeader*)(m_pData + offset);
+        SessionIndexEntry entry = { pChunk->timestamp, offset, pChunk->type, pChunk->frameNumber };
+        m_Index.push_back(entry);
+        offset += sizeof(SessionChunkHeader) + pChunk->payloadSize;
+    }
+    return !m_Index.empty();
+}
+
+// A chunk of a known type at offset, payload included, that ends at or before end.
+bool SessionPlayer::IsValidChunk(long long offset, long long end)
+{
+    if (offset < (long long)sizeof(SessionFileHeader) || offset + (long long)sizeof(SessionChunkHeader) > end)
+    {
+        return false;
+    }
+    const SessionChunkHeader* pChunk = (const SessionChunkHeader*)(m_pData + offset);
+    return pChunk->type >= SESSION_CHUNK_VIDEO && pChunk->type <= SESSION_CHUNK_DEPTH_CODED &&
+        offset + (long long)sizeof(SessionChunkHeader) + pChunk->payloadSize <= end;
+}
+
+void SessionPlayer::BuildStreamIndexes()
+{
+    std::vector<std::pair<long long, int> > sorted[3];
+    for (size_t i = 0; i < m_Index.size(); ++i)
+    {
+        unsigned int type = m_Index[i].type == SESSION_CHUNK_DEPTH_CODED ? (unsigned int)SESSION_CHUNK_DEPTH : m_Index[i].type;
+        if (type >= SESSION_CHUNK_VIDEO && type <= SESSION_CHUNK_SKELETON)
+        {
+            sorted[type - SESSION_CHUNK_VIDEO].push_back(std::make_pair(m_Index[i].timestamp, int(i)));
+        }
+    }
+
+    m_StartTime = m_Index.empty() ? 0 : m_Index.front().timestamp;
+    m_EndTime = m_StartTime;
+    for (int t = 0; t < 3; ++t)
+    {
+        // Streams arrive interleaved, each one is nearly sorted already
+        std::stable_sort(sorted[t].begin(), sorted[t].end());
+        StreamIndex& index = GetStreamIndex(SessionChunkType(SESSION_CHUNK_VIDEO + t));
+        index.timestamps.resize(sorted[t].size());
+        index.entries.resize(sorted[t].size());
+        for (size_t i = 0; i < sorted[t].size(); ++i)
+        {
+            index.timestamps[i] = sorted[t][i].first;
+            index.entries[i] = sorted[t][i].second;
+        }
+        if (!sorted[t].empty())
+        {
+            m_StartTime = std::min(m_StartTime, sorted[t].front().first);
+            m_EndTime = std::max(m_EndTime, sorted[t].back().first);
+        }
+    }
+}
+
+SessionPlayer::StreamIndex& SessionPlayer::GetStreamIndex(SessionChunkType type)
+{
+    switch (type)
+    {
+    case SESSION_CHUNK_VIDEO:   return m_VideoIndex;
+    case SESSION_CHUNK_DEPTH:
+    case SESSION_CHUNK_DEPTH_CODED: return m_DepthIndex;
+    default:                    return m_SkeletonIndex;
+    }
+}
+
+int SessionPlayer::FindFrame(SessionChunkType type, long long timestamp)
+{
+    StreamIndex& index = GetStreamIndex(type);
+    std::vector<long long>::iterator it = std::upper_bound(index.timestamps.begin(), index.timestamps.end(), timestamp);
+    if (it == index.timestamps.begin())
+    {
+        return -1;
+    }
+    return index.entries[(it - index.timestamps.begin()) - 1];
+}
+
+// Region frames only say how large the full image is at least, so this takes
+// the extent of all frames of the stream.
+bool SessionPlayer::GetImageFormat(SessionChunkType type, SessionImageHeader* pImage)
+{
+    StreamIndex& index = GetStreamIndex(type);
+    bool found = false;
+    for (size_t i = 0; type != SESSION_CHUNK_SKELETON && i < index.entries.size(); ++i)
+    {
+        const SessionIndexEntry& entry = m_Index[index.entries[i]];
+        SessionImageHeader image;
+        if (!ReadImageHeader(entry, &image))
+        {
+            continue;
+        }
+        const SessionChunkHeader* pChunk = (const SessionChunkHeader*)(m_pData + entry.offset);
+        image.width += pChunk->region & 0xFFFF;
+        image.height += pChunk->region >> 16;
+        if (!found)
+        {
+            *pImage = image;
+            found = true;
+        }
+        pImage->width = std::max(pImage->width, image.width);
+        pImage->height = std::max(pImage->height, image.height);
+    }
+    if (found)
+    {
+        pImage->rowBytes = pImage->width * FrameFormatBytesPerPixel(FrameFormat(pImage->format));
+    }
+    return found;
+}
+
+bool SessionPlayer::ReadFrame(SessionChunkType type, unsigned int n, FrameRef& frame)
+{
+    StreamIndex& index = GetStreamIndex(type);
+    if (n >= index.entries.size() || type == SESSION_CHUNK_SKELETON)
+    {
+        return false;
+    }
+    const SessionIndexEntry& entry = m_Index[index.entries[n]];
+    return entry.type == SESSION_CHUNK_DEPTH_CODED ? DecodeImage(entry, frame) : CopyImage(entry, frame);
+}
+
+bool SessionPlayer::ReadSkeletonFrame(unsigned int n, SkeletonFrame& frame)
+{
+    StreamIndex& index = GetStreamIndex(SESSION_CHUNK_SKELETON);
+    if (n >= index.entries.size())
+    {
+        return false;
+    }
+    const SessionChunkHeader* pChunk = (const SessionChunkHeader*)(m_pData + m_Index[index.entries[n]].offset);
+    if (pChunk->payloadSize != sizeof(SkeletonFrame))
+    {
+        return false;
+    }
+    memcpy(&frame, pChunk + 1, sizeof(SkeletonFrame));
+    return true;
+}
+
+void SessionPlayer::Seek(long long timestamp)
+{
+    int position = FindFrame(SESSION_CHUNK_VIDEO, timestamp);
+    m_Position = position < 0 ? 0 : position;
+}
+
+SessionPlayerStats SessionPlayer::GetStats()
+{
+    SessionPlayerStats stats;
+    stats.framesPlayed = m_FramesPlayed.load();
+    stats.elapsed = m_PlayStart ? FrameClockMicroseconds() - m_PlayStart : 0;
+    stats.sessionTime = m_SessionTime.load();
+    return stats;
+}
+
+void SessionPlayer::Init()
+{
+    Release(); // Deal with double initializations.
+
+    // Size the frame pools after the images of each stream
+    SessionImageHeader video = { 640, 480, FRAME_FORMAT_B8G8R8X8, 640 * 4 };
+    SessionImageHeader depth = { 320, 240, FRAME_FORMAT_D13P3, 320 * 2 };
+    GetImageFormat(SESSION_CHUNK_VIDEO, &video);
+    GetImageFormat(SESSION_CHUNK_DEPTH, &depth);
+    InitExchange(video.width, video.height, depth.width, depth.height);
+
+    m_FramesPlayed = 0;
+    m_SessionTime = 0;
+    m_Stop = false;
+    m_Finished = false;
+    m_PlayStart = FrameClockMicroseconds();
+    m_Thread = std::thread(&SessionPlayer::ProcessThread, this);
+}
+
+void SessionPlayer::Release()
+{
+    if (m_Thread.joinable())
+    {
+        m_Stop = true;
+        m_Thread.join();
+    }
+    ReleaseExchange();
+}
+
+void SessionPlayer::ProcessThread()
+{
+    long long sessionBase = 0;     // session time that maps to wallBase
+    long long wallBase = 0;
+    int expected = -1;              // position we left off at, anything else is a seek
+    long long lastVideo = 0;        // timestamp of the last color frame played
+    bool playedVideo = false;
+
+    while (!m_Stop)
+    {
+        int position = m_Position.load();
+        if (position >= (int)m_Index.size())
+        {
+            if (!m_Loop || m_Index.empty())
+            {
+                break;
+            }
+            m_Position.compare_exchange_strong(position, 0);
+            continue;
+        }
+
+        const SessionIndexEntry& entry = m_Index[position];
+        if (position != expected)
+        {   // Started, looped or seeked: restart the clock at this frame
+            sessionBase = entry.timestamp;
+            wallBase = FrameClockMicroseconds();
+            if (playedVideo && entry.timestamp <= lastVideo)
+            {   // Back in time. Done here rather than in Seek() so no frame of the
+                // old position can be published after the restart.
+                RestartTimeline();
+                playedVideo = false;
+            }
+        }
+
+        if (m_Mode == SESSION_PLAYBACK_REALTIME)
+        {
+            long long due = wallBase + (entry.timestamp - sessionBase);
+            for (long long now = FrameClockMicroseconds(); now < due && !m_Stop; now = FrameClockMicroseconds())
+            {   // Short naps so Release() does not wait for a long gap in the recording
+                std::this_thread::sleep_for(std::chrono::microseconds(std::min(due - now, 10000LL)));
+            }
+        }
+        else if (entry.type == SESSION_CHUNK_VIDEO)
+        {   // Free running: hand out the next color frame once the last one was taken.
+            // Short waits again, a triple buffer reader taking it does not wake us.
+            while (IsVideoFramePending() && !m_Stop)
+            {
+                WaitVideoFrameTaken(10);
+            }
+        }
+        if (m_Stop)
+        {
+            break;
+        }
+
+        if (PlayChunk(entry) && entry.type == SESSION_CHUNK_VIDEO)
+        {
+            lastVideo = entry.timestamp;
+            playedVideo = true;
+            m_FramesPlayed++;
+            m_SessionTime = entry.timestamp - m_StartTime;
+        }
+
+        // Leave the position alone if Seek() moved it meanwhile
+        expected = position + 1;
+        if (!m_Position.compare_exchange_strong(position, expected))
+        {
+            expected = -1;
+        }
+    }
+    m_Finished = true;
+}
+
+bool SessionPlayer::ReadImageHeader(const SessionIndexEntry& entry, SessionImageHeader* pImage)
+{
+    const SessionChunkHeader* pChunk = (const SessionChunkHeader*)(m_pData + entry.offset);
+    if (pChunk->payloadSize < sizeof(SessionImageHeader))
+    {
+        return false;
+    }
+    memcpy(pImage, pChunk + 1, sizeof(SessionImageHeader));
+    if (pChunk->type == SESSION_CHUNK_DEPTH_CODED)
+    {
+        return true;
+    }
+    // Rows must hold a whole row of pixels and all of them must be in the chunk
+    return pImage->rowBytes >= (long long)pImage->width * FrameFormatBytesPerPixel(FrameFormat(pImage->format)) &&
+        (long long)pImage->rowBytes * pImage->height <= pChunk->payloadSize - sizeof(SessionImageHeader);
+}
+
+bool SessionPlayer::PlayChunk(const SessionIndexEntry& entry)
+{
+    const SessionChunkHeader* pChunk = (const SessionChunkHeader*)(m_pData + entry.offset);
+
+    switch (entry.type)
+    {
+    case SESSION_CHUNK_VIDEO:
+        if (!CopyImage(entry, BeginVideoFrame()))
+        {
+            return false;
+        }
+        PublishVideoFrame();
+        return true;
+
+    case SESSION_CHUNK_DEPTH:
+        if (!CopyImage(entry, BeginDepthFrame()))
+        {
+            return false;
+        }
+        PublishDepthFrame();
+        return true;
+
+    case SESSION_CHUNK_DEPTH_CODED:
+        if (!DecodeImage(entry, BeginDepthFrame()))
+        {
+            return false;
+        }
+        PublishDepthFrame();
+        return true;
+
+    case SESSION_CHUNK_SKELETON:
+        if (pChunk->payloadSize != sizeof(SkeletonFrame))
+        {
+            return false;
+        }
+        memcpy(&BeginSkeletonFrame(), pChunk + 1, sizeof(SkeletonFrame));
+        PublishSkeletonFrame();
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Checks the image fits the pooled frame, and makes the frame a region if the
+// image was recorded as one.
+bool SessionPlayer::PrepareImage(const SessionIndexEntry& entry, FrameRef& slot, SessionImageHeader* pImage)
+{
+    if (!slot || !ReadImageHeader(entry, pImage) || pImage->format != (unsigned int)slot->GetFormat())
+    {
+        return false;
+    }
+    if (pImage->width != slot->GetWidth() || pImage->height != slot->GetHeight())
+    {
+        const SessionChunkHeader* pChunk = (const SessionChunkHeader*)(m_pData + entry.offset);
+        if (!slot->SetRegion(pChunk->region & 0xFFFF, pChunk->region >> 16, pImage->width, pImage->height))
+        {
+            return false;
+        }
+    }
+    // Stored rows are never padded beyond what a frame row holds
+    return pImage->rowBytes <= slot->GetStride();
+}
+
+// The mapped file cannot be handed out directly: consumers expect pooled,
+// aligned frames they can keep after the player moved on.
+bool SessionPlayer::CopyImage(const SessionIndexEntry& entry, FrameRef& slot)
+{
+    SessionImageHeader image;
+    if (!PrepareImage(entry, slot, &image))
+    {
+        return false;
+    }
+
+    const unsigned char* pRows = m_pData + entry.offset + sizeof(SessionChunkHeader) + sizeof(SessionImageHeader);
+    unsigned int pixelBytes = image.width * FrameFormatBytesPerPixel(slot->GetFormat());
+    for (unsigned int y = 0; y < image.height; ++y)
+    {
+        memcpy(slot->GetBuffer() + y * slot->GetStride(), pRows + y * image.rowBytes, pixelBytes);
+    }
+    slot->SetTimestamp(entry.timestamp, entry.frameNumber);
+    return true;
+}
+
+bool SessionPlayer::DecodeImage(const SessionIndexEntry& entry, FrameRef& slot)
+{
+    SessionImageHeader image;
+    if (!PrepareImage(entry, slot, &image))
+    {
+        return false;
+    }
+
+    const SessionChunkHeader* pChunk = (const SessionChunkHeader*)(m_pData + entry.offset);
+    if (!DecodeDepthFrame((const unsigned char*)(pChunk + 1) + sizeof(SessionImageHeader),
+        pChunk->payloadSize - sizeof(SessionImageHeader), slot.Get()))
+    {
+        return false;
+    }
+    slot->SetTimestamp(entry.timestamp, entry.frameNumber);
+    return true;
+}
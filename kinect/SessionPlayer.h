@@ -0,0 +1,111 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SessionPlayer.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FrameSource.h"
+#include "SessionFormat.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+enum SessionPlaybackMode
+{
+    SESSION_PLAYBACK_REALTIME = 0,  // frames come out with their recorded spacing
+    SESSION_PLAYBACK_FREE_RUNNING,  // next color frame as soon as the previous one was read
+};
+
+struct SessionPlayerStats
+{
+    unsigned int    framesPlayed;   // color frames
+    long long       elapsed;        // microseconds since playback started
+    long long       sessionTime;    // microseconds of recording played
+};
+
+// Frame source replaying a session recorded by SessionRecorder. The file is
+// memory mapped and located through its footer index, so seeking to a
+// timestamp is a binary search. Free-running mode paces the player on the
+// reader and so measures the highest rate the consumers can sustain.
+class SessionPlayer : public FrameSourceBase
+{
+public:
+    SessionPlayer();
+    ~SessionPlayer();
+
+    bool Open(const char* path);
+    void Close();
+    void SetMode(SessionPlaybackMode mode) { m_Mode = mode; };
+    void SetLoop(bool loop) { m_Loop = loop; };
+
+    void Init();        // starts playing from the current position
+    void Release();     // stops playing
+    // A session plays at the resolution it was recorded at
+    bool SetProfile(SensorProfileId) { return(false); };
+    bool IsPlaying()    { return(m_Thread.joinable() && !m_Finished.load()); };
+
+    // Moves the playback position to the last color frame at or before timestamp.
+    // Going back, like looping, restarts the source's timeline: the frames
+    // that follow make FrameSets again although they are older.
+    void Seek(long long timestamp);
+    // Position in the chunk index of the last frame of the given type at or
+    // before timestamp, -1 if there is none. O(log n).
+    int FindFrame(SessionChunkType type, long long timestamp);
+
+    // Random access for tools, independent of playback. frame must be sized
+    // like the stream. Depth is the same stream whether it was compressed or not.
+    unsigned int GetFrameCount(SessionChunkType type) { return((unsigned int)GetStreamIndex(type).entries.size()); };
+    bool GetImageFormat(SessionChunkType type, SessionImageHeader* pImage);  // of the full images
+    bool ReadFrame(SessionChunkType type, unsigned int n, FrameRef& frame);
+    bool ReadSkeletonFrame(unsigned int n, SkeletonFrame& frame);
+
+    long long GetStartTime()    { return(m_StartTime); };
+    long long GetEndTime()      { return(m_EndTime); };
+    SessionPlayerStats GetStats();
+
+private:
+    struct StreamIndex
+    {
+        std::vector<long long>  timestamps;     // sorted
+        std::vector<int>        entries;        // position in m_Index for each timestamp
+    };
+
+    bool MapFile(const char* path);
+    void UnmapFile();
+    bool LoadIndex();
+    bool IsValidChunk(long long offset, long long end);
+    void BuildStreamIndexes();
+    StreamIndex& GetStreamIndex(SessionChunkType type);
+    bool ReadImageHeader(const SessionIndexEntry& entry, SessionImageHeader* pImage);
+    bool PlayChunk(const SessionIndexEntry& entry);
+    bool PrepareImage(const SessionIndexEntry& entry, FrameRef& slot, SessionImageHeader* pImage);
+    bool CopyImage(const SessionIndexEntry& entry, FrameRef& slot);
+    bool DecodeImage(const SessionIndexEntry& entry, FrameRef& slot);
+    void ProcessThread();
+
+    const unsigned char*    m_pData;
+    long long               m_Size;
+#ifdef _WIN32
+    void*                   m_hFile;
+    void*                   m_hMapping;
+#endif
+
+    std::vector<SessionIndexEntry> m_Index;
+    StreamIndex             m_VideoIndex;
+    StreamIndex             m_DepthIndex;
+    StreamIndex             m_SkeletonIndex;
+    long long               m_StartTime;
+    long long               m_EndTime;
+
+    SessionPlaybackMode     m_Mode;
+    bool                    m_Loop;
+    std::thread             m_Thread;
+    std::atomic<bool>       m_Stop;
+    std::atomic<bool>       m_Finished;
+    std::atomic<int>        m_Position;     // next chunk to play
+    std::atomic<unsigned int> m_FramesPlayed;
+    std::atomic<long long>  m_SessionTime;
+    long long               m_PlayStart;
+};
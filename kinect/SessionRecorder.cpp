@@ -0,0 +1,275 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SessionRecorder.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "SessionRecorder.h"
+#include "DepthCodec.h"
+#include <cstring>
+
+SessionRecorder::SessionRecorder()
+{
+    m_pFile = NULL;
+    m_QueueCapacity = 0;
+    m_CompressDepth = true;
+    m_WriteFailed = false;
+    m_WriterBytes = 0;
+    m_StopRequested = false;
+    m_Recording = false;
+    memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    Stop();
+}
+
+bool SessionRecorder::Start(const char* path, unsigned int queueCapacity)
+{
+    Stop(); // Deal with double starts.
+
+    m_pFile = fopen(path, "wb");
+    if (!m_pFile)
+    {
+        return false;
+    }
+
+    SessionFileHeader header = { SESSION_MAGIC, SESSION_VERSION, sizeof(SessionFileHeader), 0 };
+    if (fwrite(&header, sizeof(header), 1, m_pFile) != 1)
+    {
+        fclose(m_pFile);
+        m_pFile = NULL;
+        return false;
+    }
+
+    m_WriterBytes = sizeof(header);
+    m_Index.clear();
+    m_WriteFailed = false;
+    {   // Producers read these under the lock once they see m_Recording
+        std::lock_guard<std::mutex> lock(m_Lock);
+        memset(&m_Stats, 0, sizeof(m_Stats));
+        m_Stats.bytesWritten = m_WriterBytes;
+        m_QueueCapacity = queueCapacity;
+        m_StopRequested = false;
+    }
+    m_Thread = std::thread(&SessionRecorder::WriterThread, this);
+    m_Recording.store(true, std::memory_order_release);
+    return true;
+}
+
+void SessionRecorder::Stop()
+{
+    m_Recording = false;
+    if (m_Thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_StopRequested = true;
+        }
+        m_QueueChanged.notify_one();
+        m_Thread.join();
+
+        // Nothing can be queued once the stop was requested, but do not let a
+        // frame of this recording turn up at the start of the next one.
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Queue.clear();
+        m_Skeletons.clear();
+    }
+    if (m_pFile)
+    {
+        if (!m_WriteFailed)
+        {   // Offsets past a short write are meaningless
+            WriteIndex();
+        }
+        fclose(m_pFile);
+        m_pFile = NULL;
+    }
+}
+
+SessionRecorderStats SessionRecorder::GetStats()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    return m_Stats;
+}
+
+void SessionRecorder::Enqueue(EntryType type, const FrameRef& frame, const SkeletonFrame* pSkeleton)
+{
+    if (!IsRecording())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        if (!m_Recording.load(std::memory_order_relaxed) || m_StopRequested)
+        {   // Stop() got in after the check above; the writer may already be gone
+            return;
+        }
+        if (m_Queue.size() >= m_QueueCapacity)
+        {   // Never make the producer wait for the disk
+            m_Stats.dropped++;
+            return;
+        }
+        m_Queue.push_back(Entry());
+        Entry& entry = m_Queue.back();
+        entry.type = type;
+        entry.frame = frame;
+        if (pSkeleton)
+        {
+            m_Skeletons.push_back(*pSkeleton);
+        }
+    }
+    m_QueueChanged.notify_one();
+}
+
+void SessionRecorder::WriterThread()
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    while (true)
+    {
+        m_QueueChanged.wait(lock, [this] { return m_StopRequested || !m_Queue.empty(); });
+        if (m_Queue.empty())
+        {   // Stop requested and everything written
+            break;
+        }
+
+        Entry entry = std::move(m_Queue.front());
+        m_Queue.pop_front();
+        if (entry.type == SESSION_ENTRY_SKELETON)
+        {
+            m_Skeleton = m_Skeletons.front();
+            m_Skeletons.pop_front();
+        }
+
+        lock.unlock();
+        bool written = WriteEntry(entry);
+        entry.frame.Reset();    // give the buffer back to its pool before we wait again
+        lock.lock();
+
+        m_Stats.bytesWritten = m_WriterBytes;
+        if (!written)
+        {
+            m_Stats.dropped++;
+            if (m_WriteFailed)
+            {   // The file is unusable past this point, stop taking frames
+                m_Recording = false;
+            }
+        }
+        else if (entry.type == SESSION_ENTRY_VIDEO)
+        {
+            m_Stats.videoFrames++;
+        }
+        else if (entry.type == SESSION_ENTRY_DEPTH)
+        {
+            m_Stats.depthFrames++;
+        }
+        else
+        {
+            m_Stats.skeletonFrames++;
+        }
+    }
+}
+
+bool SessionRecorder::WriteEntry(Entry& entry)
+{
+    if (m_WriteFailed)
+    {
+        return false;
+    }
+    if (entry.type == SESSION_ENTRY_SKELETON)
+    {
+        return WriteChunk(SESSION_CHUNK_SKELETON, m_Skeleton.timestamp, m_Skeleton.frameNumber, 0,
+            NULL, 0, &m_Skeleton, sizeof(SkeletonFrame));
+    }
+
+    Frame* pFrame = entry.frame.Get();
+    if (!pFrame)
+    {
+        return false;
+    }
+
+    SessionImageHeader image;
+    image.width = pFrame->GetWidth();
+    image.height = pFrame->GetHeight();
+    image.format = pFrame->GetFormat();
+    image.rowBytes = pFrame->GetWidth() * FrameFormatBytesPerPixel(pFrame->GetFormat());
+    unsigned int type = entry.type == SESSION_ENTRY_VIDEO ? SESSION_CHUNK_VIDEO : SESSION_CHUNK_DEPTH;
+    unsigned int region = pFrame->GetOffsetX() | (pFrame->GetOffsetY() << 16);
+
+    if (type == SESSION_CHUNK_DEPTH && m_CompressDepth && pFrame->GetFormat() == FRAME_FORMAT_D13P3)
+    {
+        m_Coded.clear();
+        EncodeDepthFrame(pFrame, m_Coded);
+        m_Coded.resize((m_Coded.size() + 3) & ~size_t(3));  // keep the next chunk header aligned
+        return WriteChunk(SESSION_CHUNK_DEPTH_CODED, pFrame->GetTimestamp(), pFrame->GetFrameNumber(), region,
+            &image, sizeof(image), &m_Coded[0], (unsigned int)m_Coded.size());
+    }
+
+    if (image.rowBytes == pFrame->GetStride())
+    {
+        return WriteChunk(type, pFrame->GetTimestamp(), pFrame->GetFrameNumber(), region,
+            &image, sizeof(image), pFrame->GetBuffer(), image.rowBytes * image.height);
+    }
+
+    // Padded rows: write the chunk header once, then row by row
+    if (!WriteChunk(type, pFrame->GetTimestamp(), pFrame->GetFrameNumber(), region,
+        &image, sizeof(image), NULL, image.rowBytes * image.height))
+    {
+        return false;
+    }
+    for (unsigned int y = 0; y < image.height; ++y)
+    {
+        if (fwrite(pFrame->GetBuffer() + y * pFrame->GetStride(), image.rowBytes, 1, m_pFile) != 1)
+        {
+            m_WriteFailed = true;
+            return false;
+        }
+    }
+    m_WriterBytes += image.rowBytes * image.height;
+    return true;
+}
+
+// Writes a chunk header plus pHeader and pData. A NULL pData only reserves
+// dataSize bytes in the chunk size; the caller writes them.
+bool SessionRecorder::WriteChunk(unsigned int type, long long timestamp, unsigned int frameNumber, unsigned int region,
+    const void* pHeader, unsigned int headerSize, const void* pData, unsigned int dataSize)
+{
+    SessionChunkHeader chunk;
+    chunk.type = type;
+    chunk.payloadSize = headerSize + dataSize;
+    chunk.timestamp = timestamp;
+    chunk.frameNumber = frameNumber;
+    chunk.region = region;
+
+    SessionIndexEntry entry = { timestamp, m_WriterBytes, type, frameNumber };
+    if (fwrite(&chunk, sizeof(chunk), 1, m_pFile) != 1 ||
+        (headerSize && fwrite(pHeader, headerSize, 1, m_pFile) != 1) ||
+        (pData && dataSize && fwrite(pData, dataSize, 1, m_pFile) != 1))
+    {
+        m_WriteFailed = true;
+        return false;
+    }
+    m_WriterBytes += sizeof(chunk) + headerSize + (pData ? dataSize : 0);
+    m_Index.push_back(entry);
+    return true;
+}
+
+// Called once the writer thread is gone; the index lets players seek without
+// reading the whole file.
+bool SessionRecorder::WriteIndex()
+{
+    SessionFooter footer = { SESSION_INDEX_MAGIC, (unsigned int)m_Index.size(), m_WriterBytes };
+    if ((!m_Index.empty() && fwrite(&m_Index[0], sizeof(SessionIndexEntry), m_Index.size(), m_pFile) != m_Index.size()) ||
+        fwrite(&footer, sizeof(footer), 1, m_pFile) != 1)
+    {
+        return false;
+    }
+    m_WriterBytes += m_Index.size() * sizeof(SessionIndexEntry) + sizeof(footer);
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Stats.bytesWritten = m_WriterBytes;
+    }
+    m_Index.clear();
+    return true;
+}
@@ -0,0 +1,87 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SessionRecorder.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+#include "SessionFormat.h"
+#include "SkeletonFrame.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct SessionRecorderStats
+{
+    unsigned int    videoFrames;    // written to disk
+    unsigned int    depthFrames;
+    unsigned int    skeletonFrames;
+    unsigned int    dropped;        // queue was full, frame not recorded
+    long long       bytesWritten;
+};
+
+// Writes the frames of a source to a session file (see SessionFormat.h).
+// Record*() only queue a reference to the frame; a background thread does the
+// disk writes, so the sensor thread never waits for I/O. When the writer falls
+// more than the queue capacity behind, new frames are dropped and counted.
+// Depth is compressed with DepthCodec on the writer thread unless disabled.
+// A failed disk write ends the recording; the file is then closed without an
+// index, and players fall back to walking its chunks.
+class SessionRecorder
+{
+public:
+    SessionRecorder();
+    ~SessionRecorder();
+
+    bool Start(const char* path, unsigned int queueCapacity = 64);
+    void Stop();    // writes everything still queued and the index, then closes the file
+    bool IsRecording() { return(m_Recording.load(std::memory_order_acquire)); };
+    void SetDepthCompression(bool compress) { m_CompressDepth = compress; };    // before Start()
+
+    void RecordVideo(const FrameRef& frame)     { Enqueue(SESSION_ENTRY_VIDEO, frame, NULL); };
+    void RecordDepth(const FrameRef& frame)     { Enqueue(SESSION_ENTRY_DEPTH, frame, NULL); };
+    void RecordSkeleton(const SkeletonFrame& frame) { Enqueue(SESSION_ENTRY_SKELETON, FrameRef(), &frame); };
+
+    SessionRecorderStats GetStats();
+
+private:
+    enum EntryType { SESSION_ENTRY_VIDEO, SESSION_ENTRY_DEPTH, SESSION_ENTRY_SKELETON };
+
+    // Skeleton entries take their frame from m_Skeletons, in the same order,
+    // so color and depth entries do not carry one.
+    struct Entry
+    {
+        EntryType       type;
+        FrameRef        frame;
+    };
+
+    void Enqueue(EntryType type, const FrameRef& frame, const SkeletonFrame* pSkeleton);
+    void WriterThread();
+    bool WriteEntry(Entry& entry);
+    bool WriteIndex();
+    bool WriteChunk(unsigned int type, long long timestamp, unsigned int frameNumber, unsigned int region,
+        const void* pHeader, unsigned int headerSize, const void* pData, unsigned int dataSize);
+
+    FILE*                   m_pFile;
+    std::thread             m_Thread;
+    std::mutex              m_Lock;
+    std::condition_variable m_QueueChanged;
+    std::deque<Entry>       m_Queue;
+    std::deque<SkeletonFrame> m_Skeletons;
+    unsigned int            m_QueueCapacity;
+    bool                    m_StopRequested;
+    std::atomic<bool>       m_Recording;
+    SessionRecorderStats    m_Stats;
+    bool                    m_CompressDepth;
+    bool                    m_WriteFailed;  // only touched by the writer thread
+    long long               m_WriterBytes;  // idem
+    std::vector<SessionIndexEntry> m_Index; // idem
+    std::vector<unsigned char> m_Coded;     // idem
+    SkeletonFrame           m_Skeleton;     // idem, that of the skeleton entry being written
+};
@@ -0,0 +1,26 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="Simd.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+// Instruction sets the image kernels may use, decided at compile time.
+// SSE2 is part of every x64 target and of x86 builds with /arch:SSE2 (the
+// default). AVX2 needs /arch:AVX2 (MSVC) or -mavx2 (gcc/clang). Every kernel
+// keeps a plain C++ path for other targets.
+
+#if defined(__AVX2__)
+#define KINECT_AVX2 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KINECT_SSE2 1
+#endif
+
+#if defined(KINECT_AVX2)
+#include <immintrin.h>
+#elif defined(KINECT_SSE2)
+#include <emmintrin.h>
+#endif
@@ -0,0 +1,59 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SkeletonFrame.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+// Mirrors NUI_SKELETON_COUNT / NUI_SKELETON_POSITION_COUNT without depending on NuiApi.h.
+const int SKELETON_COUNT = 6;
+const int SKELETON_JOINT_COUNT = 20;
+
+// Same numbering as NUI_SKELETON_POSITION_INDEX
+enum SkeletonJoint
+{
+    SKELETON_JOINT_HIP_CENTER = 0,
+    SKELETON_JOINT_SPINE,
+    SKELETON_JOINT_SHOULDER_CENTER,
+    SKELETON_JOINT_HEAD,
+    SKELETON_JOINT_SHOULDER_LEFT,
+    SKELETON_JOINT_ELBOW_LEFT,
+    SKELETON_JOINT_WRIST_LEFT,
+    SKELETON_JOINT_HAND_LEFT,
+    SKELETON_JOINT_SHOULDER_RIGHT,
+    SKELETON_JOINT_ELBOW_RIGHT,
+    SKELETON_JOINT_WRIST_RIGHT,
+    SKELETON_JOINT_HAND_RIGHT,
+    SKELETON_JOINT_HIP_LEFT,
+    SKELETON_JOINT_KNEE_LEFT,
+    SKELETON_JOINT_ANKLE_LEFT,
+    SKELETON_JOINT_FOOT_LEFT,
+    SKELETON_JOINT_HIP_RIGHT,
+    SKELETON_JOINT_KNEE_RIGHT,
+    SKELETON_JOINT_ANKLE_RIGHT,
+    SKELETON_JOINT_FOOT_RIGHT,
+};
+
+// Same values as NUI_SKELETON_POSITION_TRACKING_STATE
+enum JointTrackingState
+{
+    JOINT_NOT_TRACKED = 0,
+    JOINT_INFERRED,
+    JOINT_TRACKED,
+};
+
+struct Point3
+{
+    float x, y, z;
+};
+
+// All skeletons of one sensor frame, positions in camera space (meters).
+struct SkeletonFrame
+{
+    long long       timestamp;      // microseconds
+    unsigned int    frameNumber;
+    bool            tracked[SKELETON_COUNT];
+    Point3          joints[SKELETON_COUNT][SKELETON_JOINT_COUNT];
+    unsigned char   jointState[SKELETON_COUNT][SKELETON_JOINT_COUNT];
+};
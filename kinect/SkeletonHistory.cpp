@@ -0,0 +1,100 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SkeletonHistory.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "SkeletonHistory.h"
+
+void SkeletonFrameToSoA(const SkeletonFrame& frame, SkeletonSoA& soa)
+{
+    for (int i = 0; i < SKELETON_COUNT; ++i)
+    {
+        for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+        {
+            unsigned int n = SkeletonSoAIndex(i, j);
+            soa.x[n] = frame.joints[i][j].x;
+            soa.y[n] = frame.joints[i][j].y;
+            soa.z[n] = frame.joints[i][j].z;
+            soa.state[n] = frame.jointState[i][j];
+        }
+        soa.tracked[i] = frame.tracked[i];
+    }
+    soa.timestamp = frame.timestamp;
+    soa.frameNumber = frame.frameNumber;
+}
+
+void SkeletonSoAToFrame(const SkeletonSoA& soa, SkeletonFrame& frame)
+{
+    for (int i = 0; i < SKELETON_COUNT; ++i)
+    {
+        for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+        {
+            unsigned int n = SkeletonSoAIndex(i, j);
+            frame.joints[i][j].x = soa.x[n];
+            frame.joints[i][j].y = soa.y[n];
+            frame.joints[i][j].z = soa.z[n];
+            frame.jointState[i][j] = soa.state[n];
+        }
+        frame.tracked[i] = soa.tracked[i];
+    }
+    frame.timestamp = soa.timestamp;
+    frame.frameNumber = soa.frameNumber;
+}
+
+SkeletonHistory::SkeletonHistory()
+{
+    m_Count = 0;
+}
+
+void SkeletonHistory::Reset()
+{
+    m_Count = 0;
+}
+
+void SkeletonHistory::Push(const SkeletonFrame& frame)
+{
+    SkeletonFrameToSoA(frame, m_Staging);
+    Push(m_Staging);
+}
+
+void SkeletonHistory::Push(const SkeletonSoA& frame)
+{
+    unsigned int count = m_Count.load(std::memory_order_relaxed);
+    if (&frame != &m_Staging)
+    {
+        m_Staging = frame;
+    }
+    m_Staging.sequence = count;
+    m_Slots[count % Capacity].Write(m_Staging);
+    m_Count.store(count + 1, std::memory_order_release);
+}
+
+bool SkeletonHistory::GetSnapshot(unsigned int age, SkeletonSoA& snapshot)
+{
+    unsigned int count = GetCount();
+    return age < count && ReadSequence(count - 1 - age, count, snapshot);
+}
+
+unsigned int SkeletonHistory::GetRecent(SkeletonSoA* pSnapshots, unsigned int count)
+{
+    // Ages relative to one count, so a push in between does not shift them
+    unsigned int pushed = GetCount();
+    unsigned int copied = 0;
+    while (copied < count && copied < pushed && ReadSequence(pushed - 1 - copied, pushed, pSnapshots[copied]))
+    {
+        copied++;
+    }
+    return copied;
+}
+
+bool SkeletonHistory::ReadSequence(unsigned int sequence, unsigned int count, SkeletonSoA& snapshot)
+{
+    if (count - sequence > Capacity)
+    {
+        return false;
+    }
+    m_Slots[sequence % Capacity].Read(snapshot);
+    // The producer went round the ring while we were reading
+    return snapshot.sequence == sequence;
+}
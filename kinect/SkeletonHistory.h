@@ -0,0 +1,62 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SkeletonHistory.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Seqlock.h"
+#include "SkeletonFrame.h"
+
+// Joints of all skeletons of a frame, element index skeleton * SKELETON_JOINT_COUNT + joint.
+const unsigned int SKELETON_SOA_COUNT = SKELETON_COUNT * SKELETON_JOINT_COUNT;
+
+// One skeleton frame as a structure of arrays: every coordinate of every joint
+// of every skeleton is contiguous, 120 floats or fifteen AVX registers, so a
+// filter can run over all joints with straight vector loads and stores.
+struct SkeletonSoA
+{
+    float           x[SKELETON_SOA_COUNT];
+    float           y[SKELETON_SOA_COUNT];
+    float           z[SKELETON_SOA_COUNT];
+    unsigned char   state[SKELETON_SOA_COUNT];  // JointTrackingState
+    bool            tracked[SKELETON_COUNT];
+    long long       timestamp;                  // microseconds
+    unsigned int    frameNumber;
+    unsigned int    sequence;                   // position in the history, see SkeletonHistory
+};
+
+inline unsigned int SkeletonSoAIndex(int skeleton, int joint) { return skeleton * SKELETON_JOINT_COUNT + joint; }
+
+void SkeletonFrameToSoA(const SkeletonFrame& frame, SkeletonSoA& soa);
+void SkeletonSoAToFrame(const SkeletonSoA& soa, SkeletonFrame& frame);
+
+// The last Capacity skeleton frames of a source, newest last. The skeleton
+// stream pushes every frame; any number of threads take consistent snapshots
+// of any frame still in the ring without locks, each slot being a Seqlock.
+class SkeletonHistory
+{
+public:
+    static const unsigned int Capacity = 32;    // about a second at 30 Hz
+
+    SkeletonHistory();
+
+    void Reset();       // only while no other thread uses the history
+    void Push(const SkeletonFrame& frame);      // producer thread only
+    void Push(const SkeletonSoA& frame);
+
+    unsigned int GetCount() { return(m_Count.load(std::memory_order_acquire)); };   // frames pushed so far
+    // Copies the frame pushed age frames before the newest one. False if there
+    // is no such frame, or it was overwritten before it could be read.
+    bool GetSnapshot(unsigned int age, SkeletonSoA& snapshot);
+    // Copies up to count of the newest frames, newest first; returns how many.
+    unsigned int GetRecent(SkeletonSoA* pSnapshots, unsigned int count);
+
+private:
+    Seqlock<SkeletonSoA>        m_Slots[Capacity];
+    std::atomic<unsigned int>   m_Count;
+    SkeletonSoA                 m_Staging;      // producer side copy, stamped with the sequence
+
+    bool ReadSequence(unsigned int sequence, unsigned int count, SkeletonSoA& snapshot);
+};
@@ -0,0 +1,205 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SkeletonSmoother.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "SkeletonSmoother.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+SkeletonSmoothingParams DefaultSkeletonSmoothing()
+{
+    SkeletonSmoothingParams params = { 0.5f, 0.5f, 0.5f, 0.05f, 0.04f };
+    return params;
+}
+
+// The filter is written once against these: a plain float, SSE2 and AVX2
+// version of the few operations it needs. Masks are all ones or all zeros.
+struct ScalarOps
+{
+    typedef float V;
+    enum { Width = 1 };
+    static V Load(const float* p)           { return *p; }
+    static void Store(float* p, V v)        { *p = v; }
+    static V Set(float f)                   { return f; }
+    static V Add(V a, V b)                  { return a + b; }
+    static V Sub(V a, V b)                  { return a - b; }
+    static V Mul(V a, V b)                  { return a * b; }
+    static V Div(V a, V b)                  { return a / b; }
+    static V Min(V a, V b)                  { return a < b ? a : b; }
+    static V Max(V a, V b)                  { return a > b ? a : b; }
+    static V Sqrt(V a)                      { return sqrtf(a); }
+    static V Equal(V a, V b)                { return a == b ? 1.0f : 0.0f; }
+    static V Select(V mask, V a, V b)       { return mask != 0 ? a : b; }
+};
+
+#if defined(KINECT_SSE2)
+struct Sse2Ops
+{
+    typedef __m128 V;
+    enum { Width = 4 };
+    static V Load(const float* p)           { return _mm_loadu_ps(p); }
+    static void Store(float* p, V v)        { _mm_storeu_ps(p, v); }
+    static V Set(float f)                   { return _mm_set1_ps(f); }
+    static V Add(V a, V b)                  { return _mm_add_ps(a, b); }
+    static V Sub(V a, V b)                  { return _mm_sub_ps(a, b); }
+    static V Mul(V a, V b)                  { return _mm_mul_ps(a, b); }
+    static V Div(V a, V b)                  { return _mm_div_ps(a, b); }
+    static V Min(V a, V b)                  { return _mm_min_ps(a, b); }
+    static V Max(V a, V b)                  { return _mm_max_ps(a, b); }
+    static V Sqrt(V a)                      { return _mm_sqrt_ps(a); }
+    static V Equal(V a, V b)                { return _mm_cmpeq_ps(a, b); }
+    static V Select(V mask, V a, V b)       { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+};
+#endif
+
+#if defined(KINECT_AVX2)
+struct Avx2Ops
+{
+    typedef __m256 V;
+    enum { Width = 8 };
+    static V Load(const float* p)           { return _mm256_loadu_ps(p); }
+    static void Store(float* p, V v)        { _mm256_storeu_ps(p, v); }
+    static V Set(float f)                   { return _mm256_set1_ps(f); }
+    static V Add(V a, V b)                  { return _mm256_add_ps(a, b); }
+    static V Sub(V a, V b)                  { return _mm256_sub_ps(a, b); }
+    static V Mul(V a, V b)                  { return _mm256_mul_ps(a, b); }
+    static V Div(V a, V b)                  { return _mm256_div_ps(a, b); }
+    static V Min(V a, V b)                  { return _mm256_min_ps(a, b); }
+    static V Max(V a, V b)                  { return _mm256_max_ps(a, b); }
+    static V Sqrt(V a)                      { return _mm256_sqrt_ps(a); }
+    static V Equal(V a, V b)                { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static V Select(V mask, V a, V b)       { return _mm256_blendv_ps(b, a, mask); }
+};
+#endif
+
+SkeletonSmoother::SkeletonSmoother()
+{
+    m_Params = DefaultSkeletonSmoothing();
+    Reset();
+}
+
+void SkeletonSmoother::Reset()
+{
+    memset(m_Frames, 0, sizeof(m_Frames));
+    memset(m_RawX, 0, sizeof(m_RawX));
+    memset(m_RawY, 0, sizeof(m_RawY));
+    memset(m_RawZ, 0, sizeof(m_RawZ));
+    memset(m_FilteredX, 0, sizeof(m_FilteredX));
+    memset(m_FilteredY, 0, sizeof(m_FilteredY));
+    memset(m_FilteredZ, 0, sizeof(m_FilteredZ));
+    memset(m_TrendX, 0, sizeof(m_TrendX));
+    memset(m_TrendY, 0, sizeof(m_TrendY));
+    memset(m_TrendZ, 0, sizeof(m_TrendZ));
+}
+
+void SkeletonSmoother::Apply(SkeletonSoA& frame)
+{
+    // Per joint flags as floats, so the vector pass needs no byte unpacking
+    for (int i = 0; i < SKELETON_COUNT; ++i)
+    {
+        for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+        {
+            unsigned int n = SkeletonSoAIndex(i, j);
+            m_Valid[n] = frame.tracked[i] && frame.state[n] != JOINT_NOT_TRACKED ? 1.0f : 0.0f;
+            m_Radius[n] = frame.state[n] == JOINT_INFERRED ? 2.0f : 1.0f;
+        }
+    }
+
+    unsigned int n = 0;
+#if defined(KINECT_AVX2)
+    n = SKELETON_SOA_COUNT / Avx2Ops::Width * Avx2Ops::Width;
+    Filter<Avx2Ops>(frame, 0, n);
+#elif defined(KINECT_SSE2)
+    n = SKELETON_SOA_COUNT / Sse2Ops::Width * Sse2Ops::Width;
+    Filter<Sse2Ops>(frame, 0, n);
+#endif
+    Filter<ScalarOps>(frame, n, SKELETON_SOA_COUNT);
+}
+
+template <typename Ops>
+void SkeletonSmoother::Filter(SkeletonSoA& frame, unsigned int begin, unsigned int end)
+{
+    typedef typename Ops::V V;
+    const V zero = Ops::Set(0.0f);
+    const V one = Ops::Set(1.0f);
+    const V two = Ops::Set(2.0f);
+    const V half = Ops::Set(0.5f);
+    const V tiny = Ops::Set(1e-6f);
+    const V smoothing = Ops::Set(m_Params.smoothing);
+    const V correction = Ops::Set(m_Params.correction);
+    const V prediction = Ops::Set(m_Params.prediction);
+    const V jitterRadius = Ops::Set(std::max(m_Params.jitterRadius, 1e-6f));
+    const V maxDeviation = Ops::Set(m_Params.maxDeviationRadius);
+
+    for (unsigned int n = begin; n < end; n += Ops::Width)
+    {
+        V valid = Ops::Equal(Ops::Load(m_Valid + n), one);
+        V frames = Ops::Load(m_Frames + n);
+        V first = Ops::Equal(frames, zero);
+        V second = Ops::Equal(frames, one);
+        V radius = Ops::Load(m_Radius + n);
+
+        V rawX = Ops::Load(frame.x + n), rawY = Ops::Load(frame.y + n), rawZ = Ops::Load(frame.z + n);
+        V lastX = Ops::Load(m_FilteredX + n), lastY = Ops::Load(m_FilteredY + n), lastZ = Ops::Load(m_FilteredZ + n);
+        V trendX = Ops::Load(m_TrendX + n), trendY = Ops::Load(m_TrendY + n), trendZ = Ops::Load(m_TrendZ + n);
+
+        // Jitter filter: within the radius, move only part of the way to the new position
+        V dx = Ops::Sub(rawX, lastX), dy = Ops::Sub(rawY, lastY), dz = Ops::Sub(rawZ, lastZ);
+        V length = Ops::Sqrt(Ops::Add(Ops::Add(Ops::Mul(dx, dx), Ops::Mul(dy, dy)), Ops::Mul(dz, dz)));
+        V damping = Ops::Min(Ops::Div(length, Ops::Mul(jitterRadius, radius)), one);
+        V inX = Ops::Add(lastX, Ops::Mul(dx, damping));
+        V inY = Ops::Add(lastY, Ops::Mul(dy, damping));
+        V inZ = Ops::Add(lastZ, Ops::Mul(dz, damping));
+
+        // Double exponential filter; the second frame averages the first two
+        V keep = Ops::Sub(one, smoothing);
+        V fx = Ops::Add(Ops::Mul(inX, keep), Ops::Mul(Ops::Add(lastX, trendX), smoothing));
+        V fy = Ops::Add(Ops::Mul(inY, keep), Ops::Mul(Ops::Add(lastY, trendY), smoothing));
+        V fz = Ops::Add(Ops::Mul(inZ, keep), Ops::Mul(Ops::Add(lastZ, trendZ), smoothing));
+        fx = Ops::Select(second, Ops::Mul(Ops::Add(rawX, Ops::Load(m_RawX + n)), half), fx);
+        fy = Ops::Select(second, Ops::Mul(Ops::Add(rawY, Ops::Load(m_RawY + n)), half), fy);
+        fz = Ops::Select(second, Ops::Mul(Ops::Add(rawZ, Ops::Load(m_RawZ + n)), half), fz);
+        fx = Ops::Select(first, rawX, fx);
+        fy = Ops::Select(first, rawY, fy);
+        fz = Ops::Select(first, rawZ, fz);
+
+        V oldTrend = Ops::Sub(one, correction);
+        V tx = Ops::Add(Ops::Mul(Ops::Sub(fx, lastX), correction), Ops::Mul(trendX, oldTrend));
+        V ty = Ops::Add(Ops::Mul(Ops::Sub(fy, lastY), correction), Ops::Mul(trendY, oldTrend));
+        V tz = Ops::Add(Ops::Mul(Ops::Sub(fz, lastZ), correction), Ops::Mul(trendZ, oldTrend));
+        tx = Ops::Select(first, zero, tx);
+        ty = Ops::Select(first, zero, ty);
+        tz = Ops::Select(first, zero, tz);
+
+        // Predict ahead, but stay within the maximum deviation of the raw position
+        V ex = Ops::Mul(tx, prediction), ey = Ops::Mul(ty, prediction), ez = Ops::Mul(tz, prediction);
+        V px = Ops::Add(fx, ex), py = Ops::Add(fy, ey), pz = Ops::Add(fz, ez);
+        ex = Ops::Sub(px, rawX);
+        ey = Ops::Sub(py, rawY);
+        ez = Ops::Sub(pz, rawZ);
+        V deviation = Ops::Sqrt(Ops::Add(Ops::Add(Ops::Mul(ex, ex), Ops::Mul(ey, ey)), Ops::Mul(ez, ez)));
+        V clamp = Ops::Min(Ops::Div(Ops::Mul(maxDeviation, radius), Ops::Max(deviation, tiny)), one);
+        px = Ops::Add(rawX, Ops::Mul(ex, clamp));
+        py = Ops::Add(rawY, Ops::Mul(ey, clamp));
+        pz = Ops::Add(rawZ, Ops::Mul(ez, clamp));
+
+        // Joints not tracked pass through and restart their filter
+        Ops::Store(frame.x + n, Ops::Select(valid, px, rawX));
+        Ops::Store(frame.y + n, Ops::Select(valid, py, rawY));
+        Ops::Store(frame.z + n, Ops::Select(valid, pz, rawZ));
+        Ops::Store(m_RawX + n, rawX);
+        Ops::Store(m_RawY + n, rawY);
+        Ops::Store(m_RawZ + n, rawZ);
+        Ops::Store(m_FilteredX + n, fx);
+        Ops::Store(m_FilteredY + n, fy);
+        Ops::Store(m_FilteredZ + n, fz);
+        Ops::Store(m_TrendX + n, tx);
+        Ops::Store(m_TrendY + n, ty);
+        Ops::Store(m_TrendZ + n, tz);
+        Ops::Store(m_Frames + n, Ops::Select(valid, Ops::Min(Ops::Add(frames, one), two), zero));
+    }
+}
@@ -0,0 +1,62 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SkeletonSmoother.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "SkeletonHistory.h"
+
+// Same meaning as NUI_TRANSFORM_SMOOTH_PARAMETERS.
+struct SkeletonSmoothingParams
+{
+    float   smoothing;          // 0..1, more is smoother and lags more
+    float   correction;         // 0..1, how fast the trend follows the data
+    float   prediction;         // frames to predict ahead
+    float   jitterRadius;       // meters, changes below this are damped
+    float   maxDeviationRadius; // meters, the output stays this close to the raw joint
+};
+
+// The Kinect SDK's default parameters.
+SkeletonSmoothingParams DefaultSkeletonSmoothing();
+
+// Holt double exponential smoothing of every joint of every skeleton, after the
+// Kinect SDK's NuiTransformSmooth: a jitter filter damps moves smaller than the
+// jitter radius, the double exponential filter tracks position and trend, the
+// output is predicted ahead and clamped to the maximum deviation from the raw
+// position. Inferred joints get twice the radii. A joint that is not tracked,
+// or belongs to a skeleton that is not, restarts its filter.
+//
+// State is kept as a structure of arrays like SkeletonSoA, so one frame is a
+// single branch free pass over all 120 joints, eight at a time with AVX2.
+class SkeletonSmoother
+{
+public:
+    SkeletonSmoother();
+
+    void SetParameters(const SkeletonSmoothingParams& params) { m_Params = params; };
+    const SkeletonSmoothingParams& GetParameters() { return(m_Params); };
+    void Reset();
+
+    // Replaces the joint positions of frame with their smoothed ones.
+    void Apply(SkeletonSoA& frame);
+
+private:
+    SkeletonSmoothingParams m_Params;
+    float   m_Valid[SKELETON_SOA_COUNT];    // 1 if the joint is filtered this frame, else 0
+    float   m_Radius[SKELETON_SOA_COUNT];   // 2 for inferred joints, else 1
+    float   m_Frames[SKELETON_SOA_COUNT];   // frames in the filter, up to 2
+    float   m_RawX[SKELETON_SOA_COUNT];     // previous raw position
+    float   m_RawY[SKELETON_SOA_COUNT];
+    float   m_RawZ[SKELETON_SOA_COUNT];
+    float   m_FilteredX[SKELETON_SOA_COUNT];
+    float   m_FilteredY[SKELETON_SOA_COUNT];
+    float   m_FilteredZ[SKELETON_SOA_COUNT];
+    float   m_TrendX[SKELETON_SOA_COUNT];
+    float   m_TrendY[SKELETON_SOA_COUNT];
+    float   m_TrendZ[SKELETON_SOA_COUNT];
+
+    template <typename Ops>
+    void Filter(SkeletonSoA& frame, unsigned int begin, unsigned int end);
+};
@@ -0,0 +1,170 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="StreamDispatcher.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "StreamDispatcher.h"
+#include "FrameSource.h"
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+StreamDispatcher::StreamDispatcher()
+{
+    m_Stop = false;
+#ifdef _WIN32
+    m_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+#endif
+}
+
+StreamDispatcher::~StreamDispatcher()
+{
+    Clear();
+#ifdef _WIN32
+    CloseHandle(m_hStopEvent);
+#endif
+}
+
+int StreamDispatcher::AddStream(const char* name, Handler handler)
+{
+    Stream* pStream = new Stream();
+    pStream->name = name;
+    pStream->handler = handler;
+    pStream->signalTime = 0;
+#ifdef _WIN32
+    pStream->hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+#else
+    pStream->pending = false;
+#endif
+    pStream->events = 0;
+    pStream->lastLatency = 0;
+    pStream->maxLatency = 0;
+    pStream->totalLatency = 0;
+    m_Streams.push_back(pStream);
+    return int(m_Streams.size()) - 1;
+}
+
+void* StreamDispatcher::GetEventHandle(int stream)
+{
+#ifdef _WIN32
+    return m_Streams[stream]->hEvent;
+#else
+    (void)stream;
+    return NULL;
+#endif
+}
+
+void StreamDispatcher::Signal(int stream)
+{
+    Stream& s = *m_Streams[stream];
+    long long none = 0;
+    s.signalTime.compare_exchange_strong(none, FrameClockMicroseconds());
+#ifdef _WIN32
+    SetEvent(s.hEvent);
+#else
+    {
+        std::lock_guard<std::mutex> lock(s.lock);
+        s.pending = true;
+    }
+    s.signalled.notify_one();
+#endif
+}
+
+void StreamDispatcher::Start()
+{
+    Stop(); // Deal with double starts.
+
+    m_Stop = false;
+#ifdef _WIN32
+    ResetEvent(m_hStopEvent);
+#endif
+    for (size_t i = 0; i < m_Streams.size(); ++i)
+    {
+        m_Streams[i]->worker = std::thread(&StreamDispatcher::Worker, this, m_Streams[i]);
+    }
+}
+
+void StreamDispatcher::Stop()
+{
+    m_Stop = true;
+#ifdef _WIN32
+    SetEvent(m_hStopEvent);
+#endif
+    for (size_t i = 0; i < m_Streams.size(); ++i)
+    {
+#ifndef _WIN32
+        {   // Under the lock, or the worker could miss the wake up between its check and its wait
+            std::lock_guard<std::mutex> lock(m_Streams[i]->lock);
+        }
+        m_Streams[i]->signalled.notify_one();
+#endif
+        if (m_Streams[i]->worker.joinable())
+        {
+            m_Streams[i]->worker.join();
+        }
+    }
+}
+
+void StreamDispatcher::Clear()
+{
+    Stop();
+    for (size_t i = 0; i < m_Streams.size(); ++i)
+    {
+#ifdef _WIN32
+        CloseHandle(m_Streams[i]->hEvent);
+#endif
+        delete m_Streams[i];
+    }
+    m_Streams.clear();
+}
+
+StreamLatencyStats StreamDispatcher::GetLatency(int stream)
+{
+    Stream& s = *m_Streams[stream];
+    StreamLatencyStats stats;
+    stats.events = s.events.load();
+    stats.last = s.lastLatency.load();
+    stats.max = s.maxLatency.load();
+    stats.mean = stats.events ? s.totalLatency.load() / stats.events : 0;
+    return stats;
+}
+
+bool StreamDispatcher::Wait(Stream& stream)
+{
+#ifdef _WIN32
+    HANDLE hEvents[2] = { m_hStopEvent, stream.hEvent };
+    if (WaitForMultipleObjects(2, hEvents, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+    {
+        return false;
+    }
+    // Reset before handling: a frame that arrives while we work sets it again.
+    ResetEvent(stream.hEvent);
+    return !m_Stop;
+#else
+    std::unique_lock<std::mutex> lock(stream.lock);
+    stream.signalled.wait(lock, [&] { return stream.pending || m_Stop.load(); });
+    stream.pending = false;
+    return !m_Stop;
+#endif
+}
+
+void StreamDispatcher::Worker(Stream* pStream)
+{
+    while (Wait(*pStream))
+    {
+        long long woken = FrameClockMicroseconds();
+        long long signalled = pStream->signalTime.exchange(0);
+
+        pStream->handler();
+
+        long long latency = FrameClockMicroseconds() - (signalled ? signalled : woken);
+        pStream->lastLatency = latency;
+        pStream->totalLatency += latency;
+        if (latency > pStream->maxLatency.load())
+        {   // Only this thread writes it
+            pStream->maxLatency = latency;
+        }
+        pStream->events++;
+    }
+}
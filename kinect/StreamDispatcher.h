@@ -0,0 +1,79 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="StreamDispatcher.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct StreamLatencyStats
+{
+    unsigned int    events;     // handled
+    long long       last;       // microseconds from the event to the handler returning
+    long long       mean;
+    long long       max;
+};
+
+// Runs the handler of each stream on its own worker thread as soon as the
+// stream's event fires, so a slow stream never delays the others.
+//
+// On Windows every stream owns a manual reset event that can be handed to the
+// NUI runtime, which sets it when a frame is ready. Elsewhere the event is a
+// condition variable, and producers call Signal(). Signal() also stamps the
+// event time; for events set by the runtime the latency is measured from the
+// moment the worker woke up.
+class StreamDispatcher
+{
+public:
+    typedef std::function<void()> Handler;
+
+    StreamDispatcher();
+    ~StreamDispatcher();
+
+    int AddStream(const char* name, Handler handler);   // before Start(), returns the stream id
+    void* GetEventHandle(int stream);   // Windows event HANDLE, NULL on other platforms
+    void Signal(int stream);
+    void Start();
+    void Stop();    // waits for the handlers running to return
+    void Clear();   // stops and removes all streams
+
+    unsigned int GetStreamCount() { return((unsigned int)m_Streams.size()); };
+    const char* GetStreamName(int stream) { return(m_Streams[stream]->name); };
+    StreamLatencyStats GetLatency(int stream);
+
+private:
+    struct Stream
+    {
+        const char*             name;
+        Handler                 handler;
+        std::thread             worker;
+        std::atomic<long long>  signalTime;     // of the oldest unhandled Signal(), 0 if none
+#ifdef _WIN32
+        void*                   hEvent;
+#else
+        std::mutex              lock;
+        std::condition_variable signalled;
+        bool                    pending;
+#endif
+        std::atomic<unsigned int> events;
+        std::atomic<long long>  lastLatency;
+        std::atomic<long long>  maxLatency;
+        std::atomic<long long>  totalLatency;
+    };
+
+    bool Wait(Stream& stream);      // false when stopping
+    void Worker(Stream* pStream);
+
+    std::vector<Stream*>    m_Streams;
+    std::atomic<bool>       m_Stop;
+#ifdef _WIN32
+    void*                   m_hStopEvent;
+#endif
+};
@@ -0,0 +1,387 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SyntheticFrameSource.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "SyntheticFrameSource.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+static const float Pi = 3.14159265f;
+static const float BackgroundDistance = 3.5f;   // meters, flat wall behind the viewer
+static const float TorsoHalfWidth = 0.2f;
+static const float TorsoTop = 0.22f;            // below the head center
+static const float TorsoBottom = 0.85f;
+static const unsigned char PlayerIndex = 1;
+
+// Depth along z of the ray through pixel (u, v) hitting the head sphere, 0 if it misses.
+static float IntersectHead(float u, float v, float cx, float cy, float focal, const Point3& head, float radius)
+{
+    float dx = (u - cx) / focal;
+    float dy = (cy - v) / focal;
+    float a = dx * dx + dy * dy + 1.0f;
+    float b = -2.0f * (dx * head.x + dy * head.y + head.z);
+    float c = head.x * head.x + head.y * head.y + head.z * head.z - radius * radius;
+    float disc = b * b - 4.0f * a * c;
+    if (disc < 0)
+    {
+        return 0;
+    }
+    return (-b - sqrtf(disc)) / (2.0f * a);
+}
+
+// Pixel bounds [x0, x1) x [y0, y1) of a camera space box, clamped to the image.
+static void ProjectBounds(float left, float right, float top, float bottom, float z,
+    float cx, float cy, float focal, int width, int height, int* x0, int* x1, int* y0, int* y1)
+{
+    *x0 = std::max(0, std::min(width, int(floorf(cx + focal * left / z))));
+    *x1 = std::max(0, std::min(width, int(ceilf(cx + focal * right / z)) + 1));
+    *y0 = std::max(0, std::min(height, int(floorf(cy - focal * top / z))));
+    *y1 = std::max(0, std::min(height, int(ceilf(cy - focal * bottom / z)) + 1));
+}
+
+// Restricts full image bounds to the part a region frame holds.
+static void ClipToFrame(Frame* pFrame, int* x0, int* x1, int* y0, int* y1)
+{
+    *x0 = std::max(*x0, int(pFrame->GetOffsetX()));
+    *x1 = std::min(*x1, int(pFrame->GetOffsetX() + pFrame->GetWidth()));
+    *y0 = std::max(*y0, int(pFrame->GetOffsetY()));
+    *y1 = std::min(*y1, int(pFrame->GetOffsetY() + pFrame->GetHeight()));
+}
+
+SyntheticFrameSource::SyntheticFrameSource()
+{
+    m_Config = DefaultConfig();
+    m_Stop = false;
+    m_FramesGenerated = 0;
+    m_FrameNumber = 0;
+    m_StartTime = 0;
+    m_DepthStream = m_Dispatcher.AddStream("depth", [this] { ProduceDepth(); });
+    m_VideoStream = m_Dispatcher.AddStream("color", [this] { ProduceVideo(); });
+    m_SkeletonStream = m_Dispatcher.AddStream("skeleton", [this] { ProduceSkeleton(); });
+}
+
+SyntheticFrameSource::~SyntheticFrameSource()
+{
+    Release();
+}
+
+SyntheticConfig SyntheticFrameSource::DefaultConfig()
+{
+    SyntheticConfig config;
+    config.rateHz = 30;
+    config.trajectory = SYNTHETIC_TRAJECTORY_SWAY;
+    config.cycleSeconds = 4.0f;
+    config.headRadius = 0.1f;
+    config.videoWidth = 640;
+    config.videoHeight = 480;
+    config.depthWidth = 320;
+    config.depthHeight = 240;
+    return config;
+}
+
+void SyntheticFrameSource::Init()
+{
+    Release(); // Deal with double initializations.
+
+    InitExchange(m_Config.videoWidth, m_Config.videoHeight, m_Config.depthWidth, m_Config.depthHeight);
+
+    RenderBackground();
+
+    m_FramesGenerated = 0;
+    m_FrameNumber = 0;
+    m_Stop = false;
+    m_StartTime = FrameClockMicroseconds();
+    m_Dispatcher.Start();
+    m_Thread = std::thread(&SyntheticFrameSource::ProcessThread, this);
+}
+
+void SyntheticFrameSource::Release()
+{
+    if (m_Thread.joinable())
+    {
+        m_Stop = true;
+        m_Thread.join();
+    }
+    m_Dispatcher.Stop();
+    ReleaseExchange();
+}
+
+bool SyntheticFrameSource::SetProfile(SensorProfileId profile)
+{
+    if (profile >= SENSOR_PROFILE_COUNT)
+    {
+        return false;
+    }
+    // The clock keeps running; only the streams pause while the buffers change.
+    // They render at m_Config's size, so it must not change under them.
+    bool running = m_Thread.joinable();
+    if (running)
+    {
+        m_Dispatcher.Stop();
+    }
+
+    const SensorProfile& resolution = GetSensorProfile(profile);
+    m_Profile = profile;
+    m_Config.videoWidth = resolution.videoWidth;
+    m_Config.videoHeight = resolution.videoHeight;
+    m_Config.depthWidth = resolution.depthWidth;
+    m_Config.depthHeight = resolution.depthHeight;
+    if (!running)
+    {   // Init() starts at this resolution
+        return true;
+    }
+
+    ResizeExchange(m_Config.videoWidth, m_Config.videoHeight, m_Config.depthWidth, m_Config.depthHeight);
+    RenderBackground();
+    m_Dispatcher.Start();
+    return true;
+}
+
+// The background never changes, render it once and copy it under every frame
+void SyntheticFrameSource::RenderBackground()
+{
+    m_DepthBackground.assign(m_Config.depthWidth, (unsigned short)(unsigned(BackgroundDistance * 1000.0f) << 3));
+    m_VideoBackground.resize(size_t(m_Config.videoWidth) * m_Config.videoHeight);
+    for (unsigned int y = 0; y < m_Config.videoHeight; ++y)
+    {
+        unsigned int gray = 64 + 96 * y / m_Config.videoHeight;
+        for (unsigned int x = 0; x < m_Config.videoWidth; ++x)
+        {
+            m_VideoBackground[y * m_Config.videoWidth + x] = gray | (gray << 8) | (gray << 16);
+        }
+    }
+}
+
+Point3 SyntheticFrameSource::GetGroundTruth(long long timestamp)
+{
+    return HeadAt(float(timestamp - m_StartTime) * 1e-6f);
+}
+
+Point3 SyntheticFrameSource::HeadAt(float seconds)
+{
+    float phase = 2.0f * Pi * seconds / m_Config.cycleSeconds;
+    Point3 head = { 0.0f, 0.1f, 1.5f };
+
+    switch (m_Config.trajectory)
+    {
+    case SYNTHETIC_TRAJECTORY_SWAY:
+        head.x = 0.3f * sinf(phase);
+        break;
+    case SYNTHETIC_TRAJECTORY_CIRCLE:
+        head.x = 0.25f * cosf(phase);
+        head.y += 0.15f * sinf(phase);
+        break;
+    case SYNTHETIC_TRAJECTORY_FIGURE_EIGHT:
+        head.x = 0.3f * sinf(phase);
+        head.y += 0.1f * sinf(2.0f * phase);
+        break;
+    case SYNTHETIC_TRAJECTORY_APPROACH:
+        head.x = 0.05f * sinf(3.0f * phase);
+        head.z += 0.6f * sinf(phase);
+        break;
+    default:
+        break;
+    }
+    return head;
+}
+
+void SyntheticFrameSource::ProcessThread()
+{
+    for (unsigned int frameNumber = 0; !m_Stop; ++frameNumber)
+    {
+        // Frames are scheduled on a fixed grid so timestamps, and therefore the
+        // ground truth, do not depend on how late the thread wakes up.
+        long long timestamp = FrameTimestamp(frameNumber);
+        long long now = FrameClockMicroseconds();
+        if (timestamp > now)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(timestamp - now));
+        }
+
+        // A stream still busy with the previous frame skips to this one
+        m_FrameNumber = frameNumber;
+        m_Dispatcher.Signal(m_DepthStream);
+        m_Dispatcher.Signal(m_VideoStream);
+        m_Dispatcher.Signal(m_SkeletonStream);
+        m_FramesGenerated++;
+    }
+}
+
+long long SyntheticFrameSource::FrameTimestamp(unsigned int frameNumber)
+{
+    return m_StartTime + (long long)frameNumber * (1000000 / std::max(1u, m_Config.rateHz));
+}
+
+void SyntheticFrameSource::ProduceDepth()
+{
+    unsigned int frameNumber = m_FrameNumber.load();
+    long long timestamp = FrameTimestamp(frameNumber);
+    FrameRef& depth = BeginDepthFrame();
+    ApplyAcquisitionRegion(depth, FRAME_ROI_DEPTH);
+    if (depth)
+    {
+        RenderDepth(depth.Get(), GetGroundTruth(timestamp));
+        depth->SetTimestamp(timestamp, frameNumber);
+        PublishDepthFrame();
+    }
+}
+
+void SyntheticFrameSource::ProduceVideo()
+{
+    unsigned int frameNumber = m_FrameNumber.load();
+    long long timestamp = FrameTimestamp(frameNumber);
+    FrameRef& video = BeginVideoFrame();
+    ApplyAcquisitionRegion(video, FRAME_ROI_VIDEO);
+    if (video)
+    {
+        RenderVideo(video.Get(), GetGroundTruth(timestamp));
+        video->SetTimestamp(timestamp, frameNumber);
+        PublishVideoFrame();
+    }
+}
+
+void SyntheticFrameSource::ProduceSkeleton()
+{
+    unsigned int frameNumber = m_FrameNumber.load();
+    long long timestamp = FrameTimestamp(frameNumber);
+    SkeletonFrame& skeleton = BeginSkeletonFrame();
+    skeleton.timestamp = timestamp;
+    skeleton.frameNumber = frameNumber;
+    FillSkeleton(skeleton, GetGroundTruth(timestamp));
+    PublishSkeletonFrame();
+}
+
+void SyntheticFrameSource::RenderDepth(Frame* pFrame, const Point3& head)
+{
+    // The frame may be a region: project with the full image, clip to the region
+    int width = pFrame->GetFullWidth();
+    int height = pFrame->GetFullHeight();
+    int ox = pFrame->GetOffsetX();
+    int oy = pFrame->GetOffsetY();
+    float focal = NOMINAL_DEPTH_FOCAL_LENGTH * width / 320.0f;
+    float cx = width * 0.5f;
+    float cy = height * 0.5f;
+
+    for (unsigned int y = 0; y < pFrame->GetHeight(); ++y)
+    {
+        memcpy(pFrame->GetBuffer() + y * pFrame->GetStride(), &m_DepthBackground[0], pFrame->GetWidth() * sizeof(unsigned short));
+    }
+
+    // Torso: flat slab just behind the head
+    int x0, x1, y0, y1;
+    float torsoZ = head.z + 0.05f;
+    ProjectBounds(head.x - TorsoHalfWidth, head.x + TorsoHalfWidth, head.y - TorsoTop, head.y - TorsoBottom, torsoZ,
+        cx, cy, focal, width, height, &x0, &x1, &y0, &y1);
+    ClipToFrame(pFrame, &x0, &x1, &y0, &y1);
+    unsigned short torso = (unsigned short)((unsigned(torsoZ * 1000.0f) << 3) | PlayerIndex);
+    for (int y = y0; y < y1; ++y)
+    {
+        unsigned short* pRow = (unsigned short*)(pFrame->GetBuffer() + (y - oy) * pFrame->GetStride());
+        for (int x = x0; x < x1; ++x)
+        {
+            pRow[x - ox] = torso;
+        }
+    }
+
+    // Head: only pixels inside the projected bounding square can hit the sphere
+    float r = m_Config.headRadius;
+    ProjectBounds(head.x - r, head.x + r, head.y + r, head.y - r, head.z - r,
+        cx, cy, focal, width, height, &x0, &x1, &y0, &y1);
+    ClipToFrame(pFrame, &x0, &x1, &y0, &y1);
+    for (int y = y0; y < y1; ++y)
+    {
+        unsigned short* pRow = (unsigned short*)(pFrame->GetBuffer() + (y - oy) * pFrame->GetStride());
+        for (int x = x0; x < x1; ++x)
+        {
+            float z = IntersectHead(x + 0.5f, y + 0.5f, cx, cy, focal, head, r);
+            if (z > 0)
+            {
+                pRow[x - ox] = (unsigned short)((unsigned(z * 1000.0f) << 3) | PlayerIndex);
+            }
+        }
+    }
+}
+
+void SyntheticFrameSource::RenderVideo(Frame* pFrame, const Point3& head)
+{
+    int width = pFrame->GetFullWidth();
+    int height = pFrame->GetFullHeight();
+    int ox = pFrame->GetOffsetX();
+    int oy = pFrame->GetOffsetY();
+    float focal = NOMINAL_COLOR_FOCAL_LENGTH * width / 640.0f;
+    float cx = width * 0.5f;
+    float cy = height * 0.5f;
+
+    for (unsigned int y = 0; y < pFrame->GetHeight(); ++y)
+    {
+        memcpy(pFrame->GetBuffer() + y * pFrame->GetStride(), &m_VideoBackground[(y + oy) * width + ox], pFrame->GetWidth() * sizeof(unsigned int));
+    }
+
+    int x0, x1, y0, y1;
+    ProjectBounds(head.x - TorsoHalfWidth, head.x + TorsoHalfWidth, head.y - TorsoTop, head.y - TorsoBottom, head.z + 0.05f,
+        cx, cy, focal, width, height, &x0, &x1, &y0, &y1);
+    ClipToFrame(pFrame, &x0, &x1, &y0, &y1);
+    for (int y = y0; y < y1; ++y)
+    {
+        unsigned int* pRow = (unsigned int*)(pFrame->GetBuffer() + (y - oy) * pFrame->GetStride());
+        for (int x = x0; x < x1; ++x)
+        {
+            pRow[x - ox] = 0x00803020;   // dark blue shirt, BGRX
+        }
+    }
+
+    // Skin colored head, shaded by how much its surface faces the camera
+    float r = m_Config.headRadius;
+    ProjectBounds(head.x - r, head.x + r, head.y + r, head.y - r, head.z - r,
+        cx, cy, focal, width, height, &x0, &x1, &y0, &y1);
+    ClipToFrame(pFrame, &x0, &x1, &y0, &y1);
+    for (int y = y0; y < y1; ++y)
+    {
+        unsigned int* pRow = (unsigned int*)(pFrame->GetBuffer() + (y - oy) * pFrame->GetStride());
+        for (int x = x0; x < x1; ++x)
+        {
+            float z = IntersectHead(x + 0.5f, y + 0.5f, cx, cy, focal, head, r);
+            if (z > 0)
+            {
+                float shade = 0.4f + 0.6f * (head.z - z) / r;
+                unsigned int b = unsigned(120 * shade), g = unsigned(150 * shade), rd = unsigned(210 * shade);
+                pRow[x - ox] = b | (g << 8) | (rd << 16);
+            }
+        }
+    }
+}
+
+void SyntheticFrameSource::FillSkeleton(SkeletonFrame& frame, const Point3& head)
+{
+    for (int i = 0; i < SKELETON_COUNT; ++i)
+    {
+        frame.tracked[i] = false;
+        for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+        {
+            Point3 zero = { 0, 0, 0 };
+            frame.joints[i][j] = zero;
+            frame.jointState[i][j] = JOINT_NOT_TRACKED;
+        }
+    }
+
+    // One viewer in the first slot with the upper body joints the torso implies
+    struct { SkeletonJoint joint; float dx, dy; } upperBody[] = {
+        { SKELETON_JOINT_HEAD,            0.0f,  0.0f  },
+        { SKELETON_JOINT_SHOULDER_CENTER, 0.0f, -0.25f },
+        { SKELETON_JOINT_SHOULDER_LEFT,  -0.18f, -0.27f },
+        { SKELETON_JOINT_SHOULDER_RIGHT,  0.18f, -0.27f },
+        { SKELETON_JOINT_SPINE,           0.0f, -0.5f  },
+        { SKELETON_JOINT_HIP_CENTER,      0.0f, -0.75f },
+    };
+    frame.tracked[0] = true;
+    for (size_t k = 0; k < sizeof(upperBody) / sizeof(upperBody[0]); ++k)
+    {
+        Point3 p = { head.x + upperBody[k].dx, head.y + upperBody[k].dy, head.z + (k ? 0.05f : 0.0f) };
+        frame.joints[0][upperBody[k].joint] = p;
+        frame.jointState[0][upperBody[k].joint] = JOINT_TRACKED;
+    }
+}
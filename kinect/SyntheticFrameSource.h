@@ -0,0 +1,84 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="SyntheticFrameSource.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FrameSource.h"
+#include "StreamDispatcher.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+enum SyntheticTrajectory
+{
+    SYNTHETIC_TRAJECTORY_STATIC = 0,
+    SYNTHETIC_TRAJECTORY_SWAY,          // side to side
+    SYNTHETIC_TRAJECTORY_CIRCLE,        // circle parallel to the sensor
+    SYNTHETIC_TRAJECTORY_FIGURE_EIGHT,
+    SYNTHETIC_TRAJECTORY_APPROACH,      // towards and away from the sensor
+};
+
+struct SyntheticConfig
+{
+    unsigned int        rateHz;         // frames per second, e.g. 30, 60 or 120
+    SyntheticTrajectory trajectory;
+    float               cycleSeconds;   // duration of one pass over the trajectory
+    float               headRadius;     // meters
+    unsigned int        videoWidth;
+    unsigned int        videoHeight;
+    unsigned int        depthWidth;
+    unsigned int        depthHeight;
+};
+
+// Sensor stand-in that renders a spherical head on a simple torso moving along a
+// scripted trajectory. It needs no Kinect runtime, runs at any rate and knows the
+// exact head position of every frame it produced. A clock thread signals the
+// three streams every frame period and each one renders on its own dispatcher
+// worker, like the sensor's streams do.
+class SyntheticFrameSource : public FrameSourceBase
+{
+public:
+    SyntheticFrameSource();
+    ~SyntheticFrameSource();
+
+    static SyntheticConfig DefaultConfig();
+    void SetConfig(const SyntheticConfig& config) { m_Config = config; };   // takes effect on Init()
+
+    void Init();
+    void Release();
+    // Overrides the resolution of the config
+    bool SetProfile(SensorProfileId profile);
+
+    // Head center in camera space (meters) of the frame with the given timestamp.
+    Point3 GetGroundTruth(long long timestamp);
+    unsigned int GetFramesGenerated() { return(m_FramesGenerated.load()); };
+    StreamDispatcher& GetDispatcher() { return(m_Dispatcher); };
+
+private:
+    SyntheticConfig     m_Config;
+    std::thread         m_Thread;
+    std::atomic<bool>   m_Stop;
+    std::atomic<unsigned int> m_FramesGenerated;
+    std::atomic<unsigned int> m_FrameNumber;   // frame the streams render when signalled
+    StreamDispatcher    m_Dispatcher;
+    int                 m_DepthStream;
+    int                 m_VideoStream;
+    int                 m_SkeletonStream;
+    long long           m_StartTime;
+    std::vector<unsigned int>   m_VideoBackground;
+    std::vector<unsigned short> m_DepthBackground;
+
+    void RenderBackground();
+    void ProcessThread();
+    long long FrameTimestamp(unsigned int frameNumber);
+    void ProduceDepth();
+    void ProduceVideo();
+    void ProduceSkeleton();
+    Point3 HeadAt(float seconds);
+    void RenderDepth(Frame* pFrame, const Point3& head);
+    void RenderVideo(Frame* pFrame, const Point3& head);
+    void FillSkeleton(SkeletonFrame& frame, const Point3& head);
+};
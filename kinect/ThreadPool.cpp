@@ -0,0 +1,107 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="ThreadPool.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool()
+{
+    m_pTask = NULL;
+    m_Count = 0;
+    m_Next = 0;
+    m_Busy = 0;
+    m_Generation = 0;
+    m_Stopping = false;
+}
+
+ThreadPool::~ThreadPool()
+{
+    Stop();
+}
+
+void ThreadPool::Start(unsigned int workers)
+{
+    Stop(); // Deal with double starts.
+
+    m_Stopping = false;
+    for (unsigned int i = 0; i < workers; ++i)
+    {
+        // Passed in: a worker may only get to wait after the first Run() began
+        m_Workers.push_back(std::thread(&ThreadPool::Worker, this, m_Generation));
+    }
+}
+
+void ThreadPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Stopping = true;
+    }
+    m_WorkReady.notify_all();
+    for (size_t i = 0; i < m_Workers.size(); ++i)
+    {
+        m_Workers[i].join();
+    }
+    m_Workers.clear();
+}
+
+void ThreadPool::RunTasks()
+{
+    for (unsigned int band = m_Next.fetch_add(1); band < m_Count; band = m_Next.fetch_add(1))
+    {
+        (*m_pTask)(band);
+    }
+}
+
+void ThreadPool::Run(unsigned int count, const Task& task)
+{
+    std::lock_guard<std::mutex> run(m_RunLock);
+    if (m_Workers.empty() || count < 2)
+    {
+        for (unsigned int band = 0; band < count; ++band)
+        {
+            task(band);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_pTask = &task;
+        m_Count = count;
+        m_Next = 0;
+        m_Busy = (unsigned int)m_Workers.size();
+        m_Generation++;
+    }
+    m_WorkReady.notify_all();
+    RunTasks();
+
+    // The task lives on the caller's stack; wait for every worker to let go of it
+    std::unique_lock<std::mutex> lock(m_Lock);
+    m_WorkDone.wait(lock, [this] { return m_Busy == 0; });
+    m_pTask = NULL;
+}
+
+void ThreadPool::Worker(unsigned int seen)
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    while (true)
+    {
+        m_WorkReady.wait(lock, [&] { return m_Stopping || m_Generation != seen; });
+        if (m_Stopping)
+        {
+            break;
+        }
+        seen = m_Generation;
+
+        lock.unlock();
+        RunTasks();
+        lock.lock();
+        if (--m_Busy == 0)
+        {
+            m_WorkDone.notify_one();
+        }
+    }
+}
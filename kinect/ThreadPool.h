@@ -0,0 +1,51 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="ThreadPool.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join workers for image kernels that split a frame into bands. Run()
+// hands the band indices out to the workers and to the calling thread, and
+// returns once every band is done. Calls to Run() from several threads take
+// turns.
+class ThreadPool
+{
+public:
+    typedef std::function<void(unsigned int)> Task;
+
+    ThreadPool();
+    ~ThreadPool();
+
+    // Workers besides the calling thread; with none Run() does all the work
+    // itself. Not while another thread is in Run().
+    void Start(unsigned int workers);
+    void Stop();
+
+    unsigned int GetThreadCount() { return((unsigned int)m_Workers.size() + 1); };    // including the caller
+    void Run(unsigned int count, const Task& task);
+
+private:
+    void Worker(unsigned int seen);
+    void RunTasks();
+
+    std::mutex              m_RunLock;      // one Run() at a time
+    std::mutex              m_Lock;
+    std::condition_variable m_WorkReady;
+    std::condition_variable m_WorkDone;
+    std::vector<std::thread> m_Workers;
+    const Task*             m_pTask;
+    unsigned int            m_Count;
+    std::atomic<unsigned int> m_Next;       // next band to hand out
+    unsigned int            m_Busy;         // workers still on the current Run()
+    unsigned int            m_Generation;   // Run() calls so far
+    bool                    m_Stopping;
+};
@@ -6,76 +6,305 @@
 
 #include "Tracker.h"
 #include "KinectSensor.h"
+#include <algorithm>
+#include <cmath>
+
+// Fallback chain: how much each estimator is trusted, and how the pose moves
+// over from one to the next
+static const float SkeletonConfidence = 0.6f;
+static const float DepthConfidence = 0.4f;
+static const float OffsetFade = 0.3f;           // share of the offset gone per frame set, at confidence 1
+static const float MaxOffset = 0.3f;            // meters, larger jumps are a different head
+static const long long MaxPoseGap = 500000;     // microseconds, the depth blob is not searched around older poses
+static const long long DefaultFaceBudget = 25000;
+static const unsigned int MinFaceBackoff = 2;   // frame sets
+static const unsigned int MaxFaceBackoff = 32;
+
+// Re-acquisition
+static const float SearchRadius = 0.15f;        // meters around the head, for the first search region
+static const unsigned int DefaultReacquireAttempts = 4;
+static const unsigned int MaxReacquireAttempts = 8;     // the last region is 256 times the first, beyond any frame
 
 Tracker::Tracker()
 {
+    m_pSource = NULL;
+    m_OwnsSource = false;
     m_pFaceTracker = 0;
     m_pFTResult = NULL;
     m_colorImage = NULL;
     m_depthImage = NULL;
+    m_FrameSet.hasSkeleton = false;
     m_LastTrackSucceeded = false;
+    m_InitDone = false;
+    m_pPendingTracker = NULL;
+    m_pPendingResult = NULL;
+    m_Pose = HeadPose();
+    m_Offset.x = m_Offset.y = m_Offset.z = 0;
+    m_Rotation[0] = m_Rotation[1] = m_Rotation[2] = 0;
+    m_FaceBudget = DefaultFaceBudget;
+    m_FaceSkip = 0;
+    m_FaceBackoff = MinFaceBackoff;
+    m_FaceTime = 0;
+    m_FaceTracks = 0;
+    m_FallbackStats = TrackerFallbackStats();
+    m_ReacquireAttempts = DefaultReacquireAttempts;
+    m_SearchFailures = 0;
+    m_LostTime = -1;
+    m_RecoveryTime = 0;
+    m_ReacquireStats = TrackerReacquireStats();
 }
 
 Tracker::~Tracker()
 {
 }
 
-void Tracker::Init()
+bool Tracker::Init(IFrameSource* pSource)
 {
-	FT_CAMERA_CONFIG videoConfig = { 640, 480, NUI_CAMERA_COLOR_NOMINAL_FOCAL_LENGTH_IN_PIXELS };
-	FT_CAMERA_CONFIG depthConfig = { 320, 240, NUI_CAMERA_DEPTH_NOMINAL_FOCAL_LENGTH_IN_PIXELS };
-
-	// Try to get the Kinect camera to work
-	m_KinectSensor = new KinectSensor();
-	m_KinectSensor->Init();
+	// Try to get the Kinect camera to work, unless we were given another source
+	m_OwnsSource = (pSource == NULL);
+	m_pSource = pSource ? pSource : new KinectSensor();
+	m_pSource->Init();
 
 	m_hint3D[0] = m_hint3D[1] = FT_VECTOR3D(0, 0, 0);
 
-	// Try to start the face tracker.
-	m_pFaceTracker = FTCreateFaceTracker();
-	m_pFaceTracker->Initialize(&videoConfig, &depthConfig, NULL, NULL);
-	m_pFaceTracker->CreateFTResult(&m_pFTResult);
+	// Try to start the face tracker, for the resolution the source starts with.
+	const SensorProfile& profile = GetSensorProfile(m_pSource->GetProfile());
+	m_VideoConfig = CameraConfig(profile.videoWidth, profile.videoHeight, NUI_CAMERA_COLOR_NOMINAL_FOCAL_LENGTH_IN_PIXELS, 640);
+	m_DepthConfig = CameraConfig(profile.depthWidth, profile.depthHeight, NUI_CAMERA_DEPTH_NOMINAL_FOCAL_LENGTH_IN_PIXELS, 320);
+	if (!CreateFaceTracker(m_VideoConfig, m_DepthConfig, &m_pFaceTracker, &m_pFTResult))
+	{
+		return false;
+	}
 
 	// Initialize the RGB image.
 	m_colorImage = FTCreateImage();
 	m_depthImage = FTCreateImage();
 
 	m_LastTrackSucceeded = false;
+	return true;
 }
 
 void Tracker::Destroy()
 {
-	m_pFaceTracker->Release();
-	m_pFaceTracker = NULL;
+	if (m_InitThread.joinable())
+	{
+		FinishReinitialize(true);
+	}
+	// Init() may have stopped half way
+	ReleaseFaceTracker();
+	if (m_colorImage)
+	{
+		m_colorImage->Release();
+		m_colorImage = NULL;
+	}
+	if (m_depthImage)
+	{
+		m_depthImage->Release();
+		m_depthImage = NULL;
+	}
+	m_FrameSet.video.Reset();
+	m_FrameSet.depth.Reset();
+
+	if (m_pSource)
+	{
+		m_pSource->Release();
+		if (m_OwnsSource)
+		{
+			delete m_pSource;
+		}
+		m_pSource = NULL;
+	}
+}
+
+void Tracker::ReleaseFaceTracker()
+{
+	if (m_pFaceTracker)
+	{
+		m_pFaceTracker->Release();
+		m_pFaceTracker = NULL;
+	}
+	if (m_pFTResult)
+	{
+		m_pFTResult->Release();
+		m_pFTResult = NULL;
+	}
+}
+
+// The nominal focal lengths are for 640x480 color and 320x240 depth and scale
+// with the image width.
+FT_CAMERA_CONFIG Tracker::CameraConfig(unsigned int width, unsigned int height, float nominalFocalLength, unsigned int nominalWidth)
+{
+	FT_CAMERA_CONFIG config = { width, height, nominalFocalLength * width / nominalWidth };
+	return config;
+}
+
+bool Tracker::CreateFaceTracker(const FT_CAMERA_CONFIG& videoConfig, const FT_CAMERA_CONFIG& depthConfig,
+	IFTFaceTracker** ppTracker, IFTResult** ppResult)
+{
+	*ppTracker = FTCreateFaceTracker();
+	*ppResult = NULL;
+	if (!*ppTracker ||
+		FAILED((*ppTracker)->Initialize(&videoConfig, &depthConfig, NULL, NULL)) ||
+		FAILED((*ppTracker)->CreateFTResult(ppResult)))
+	{
+		return false;
+	}
+	return true;
+}
+
+bool Tracker::MatchesConfig(FrameSet& set)
+{
+	return set.video->GetFullWidth() == m_VideoConfig.Width && set.video->GetFullHeight() == m_VideoConfig.Height &&
+		set.depth->GetFullWidth() == m_DepthConfig.Width && set.depth->GetFullHeight() == m_DepthConfig.Height;
+}
+
+// Initializing a face tracker loads its models and takes long enough to stall
+// tracking for several frames, so it runs beside the render and sensor threads.
+void Tracker::StartReinitialize(FrameSet& set)
+{
+	m_PendingVideoConfig = CameraConfig(set.video->GetFullWidth(), set.video->GetFullHeight(), NUI_CAMERA_COLOR_NOMINAL_FOCAL_LENGTH_IN_PIXELS, 640);
+	m_PendingDepthConfig = CameraConfig(set.depth->GetFullWidth(), set.depth->GetFullHeight(), NUI_CAMERA_DEPTH_NOMINAL_FOCAL_LENGTH_IN_PIXELS, 320);
+	m_InitDone = false;
+	m_InitThread = std::thread([this]
+	{
+		if (!CreateFaceTracker(m_PendingVideoConfig, m_PendingDepthConfig, &m_pPendingTracker, &m_pPendingResult))
+		{
+			if (m_pPendingTracker)
+			{
+				m_pPendingTracker->Release();
+				m_pPendingTracker = NULL;
+			}
+		}
+		m_InitDone = true;
+	});
+}
+
+// Swaps in the face tracker the background thread made, once it is done or,
+// with wait, after waiting for it.
+bool Tracker::FinishReinitialize(bool wait)
+{
+	if (!wait && !m_InitDone.load())
+	{
+		return false;
+	}
+	m_InitThread.join();
 
-	m_colorImage->Release();
-	m_colorImage = NULL;
+	// A failed initialization still switches the configuration, so Update()
+	// does not retry every frame; it stops tracking until the next switch.
+	ReleaseFaceTracker();
+	m_pFaceTracker = m_pPendingTracker;
+	m_pFTResult = m_pPendingResult;
+	m_pPendingTracker = NULL;
+	m_pPendingResult = NULL;
+	if (!m_pFaceTracker || !m_pFTResult)
+	{
+		ReleaseFaceTracker();
+	}
+	m_VideoConfig = m_PendingVideoConfig;
+	m_DepthConfig = m_PendingDepthConfig;
+	m_LastTrackSucceeded = false;
+	return true;
+}
 
-	m_depthImage->Release();
-	m_depthImage = NULL;
+// Point pImage at the frame's memory without copying it.
+bool Tracker::AttachFrame(IFTImage* pImage, FrameRef& frame)
+{
+    if (!frame)
+    {
+        return false;
+    }
 
-	m_pFTResult->Release();
-	m_pFTResult = NULL;
+    FTIMAGEFORMAT format;
+    switch (frame->GetFormat())
+    {
+    case FRAME_FORMAT_B8G8R8X8: format = FTIMAGEFORMAT_UINT8_B8G8R8X8; break;
+    case FRAME_FORMAT_D13P3:    format = FTIMAGEFORMAT_UINT16_D13P3; break;
+    default:                    return false;
+    }
+    return SUCCEEDED(pImage->Attach(frame->GetWidth(), frame->GetHeight(), frame->GetBuffer(), format, frame->GetStride()));
+}
 
-	m_KinectSensor->Release();
-	delete m_KinectSensor;
+// Neck and head of the skeleton to track, see SelectClosestSkeleton.
+bool Tracker::GetClosestHint(FT_VECTOR3D* pHint3D)
+{
+    Point3 hint[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        hint[i].x = pHint3D[i].x;
+        hint[i].y = pHint3D[i].y;
+        hint[i].z = pHint3D[i].z;
+    }
+    if (!m_FrameSet.hasSkeleton || !SelectClosestSkeleton(m_FrameSet.skeleton, hint))
+    {
+        return false;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        pHint3D[i] = FT_VECTOR3D(hint[i].x, hint[i].y, hint[i].z);
+    }
+    return true;
 }
 
 // Get a video image and process it.
-void Tracker::Update()
+bool Tracker::Update()
+{
+    // Only track when the sensor delivered a new color frame, and only with the
+    // depth and skeleton frames captured with it.
+    if (!m_pSource->AcquireFrameSet(m_FrameSet))
+    {
+        return false;
+    }
+    UpdatePose(TrackFace());
+    return true;
+}
+
+// Face tracks m_FrameSet, true if the face tracker has a pose for it.
+bool Tracker::TrackFace()
 {
     HRESULT hrFT = E_FAIL;
 
-    if (m_KinectSensor->GetVideoBuffer())
+    // A resolution switch: wait for the face tracker of the new size, and do
+    // not track frames it was not made for.
+    if (m_InitThread.joinable() && !FinishReinitialize(false))
+    {
+        return false;
+    }
+    if (!MatchesConfig(m_FrameSet))
+    {
+        m_LastTrackSucceeded = false;
+        m_pSource->SetFaceTracked(false);
+        StartReinitialize(m_FrameSet);
+        return false;
+    }
+    if (!m_pFaceTracker)
+    {
+        return false;
+    }
+    // Sitting out an overrun keeps the track, ContinueTracking() picks it up
+    if (m_FaceSkip > 0)
+    {
+        m_FaceSkip--;
+        m_FallbackStats.faceSkipped++;
+        return false;
+    }
+
+    // Attach the images to the sensor's pooled frames instead of copying them.
+    bool searched = false;
+    bool roi = false;
+    long long start = FrameClockMicroseconds();
+    if (AttachFrame(m_colorImage, m_FrameSet.video) && AttachFrame(m_depthImage, m_FrameSet.depth))
     {
-        m_KinectSensor->GetVideoBuffer()->CopyTo(m_colorImage, NULL, 0, 0);
-        m_KinectSensor->GetDepthBuffer()->CopyTo(m_depthImage, NULL, 0, 0);
-        
     	// Do face tracking
-        FT_SENSOR_DATA sensorData(m_colorImage, m_depthImage, m_KinectSensor->GetZoomFactor(), m_KinectSensor->GetViewOffSet());
+        POINT viewOffset;
+        int viewOffsetX, viewOffsetY;
+        m_pSource->GetViewOffset(&viewOffsetX, &viewOffsetY);
+        // A region frame starts further into the camera image
+        viewOffset.x = viewOffsetX + m_FrameSet.video->GetOffsetX();
+        viewOffset.y = viewOffsetY + m_FrameSet.video->GetOffsetY();
+        FT_SENSOR_DATA sensorData(m_colorImage, m_depthImage, m_pSource->GetZoomFactor(), &viewOffset);
 
         FT_VECTOR3D* hint = NULL;
-        if (SUCCEEDED(m_KinectSensor->GetClosestHint(m_hint3D)))
+        if (GetClosestHint(m_hint3D))
         {
             hint = m_hint3D;
         }
@@ -85,13 +314,216 @@ void Tracker::Update()
         }
         else
         {
-            hrFT = m_pFaceTracker->StartTracking(&sensorData, NULL, hint, m_pFTResult);
+            RECT region;
+            roi = GetSearchRegion(hint, &region);
+            searched = true;
+            hrFT = m_pFaceTracker->StartTracking(&sensorData, roi ? &region : NULL, hint, m_pFTResult);
         }
     }
 
+    // Over budget: let the cheaper estimators stand in for a while
+    long long time = FrameClockMicroseconds() - start;
+    m_FaceTime += time;
+    m_FaceTracks++;
+    m_FallbackStats.meanFaceTime = m_FaceTime / m_FaceTracks;
+    if (time > m_FaceBudget)
+    {
+        m_FallbackStats.overruns++;
+        m_FaceSkip = m_FaceBackoff;
+        m_FaceBackoff = std::min(m_FaceBackoff * 2, MaxFaceBackoff);
+    }
+    else
+    {
+        m_FaceBackoff = MinFaceBackoff;
+    }
+
+    bool wasTracking = m_LastTrackSucceeded;
     m_LastTrackSucceeded = SUCCEEDED(hrFT) && SUCCEEDED(m_pFTResult->GetStatus());
     if (!m_LastTrackSucceeded)
     {
         m_pFTResult->Reset();
     }
+
+    // Search statistics, by how long the search took
+    if (searched)
+    {
+        unsigned int bucket = 0;
+        while (bucket + 1 < REACQUIRE_HISTOGRAM_BUCKETS && time >= (2000LL << bucket))
+        {
+            bucket++;
+        }
+        (roi ? m_ReacquireStats.roiTime : m_ReacquireStats.fullTime)[bucket]++;
+        (roi ? m_ReacquireStats.roiSearches : m_ReacquireStats.fullSearches)++;
+        m_SearchFailures = m_LastTrackSucceeded ? 0 : m_SearchFailures + 1;
+        if (m_LastTrackSucceeded && m_LostTime >= 0)
+        {
+            m_RecoveryTime += m_FrameSet.video->GetTimestamp() - m_LostTime;
+            m_ReacquireStats.reacquired++;
+            m_ReacquireStats.meanRecovery = m_RecoveryTime / m_ReacquireStats.reacquired;
+            m_LostTime = -1;
+        }
+    }
+    else if (wasTracking && !m_LastTrackSucceeded)
+    {
+        m_LostTime = m_FrameSet.video->GetTimestamp();
+        m_SearchFailures = 0;
+    }
+    // ROI acquisition follows the face only while we have it
+    m_pSource->SetFaceTracked(m_LastTrackSucceeded);
+    return m_LastTrackSucceeded;
+}
+
+void Tracker::SetReacquireAttempts(unsigned int attempts)
+{
+    m_ReacquireAttempts = std::min(attempts, MaxReacquireAttempts);
+}
+
+// Region of the color image to search for a lost face: around where the head
+// was last and where the skeleton has it now, from SearchRadius around them,
+// doubling with every failed search. False when there is nothing to search
+// around, or when it is the whole frame's turn.
+bool Tracker::GetSearchRegion(const FT_VECTOR3D* pHint3D, RECT* pRegion)
+{
+    unsigned int attempt = m_SearchFailures % (m_ReacquireAttempts + 1);
+    if (attempt == m_ReacquireAttempts)
+    {
+        return false;
+    }
+
+    Point3 heads[2];
+    unsigned int count = 0;
+    if (m_Pose.source != HEAD_POSE_NONE && m_FrameSet.video->GetTimestamp() - m_Pose.frameTimestamp <= MaxPoseGap)
+    {
+        heads[count++] = m_Pose.position;
+    }
+    if (pHint3D)
+    {
+        Point3 head = { pHint3D[1].x, pHint3D[1].y, pHint3D[1].z };
+        heads[count++] = head;
+    }
+
+    // Projected with the face tracker's camera; the image may be a region
+    float focal = m_VideoConfig.FocalLength;
+    float cx = m_VideoConfig.Width * 0.5f - m_FrameSet.video->GetOffsetX();
+    float cy = m_VideoConfig.Height * 0.5f - m_FrameSet.video->GetOffsetY();
+    float left = 1e9f, top = 1e9f, right = -1e9f, bottom = -1e9f;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (heads[i].z <= 0)
+        {
+            continue;
+        }
+        float u = cx + focal * heads[i].x / heads[i].z;
+        float v = cy - focal * heads[i].y / heads[i].z;
+        float radius = focal * SearchRadius * (1 << attempt) / heads[i].z;
+        left = std::min(left, u - radius);
+        right = std::max(right, u + radius);
+        top = std::min(top, v - radius);
+        bottom = std::max(bottom, v + radius);
+    }
+    pRegion->left = std::max(0L, (LONG)left);
+    pRegion->top = std::max(0L, (LONG)top);
+    pRegion->right = std::min((LONG)m_FrameSet.video->GetWidth(), (LONG)right);
+    pRegion->bottom = std::min((LONG)m_FrameSet.video->GetHeight(), (LONG)bottom);
+    return pRegion->left < pRegion->right && pRegion->top < pRegion->bottom;
+}
+
+// Picks the most accurate estimate of m_FrameSet's head and blends it into
+// m_Pose, see Update().
+void Tracker::UpdatePose(bool faceTracked)
+{
+    HeadPose estimate = HeadPose();
+    estimate.frameNumber = m_FrameSet.video->GetFrameNumber();
+    estimate.frameTimestamp = m_FrameSet.video->GetTimestamp();
+    bool recent = m_Pose.source != HEAD_POSE_NONE && estimate.frameTimestamp - m_Pose.frameTimestamp <= MaxPoseGap;
+
+    FLOAT scale;
+    FLOAT rotation[3];
+    FLOAT translation[3];
+    Point3 hint[2] = {};
+    HeadPose blob;
+    Frame* pDepth = m_FrameSet.depthMm ? m_FrameSet.depthMm.Get() : m_FrameSet.depth.Get();
+    if (recent)
+    {   // The skeleton closest to the head we have
+        hint[1] = m_Pose.position;
+    }
+    if (faceTracked && SUCCEEDED(m_pFTResult->Get3DPose(&scale, rotation, translation)))
+    {
+        estimate.source = HEAD_POSE_FACE;
+        estimate.confidence = 1.0f;
+        estimate.position.x = translation[0];
+        estimate.position.y = translation[1];
+        estimate.position.z = translation[2];
+        std::copy(rotation, rotation + 3, m_Rotation);
+    }
+    else if (m_FrameSet.hasSkeleton && SelectClosestSkeleton(m_FrameSet.skeleton, hint))
+    {
+        estimate.source = HEAD_POSE_SKELETON;
+        estimate.confidence = SkeletonConfidence;
+        estimate.position = hint[1];
+    }
+    else if (recent && pDepth && m_DepthLocator.Locate(pDepth, m_Pose.position, &blob))
+    {
+        estimate.source = HEAD_POSE_DEPTH;
+        estimate.confidence = DepthConfidence * blob.confidence;
+        estimate.position = blob.position;
+    }
+    m_FallbackStats.frames[estimate.source]++;
+    if (estimate.source == HEAD_POSE_NONE)
+    {
+        // Keep the last pose as the depth blob's seed until it is too old
+        m_Pose.confidence = 0;
+        return;
+    }
+
+    // A switch starts from where the previous estimator left the pose
+    if (estimate.source != m_Pose.source)
+    {
+        m_Offset.x = m_Offset.y = m_Offset.z = 0;
+        if (recent)
+        {
+            m_FallbackStats.switches++;
+            Point3 offset = { m_Pose.position.x - estimate.position.x, m_Pose.position.y - estimate.position.y,
+                m_Pose.position.z - estimate.position.z };
+            if (sqrtf(offset.x * offset.x + offset.y * offset.y + offset.z * offset.z) <= MaxOffset)
+            {
+                m_Offset = offset;
+            }
+        }
+    }
+    estimate.position.x += m_Offset.x;
+    estimate.position.y += m_Offset.y;
+    estimate.position.z += m_Offset.z;
+    std::copy(m_Rotation, m_Rotation + 3, estimate.rotation);
+    float fade = 1.0f - OffsetFade * estimate.confidence;
+    m_Offset.x *= fade;
+    m_Offset.y *= fade;
+    m_Offset.z *= fade;
+    m_Pose = estimate;
+}
+
+bool Tracker::GetHeadPosition(Point3* pHead, long long* pTimestamp)
+{
+    FLOAT scale;
+    FLOAT rotation[3];
+    FLOAT translation[3];
+    if (!m_LastTrackSucceeded || !m_FrameSet.video || FAILED(m_pFTResult->Get3DPose(&scale, rotation, translation)))
+    {
+        return false;
+    }
+    pHead->x = translation[0];
+    pHead->y = translation[1];
+    pHead->z = translation[2];
+    *pTimestamp = m_FrameSet.video->GetTimestamp();
+    return true;
+}
+
+bool Tracker::GetHeadPose(HeadPose* pPose)
+{
+    if (m_Pose.source == HEAD_POSE_NONE || m_Pose.confidence <= 0)
+    {
+        return false;
+    }
+    *pPose = m_Pose;
+    return true;
 }
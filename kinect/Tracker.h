@@ -7,6 +7,33 @@
 #pragma once
 
 #include <FaceTrackLib.h>
+#include "FrameSource.h"
+#include "DepthHeadLocator.h"
+#include "HeadPose.h"
+#include <atomic>
+#include <thread>
+
+struct TrackerFallbackStats
+{
+    unsigned int    frames[HEAD_POSE_SOURCE_COUNT]; // frame sets by the source of their pose
+    unsigned int    switches;       // changes of source between consecutive poses
+    unsigned int    overruns;       // face tracks over the budget
+    unsigned int    faceSkipped;    // frame sets the face tracker sat out after overruns
+    long long       meanFaceTime;   // microseconds per face track
+};
+
+// Buckets of the search time histograms: under 2, 4, 8 ... 128 ms, and longer
+const unsigned int REACQUIRE_HISTOGRAM_BUCKETS = 8;
+
+struct TrackerReacquireStats
+{
+    unsigned int    roiSearches;    // StartTracking() calls on a search region
+    unsigned int    fullSearches;   // and on the whole frame
+    unsigned int    roiTime[REACQUIRE_HISTOGRAM_BUCKETS];   // their durations
+    unsigned int    fullTime[REACQUIRE_HISTOGRAM_BUCKETS];
+    unsigned int    reacquired;     // faces found again after being lost
+    long long       meanRecovery;   // microseconds from the loss to finding the face again
+};
 
 class Tracker
 {
@@ -14,22 +41,99 @@ public:
     Tracker();
     ~Tracker();
 
-    void Init();
+    // Tracks faces in the frames of pSource, or of a Kinect sensor it creates
+    // itself if pSource is NULL. The tracker does not own a source passed in.
+    bool Init(IFrameSource* pSource = NULL);
     void Destroy();
 
 	bool LastTrackSucceeded()    { return m_LastTrackSucceeded; }
     IFTResult* GetResult()       { return m_pFTResult;}
     IFTImage* GetColorImage()    { return m_colorImage;}
     IFTFaceTracker* GetTracker() { return m_pFaceTracker;}
+    IFrameSource* GetSource()    { return m_pSource;}
 
-	void Update();
+	// Tracks the newest frame set, false if there was none. When the source
+	// switched resolution (see IFrameSource::SetProfile) a face tracker for the
+	// new size is created on a background thread; frames are skipped, not
+	// face tracked, until it is ready.
+	//
+	// The head pose falls back from the face tracker, when it fails, is being
+	// re-created or sits out an overrun, to the closest skeleton's head joint
+	// and, without one, to the depth blob around the last position. On a
+	// switch the pose carries the difference to the previous estimator and
+	// lets it fade, faster the more the new estimator is trusted.
+	bool Update();
+	// Head center in camera space (meters) and the timestamp of the frame it
+	// was tracked on, false unless the last track succeeded.
+	bool GetHeadPosition(Point3* pHead, long long* pTimestamp);
+	// Head pose of the last frame set from the fallback chain (see Update()),
+	// false if no estimator found the head. Rotation is the face tracker's
+	// latest; publishTime is left to the caller.
+	bool GetHeadPose(HeadPose* pPose);
+	// Microseconds a face track may take, 25000 by default. A track over it
+	// makes the face tracker sit out the next frame sets, twice as many after
+	// each further overrun, while the cheaper estimators stand in.
+	void SetFaceBudget(long long microseconds) { m_FaceBudget = microseconds; }
+	// Tracking thread only, or once it stopped.
+	TrackerFallbackStats GetFallbackStats() { return m_FallbackStats; }
+	// A lost face is searched for in a region around the last pose and the
+	// skeleton's head, twice as large after every failed search; after this
+	// many (4 by default, at most 8) the whole frame is searched once and the
+	// regions start over.
+	void SetReacquireAttempts(unsigned int attempts);
+	TrackerReacquireStats GetReacquireStats() { return m_ReacquireStats; }
+	bool IsReinitializing()      { return m_InitThread.joinable(); }
 
 private:
-    class KinectSensor*         m_KinectSensor;
+    IFrameSource*               m_pSource;
+    bool                        m_OwnsSource;
     IFTFaceTracker*             m_pFaceTracker;
     IFTResult*                  m_pFTResult;
     IFTImage*                   m_colorImage;
     IFTImage*                   m_depthImage;
+    FrameSet                    m_FrameSet;     // keeps the frames the images are attached to alive
     FT_VECTOR3D                 m_hint3D[2];
     bool                        m_LastTrackSucceeded;
+    FT_CAMERA_CONFIG            m_VideoConfig;  // of m_pFaceTracker
+    FT_CAMERA_CONFIG            m_DepthConfig;
+
+    // Background initialization of the face tracker for a new resolution
+    std::thread                 m_InitThread;
+    std::atomic<bool>           m_InitDone;
+    IFTFaceTracker*             m_pPendingTracker;
+    IFTResult*                  m_pPendingResult;
+    FT_CAMERA_CONFIG            m_PendingVideoConfig;
+    FT_CAMERA_CONFIG            m_PendingDepthConfig;
+
+    // Fallback chain
+    HeadPose                    m_Pose;         // of m_FrameSet
+    Point3                      m_Offset;       // pose minus the current estimator's, fading
+    float                       m_Rotation[3];  // latest from the face tracker
+    DepthHeadLocator            m_DepthLocator;
+    long long                   m_FaceBudget;
+    unsigned int                m_FaceSkip;     // frame sets left to sit out
+    unsigned int                m_FaceBackoff;  // frame sets to sit out after the next overrun
+    long long                   m_FaceTime;     // total, for meanFaceTime
+    unsigned int                m_FaceTracks;
+    TrackerFallbackStats        m_FallbackStats;
+
+    // Re-acquisition
+    unsigned int                m_ReacquireAttempts;
+    unsigned int                m_SearchFailures;   // since the face was lost
+    long long                   m_LostTime;         // frame timestamp, -1 while tracked or never tracked
+    long long                   m_RecoveryTime;     // total, for meanRecovery
+    TrackerReacquireStats       m_ReacquireStats;
+
+    static FT_CAMERA_CONFIG CameraConfig(unsigned int width, unsigned int height, float nominalFocalLength, unsigned int nominalWidth);
+    static bool CreateFaceTracker(const FT_CAMERA_CONFIG& videoConfig, const FT_CAMERA_CONFIG& depthConfig,
+        IFTFaceTracker** ppTracker, IFTResult** ppResult);
+    bool MatchesConfig(FrameSet& set);
+    void StartReinitialize(FrameSet& set);
+    bool FinishReinitialize(bool wait);
+    void ReleaseFaceTracker();
+    static bool AttachFrame(IFTImage* pImage, FrameRef& frame);
+    bool GetClosestHint(FT_VECTOR3D* pHint3D);
+    bool TrackFace();
+    bool GetSearchRegion(const FT_VECTOR3D* pHint3D, RECT* pRegion);
+    void UpdatePose(bool faceTracked);
 };
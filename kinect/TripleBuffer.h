@@ -0,0 +1,77 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="TripleBuffer.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+
+// Lock-free single producer / single consumer frame exchange.
+// The writer fills WriteSlot() and publishes it; the reader acquires the newest
+// published slot and owns ReadSlot() until its next Acquire(). Neither side
+// ever waits for the other.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+    {
+        m_WriteIndex = 0;
+        m_ReadIndex = 1;
+        m_ReadyState = 2;
+        m_Published = 0;
+        m_Overwritten = 0;
+    }
+
+    T&   Slot(int index)    { return(m_Slots[index]); };
+    T&   WriteSlot()        { return(m_Slots[m_WriteIndex]); };
+    T&   ReadSlot()         { return(m_Slots[m_ReadIndex]); };
+    unsigned int PublishedCount()   { return(m_Published.load(std::memory_order_relaxed)); };
+    unsigned int OverwrittenCount() { return(m_Overwritten.load(std::memory_order_relaxed)); };
+    bool HasUnread()        { return((m_ReadyState.load(std::memory_order_acquire) & FreshBit) != 0); };
+
+    // Writer side: make the write slot the newest complete frame.
+    void Publish()
+    {
+        int previous = m_ReadyState.exchange(m_WriteIndex | FreshBit, std::memory_order_acq_rel);
+        if (previous & FreshBit)
+        {   // Nobody read the previous frame before it got replaced
+            m_Overwritten.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_WriteIndex = previous & IndexMask;
+        m_Published.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Reader side: take the newest complete frame. Returns false if nothing
+    // was published since the last call, in which case ReadSlot() is unchanged.
+    bool Acquire()
+    {
+        if (!(m_ReadyState.load(std::memory_order_relaxed) & FreshBit))
+        {
+            return false;
+        }
+        int previous = m_ReadyState.exchange(m_ReadIndex, std::memory_order_acq_rel);
+        m_ReadIndex = previous & IndexMask;
+        return true;
+    }
+
+    // Forget any unread frame and the counters (only while no thread is using the buffer).
+    void Reset()
+    {
+        m_ReadyState = m_ReadyState.load() & IndexMask;
+        m_Published = 0;
+        m_Overwritten = 0;
+    }
+
+private:
+    enum { IndexMask = 0x3, FreshBit = 0x4 };
+
+    T                   m_Slots[3];
+    int                 m_WriteIndex;   // only touched by the writer
+    int                 m_ReadIndex;    // only touched by the reader
+    std::atomic<int>    m_ReadyState;   // index of the newest published slot | FreshBit if unread
+    std::atomic<unsigned int>   m_Published;
+    std::atomic<unsigned int>   m_Overwritten;
+};
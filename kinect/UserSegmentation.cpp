@@ -0,0 +1,341 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="UserSegmentation.cpp" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#include "UserSegmentation.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cstring>
+
+static unsigned int PopCount(unsigned long long word)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (unsigned int)((word * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Index of the lowest and highest set bit of a word that is not zero.
+static unsigned int LowestBit(unsigned long long word)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctzll(word);
+#else
+    return PopCount((word & (0 - word)) - 1);
+#endif
+}
+
+static unsigned int HighestBit(unsigned long long word)
+{
+#if defined(__GNUC__)
+    return 63 - (unsigned int)__builtin_clzll(word);
+#else
+    word |= word >> 1;
+    word |= word >> 2;
+    word |= word >> 4;
+    word |= word >> 8;
+    word |= word >> 16;
+    word |= word >> 32;
+    return PopCount(word) - 1;
+#endif
+}
+
+// Sets bit i of bits[p - 1] for each of the 32 pixels whose player index is p.
+// False, leaving bits alone, if none of them has a player.
+static bool PlayerBits(const unsigned char* pPlayers, unsigned int bits[USER_MASK_PLAYERS])
+{
+#if defined(KINECT_AVX2)
+    __m256i v = _mm256_loadu_si256((const __m256i*)pPlayers);
+    if (_mm256_testz_si256(v, v))
+    {
+        return false;
+    }
+    for (unsigned int p = 0; p < USER_MASK_PLAYERS; ++p)
+    {
+        bits[p] = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(char(p + 1))));
+    }
+#elif defined(KINECT_SSE2)
+    __m128i a = _mm_loadu_si128((const __m128i*)pPlayers);
+    __m128i b = _mm_loadu_si128((const __m128i*)(pPlayers + 16));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(a, b), _mm_setzero_si128())) == 0xFFFF)
+    {
+        return false;
+    }
+    for (unsigned int p = 0; p < USER_MASK_PLAYERS; ++p)
+    {
+        __m128i player = _mm_set1_epi8(char(p + 1));
+        bits[p] = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a, player)) |
+            ((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(b, player)) << 16);
+    }
+#else
+    unsigned int any = 0;
+    for (unsigned int i = 0; i < 32; ++i)
+    {
+        any |= pPlayers[i];
+    }
+    if (!any)
+    {
+        return false;
+    }
+    memset(bits, 0, USER_MASK_PLAYERS * sizeof(unsigned int));
+    for (unsigned int i = 0; i < 32; ++i)
+    {
+        if (pPlayers[i] >= 1 && pPlayers[i] <= USER_MASK_PLAYERS)
+        {
+            bits[pPlayers[i] - 1] |= 1u << i;
+        }
+    }
+#endif
+    return true;
+}
+
+// Player indices of a D13P3 row as bytes, up to the next multiple of 32
+// pixels; frame rows are padded to whole cache lines, 32 D13P3 pixels.
+static void PlayerIndices(const unsigned short* pDepth, unsigned char* pPlayers, unsigned int width)
+{
+    unsigned int x = 0;
+#if defined(KINECT_SSE2)
+    const __m128i playerMask = _mm_set1_epi16(7);
+    for (; x < width; x += 16)
+    {
+        __m128i a = _mm_and_si128(_mm_load_si128((const __m128i*)(pDepth + x)), playerMask);
+        __m128i b = _mm_and_si128(_mm_load_si128((const __m128i*)(pDepth + x + 8)), playerMask);
+        _mm_storeu_si128((__m128i*)(pPlayers + x), _mm_packus_epi16(a, b));
+    }
+#else
+    for (; x < width; ++x)
+    {
+        pPlayers[x] = (unsigned char)(pDepth[x] & 7);
+    }
+#endif
+}
+
+// Running totals of a player's final mask, turned into UserMaskStats at the end.
+struct MaskSums
+{
+    unsigned long long  pixels;
+    unsigned long long  sumX;
+    unsigned long long  sumY;
+    unsigned int        left;
+    unsigned int        right;
+    unsigned int        top;
+    unsigned int        bottom;
+};
+
+// The sum of the bit indices of a word is, over the six bits k of an index,
+// 2^k times the number of set bits whose index has bit k set.
+static void AddRow(const unsigned long long* pRow, unsigned int words, unsigned int y, MaskSums& sums)
+{
+    static const unsigned long long IndexBits[6] =
+    {
+        0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+        0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL,
+    };
+    for (unsigned int w = 0; w < words; ++w)
+    {
+        unsigned long long word = pRow[w];
+        if (!word)
+        {
+            continue;
+        }
+        unsigned int count = PopCount(word);
+        unsigned long long sumX = (unsigned long long)count * w * 64;
+        for (unsigned int k = 0; k < 6; ++k)
+        {
+            sumX += (unsigned long long)PopCount(word & IndexBits[k]) << k;
+        }
+        if (!sums.pixels)
+        {
+            sums.top = y;
+        }
+        sums.pixels += count;
+        sums.sumX += sumX;
+        sums.sumY += (unsigned long long)count * y;
+        sums.left = std::min(sums.left, w * 64 + LowestBit(word));
+        sums.right = std::max(sums.right, w * 64 + HighestBit(word) + 1);
+        sums.bottom = y + 1;
+    }
+}
+
+static void FinishStats(const MaskSums& sums, const UserMasks& masks, UserMaskStats& stats)
+{
+    memset(&stats, 0, sizeof(stats));
+    if (!sums.pixels)
+    {
+        return;
+    }
+    stats.pixels = (unsigned int)sums.pixels;
+    stats.left = masks.offsetX + sums.left;
+    stats.right = masks.offsetX + sums.right;
+    stats.top = masks.offsetY + sums.top;
+    stats.bottom = masks.offsetY + sums.bottom;
+    stats.centroidX = masks.offsetX + float(double(sums.sumX) / sums.pixels);
+    stats.centroidY = masks.offsetY + float(double(sums.sumY) / sums.pixels);
+}
+
+static void ResetSums(MaskSums& sums)
+{
+    memset(&sums, 0, sizeof(sums));
+    sums.left = ~0u;
+}
+
+UserSegmenter::UserSegmenter()
+{
+    m_OpenRadius = 1;
+    m_CloseRadius = 1;
+}
+
+void UserSegmenter::Pack(Frame* pFrame, UserMasks& masks, bool present[USER_MASK_PLAYERS])
+{
+    unsigned int width = masks.width;
+    for (unsigned int y = 0; y < masks.height; ++y)
+    {
+        const unsigned char* pPlayers = pFrame->GetBuffer() + y * pFrame->GetStride();
+        if (pFrame->GetFormat() == FRAME_FORMAT_D13P3)
+        {
+            PlayerIndices((const unsigned short*)pPlayers, &m_Players[0], width);
+            pPlayers = &m_Players[0];
+        }
+
+        for (unsigned int w = 0; w < masks.wordsPerRow; ++w)
+        {
+            unsigned long long words[USER_MASK_PLAYERS] = { 0 };
+            for (unsigned int half = 0; half < 2 && w * 64 + half * 32 < width; ++half)
+            {
+                unsigned int bits[USER_MASK_PLAYERS];
+                if (PlayerBits(pPlayers + w * 64 + half * 32, bits))
+                {
+                    for (unsigned int p = 0; p < USER_MASK_PLAYERS; ++p)
+                    {
+                        words[p] |= (unsigned long long)bits[p] << (half * 32);
+                    }
+                }
+            }
+            // Row padding past the width holds anything
+            unsigned int valid = std::min(64u, width - w * 64);
+            unsigned long long mask = valid == 64 ? ~0ULL : (1ULL << valid) - 1;
+            for (unsigned int p = 0; p < USER_MASK_PLAYERS; ++p)
+            {
+                masks.bits[p][y * masks.wordsPerRow + w] = words[p] & mask;
+                present[p] = present[p] || (words[p] & mask) != 0;
+            }
+        }
+    }
+}
+
+// One 3x3 erosion or dilation: a horizontal pass into m_Temp, where the
+// neighbours of a bit come from shifting its word and the next bit of the
+// word beside it, and a vertical pass back into bits that combines three
+// rows of words. Pixels outside the frame count as background.
+void UserSegmenter::Morphology(std::vector<unsigned long long>& bits, const UserMasks& masks, bool dilate, UserMaskStats* pStats)
+{
+    unsigned int words = masks.wordsPerRow;
+    unsigned int lastBits = masks.width - (words - 1) * 64;
+    unsigned long long lastMask = lastBits == 64 ? ~0ULL : (1ULL << lastBits) - 1;
+
+    for (unsigned int y = 0; y < masks.height; ++y)
+    {
+        const unsigned long long* pIn = &bits[y * words];
+        unsigned long long* pOut = &m_Temp[y * words];
+        for (unsigned int w = 0; w < words; ++w)
+        {
+            unsigned long long word = pIn[w];
+            unsigned long long left = (word << 1) | (w > 0 ? pIn[w - 1] >> 63 : 0);
+            unsigned long long right = (word >> 1) | (w + 1 < words ? pIn[w + 1] << 63 : 0);
+            pOut[w] = dilate ? word | left | right : word & left & right;
+        }
+        pOut[words - 1] &= lastMask;
+    }
+
+    MaskSums sums;
+    ResetSums(sums);
+    for (unsigned int y = 0; y < masks.height; ++y)
+    {
+        const unsigned long long* pAbove = y > 0 ? &m_Temp[(y - 1) * words] : NULL;
+        const unsigned long long* pRow = &m_Temp[y * words];
+        const unsigned long long* pBelow = y + 1 < masks.height ? &m_Temp[(y + 1) * words] : NULL;
+        unsigned long long* pOut = &bits[y * words];
+        for (unsigned int w = 0; w < words; ++w)
+        {
+            unsigned long long above = pAbove ? pAbove[w] : 0;
+            unsigned long long below = pBelow ? pBelow[w] : 0;
+            pOut[w] = dilate ? pRow[w] | above | below : pRow[w] & above & below;
+        }
+        if (pStats)
+        {
+            AddRow(pOut, words, y, sums);
+        }
+    }
+    if (pStats)
+    {
+        FinishStats(sums, masks, *pStats);
+    }
+}
+
+bool UserSegmenter::Segment(Frame* pFrame, UserMasks& masks)
+{
+    if (pFrame->GetFormat() != FRAME_FORMAT_P8 && pFrame->GetFormat() != FRAME_FORMAT_D13P3)
+    {
+        return false;
+    }
+
+    masks.width = pFrame->GetWidth();
+    masks.height = pFrame->GetHeight();
+    masks.offsetX = pFrame->GetOffsetX();
+    masks.offsetY = pFrame->GetOffsetY();
+    masks.wordsPerRow = (masks.width + 63) / 64;
+    masks.timestamp = pFrame->GetTimestamp();
+    size_t size = size_t(masks.wordsPerRow) * masks.height;
+    for (unsigned int p = 0; p < USER_MASK_PLAYERS; ++p)
+    {
+        masks.bits[p].resize(size);
+    }
+    m_Temp.resize(size);
+    m_Players.resize(masks.wordsPerRow * 64);
+
+    bool present[USER_MASK_PLAYERS] = { false };
+    Pack(pFrame, masks, present);
+
+    for (unsigned int p = 0; p < USER_MASK_PLAYERS; ++p)
+    {
+        UserMaskStats& stats = masks.stats[p];
+        if (!present[p])
+        {   // Nothing to clean, the mask is all zero
+            memset(&stats, 0, sizeof(stats));
+            continue;
+        }
+
+        unsigned int steps = 2 * (m_OpenRadius + m_CloseRadius);
+        if (!steps)
+        {
+            MaskSums sums;
+            ResetSums(sums);
+            for (unsigned int y = 0; y < masks.height; ++y)
+            {
+                AddRow(&masks.bits[p][y * masks.wordsPerRow], masks.wordsPerRow, y, sums);
+            }
+            FinishStats(sums, masks, stats);
+            continue;
+        }
+
+        // Open: erode, dilate. Close: dilate, erode.
+        unsigned int step = 0;
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            unsigned int count = i < 2 ? m_OpenRadius : m_CloseRadius;
+            bool dilate = i == 1 || i == 2;
+            for (unsigned int n = 0; n < count; ++n)
+            {
+                ++step;
+                Morphology(masks.bits[p], masks, dilate, step == steps ? &stats : NULL);
+            }
+        }
+    }
+    return true;
+}
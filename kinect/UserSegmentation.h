@@ -0,0 +1,72 @@
+﻿//------------------------------------------------------------------------------
+// <copyright file="UserSegmentation.h" company="Microsoft">
+//     Copyright (c) Microsoft Corporation.  All rights reserved.
+// </copyright>
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "FramePool.h"
+#include <vector>
+
+// Player indices 1 to 6; 0 is no player and 7 is never used.
+const unsigned int USER_MASK_PLAYERS = 6;
+
+struct UserMaskStats
+{
+    unsigned int    pixels;         // 0 if the player is not in the frame
+    unsigned int    left;           // bounding box in frame pixels, right and bottom exclusive
+    unsigned int    top;
+    unsigned int    right;
+    unsigned int    bottom;
+    float           centroidX;
+    float           centroidY;
+};
+
+// One bit-packed mask per player of a depth frame: 64 pixels to a word with
+// the leftmost pixel in bit 0, every row starting on a new word. Coordinates
+// are those of the frame, which may be a region of the full image. The
+// vectors keep their memory from frame to frame.
+struct UserMasks
+{
+    unsigned int    width;
+    unsigned int    height;
+    unsigned int    offsetX;
+    unsigned int    offsetY;
+    unsigned int    wordsPerRow;
+    long long       timestamp;
+    std::vector<unsigned long long> bits[USER_MASK_PLAYERS];    // player i + 1, wordsPerRow * height
+    UserMaskStats   stats[USER_MASK_PLAYERS];
+
+    const unsigned long long* Row(unsigned int player, unsigned int y) const { return(&bits[player - 1][y * wordsPerRow]); };
+    bool Test(unsigned int player, unsigned int x, unsigned int y) const { return((Row(player, y)[x / 64] >> (x % 64)) & 1) != 0; };
+};
+
+// Turns the player index channel into UserMasks. Each 32 pixels of a row are
+// compared with every player index at once (SSE2 or AVX2 compares and
+// movemasks); rows without players cost a load and a test. The masks are
+// then cleaned with a morphological open, which removes specks, and close,
+// which fills pinholes, using 3x3 squares repeated as often as the radius.
+// Both work on whole words, 64 pixels per operation. The pass that writes
+// the final mask also sums up each player's bounding box and centroid.
+class UserSegmenter
+{
+public:
+    UserSegmenter();
+
+    // Radii of the open and close in pixels, 1 each by default; 0 skips it.
+    void SetCleanup(unsigned int openRadius, unsigned int closeRadius) { m_OpenRadius = openRadius; m_CloseRadius = closeRadius; };
+
+    // pFrame is FRAME_FORMAT_P8 (FrameSet::players) or FRAME_FORMAT_D13P3, full
+    // frame or region.
+    bool Segment(Frame* pFrame, UserMasks& masks);
+
+private:
+    void Pack(Frame* pFrame, UserMasks& masks, bool present[USER_MASK_PLAYERS]);
+    void Morphology(std::vector<unsigned long long>& bits, const UserMasks& masks, bool dilate, UserMaskStats* pStats);
+
+    unsigned int    m_OpenRadius;
+    unsigned int    m_CloseRadius;
+    std::vector<unsigned char>      m_Players;  // a D13P3 row's player indices
+    std::vector<unsigned long long> m_Temp;     // between the horizontal and the vertical pass
+};